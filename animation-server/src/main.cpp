@@ -697,11 +697,13 @@ void* animateVoxels(void* args) {
                 uint64_t totalBytesQueued = ::voxelEditPacketSender->getLifetimeBytesQueued();
 
                 uint64_t packetsPending = ::voxelEditPacketSender->packetsToSendCount();
+                uint64_t packetsOverflowed = ::voxelEditPacketSender->getLifetimePacketsOverflowed();
 
                 printf("lifetime=%f secs packetsSent=%lld, bytesSent=%lld targetPPS=%d pps=%f bps=%f\n",
                     lifetimeSeconds, totalPacketsSent, totalBytesSent, targetPPS, lifetimePPS, lifetimeBPS);
-                printf("packetsPending=%lld packetsQueued=%lld, bytesQueued=%lld ppsQueued=%f bpsQueued=%f\n",
-                    packetsPending, totalPacketsQueued, totalBytesQueued, lifetimePPSQueued, lifetimeBPSQueued);
+                printf("packetsPending=%lld packetsOverflowed=%lld packetsQueued=%lld, bytesQueued=%lld "
+                    "ppsQueued=%f bpsQueued=%f\n",
+                    packetsPending, packetsOverflowed, totalPacketsQueued, totalBytesQueued, lifetimePPSQueued, lifetimeBPSQueued);
             }
         }
         // dynamically sleep until we need to fire off the next set of voxels
@@ -6,9 +6,11 @@
 //  Copyright (c) 2013 HighFidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <math.h>
@@ -28,6 +30,10 @@
 #include <sys/socket.h>
 #endif //_WIN32
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <glm/glm.hpp>
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/vector_angle.hpp>
@@ -58,40 +64,123 @@ const int MIN_SAMPLE_VALUE = std::numeric_limits<int16_t>::min();
 
 const char AUDIO_MIXER_LOGGING_TARGET_NAME[] = "audio-mixer";
 
+const float DISTANCE_SCALE = 2.5f;
+const float GEOMETRIC_AMPLITUDE_SCALAR = 0.3f;
+const float DISTANCE_LOG_BASE = 2.5f;
+const float DISTANCE_SCALE_LOG = logf(DISTANCE_SCALE) / logf(DISTANCE_LOG_BASE);
+
+// the distance coefficient is
+//     GEOMETRIC_AMPLITUDE_SCALAR ^ (DISTANCE_SCALE_LOG + log(distance) / log(DISTANCE_LOG_BASE) - 1)
+// which works out to a constant times a power of the squared distance, so each pair only needs one powf
+const float DISTANCE_COEFFICIENT_SCALE = powf(GEOMETRIC_AMPLITUDE_SCALAR, DISTANCE_SCALE_LOG - 1);
+const float DISTANCE_COEFFICIENT_EXPONENT = 0.5f * logf(GEOMETRIC_AMPLITUDE_SCALAR) / logf(DISTANCE_LOG_BASE);
+
+const int PHASE_DELAY_AT_90 = 20;
+
+const float DEFAULT_AUDIBILITY_THRESHOLD = 1.0f;
+const int DEFAULT_MAX_SOURCES_PER_LISTENER = 0;
+
+const float SOURCE_GRID_SMALLEST_CELL_SIZE = 4.0f;
+const int SOURCE_GRID_LEVELS = 24;
+const int SOURCE_GRID_COORDINATE_BITS = 19;
+
+float AudioMixer::_audibilityThreshold = DEFAULT_AUDIBILITY_THRESHOLD;
+int AudioMixer::_maxSourcesPerListener = DEFAULT_MAX_SOURCES_PER_LISTENER;
+
 void attachNewBufferToNode(Node *newNode) {
     if (!newNode->getLinkedData()) {
         newNode->setLinkedData(new AudioMixerClientData());
     }
 }
 
-AudioMixer::AudioMixer(const unsigned char* dataBuffer, int numBytes) : Assignment(dataBuffer, numBytes) {
+/// Adds samples, scaled by gain and truncated, to a 32 bit mix
+static void addScaledSamples(int* mix, const int16_t* samples, int numSamples, float gain) {
+    int s = 0;
+#ifdef __SSE2__
+    __m128 gains = _mm_set1_ps(gain);
+    for (; s + 8 <= numSamples; s += 8) {
+        __m128i eightSamples = _mm_loadu_si128((const __m128i*) (samples + s));
+
+        // sign extend each half of the samples to 32 bits, scale them as floats and truncate them back
+        __m128i lowSamples = _mm_srai_epi32(_mm_unpacklo_epi16(eightSamples, eightSamples), 16);
+        __m128i highSamples = _mm_srai_epi32(_mm_unpackhi_epi16(eightSamples, eightSamples), 16);
+        __m128i lowScaled = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lowSamples), gains));
+        __m128i highScaled = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(highSamples), gains));
+
+        _mm_storeu_si128((__m128i*) (mix + s), _mm_add_epi32(_mm_loadu_si128((const __m128i*) (mix + s)), lowScaled));
+        _mm_storeu_si128((__m128i*) (mix + s + 4),
+                         _mm_add_epi32(_mm_loadu_si128((const __m128i*) (mix + s + 4)), highScaled));
+    }
+#endif
+    for (; s < numSamples; s++) {
+        mix[s] += (int) (samples[s] * gain);
+    }
+}
+
+/// Clamps a 32 bit mix to the range of 16 bit samples
+static void saturateMix(const int* mix, int16_t* samples, int numSamples) {
+    int s = 0;
+#ifdef __SSE2__
+    for (; s + 8 <= numSamples; s += 8) {
+        __m128i lowMix = _mm_loadu_si128((const __m128i*) (mix + s));
+        __m128i highMix = _mm_loadu_si128((const __m128i*) (mix + s + 4));
+        _mm_storeu_si128((__m128i*) (samples + s), _mm_packs_epi32(lowMix, highMix));
+    }
+#endif
+    for (; s < numSamples; s++) {
+        samples[s] = glm::clamp(mix[s], MIN_SAMPLE_VALUE, MAX_SAMPLE_VALUE);
+    }
+}
+
+static float sourceGridCellSize(int level) {
+    return SOURCE_GRID_SMALLEST_CELL_SIZE * (1 << level);
+}
+
+static int sourceGridCoordinate(float position, float cellSize) {
+    const float MAX_SOURCE_GRID_COORDINATE = 1 << 30;
+    float coordinate = floorf(position / cellSize);
     
+    // positions too far out for an int, or that aren't numbers at all, go in a cell at the edge of the grid
+    return (coordinate > -MAX_SOURCE_GRID_COORDINATE && coordinate < MAX_SOURCE_GRID_COORDINATE)
+        ? (int) coordinate : (int) MAX_SOURCE_GRID_COORDINATE;
+}
+
+static quint64 sourceGridKey(int level, int x, int y, int z) {
+    // coordinates wrap around in the key, which can only put far apart sources in the same cell, and listeners will
+    // still check the distance to each of them
+    const quint64 COORDINATE_MASK = (1 << SOURCE_GRID_COORDINATE_BITS) - 1;
+    return ((quint64) level << (SOURCE_GRID_COORDINATE_BITS * 3))
+        | (((quint64) x & COORDINATE_MASK) << (SOURCE_GRID_COORDINATE_BITS * 2))
+        | (((quint64) y & COORDINATE_MASK) << SOURCE_GRID_COORDINATE_BITS)
+        | ((quint64) z & COORDINATE_MASK);
 }
 
-void AudioMixer::addBufferToMixForListeningNodeWithBuffer(PositionalAudioRingBuffer* bufferToAdd,
-                                                          AvatarAudioRingBuffer* listeningNodeBuffer) {
+/// the most a source's samples will be scaled by for a listener at this distance
+static float loudestGainAtDistanceSquared(const AudioMixSource& source, float distanceSquareToSource) {
+    float radiusSquared = source.radius * source.radius;
+    if (distanceSquareToSource <= radiusSquared) {
+        return source.attenuationRatio;
+    }
+    return source.attenuationRatio * std::min(1.0f, DISTANCE_COEFFICIENT_SCALE
+                                              * powf(distanceSquareToSource - radiusSquared,
+                                                     DISTANCE_COEFFICIENT_EXPONENT));
+}
+
+/// Adds one source to the mix for a listener
+static void addSourceToMix(const AudioMixSource& source, const AudioMixListener& listener, int* mix) {
     float bearingRelativeAngleToSource = 0.0f;
     float attenuationCoefficient = 1.0f;
     int numSamplesDelay = 0;
     float weakChannelAmplitudeRatio = 1.0f;
     
-    const int PHASE_DELAY_AT_90 = 20;
-    
-    if (bufferToAdd != listeningNodeBuffer) {
+    if (source.buffer != listener.buffer) {
         // if the two buffer pointers do not match then these are different buffers
         
-        glm::vec3 listenerPosition = listeningNodeBuffer->getPosition();
-        glm::vec3 relativePosition = bufferToAdd->getPosition() - listeningNodeBuffer->getPosition();
-        glm::quat inverseOrientation = glm::inverse(listeningNodeBuffer->getOrientation());
+        glm::vec3 relativePosition = source.position - listener.position;
         
         float distanceSquareToSource = glm::dot(relativePosition, relativePosition);
-        float radius = 0.0f;
-        
-        if (bufferToAdd->getType() == PositionalAudioRingBuffer::Injector) {
-            InjectedAudioRingBuffer* injectedBuffer = (InjectedAudioRingBuffer*) bufferToAdd;
-            radius = injectedBuffer->getRadius();
-            attenuationCoefficient *= injectedBuffer->getAttenuationRatio();
-        }
+        float radius = source.radius;
+        attenuationCoefficient *= source.attenuationRatio;
         
         if (radius == 0 || (distanceSquareToSource > radius * radius)) {
             // this is either not a spherical source, or the listener is outside the sphere
@@ -106,7 +195,7 @@ void AudioMixer::addBufferToMixForListeningNodeWithBuffer(PositionalAudioRingBuf
                 
             } else {
                 // calculate the angle delivery for off-axis attenuation
-                glm::vec3 rotatedListenerPosition = glm::inverse(bufferToAdd->getOrientation()) * relativePosition;
+                glm::vec3 rotatedListenerPosition = source.inverseOrientation * relativePosition;
                 
                 float angleOfDelivery = glm::angle(glm::vec3(0.0f, 0.0f, -1.0f),
                                                    glm::normalize(rotatedListenerPosition));
@@ -121,17 +210,11 @@ void AudioMixer::addBufferToMixForListeningNodeWithBuffer(PositionalAudioRingBuf
                 attenuationCoefficient *= offAxisCoefficient;
             }
             
-            glm::vec3 rotatedSourcePosition = inverseOrientation * relativePosition;
-            
-            const float DISTANCE_SCALE = 2.5f;
-            const float GEOMETRIC_AMPLITUDE_SCALAR = 0.3f;
-            const float DISTANCE_LOG_BASE = 2.5f;
-            const float DISTANCE_SCALE_LOG = logf(DISTANCE_SCALE) / logf(DISTANCE_LOG_BASE);
+            glm::vec3 rotatedSourcePosition = listener.inverseOrientation * relativePosition;
             
             // calculate the distance coefficient using the distance to this node
-            float distanceCoefficient = powf(GEOMETRIC_AMPLITUDE_SCALAR,
-                                             DISTANCE_SCALE_LOG +
-                                             (0.5f * logf(distanceSquareToSource) / logf(DISTANCE_LOG_BASE)) - 1);
+            float distanceCoefficient = DISTANCE_COEFFICIENT_SCALE * powf(distanceSquareToSource,
+                                                                          DISTANCE_COEFFICIENT_EXPONENT);
             distanceCoefficient = std::min(1.0f, distanceCoefficient);
             
             // multiply the current attenuation coefficient by the distance coefficient
@@ -155,66 +238,242 @@ void AudioMixer::addBufferToMixForListeningNodeWithBuffer(PositionalAudioRingBuf
         }
     }
     
-    int16_t* sourceBuffer = bufferToAdd->getNextOutput();
+    int* goodChannel = (bearingRelativeAngleToSource > 0.0f) ? mix : mix + BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
+    int* delayedChannel = (bearingRelativeAngleToSource > 0.0f) ? mix + BUFFER_LENGTH_SAMPLES_PER_CHANNEL : mix;
+    float delayedChannelGain = attenuationCoefficient * weakChannelAmplitudeRatio;
     
-    int16_t* goodChannel = (bearingRelativeAngleToSource > 0.0f)
-        ? _clientSamples
-        : _clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
-    int16_t* delayedChannel = (bearingRelativeAngleToSource > 0.0f)
-        ? _clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL
-        : _clientSamples;
+    // the good channel gets this frame as is, the delayed channel gets the end of the last frame and then this frame
+    addScaledSamples(goodChannel, source.samples, BUFFER_LENGTH_SAMPLES_PER_CHANNEL, attenuationCoefficient);
+    addScaledSamples(delayedChannel, source.previousSamplesEnd - numSamplesDelay, numSamplesDelay, delayedChannelGain);
+    addScaledSamples(delayedChannel + numSamplesDelay, source.samples,
+                     BUFFER_LENGTH_SAMPLES_PER_CHANNEL - numSamplesDelay, delayedChannelGain);
+}
+
+AudioMixer::AudioMixer(const unsigned char* dataBuffer, int numBytes) :
+    Assignment(dataBuffer, numBytes),
+    _mixedAudioPacketHeaderBytes(numBytesForPacketHeader((unsigned char*) &PACKET_TYPE_MIXED_AUDIO)),
+    _usedSourceGridLevels(0),
+    _firstSourceHeardEverywhere(-1)
+{
     
-    int16_t* delaySamplePointer = bufferToAdd->getNextOutput() == bufferToAdd->getBuffer()
-        ? bufferToAdd->getBuffer() + RING_BUFFER_LENGTH_SAMPLES - numSamplesDelay
-        : bufferToAdd->getNextOutput() - numSamplesDelay;
+}
+
+void AudioMixer::prepareMixSourcesAndListeners() {
+    NodeList* nodeList = NodeList::getInstance();
     
-    for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
-        if (s < numSamplesDelay) {
-            // pull the earlier sample for the delayed channel
-            int earlierSample = delaySamplePointer[s] * attenuationCoefficient * weakChannelAmplitudeRatio;
+    _mixSources.clear();
+    _mixListeners.clear();
+    
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->getLinkedData()) {
+            AudioMixerClientData* nodeClientData = (AudioMixerClientData*) node->getLinkedData();
             
-            delayedChannel[s] = glm::clamp(delayedChannel[s] + earlierSample, MIN_SAMPLE_VALUE, MAX_SAMPLE_VALUE);
+            // every ring buffer with enough audio that's loud enough to hear is a source in this frame's mixes
+            AvatarAudioRingBuffer* avatarBuffer = nodeClientData->getAvatarAudioRingBuffer();
+            int ownSourceIndex = -1;
+            for (int i = 0; i < nodeClientData->getRingBuffers().size(); i++) {
+                PositionalAudioRingBuffer* nodeBuffer = nodeClientData->getRingBuffers()[i];
+                if (nodeBuffer->willBeAddedToMix() && addMixSource(nodeBuffer) && nodeBuffer == avatarBuffer) {
+                    ownSourceIndex = _mixSources.size() - 1;
+                }
+            }
+            
+            if (node->getType() == NODE_TYPE_AGENT && node->getActiveSocket() && avatarBuffer) {
+                addMixListener(&(*node), avatarBuffer, ownSourceIndex);
+            }
+        }
+    }
+    
+    buildSourceGrid();
+}
+
+bool AudioMixer::addMixSource(PositionalAudioRingBuffer* buffer) {
+    AudioMixSource source;
+    source.buffer = buffer;
+    source.position = buffer->getPosition();
+    source.inverseOrientation = glm::inverse(buffer->getOrientation());
+    source.samples = buffer->getNextOutput();
+    source.previousSamplesEnd = (buffer->getNextOutput() == buffer->getBuffer())
+        ? buffer->getBuffer() + RING_BUFFER_LENGTH_SAMPLES
+        : buffer->getNextOutput();
+    source.radius = 0.0f;
+    source.attenuationRatio = 1.0f;
+    
+    if (buffer->getType() == PositionalAudioRingBuffer::Injector) {
+        InjectedAudioRingBuffer* injectedBuffer = (InjectedAudioRingBuffer*) buffer;
+        source.radius = injectedBuffer->getRadius();
+        source.attenuationRatio = injectedBuffer->getAttenuationRatio();
+    }
+    
+    // the delayed channel reaches back into the end of the last frame as well
+    int peakLoudness = 0;
+    for (int s = -PHASE_DELAY_AT_90; s < 0; s++) {
+        peakLoudness = std::max(peakLoudness, abs(source.previousSamplesEnd[s]));
+    }
+    for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
+        peakLoudness = std::max(peakLoudness, abs(source.samples[s]));
+    }
+    source.peakLoudness = peakLoudness;
+    
+    // no listener gets more than the attenuation ratio of a source, so if that's too quiet nobody will hear it
+    float loudestContribution = source.peakLoudness * source.attenuationRatio;
+    if (loudestContribution <= 0.0f || loudestContribution < _audibilityThreshold) {
+        return false;
+    }
+    
+    // past the sphere, the distance where the distance coefficient takes the loudest contribution down to the
+    // threshold - the exponent is negative, which is why the threshold is always greater than 0
+    source.audibleDistanceSquared = source.radius * source.radius
+        + powf(_audibilityThreshold / (loudestContribution * DISTANCE_COEFFICIENT_SCALE),
+               1.0f / DISTANCE_COEFFICIENT_EXPONENT);
+    source.nextInGridCell = -1;
+    
+    _mixSources.push_back(source);
+    return true;
+}
+
+void AudioMixer::addMixListener(Node* node, AvatarAudioRingBuffer* buffer, int ownSourceIndex) {
+    AudioMixListener listener;
+    listener.node = node;
+    listener.buffer = buffer;
+    listener.position = buffer->getPosition();
+    listener.inverseOrientation = glm::inverse(buffer->getOrientation());
+    listener.codec = smallestAudioCodec(buffer->getAcceptedCodecs());
+    listener.ownSourceIndex = ownSourceIndex;
+    _mixListeners.push_back(listener);
+}
+
+void AudioMixer::buildSourceGrid() {
+    _sourceGrid.clear();
+    _usedSourceGridLevels = 0;
+    _firstSourceHeardEverywhere = -1;
+    
+    for (int i = 0; i < _mixSources.size(); i++) {
+        AudioMixSource& source = _mixSources[i];
+        
+        int level = 0;
+        while (level < SOURCE_GRID_LEVELS
+               && sourceGridCellSize(level) * sourceGridCellSize(level) < source.audibleDistanceSquared) {
+            level++;
+        }
+        
+        if (level == SOURCE_GRID_LEVELS) {
+            source.nextInGridCell = _firstSourceHeardEverywhere;
+            _firstSourceHeardEverywhere = i;
+            continue;
         }
         
-        // pull the current sample for the good channel
-        int16_t currentSample = sourceBuffer[s] * attenuationCoefficient;
-        goodChannel[s] = glm::clamp(goodChannel[s] + currentSample, MIN_SAMPLE_VALUE, MAX_SAMPLE_VALUE);
+        float cellSize = sourceGridCellSize(level);
+        quint64 key = sourceGridKey(level,
+                                    sourceGridCoordinate(source.position.x, cellSize),
+                                    sourceGridCoordinate(source.position.y, cellSize),
+                                    sourceGridCoordinate(source.position.z, cellSize));
+        source.nextInGridCell = _sourceGrid.value(key, -1);
+        _sourceGrid.insert(key, i);
+        _usedSourceGridLevels |= (1 << level);
+    }
+}
+
+/// adds a source, and the rest of the sources linked after it, to the list of those a listener can hear
+static void addAudibleSources(const std::vector<AudioMixSource>& sources, int firstSourceIndex,
+                              const AudioMixListener& listener, std::vector<int>& sourceIndices) {
+    for (int i = firstSourceIndex; i != -1; i = sources[i].nextInGridCell) {
+        glm::vec3 relativePosition = sources[i].position - listener.position;
+        if (sources[i].buffer != listener.buffer
+            && glm::dot(relativePosition, relativePosition) <= sources[i].audibleDistanceSquared) {
+            sourceIndices.push_back(i);
+        }
+    }
+}
+
+void AudioMixer::findAudibleSources(const AudioMixListener& listener, std::vector<int>& sourceIndices) const {
+    for (int level = 0; level < SOURCE_GRID_LEVELS; level++) {
+        if (!(_usedSourceGridLevels & (1 << level))) {
+            continue;
+        }
+        float cellSize = sourceGridCellSize(level);
+        int x = sourceGridCoordinate(listener.position.x, cellSize);
+        int y = sourceGridCoordinate(listener.position.y, cellSize);
+        int z = sourceGridCoordinate(listener.position.z, cellSize);
         
-        if (s + numSamplesDelay < BUFFER_LENGTH_SAMPLES_PER_CHANNEL) {
-            // place the curernt sample at the right spot in the delayed channel
-            int sumSample = delayedChannel[s + numSamplesDelay] + (currentSample * weakChannelAmplitudeRatio);
-            delayedChannel[s + numSamplesDelay] = glm::clamp(sumSample, MIN_SAMPLE_VALUE, MAX_SAMPLE_VALUE);
+        // a source's cell is at least as big as the distance it can be heard from, so it can only be heard from
+        // inside its own cell and the ones next to it
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dz = -1; dz <= 1; dz++) {
+                    addAudibleSources(_mixSources, _sourceGrid.value(sourceGridKey(level, x + dx, y + dy, z + dz), -1),
+                                      listener, sourceIndices);
+                }
+            }
         }
     }
+    addAudibleSources(_mixSources, _firstSourceHeardEverywhere, listener, sourceIndices);
 }
 
-void AudioMixer::prepareMixForListeningNode(Node* node) {
-	NodeList* nodeList = NodeList::getInstance();
+void AudioMixer::mixForListener(const AudioMixListener& listener, int16_t* mixedSamples) const {
+    // each listener's mix adds up in its own 32 bit buffer and is only clamped once it's done
+    int mix[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2];
+    memset(mix, 0, sizeof(mix));
     
-    AvatarAudioRingBuffer* nodeRingBuffer = ((AudioMixerClientData*) node->getLinkedData())->getAvatarAudioRingBuffer();
+    std::vector<int> audibleSources;
+    findAudibleSources(listener, audibleSources);
     
-    // zero out the client mix for this node
-    memset(_clientSamples, 0, sizeof(_clientSamples));
+    if (_maxSourcesPerListener > 0 && audibleSources.size() > _maxSourcesPerListener) {
+        // only mix the sources that will be loudest for this listener
+        std::vector<std::pair<float, int> > loudestSources(audibleSources.size());
+        for (int i = 0; i < audibleSources.size(); i++) {
+            const AudioMixSource& source = _mixSources[audibleSources[i]];
+            glm::vec3 relativePosition = source.position - listener.position;
+            loudestSources[i].first = source.peakLoudness
+                * loudestGainAtDistanceSquared(source, glm::dot(relativePosition, relativePosition));
+            loudestSources[i].second = audibleSources[i];
+        }
+        std::nth_element(loudestSources.begin(), loudestSources.begin() + _maxSourcesPerListener,
+                         loudestSources.end(), std::greater<std::pair<float, int> >());
+        
+        audibleSources.resize(_maxSourcesPerListener);
+        for (int i = 0; i < _maxSourcesPerListener; i++) {
+            audibleSources[i] = loudestSources[i].second;
+        }
+    }
     
-    // loop through all other nodes that have sufficient audio to mix
-    for (NodeList::iterator otherNode = nodeList->begin(); otherNode != nodeList->end(); otherNode++) {
-        if (otherNode->getLinkedData()) {
-            
-            AudioMixerClientData* otherNodeClientData = (AudioMixerClientData*) otherNode->getLinkedData();
-            
-            // enumerate the ARBs attached to the otherNode and add all that should be added to mix
-            for (int i = 0; i < otherNodeClientData->getRingBuffers().size(); i++) {
-                PositionalAudioRingBuffer* otherNodeBuffer = otherNodeClientData->getRingBuffers()[i];
-                
-                if ((*otherNode != *node
-                     || otherNodeBuffer->getType() != PositionalAudioRingBuffer::Microphone
-                     || nodeRingBuffer->shouldLoopbackForNode())
-                    && otherNodeBuffer->willBeAddedToMix()) {
-                    addBufferToMixForListeningNodeWithBuffer(otherNodeBuffer, nodeRingBuffer);
-                }
-            }
+    for (int i = 0; i < audibleSources.size(); i++) {
+        addSourceToMix(_mixSources[audibleSources[i]], listener, mix);
+    }
+    
+    // a listener only hears themselves if they asked for it
+    if (listener.ownSourceIndex != -1 && listener.buffer->shouldLoopbackForNode()) {
+        addSourceToMix(_mixSources[listener.ownSourceIndex], listener, mix);
+    }
+    saturateMix(mix, mixedSamples, BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2);
+}
+
+void AudioMixer::mixForListenerJob(int listenerIndex, void* audioMixer) {
+    AudioMixer* mixer = (AudioMixer*) audioMixer;
+    const AudioMixListener& listener = mixer->_mixListeners[listenerIndex];
+    int16_t mixedSamples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2];
+    mixer->mixForListener(listener, mixedSamples);
+    
+    unsigned char* codecAt = mixer->getMixedAudioPacket(listenerIndex) + mixer->_mixedAudioPacketHeaderBytes;
+    *codecAt = listener.codec;
+    encodeAudioFrame(listener.codec, mixedSamples, 2, codecAt + sizeof(unsigned char));
+}
+
+void AudioMixer::mixForAllListeners(int threadCount) {
+    // every listener's packet gets a header once, and then just has its samples replaced each frame
+    int oldListenerCount = _mixedAudioPackets.size() / getMaxMixedAudioPacketLength();
+    if (oldListenerCount < _mixListeners.size()) {
+        _mixedAudioPackets.resize(_mixListeners.size() * getMaxMixedAudioPacketLength());
+        for (int i = oldListenerCount; i < _mixListeners.size(); i++) {
+            populateTypeAndVersion(getMixedAudioPacket(i), PACKET_TYPE_MIXED_AUDIO);
         }
     }
+    
+    if (threadCount == USE_MIX_JOB_POOL) {
+        _mixJobPool.run(mixForListenerJob, _mixListeners.size(), this);
+    } else {
+        runParallelJobs(mixForListenerJob, _mixListeners.size(), threadCount, this);
+    }
 }
 
 void AudioMixer::run() {
@@ -227,15 +486,13 @@ void AudioMixer::run() {
     const char AUDIO_MIXER_NODE_TYPES_OF_INTEREST[2] = { NODE_TYPE_AGENT, NODE_TYPE_AUDIO_INJECTOR };
     nodeList->setNodeTypesOfInterest(AUDIO_MIXER_NODE_TYPES_OF_INTEREST, sizeof(AUDIO_MIXER_NODE_TYPES_OF_INTEREST));
     
-    ssize_t receivedBytes = 0;
-    
     nodeList->linkedDataCreateCallback = attachNewBufferToNode;
     
     nodeList->startSilentNodeRemovalThread();
     
-    unsigned char packetData[MAX_PACKET_SIZE] = {};
-    
-    sockaddr* nodeAddress = new sockaddr;
+    // the mixes for every listener go out, and the audio coming in is read, a batch of packets at a time
+    UDPPacketBatch mixedAudioBatch(nodeList->getNodeSocket());
+    UDPPacketBatch receivedBatch(nodeList->getNodeSocket());
     
     // make sure our node socket is non-blocking
     nodeList->getNodeSocket()->setBlocking(false);
@@ -243,10 +500,6 @@ void AudioMixer::run() {
     int nextFrame = 0;
     timeval startTime;
     
-    int numBytesPacketHeader = numBytesForPacketHeader((unsigned char*) &PACKET_TYPE_MIXED_AUDIO);
-    unsigned char clientPacket[BUFFER_LENGTH_BYTES_STEREO + numBytesPacketHeader];
-    populateTypeAndVersion(clientPacket, PACKET_TYPE_MIXED_AUDIO);
-    
     gettimeofday(&startTime, NULL);
     
     timeval lastDomainServerCheckIn = {};
@@ -295,15 +548,15 @@ void AudioMixer::run() {
             }
         }
         
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-            if (node->getType() == NODE_TYPE_AGENT && node->getActiveSocket() && node->getLinkedData()
-                && ((AudioMixerClientData*) node->getLinkedData())->getAvatarAudioRingBuffer()) {
-                prepareMixForListeningNode(&(*node));
-                
-                memcpy(clientPacket + numBytesPacketHeader, _clientSamples, sizeof(_clientSamples));
-                nodeList->getNodeSocket()->send(node->getActiveSocket(), clientPacket, sizeof(clientPacket));
-            }
+        // mix every listener's packet across the job pool, then send them all from this thread
+        prepareMixSourcesAndListeners();
+        mixForAllListeners(USE_MIX_JOB_POOL);
+        
+        for (int i = 0; i < _mixListeners.size(); i++) {
+            mixedAudioBatch.add(_mixListeners[i].node->getActiveSocket(), getMixedAudioPacket(i),
+                                getMixedAudioPacketLength(_mixListeners[i].codec));
         }
+        mixedAudioBatch.send();
         
         // push forward the next output pointers for any audio buffers we used
         for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
@@ -313,29 +566,38 @@ void AudioMixer::run() {
         }
         
         // pull any new audio data from nodes off of the network stack
-        while (nodeList->getNodeSocket()->receive(nodeAddress, packetData, &receivedBytes) &&
-               packetVersionMatch(packetData)) {
-            if (packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO
-                || packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO
-                || packetData[0] == PACKET_TYPE_INJECT_AUDIO) {
-                
-                QUuid nodeUUID = QUuid::fromRfc4122(QByteArray((char*) packetData + numBytesForPacketHeader(packetData),
-                                                               NUM_BYTES_RFC4122_UUID));
-                
-                Node* matchingNode = nodeList->nodeWithUUID(nodeUUID);
+        while (receivedBatch.receive() > 0) {
+            for (int i = 0; i < receivedBatch.getPacketCount(); i++) {
+                sockaddr* nodeAddress = &receivedBatch.getPacket(i).address;
+                unsigned char* packetData = receivedBatch.getPacket(i).data;
+                ssize_t receivedBytes = receivedBatch.getPacket(i).length;
                 
-                if (matchingNode) {
-                    nodeList->updateNodeWithData(matchingNode, nodeAddress, packetData, receivedBytes);
+                if (!packetVersionMatch(packetData)) {
+                    continue;
+                }
+                if (packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO
+                    || packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO
+                    || packetData[0] == PACKET_TYPE_INJECT_AUDIO) {
+                    
+                    QUuid nodeUUID = QUuid::fromRfc4122(QByteArray((char*) packetData
+                                                                       + numBytesForPacketHeader(packetData),
+                                                                   NUM_BYTES_RFC4122_UUID));
+                    
+                    Node* matchingNode = nodeList->nodeWithUUID(nodeUUID);
                     
-                    if (!matchingNode->getActiveSocket()) {
-                        // we don't have an active socket for this node, but they're talking to us
-                        // this means they've heard from us and can reply, let's assume public is active
-                        matchingNode->activatePublicSocket();
+                    if (matchingNode) {
+                        nodeList->updateNodeWithData(matchingNode, nodeAddress, packetData, receivedBytes);
+                        
+                        if (!matchingNode->getActiveSocket()) {
+                            // we don't have an active socket for this node, but they're talking to us
+                            // this means they've heard from us and can reply, let's assume public is active
+                            matchingNode->activatePublicSocket();
+                        }
                     }
+                } else {
+                    // let processNodeData handle it.
+                    nodeList->processNodeData(nodeAddress, packetData, receivedBytes);
                 }
-            } else {
-                // let processNodeData handle it.
-                nodeList->processNodeData(nodeAddress, packetData, receivedBytes);
             }
         }
         
@@ -361,4 +623,117 @@ void AudioMixer::run() {
             qDebug("Took too much time, not sleeping!\n");
         }
     }
-}
\ No newline at end of file
+}
+void AudioMixer::runMixBenchmark() {
+    // an audio mixer assignment, as the domain server would send it
+    unsigned char assignmentPacket[MAX_PACKET_SIZE];
+    int numAssignmentBytes = populateTypeAndVersion(assignmentPacket, PACKET_TYPE_CREATE_ASSIGNMENT);
+    Assignment mixerAssignment(Assignment::CreateCommand, Assignment::AudioMixerType);
+    numAssignmentBytes += mixerAssignment.packToBuffer(assignmentPacket + numAssignmentBytes);
+    
+    AudioMixer mixer(assignmentPacket, numAssignmentBytes);
+    
+    // listeners spread out on a plane facing every which way, each talking with a tone of their own
+    const int MAX_BENCHMARK_LISTENERS = 1024;
+    const float BENCHMARK_LISTENER_SPACING = 2.0f;
+    const int BENCHMARK_LISTENERS_PER_ROW = 32;
+    
+    std::vector<AvatarAudioRingBuffer*> buffers;
+    unsigned char microphonePacket[MAX_PACKET_SIZE];
+    int numHeaderBytes = populateTypeAndVersion(microphonePacket, PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO);
+    unsigned char* positionAt = microphonePacket + numHeaderBytes + NUM_BYTES_RFC4122_UUID;
+    unsigned char* orientationAt = positionAt + sizeof(glm::vec3);
+    unsigned char* codecsAt = orientationAt + sizeof(glm::quat);
+    int16_t* samplesAt = (int16_t*) (codecsAt + 2 * sizeof(unsigned char));
+    int numMicrophonePacketBytes = (unsigned char*) samplesAt + BUFFER_LENGTH_BYTES_PER_CHANNEL - microphonePacket;
+    memset(microphonePacket + numHeaderBytes, 0, NUM_BYTES_RFC4122_UUID);
+    
+    // the microphone audio is sent raw, and each mix is encoded with the smallest codec there is
+    codecsAt[0] = AUDIO_CODEC_PCM;
+    codecsAt[1] = SUPPORTED_AUDIO_CODECS;
+    
+    for (int i = 0; i < MAX_BENCHMARK_LISTENERS; i++) {
+        glm::vec3 position(i % BENCHMARK_LISTENERS_PER_ROW, 0.0f, i / BENCHMARK_LISTENERS_PER_ROW);
+        position *= BENCHMARK_LISTENER_SPACING;
+        glm::quat orientation = glm::angleAxis(randFloat() * 360.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+        memcpy(positionAt, &position, sizeof(position));
+        memcpy(orientationAt, &orientation, sizeof(orientation));
+        
+        // two frames, so that there's a previous frame for the delayed channel
+        AvatarAudioRingBuffer* buffer = new AvatarAudioRingBuffer();
+        float toneRadiansPerSample = (1 + i % 8) * 0.05f;
+        for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2; s++) {
+            samplesAt[s % BUFFER_LENGTH_SAMPLES_PER_CHANNEL] = 8000 * sinf(s * toneRadiansPerSample);
+            if (s % BUFFER_LENGTH_SAMPLES_PER_CHANNEL == BUFFER_LENGTH_SAMPLES_PER_CHANNEL - 1) {
+                buffer->parseData(microphonePacket, numMicrophonePacketBytes);
+            }
+        }
+        buffer->setNextOutput(buffer->getBuffer() + BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+        buffers.push_back(buffer);
+    }
+    
+    qDebug("Audibility threshold %g, at most %d sources per listener (0 for no limit)\n",
+           _audibilityThreshold, _maxSourcesPerListener);
+    
+    const int FRAMES_PER_MEASUREMENT = 10;
+    const int BENCHMARK_RUNS = 2;
+    const char* BENCHMARK_RUN_NAMES[BENCHMARK_RUNS] = { "one core", "job pool" };
+    const int BENCHMARK_RUN_THREADS[BENCHMARK_RUNS] = { 1, USE_MIX_JOB_POOL };
+    int maxListeners[BENCHMARK_RUNS];
+    
+    for (int run = 0; run < BENCHMARK_RUNS; run++) {
+        // double the listeners until a frame's mixes take too long, then narrow down on the most that fit
+        int fitting = 0;
+        int tooMany = MAX_BENCHMARK_LISTENERS + 1;
+        int listenerCount = 1;
+        while (tooMany - fitting > 1) {
+            mixer._mixSources.clear();
+            mixer._mixListeners.clear();
+            for (int i = 0; i < listenerCount; i++) {
+                int ownSourceIndex = mixer.addMixSource(buffers[i]) ? mixer._mixSources.size() - 1 : -1;
+                mixer.addMixListener(NULL, buffers[i], ownSourceIndex);
+            }
+            mixer.buildSourceGrid();
+            
+            // how many sources are left for each listener once the ones they can't hear are culled
+            int numAudibleSources = 0;
+            std::vector<int> audibleSources;
+            for (int i = 0; i < listenerCount; i++) {
+                audibleSources.clear();
+                mixer.findAudibleSources(mixer._mixListeners[i], audibleSources);
+                numAudibleSources += (_maxSourcesPerListener > 0)
+                    ? std::min((int) audibleSources.size(), _maxSourcesPerListener) : audibleSources.size();
+            }
+            
+            uint64_t start = usecTimestampNow();
+            for (int frame = 0; frame < FRAMES_PER_MEASUREMENT; frame++) {
+                mixer.mixForAllListeners(BENCHMARK_RUN_THREADS[run]);
+            }
+            uint64_t usecsPerFrame = (usecTimestampNow() - start) / FRAMES_PER_MEASUREMENT;
+            
+            qDebug("%s: %d listeners hearing %.1f sources each mixed in %llu usecs\n", BENCHMARK_RUN_NAMES[run],
+                   listenerCount, (float) numAudibleSources / listenerCount, usecsPerFrame);
+            
+            if (usecsPerFrame <= BUFFER_SEND_INTERVAL_USECS) {
+                fitting = listenerCount;
+            } else {
+                tooMany = listenerCount;
+            }
+            listenerCount = (tooMany > MAX_BENCHMARK_LISTENERS) ? std::min(fitting * 2, MAX_BENCHMARK_LISTENERS)
+                                                                  : (fitting + tooMany) / 2;
+            if (fitting == MAX_BENCHMARK_LISTENERS) {
+                break;
+            }
+        }
+        maxListeners[run] = fitting;
+    }
+    
+    int threadCount = mixer._mixJobPool.getThreadCount();
+    qDebug("Most listeners mixed within a %u usec frame: %d on one core, %d on %d threads (%.1f per thread)\n",
+           BUFFER_SEND_INTERVAL_USECS, maxListeners[0], maxListeners[1], threadCount,
+           (float) maxListeners[1] / threadCount);
+    
+    for (int i = 0; i < buffers.size(); i++) {
+        delete buffers[i];
+    }
+}
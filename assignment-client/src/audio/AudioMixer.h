@@ -9,12 +9,48 @@
 #ifndef __hifi__AudioMixer__
 #define __hifi__AudioMixer__
 
+#include <vector>
+
+#include <QtCore/QHash>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
 #include <Assignment.h>
+#include <AudioCodec.h>
 #include <AudioRingBuffer.h>
+#include <ParallelJobs.h>
 
+class Node;
 class PositionalAudioRingBuffer;
 class AvatarAudioRingBuffer;
 
+/// A ring buffer that's being mixed this frame, with what every listener's mix needs from it looked up once
+class AudioMixSource {
+public:
+    PositionalAudioRingBuffer* buffer;
+    glm::vec3 position;
+    glm::quat inverseOrientation;
+    const int16_t* samples; // this frame's samples
+    const int16_t* previousSamplesEnd; // the end of the last frame's samples, for the delayed channel
+    float radius;
+    float attenuationRatio;
+    float peakLoudness; // the loudest sample this frame, before attenuation
+    float audibleDistanceSquared; // beyond this no listener would hear anything from this frame
+    int nextInGridCell; // the next source in the same cell of the source grid, or -1
+};
+
+/// A node that gets a mix this frame
+class AudioMixListener {
+public:
+    Node* node;
+    AvatarAudioRingBuffer* buffer;
+    glm::vec3 position;
+    glm::quat inverseOrientation;
+    AudioCodec codec; // what this listener's mix is sent with
+    int ownSourceIndex; // the source for this listener's own buffer, if it's being mixed, or -1
+};
+
 /// Handles assignments of type AudioMixer - mixing streams of audio and re-distributing to various clients.
 class AudioMixer : public Assignment {
 public:
@@ -22,16 +58,66 @@ public:
     
     /// runs the audio mixer
     void run();
+    
+    /// Finds how many listeners, each hearing every other one, can be mixed within a frame on one core and on every
+    /// core, and prints the results
+    static void runMixBenchmark();
+    
+    /// Sets the quietest contribution, in samples, that a source has to make to a listener's mix to be mixed at all.
+    /// The default of 1 only drops sources that would round down to silence. Has to be greater than 0.
+    static void setAudibilityThreshold(float audibilityThreshold) { _audibilityThreshold = audibilityThreshold; }
+    
+    /// Limits each listener's mix to the loudest maxSourcesPerListener sources that reach them, 0 for no limit
+    static void setMaxSourcesPerListener(int maxSourcesPerListener) { _maxSourcesPerListener = maxSourcesPerListener; }
 private:
-    /// adds one buffer to the mix for a listening node
-    void addBufferToMixForListeningNodeWithBuffer(PositionalAudioRingBuffer* bufferToAdd,
-                                                  AvatarAudioRingBuffer* listeningNodeBuffer);
+    /// finds the buffers to be mixed and the nodes to mix for this frame
+    void prepareMixSourcesAndListeners();
+    
+    /// adds a buffer to this frame's sources, unless it's too quiet to be heard
+    /// \return bool true if the buffer was added
+    bool addMixSource(PositionalAudioRingBuffer* buffer);
+    void addMixListener(Node* node, AvatarAudioRingBuffer* buffer, int ownSourceIndex);
+    
+    /// files this frame's sources into the cells of the source grid, by position and how far away they can be heard
+    void buildSourceGrid();
+    
+    /// finds the sources, other than their own, that a listener can hear
+    void findAudibleSources(const AudioMixListener& listener, std::vector<int>& sourceIndices) const;
+    
+    /// mixes every source a listener should hear into their stereo samples
+    void mixForListener(const AudioMixListener& listener, int16_t* mixedSamples) const;
+    
+    /// the ParallelJob that mixes one listener's packet
+    static void mixForListenerJob(int listenerIndex, void* audioMixer);
+    
+    /// Mixes a packet for every listener. A threadCount of USE_MIX_JOB_POOL runs the mixes on _mixJobPool, anything
+    /// else is passed to runParallelJobs().
+    void mixForAllListeners(int threadCount);
+    static const int USE_MIX_JOB_POOL = -1;
+    
+    /// a mixed audio packet is the header, the codec and the encoded stereo frame
+    int getMixedAudioPacketLength(AudioCodec codec) const {
+        return _mixedAudioPacketHeaderBytes + sizeof(unsigned char) + encodedAudioFrameBytes(codec, 2);
+    }
+    int getMaxMixedAudioPacketLength() const { return getMixedAudioPacketLength(AUDIO_CODEC_PCM); }
+    unsigned char* getMixedAudioPacket(int listenerIndex) {
+        return &_mixedAudioPackets[listenerIndex * getMaxMixedAudioPacketLength()];
+    }
     
-    /// prepares and sends a mix to one Node
-    void prepareMixForListeningNode(Node* node);
+    int _mixedAudioPacketHeaderBytes;
+    std::vector<AudioMixSource> _mixSources;
+    std::vector<AudioMixListener> _mixListeners;
+    std::vector<unsigned char> _mixedAudioPackets; // room for one mixed audio packet per listener, back to back
+    ParallelJobPool _mixJobPool; // one thread per core, the listeners' mixes are split between them each frame
     
+    // The source grid has a level for each power of two cell size. A source goes in the level whose cells are as big
+    // as the distance it can be heard from, so a listener only has to look in the neighbouring cells on each level.
+    QHash<quint64, int> _sourceGrid; // the first source in each non-empty cell
+    unsigned int _usedSourceGridLevels; // a bit for each level with any sources
+    int _firstSourceHeardEverywhere; // sources too loud for any level, linked through nextInGridCell
     
-    int16_t _clientSamples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2];
+    static float _audibilityThreshold;
+    static int _maxSourcesPerListener;
 };
 
 #endif /* defined(__hifi__AudioMixer__) */
@@ -7,16 +7,43 @@
 //
 
 #include <PacketHeaders.h>
+#include <UUID.h>
 
 #include "AvatarAudioRingBuffer.h"
 
 AvatarAudioRingBuffer::AvatarAudioRingBuffer() :
     PositionalAudioRingBuffer(PositionalAudioRingBuffer::Microphone),
-    _shouldLoopbackForNode(false) {
+    _shouldLoopbackForNode(false),
+    _acceptedCodecs(AUDIO_CODEC_BIT(AUDIO_CODEC_PCM)) {
     
 }
 
 int AvatarAudioRingBuffer::parseData(unsigned char* sourceBuffer, int numBytes) {
     _shouldLoopbackForNode = (sourceBuffer[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO);
-    return PositionalAudioRingBuffer::parseData(sourceBuffer, numBytes);
+    
+    unsigned char* currentBuffer = sourceBuffer + numBytesForPacketHeader(sourceBuffer);
+    currentBuffer += NUM_BYTES_RFC4122_UUID; // the source UUID
+    
+    int numPositionalBytes = parsePositionalData(currentBuffer, numBytes - (currentBuffer - sourceBuffer));
+    if (numPositionalBytes == 0) {
+        // the positional data was bad, so this frame's audio is going nowhere
+        return currentBuffer - sourceBuffer;
+    }
+    currentBuffer += numPositionalBytes;
+    
+    // the codec of this frame, and the codecs the node can decode its mix with
+    if (numBytes - (currentBuffer - sourceBuffer) < 2 * sizeof(unsigned char)) {
+        return currentBuffer - sourceBuffer;
+    }
+    unsigned char codec = *(currentBuffer++);
+    _acceptedCodecs = *(currentBuffer++);
+    
+    int16_t samples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL];
+    int numEncodedBytes = decodeAudioFrame(codec, currentBuffer, numBytes - (currentBuffer - sourceBuffer), 1, samples);
+    if (numEncodedBytes > 0) {
+        parseAudioSamples((unsigned char*) samples, sizeof(samples));
+        currentBuffer += numEncodedBytes;
+    }
+    
+    return currentBuffer - sourceBuffer;
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 
 #include <QtCore/QUuid>
 
+#include "AudioCodec.h"
 #include "PositionalAudioRingBuffer.h"
 
 class AvatarAudioRingBuffer : public PositionalAudioRingBuffer {
@@ -20,12 +21,16 @@ public:
     int parseData(unsigned char* sourceBuffer, int numBytes);
     
     bool shouldLoopbackForNode() const { return _shouldLoopbackForNode; }
+    
+    /// the codecs the node said it can decode its mix with
+    AudioCodecMask getAcceptedCodecs() const { return _acceptedCodecs; }
 private:
     // disallow copying of AvatarAudioRingBuffer objects
     AvatarAudioRingBuffer(const AvatarAudioRingBuffer&);
     AvatarAudioRingBuffer& operator= (const AvatarAudioRingBuffer&);
     
     bool _shouldLoopbackForNode;
+    AudioCodecMask _acceptedCodecs;
 };
 
 #endif /* defined(__hifi__AvatarAudioRingBuffer__) */
@@ -8,7 +8,11 @@
 //  Original avatar-mixer main created by Leonardo Murillo on 03/25/13.
 //
 //  The avatar mixer receives head, hand and positional data from all connected
-//  nodes, and broadcasts that data back to them, every BROADCAST_INTERVAL ms.
+//  nodes, and broadcasts that data back to them, every BROADCAST_INTERVAL_USECS. Each node hears the avatars near
+//  them every time, and the ones further away less often, within a budget of bytes a second.
+
+#include <algorithm>
+#include <climits>
 
 #include <Logging.h>
 #include <NodeList.h>
@@ -16,78 +20,299 @@
 #include <SharedUtil.h>
 #include <UUID.h>
 
-#include "AvatarData.h"
+#include "AvatarMixerClientData.h"
+#include "AvatarMixerPacketProcessor.h"
 
 #include "AvatarMixer.h"
 
 const char AVATAR_MIXER_LOGGING_NAME[] = "avatar-mixer";
 
-unsigned char* addNodeToBroadcastPacket(unsigned char *currentPosition, Node *nodeToAdd) {
-    QByteArray rfcUUID = nodeToAdd->getUUID().toRfc4122();
-    memcpy(currentPosition, rfcUUID.constData(), rfcUUID.size());
-    currentPosition += rfcUUID.size();
+/// Writes the entry for an avatar in bulk avatar data: how long it is, the source's session ID, and the avatar. The
+/// entry is a delta against the last keyframe the receiver was sent, unless newKeyframe is passed, in which case it's
+/// the next keyframe, with the node's UUID in case the receiver doesn't know their session ID yet. Without a sentAvatar
+/// it's a keyframe that isn't kept.
+unsigned char* addNodeToBroadcastPacket(unsigned char* currentPosition, const AvatarMixerSource& source,
+                                        const SentAvatar* sentAvatar, AvatarKeyframe* newKeyframe) {
+    unsigned char* entryStart = currentPosition;
+    currentPosition += sizeof(uint16_t);
+    
+    const AvatarKeyframe& state = source.snapshot->state;
+    quint16 sessionID = source.sessionID;
+    
+    if (sentAvatar && !newKeyframe) {
+        memcpy(currentPosition, &sessionID, sizeof(sessionID));
+        currentPosition += sizeof(sessionID);
+        
+        currentPosition += AvatarData::getDeltaBroadcastData(currentPosition, state, sentAvatar->keyframe);
+    } else {
+        sessionID |= SESSION_ID_HAS_UUID;
+        memcpy(currentPosition, &sessionID, sizeof(sessionID));
+        currentPosition += sizeof(sessionID);
+        
+        QByteArray rfcUUID = source.node->getUUID().toRfc4122();
+        memcpy(currentPosition, rfcUUID.constData(), rfcUUID.size());
+        currentPosition += rfcUUID.size();
+        
+        currentPosition += newKeyframe ? AvatarData::getKeyframeBroadcastData(currentPosition, state, *newKeyframe)
+            : AvatarData::getStateBroadcastData(currentPosition, state);
+    }
     
-    AvatarData *nodeData = (AvatarData *)nodeToAdd->getLinkedData();
-    currentPosition += nodeData->getBroadcastData(currentPosition);
+    uint16_t entryBytes = currentPosition - entryStart - sizeof(entryBytes);
+    memcpy(entryStart, &entryBytes, sizeof(entryBytes));
     
     return currentPosition;
 }
 
 void attachAvatarDataToNode(Node* newNode) {
     if (newNode->getLinkedData() == NULL) {
-        newNode->setLinkedData(new AvatarData(newNode));
+        newNode->setLinkedData(new AvatarMixerClientData(newNode));
+    }
+}
+
+// avatar data goes out at a fixed rate, however often it comes in
+const uint64_t BROADCAST_INTERVAL_USECS = 1000 * 1000 / 60;
+
+const int DEFAULT_RECEIVER_BYTES_PER_SECOND = 128 * 1024;
+
+int AvatarMixer::_receiverBytesPerSecond = DEFAULT_RECEIVER_BYTES_PER_SECOND;
+
+// avatars within this many meters of a receiver are sent every time, and are all in the nearest cells of the grid
+const float FULL_RATE_DISTANCE = 10.0f;
+const float AVATAR_GRID_CELL_SIZE = FULL_RATE_DISTANCE;
+
+// past FULL_RATE_DISTANCE an avatar is sent half as often at twice the distance, but at least once a second
+const float DECIMATED_SEND_INTERVAL_USECS_PER_METER = 5000.0f;
+const uint64_t MAX_SEND_INTERVAL_USECS = 1000 * 1000;
+
+// how often each agent is sent a new keyframe of each avatar, so that one lost on the way only holds deltas up so long
+const uint64_t KEYFRAME_INTERVAL_USECS = 1000 * 1000;
+
+// when we stop remembering having sent an avatar that hasn't been heard from
+const uint64_t FORGET_SENT_AVATAR_USECS = 30 * 1000 * 1000;
+
+// at most this many batches are read each tick, so a flood of packets can't keep the next broadcast from going out,
+// whatever is left waits in the socket for the next tick
+const int MAX_RECEIVED_BATCHES_PER_TICK = 16;
+
+static uint64_t sendIntervalForDistance(float distance) {
+    if (distance <= FULL_RATE_DISTANCE) {
+        return 0;
+    }
+    return std::min(MAX_SEND_INTERVAL_USECS, (uint64_t) (distance * DECIMATED_SEND_INTERVAL_USECS_PER_METER));
+}
+
+AvatarMixer::AvatarMixer(const unsigned char* dataBuffer, int numBytes) :
+    Assignment(dataBuffer, numBytes),
+    _numReceivers(0),
+    _broadcastTime(0),
+    _lastStatsTime(0)
+{
+    
+}
+
+void AvatarMixer::prepareBroadcast(const std::vector<sockaddr>& injectorAddresses) {
+    NodeList* nodeList = NodeList::getInstance();
+    
+    _sources.clear();
+    _gridCells.clear();
+    _numReceivers = 0;
+    QHash<quint64, int> gridCellIndices;
+    
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        AvatarMixerClientData* nodeData = (AvatarMixerClientData*) node->getLinkedData();
+        if (!nodeData) {
+            // Linked data is only ever created here, rather than by the parse thread when the node's first packet comes
+            // in. The parse thread only looks for it while holding the node's lock, so it sees the data whole.
+            node->lock();
+            attachAvatarDataToNode(&*node);
+            node->unlock();
+            nodeData = (AvatarMixerClientData*) node->getLinkedData();
+        }
+        const AvatarSnapshot* snapshot = nodeData->takeLatestSnapshot();
+        if (!snapshot) {
+            continue;
+        }
+        AvatarMixerSource source;
+        source.node = &*node;
+        source.snapshot = snapshot;
+        source.sessionID = nodeList->assignSessionID(node->getUUID());
+        
+        // avatars spread out over the ground much more than up and down, so the grid is flat
+        int x = (int) floorf(snapshot->position.x / AVATAR_GRID_CELL_SIZE);
+        int z = (int) floorf(snapshot->position.z / AVATAR_GRID_CELL_SIZE);
+        quint64 key = ((quint64) (quint32) x << 32) | (quint32) z;
+        
+        int cellIndex = gridCellIndices.value(key, -1);
+        if (cellIndex == -1) {
+            cellIndex = _gridCells.size();
+            gridCellIndices.insert(key, cellIndex);
+            
+            AvatarGridCell cell;
+            cell.x = x;
+            cell.z = z;
+            cell.firstSource = -1;
+            _gridCells.push_back(cell);
+        }
+        source.nextInGridCell = _gridCells[cellIndex].firstSource;
+        _gridCells[cellIndex].firstSource = _sources.size();
+        
+        if (node->isAlive() && node->getActiveSocket()) {
+            if (_numReceivers == _receivers.size()) {
+                _receivers.push_back(AvatarMixerReceiver());
+            }
+            AvatarMixerReceiver& receiver = _receivers[_numReceivers++];
+            receiver.node = &*node;
+            receiver.sourceIndex = _sources.size();
+            memcpy(&receiver.address, node->getActiveSocket(), sizeof(receiver.address));
+        }
+        _sources.push_back(source);
+    }
+    
+    for (int i = 0; i < injectorAddresses.size(); i++) {
+        if (_numReceivers == _receivers.size()) {
+            _receivers.push_back(AvatarMixerReceiver());
+        }
+        AvatarMixerReceiver& receiver = _receivers[_numReceivers++];
+        receiver.node = NULL;
+        receiver.sourceIndex = -1;
+        receiver.address = injectorAddresses[i];
     }
 }
 
 // NOTE: some additional optimizations to consider.
 //    1) use the view frustum to cull those avatars that are out of view. Since avatar data doesn't need to be present
 //       if the avatar is not in view or in the keyhole.
-//    2) after culling for view frustum, sort order the avatars by distance, send the closest ones first.
-//    3) if we need to rate limit the amount of data we send, we can use a distance weighted "semi-random" function to
-//       determine which avatars are included in the packet stream
-//    4) we should optimize the avatar data format to be more compact (100 bytes is pretty wasteful).
-void broadcastAvatarData(NodeList* nodeList, const QUuid& receiverUUID, sockaddr* receiverAddress) {
-    static unsigned char broadcastPacketBuffer[MAX_PACKET_SIZE];
-    static unsigned char avatarDataBuffer[MAX_PACKET_SIZE];
-    unsigned char* broadcastPacket = (unsigned char*)&broadcastPacketBuffer[0];
+void AvatarMixer::broadcastAvatarData(AvatarMixerReceiver& receiver, uint64_t now) {
+    unsigned char broadcastPacket[MAX_PACKET_SIZE];
+    unsigned char avatarDataBuffer[MAX_PACKET_SIZE];
     int numHeaderBytes = populateTypeAndVersion(broadcastPacket, PACKET_TYPE_BULK_AVATAR_DATA);
     unsigned char* currentBufferPosition = broadcastPacket + numHeaderBytes;
     int packetLength = currentBufferPosition - broadcastPacket;
-    int packetsSent = 0;
+    int bytesSent = 0;
     
-    // send back a packet with other active node data to this node
-    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-        if (node->getLinkedData() && node->getUUID() != receiverUUID) {
-            unsigned char* avatarDataEndpoint = addNodeToBroadcastPacket((unsigned char*)&avatarDataBuffer[0], &*node);
-            int avatarDataLength = avatarDataEndpoint - (unsigned char*)&avatarDataBuffer;
+    receiver.packets.clear();
+    receiver.packetLengths.clear();
+    
+    // only this receiver's own data is touched here, so receivers can be broadcast to on different threads
+    AvatarMixerClientData* receiverData = receiver.node
+        ? (AvatarMixerClientData*) receiver.node->getLinkedData() : NULL;
+    int byteBudget = receiverData ? receiverData->refillByteBudget(now, _receiverBytesPerSecond) : INT_MAX;
+    glm::vec3 receiverPosition = receiverData ? _sources[receiver.sourceIndex].snapshot->position
+        : glm::vec3(0.0f, 0.0f, 0.0f);
+    
+    // go through the cells nearest the receiver first, so if their budget runs out it's the far avatars that wait
+    glm::vec2 receiverOnGround(receiverPosition.x, receiverPosition.z);
+    receiver.cellOrder.resize(_gridCells.size());
+    for (int i = 0; i < _gridCells.size(); i++) {
+        glm::vec2 cellMinimum(_gridCells[i].x * AVATAR_GRID_CELL_SIZE, _gridCells[i].z * AVATAR_GRID_CELL_SIZE);
+        glm::vec2 nearestInCell = glm::clamp(receiverOnGround, cellMinimum,
+                                             cellMinimum + glm::vec2(AVATAR_GRID_CELL_SIZE, AVATAR_GRID_CELL_SIZE));
+        receiver.cellOrder[i].first = glm::dot(nearestInCell - receiverOnGround, nearestInCell - receiverOnGround);
+        receiver.cellOrder[i].second = i;
+    }
+    std::sort(receiver.cellOrder.begin(), receiver.cellOrder.end());
+    
+    bool isOutOfBudget = false;
+    for (int i = 0; i < receiver.cellOrder.size() && !isOutOfBudget; i++) {
+        const AvatarGridCell& cell = _gridCells[receiver.cellOrder[i].second];
+        for (int s = cell.firstSource; s != -1; s = _sources[s].nextInGridCell) {
+            const AvatarMixerSource& source = _sources[s];
+            if (s == receiver.sourceIndex) {
+                continue;
+            }
+            SentAvatar* sentAvatar = NULL;
+            if (receiverData) {
+                sentAvatar = &receiverData->getSentAvatar(source.node->getUUID());
+                
+                uint64_t sendInterval = sendIntervalForDistance(glm::distance(source.snapshot->position,
+                                                                              receiverPosition));
+                if (now - sentAvatar->lastSentTime < sendInterval) {
+                    continue;
+                }
+            }
+            
+            // the receiver gets deltas against the last keyframe we sent them until it's time for the next one
+            AvatarKeyframe newKeyframe;
+            bool isKeyframeDue = sentAvatar && (sentAvatar->keyframe.sequence == -1
+                                                || now - sentAvatar->keyframeSentTime >= KEYFRAME_INTERVAL_USECS);
+            if (isKeyframeDue) {
+                newKeyframe.sequence = sentAvatar->keyframe.sequence;
+            }
+            
+            unsigned char* avatarDataEndpoint = addNodeToBroadcastPacket(&avatarDataBuffer[0], source, sentAvatar,
+                                                                         isKeyframeDue ? &newKeyframe : NULL);
+            int avatarDataLength = avatarDataEndpoint - &avatarDataBuffer[0];
+            
+            if (avatarDataLength > byteBudget) {
+                isOutOfBudget = true;
+                break;
+            }
+            byteBudget -= avatarDataLength;
             
-            if (avatarDataLength + packetLength <= MAX_PACKET_SIZE) {
-                memcpy(currentBufferPosition, &avatarDataBuffer[0], avatarDataLength);
-                packetLength += avatarDataLength;
-                currentBufferPosition += avatarDataLength;
-            } else {
-                packetsSent++;
-                //printf("packetsSent=%d packetLength=%d\n", packetsSent, packetLength);
-                nodeList->getNodeSocket()->send(receiverAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
+            if (avatarDataLength + packetLength > MAX_PACKET_SIZE) {
+                receiver.packets.insert(receiver.packets.end(), broadcastPacket, broadcastPacket + packetLength);
+                receiver.packetLengths.push_back(packetLength);
+                bytesSent += packetLength;
                 
                 // reset the packet
                 currentBufferPosition = broadcastPacket + numHeaderBytes;
                 packetLength = currentBufferPosition - broadcastPacket;
-                
-                // copy the avatar that didn't fit into the next packet
-                memcpy(currentBufferPosition, &avatarDataBuffer[0], avatarDataLength);
-                packetLength += avatarDataLength;
-                currentBufferPosition += avatarDataLength;
+            }
+            memcpy(currentBufferPosition, &avatarDataBuffer[0], avatarDataLength);
+            packetLength += avatarDataLength;
+            currentBufferPosition += avatarDataLength;
+            
+            if (sentAvatar) {
+                sentAvatar->lastSentTime = now;
+                if (isKeyframeDue) {
+                    sentAvatar->keyframe = newKeyframe;
+                    sentAvatar->keyframeSentTime = now;
+                }
             }
         }
     }
-    packetsSent++;
-    //printf("packetsSent=%d packetLength=%d\n", packetsSent, packetLength);
-    nodeList->getNodeSocket()->send(receiverAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
+    receiver.packets.insert(receiver.packets.end(), broadcastPacket, broadcastPacket + packetLength);
+    receiver.packetLengths.push_back(packetLength);
+    bytesSent += packetLength;
+    
+    if (receiverData) {
+        receiverData->spendBytes(bytesSent);
+    }
 }
 
-AvatarMixer::AvatarMixer(const unsigned char* dataBuffer, int numBytes) : Assignment(dataBuffer, numBytes) {
+void AvatarMixer::broadcastAvatarDataJob(int receiverIndex, void* avatarMixer) {
+    AvatarMixer* mixer = (AvatarMixer*) avatarMixer;
+    mixer->broadcastAvatarData(mixer->_receivers[receiverIndex], mixer->_broadcastTime);
+}
+
+void AvatarMixer::sendBroadcastStats(uint64_t now) {
+    NodeList* nodeList = NodeList::getInstance();
+    float secondsSinceLastStats = (now - _lastStatsTime) / 1000000.0f;
     
+    int totalBytesSent = 0;
+    int maxBytesSent = 0;
+    int numReceivers = 0;
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        AvatarMixerClientData* nodeData = (AvatarMixerClientData*) node->getLinkedData();
+        if (nodeData) {
+            int bytesSent = nodeData->takeBytesSent();
+            totalBytesSent += bytesSent;
+            maxBytesSent = std::max(maxBytesSent, bytesSent);
+            numReceivers++;
+            
+            nodeData->forgetAvatarsSentBefore(now - std::min(now, FORGET_SENT_AVATAR_USECS));
+        }
+    }
+    
+    if (Logging::shouldSendStats() && _lastStatsTime != 0 && numReceivers > 0) {
+        const char AVERAGE_BYTES_LOGSTASH_METRIC_NAME[] = "avatar-mixer-average-bytes-per-receiver-per-second";
+        const char MAX_BYTES_LOGSTASH_METRIC_NAME[] = "avatar-mixer-max-bytes-per-receiver-per-second";
+        
+        Logging::stashValue(STAT_TYPE_GAUGE, AVERAGE_BYTES_LOGSTASH_METRIC_NAME,
+                            totalBytesSent / (numReceivers * secondsSinceLastStats));
+        Logging::stashValue(STAT_TYPE_GAUGE, MAX_BYTES_LOGSTASH_METRIC_NAME, maxBytesSent / secondsSinceLastStats);
+    }
+    _lastStatsTime = now;
 }
 
 void AvatarMixer::run() {
@@ -99,20 +324,40 @@ void AvatarMixer::run() {
     
     nodeList->setNodeTypesOfInterest(&NODE_TYPE_AGENT, 1);
     
-    nodeList->linkedDataCreateCallback = attachAvatarDataToNode;
-    
     nodeList->startSilentNodeRemovalThread();
     
-    sockaddr nodeAddress = {};
-    ssize_t receivedBytes = 0;
+    // head data is parsed on its own thread, so reading it never holds up a broadcast
+    AvatarMixerPacketProcessor packetProcessor;
+    packetProcessor.initialize(true);
+    
+    // if we'll be sending stats, call the Logstash::socket() method to make it load the logstash IP outside the loop
+    if (Logging::shouldSendStats()) {
+        Logging::socket();
+    }
+    
+    // packets are read, and the broadcasts sent, a batch at a time
+    UDPPacketBatch receivedBatch(nodeList->getNodeSocket());
+    UDPPacketBatch broadcastBatch(nodeList->getNodeSocket());
+    
+    // make sure our node socket is non-blocking
+    nodeList->getNodeSocket()->setBlocking(false);
     
-    unsigned char packetData[MAX_PACKET_SIZE];
+    // the injectors heard from since the last tick, who are sent every avatar on the next one
+    std::vector<sockaddr> injectorAddresses;
     
     QUuid nodeUUID;
-    Node* avatarNode = NULL;
+    
+    int nextTick = 0;
+    timeval startTime;
+    gettimeofday(&startTime, NULL);
     
     timeval lastDomainServerCheckIn = {};
     
+    float sumTickTimePercentages = 0.0f;
+    int numStatCollections = 0;
+    int maxParseQueueDepth = 0;
+    int lastParsePacketsDropped = 0;
+    
     while (true) {
         
         if (NodeList::getInstance()->getNumNoReplyDomainCheckIns() == MAX_SILENT_DOMAIN_SERVER_CHECK_INS) {
@@ -123,47 +368,101 @@ void AvatarMixer::run() {
         if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
             gettimeofday(&lastDomainServerCheckIn, NULL);
             NodeList::getInstance()->sendDomainServerCheckIn();
+            
+            sendBroadcastStats(usecTimestampNow());
+            
+            if (Logging::shouldSendStats() && numStatCollections > 0) {
+                const char TICK_TIME_LOGSTASH_METRIC_NAME[] = "avatar-mixer-tick-time-usage";
+                const char PARSE_QUEUE_DEPTH_LOGSTASH_METRIC_NAME[] = "avatar-mixer-max-parse-queue-depth";
+                const char PARSE_PACKETS_DROPPED_LOGSTASH_METRIC_NAME[] = "avatar-mixer-parse-packets-dropped";
+                
+                int parsePacketsDropped = packetProcessor.getReceivedPacketsDropped();
+                Logging::stashValue(STAT_TYPE_TIMER, TICK_TIME_LOGSTASH_METRIC_NAME,
+                                    sumTickTimePercentages / numStatCollections);
+                Logging::stashValue(STAT_TYPE_GAUGE, PARSE_QUEUE_DEPTH_LOGSTASH_METRIC_NAME, maxParseQueueDepth);
+                Logging::stashValue(STAT_TYPE_COUNTER, PARSE_PACKETS_DROPPED_LOGSTASH_METRIC_NAME,
+                                    parsePacketsDropped - lastParsePacketsDropped);
+                lastParsePacketsDropped = parsePacketsDropped;
+            }
+            sumTickTimePercentages = 0.0f;
+            numStatCollections = 0;
+            maxParseQueueDepth = 0;
         }
         
         nodeList->possiblyPingInactiveNodes();
         
-        if (nodeList->getNodeSocket()->receive(&nodeAddress, packetData, &receivedBytes) &&
-            packetVersionMatch(packetData)) {
-            switch (packetData[0]) {
-                case PACKET_TYPE_HEAD_DATA:
-                    nodeUUID = QUuid::fromRfc4122(QByteArray((char*) packetData + numBytesForPacketHeader(packetData),
-                                                                   NUM_BYTES_RFC4122_UUID));
-                    
-                    // add or update the node in our list
-                    avatarNode = nodeList->nodeWithUUID(nodeUUID);
-                    
-                    if (avatarNode) {
-                        // parse positional data from an node
-                        nodeList->updateNodeWithData(avatarNode, &nodeAddress, packetData, receivedBytes);
-                    } else {
+        // build every receiver's packets from the latest snapshots across the job pool, then send them from here
+        _broadcastTime = usecTimestampNow();
+        prepareBroadcast(injectorAddresses);
+        injectorAddresses.clear();
+        _broadcastJobPool.run(broadcastAvatarDataJob, _numReceivers, this);
+        
+        for (int r = 0; r < _numReceivers; r++) {
+            const AvatarMixerReceiver& receiver = _receivers[r];
+            const unsigned char* packet = &receiver.packets[0];
+            for (int p = 0; p < receiver.packetLengths.size(); p++) {
+                broadcastBatch.add(&receiver.address, packet, receiver.packetLengths[p]);
+                packet += receiver.packetLengths[p];
+            }
+        }
+        broadcastBatch.send();
+        
+        sumTickTimePercentages += (float) (usecTimestampNow() - _broadcastTime) / BROADCAST_INTERVAL_USECS * 100.0f;
+        numStatCollections++;
+        
+        // hand what has come in since the last tick to the parse thread, or deal with it here if it's quick
+        for (int batch = 0; batch < MAX_RECEIVED_BATCHES_PER_TICK && receivedBatch.receive() > 0; batch++) {
+            for (int i = 0; i < receivedBatch.getPacketCount(); i++) {
+                sockaddr* nodeAddress = &receivedBatch.getPacket(i).address;
+                unsigned char* packetData = receivedBatch.getPacket(i).data;
+                ssize_t receivedBytes = receivedBatch.getPacket(i).length;
+                
+                if (!packetVersionMatch(packetData)) {
+                    continue;
+                }
+                switch (packetData[0]) {
+                    case PACKET_TYPE_HEAD_DATA:
+                        packetProcessor.queueReceivedPacket(*nodeAddress, packetData, receivedBytes);
                         break;
-                    }
-                case PACKET_TYPE_INJECT_AUDIO:
-                    broadcastAvatarData(nodeList, nodeUUID, &nodeAddress);
-                    break;
-                case PACKET_TYPE_AVATAR_URLS:
-                case PACKET_TYPE_AVATAR_FACE_VIDEO:
-                    nodeUUID = QUuid::fromRfc4122(QByteArray((char*) packetData + numBytesForPacketHeader(packetData),
-                                                             NUM_BYTES_RFC4122_UUID));
-                    // let everyone else know about the update
-                    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-                        if (node->getActiveSocket() && node->getUUID() != nodeUUID) {
-                            nodeList->getNodeSocket()->send(node->getActiveSocket(), packetData, receivedBytes);
+                    case PACKET_TYPE_INJECT_AUDIO: {
+                        // injectors aren't agents, so they have no budget and get every avatar
+                        bool isKnownInjector = false;
+                        for (int j = 0; j < injectorAddresses.size() && !isKnownInjector; j++) {
+                            isKnownInjector = socketMatch(&injectorAddresses[j], nodeAddress);
+                        }
+                        if (!isKnownInjector) {
+                            injectorAddresses.push_back(*nodeAddress);
                         }
+                        break;
                     }
-                    break;
-                default:
-                    // hand this off to the NodeList
-                    nodeList->processNodeData(&nodeAddress, packetData, receivedBytes);
-                    break;
+                    case PACKET_TYPE_AVATAR_URLS:
+                    case PACKET_TYPE_AVATAR_FACE_VIDEO:
+                        nodeUUID = QUuid::fromRfc4122(QByteArray((char*) packetData
+                                                                     + numBytesForPacketHeader(packetData),
+                                                                 NUM_BYTES_RFC4122_UUID));
+                        // let everyone else know about the update
+                        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+                            if (node->getActiveSocket() && node->getUUID() != nodeUUID) {
+                                broadcastBatch.add(node->getActiveSocket(), packetData, receivedBytes);
+                            }
+                        }
+                        break;
+                    default:
+                        // hand this off to the NodeList
+                        nodeList->processNodeData(nodeAddress, packetData, receivedBytes);
+                        break;
+                }
             }
         }
+        broadcastBatch.send();
+        maxParseQueueDepth = std::max(maxParseQueueDepth, packetProcessor.packetsToProcessCount());
+        
+        int usecToSleep = usecTimestamp(&startTime) + (++nextTick * BROADCAST_INTERVAL_USECS) - usecTimestampNow();
+        if (usecToSleep > 0) {
+            usleep(usecToSleep);
+        }
     }
     
+    packetProcessor.terminate();
     nodeList->stopSilentNodeRemovalThread();
 }
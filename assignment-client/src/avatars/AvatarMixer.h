@@ -9,15 +9,84 @@
 #ifndef __hifi__AvatarMixer__
 #define __hifi__AvatarMixer__
 
+#include <vector>
+
+#include <glm/glm.hpp>
+
 #include <Assignment.h>
+#include <NodeList.h>
+#include <ParallelJobs.h>
+
+class AvatarSnapshot;
+
+/// an avatar that can be broadcast this tick, and the next one in the same cell of the avatar grid
+class AvatarMixerSource {
+public:
+    Node* node;
+    const AvatarSnapshot* snapshot;
+    quint16 sessionID;
+    int nextInGridCell;
+};
 
-/// Handles assignments of type AvatarMixer - distribution of avatar data to various clients
+/// the avatars in one cell of the avatar grid
+class AvatarGridCell {
+public:
+    int x;
+    int z;
+    int firstSource;
+};
+
+/// Someone being sent avatar data this tick, and the packets built for them. Agents have a node and a source for their
+/// own avatar, injectors have neither.
+class AvatarMixerReceiver {
+public:
+    Node* node;
+    int sourceIndex; // -1 for an injector
+    sockaddr address;
+    std::vector<std::pair<float, int> > cellOrder; // how far away each grid cell is, to go through the nearest first
+    std::vector<unsigned char> packets; // back to back
+    std::vector<int> packetLengths;
+};
+
+/// Handles assignments of type AvatarMixer - distribution of avatar data to various clients. Received avatar data is
+/// parsed on a thread of its own, and broadcast from snapshots on a fixed tick, with each receiver's packets built on a
+/// pool of threads.
 class AvatarMixer : public Assignment {
 public:
     AvatarMixer(const unsigned char* dataBuffer, int numBytes);
     
     /// runs the avatar mixer
     void run();
+    
+    /// Sets how many bytes of avatar data a second each agent can be sent. Nearer avatars are sent first, so when the
+    /// budget runs out it's the far ones that wait.
+    static void setReceiverBytesPerSecond(int bytesPerSecond) { _receiverBytesPerSecond = bytesPerSecond; }
+private:
+    /// Takes every avatar's latest snapshot, and puts the ones that have one into cells of the avatar grid by where
+    /// they are on the ground. Agents with a snapshot and an active socket are this tick's receivers, along with the
+    /// injectors heard from since the last tick.
+    void prepareBroadcast(const std::vector<sockaddr>& injectorAddresses);
+    
+    /// Builds the packets of avatar data for a receiver. Agents are sent the avatars near them first and the further
+    /// away ones less often, only while their byte budget lasts. Injectors are sent everyone.
+    void broadcastAvatarData(AvatarMixerReceiver& receiver, uint64_t now);
+    
+    /// the ParallelJob that builds one receiver's packets
+    static void broadcastAvatarDataJob(int receiverIndex, void* avatarMixer);
+    
+    /// stashes the bytes each agent has been sent per second since the last call, and forgets old send times
+    void sendBroadcastStats(uint64_t now);
+    
+    std::vector<AvatarMixerSource> _sources;
+    std::vector<AvatarGridCell> _gridCells;
+    std::vector<AvatarMixerReceiver> _receivers; // kept between ticks so their buffers are reused
+    int _numReceivers;
+    ParallelJobPool _broadcastJobPool; // one thread per core, the receivers' packets are split between them each tick
+    uint64_t _broadcastTime; // when this tick's broadcast started
+    
+    uint64_t _lastStatsTime;
+    
+    static int _receiverBytesPerSecond;
 };
 
 #endif /* defined(__hifi__AvatarMixer__) */
@@ -0,0 +1,84 @@
+//
+//  AvatarMixerClientData.cpp
+//  hifi
+//
+//  Copyright (c) 2013 HighFidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+
+#include "AvatarMixerClientData.h"
+
+const float BYTE_BUDGET_BURST_SECONDS = 0.1f;
+
+SentAvatar::SentAvatar() :
+    lastSentTime(0),
+    keyframeSentTime(0),
+    keyframe()
+{
+    
+}
+
+AvatarMixerClientData::AvatarMixerClientData(Node* owningNode) :
+    AvatarData(owningNode),
+    _publishingSnapshot(0),
+    _latestSnapshot(1),
+    _broadcastingSnapshot(2),
+    _sentAvatars(),
+    _byteBudget(0.0f),
+    _lastBudgetRefill(0),
+    _bytesSent(0)
+{
+    
+}
+
+void AvatarMixerClientData::publishSnapshot() {
+    AvatarSnapshot& snapshot = _snapshots[_publishingSnapshot];
+    encodeState(snapshot.state);
+    snapshot.position = getPosition();
+    
+    _publishingSnapshot = _latestSnapshot.fetchAndStoreOrdered(_publishingSnapshot | NEW_SNAPSHOT_BIT)
+        & ~NEW_SNAPSHOT_BIT;
+}
+
+const AvatarSnapshot* AvatarMixerClientData::takeLatestSnapshot() {
+    if (_latestSnapshot.loadAcquire() & NEW_SNAPSHOT_BIT) {
+        _broadcastingSnapshot = _latestSnapshot.fetchAndStoreOrdered(_broadcastingSnapshot) & ~NEW_SNAPSHOT_BIT;
+    }
+    const AvatarSnapshot& snapshot = _snapshots[_broadcastingSnapshot];
+    return snapshot.state.groupBytes.empty() ? NULL : &snapshot;
+}
+
+void AvatarMixerClientData::forgetAvatarsSentBefore(uint64_t oldestSentTime) {
+    QHash<QUuid, SentAvatar>::iterator sentAvatar = _sentAvatars.begin();
+    while (sentAvatar != _sentAvatars.end()) {
+        if (sentAvatar.value().lastSentTime < oldestSentTime) {
+            sentAvatar = _sentAvatars.erase(sentAvatar);
+        } else {
+            ++sentAvatar;
+        }
+    }
+}
+
+int AvatarMixerClientData::refillByteBudget(uint64_t now, int bytesPerSecond) {
+    float maxBudget = bytesPerSecond * BYTE_BUDGET_BURST_SECONDS;
+    if (_lastBudgetRefill == 0) {
+        // a new agent starts out with a full budget
+        _byteBudget = maxBudget;
+    } else {
+        _byteBudget = std::min(maxBudget, _byteBudget + bytesPerSecond * ((now - _lastBudgetRefill) / 1000000.0f));
+    }
+    _lastBudgetRefill = now;
+    return std::max(0, (int) _byteBudget);
+}
+
+void AvatarMixerClientData::spendBytes(int numBytes) {
+    _byteBudget -= numBytes;
+    _bytesSent += numBytes;
+}
+
+int AvatarMixerClientData::takeBytesSent() {
+    int bytesSent = _bytesSent;
+    _bytesSent = 0;
+    return bytesSent;
+}
@@ -0,0 +1,84 @@
+//
+//  AvatarMixerClientData.h
+//  hifi
+//
+//  Copyright (c) 2013 HighFidelity, Inc. All rights reserved.
+//
+
+#ifndef __hifi__AvatarMixerClientData__
+#define __hifi__AvatarMixerClientData__
+
+#include <stdint.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
+#include <QtCore/QUuid>
+
+#include <glm/glm.hpp>
+
+#include <AvatarData.h>
+
+/// what an agent has been sent of another avatar
+class SentAvatar {
+public:
+    SentAvatar();
+    
+    uint64_t lastSentTime; // 0 if it never has been
+    uint64_t keyframeSentTime;
+    AvatarKeyframe keyframe;
+};
+
+/// an avatar as the parse thread last saw it, for the broadcast tick to send from while the next packet is parsed
+class AvatarSnapshot {
+public:
+    AvatarKeyframe state; // no group bytes until a snapshot has been published
+    glm::vec3 position;
+};
+
+/// The avatar mixer's data for an agent: their avatar, plus what the mixer has been sending them
+class AvatarMixerClientData : public AvatarData {
+public:
+    AvatarMixerClientData(Node* owningNode = NULL);
+    
+    /// Encodes the avatar as it is now into a snapshot, and makes it the latest one. Called by the parse thread, after
+    /// every packet it reads into the avatar.
+    void publishSnapshot();
+    
+    /// Switches to the latest snapshot published, if there's a new one, and keeps it until the next call. Called by
+    /// the broadcast tick, which never reads the avatar itself.
+    /// \return the snapshot to broadcast from, or NULL if none has been published yet
+    const AvatarSnapshot* takeLatestSnapshot();
+    
+    /// what this agent has been sent of the avatar with this UUID
+    SentAvatar& getSentAvatar(const QUuid& avatarUUID) { return _sentAvatars[avatarUUID]; }
+    
+    /// forgets what was sent of avatars last sent before oldestSentTime, so the ones that have gone don't pile up
+    void forgetAvatarsSentBefore(uint64_t oldestSentTime);
+    
+    /// Tops up the bytes this agent can be sent with what they've earned at bytesPerSecond since the last top up,
+    /// holding no more than a tenth of a second's worth.
+    /// \return int the bytes that can be sent now
+    int refillByteBudget(uint64_t now, int bytesPerSecond);
+    
+    /// takes bytes sent to this agent out of their budget, and counts them for stats
+    void spendBytes(int numBytes);
+    
+    /// \return int the bytes sent to this agent since the last call
+    int takeBytesSent();
+private:
+    // Snapshots are triple buffered, so that neither thread ever waits on the other: the parse thread writes into one,
+    // the broadcast tick reads from another, and they swap theirs for the latest one in between.
+    static const int NUM_SNAPSHOTS = 3;
+    static const int NEW_SNAPSHOT_BIT = 4; // set on _latestSnapshot when the tick hasn't taken it yet
+    AvatarSnapshot _snapshots[NUM_SNAPSHOTS];
+    int _publishingSnapshot; // the parse thread's
+    QAtomicInt _latestSnapshot;
+    int _broadcastingSnapshot; // the broadcast tick's
+    
+    QHash<QUuid, SentAvatar> _sentAvatars;
+    float _byteBudget;
+    uint64_t _lastBudgetRefill;
+    int _bytesSent;
+};
+
+#endif /* defined(__hifi__AvatarMixerClientData__) */
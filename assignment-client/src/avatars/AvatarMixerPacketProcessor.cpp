@@ -0,0 +1,33 @@
+//
+//  AvatarMixerPacketProcessor.cpp
+//  hifi
+//
+//  Copyright (c) 2013 HighFidelity, Inc. All rights reserved.
+//
+//  Parses the avatar data the avatar mixer receives, off of the thread that broadcasts it.
+//
+
+#include <NodeList.h>
+#include <PacketHeaders.h>
+#include <UUID.h>
+
+#include "AvatarMixerClientData.h"
+
+#include "AvatarMixerPacketProcessor.h"
+
+void AvatarMixerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned char* packetData,
+                                               ssize_t packetLength) {
+    NodeList* nodeList = NodeList::getInstance();
+    QUuid nodeUUID = QUuid::fromRfc4122(QByteArray((char*) packetData + numBytesForPacketHeader(packetData),
+                                                   NUM_BYTES_RFC4122_UUID));
+    Node* avatarNode = nodeList->nodeWithUUID(nodeUUID);
+    
+    if (avatarNode) {
+        nodeList->updateNodeWithData(avatarNode, &senderAddress, packetData, packetLength);
+        
+        AvatarMixerClientData* nodeData = (AvatarMixerClientData*) avatarNode->getLinkedData();
+        if (nodeData) {
+            nodeData->publishSnapshot();
+        }
+    }
+}
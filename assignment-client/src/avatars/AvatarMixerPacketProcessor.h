@@ -0,0 +1,22 @@
+//
+//  AvatarMixerPacketProcessor.h
+//  hifi
+//
+//  Copyright (c) 2013 HighFidelity, Inc. All rights reserved.
+//
+//  Parses the avatar data the avatar mixer receives, off of the thread that broadcasts it.
+//
+
+#ifndef __hifi__AvatarMixerPacketProcessor__
+#define __hifi__AvatarMixerPacketProcessor__
+
+#include <ReceivedPacketProcessor.h>
+
+/// Reads queued head data packets into their agents' AvatarMixerClientData, and publishes a snapshot of each avatar
+/// for the broadcast tick to send from
+class AvatarMixerPacketProcessor : public ReceivedPacketProcessor {
+protected:
+    virtual void processPacket(sockaddr& senderAddress, unsigned char* packetData, ssize_t packetLength);
+};
+
+#endif /* defined(__hifi__AvatarMixerPacketProcessor__) */
@@ -12,6 +12,7 @@
 #include <sys/time.h>
 #include <sys/wait.h>
 
+#include <AudioCodec.h>
 #include <Logging.h>
 #include <NodeList.h>
 #include <PacketHeaders.h>
@@ -188,6 +189,45 @@ int main(int argc, char* argv[]) {
     // start the Logging class with the parent's target name
     Logging::setTargetName(PARENT_TARGET_NAME);
     
+    // how quiet a source can be and still be mixed, and how many sources each listener can hear, for audio mixers
+    const char AUDIBILITY_THRESHOLD_OPTION[] = "--audibilityThreshold";
+    const char* audibilityThreshold = getCmdOption(argc, (const char**) argv, AUDIBILITY_THRESHOLD_OPTION);
+    if (audibilityThreshold) {
+        // the audible distance is the threshold to a negative power, which a threshold that isn't positive breaks
+        float threshold = atof(audibilityThreshold);
+        if (threshold > 0.0f) {
+            AudioMixer::setAudibilityThreshold(threshold);
+        } else {
+            qDebug("Ignoring %s %s, it has to be greater than 0.\n", AUDIBILITY_THRESHOLD_OPTION, audibilityThreshold);
+        }
+    }
+    const char MAX_SOURCES_PER_LISTENER_OPTION[] = "--maxSourcesPerListener";
+    const char* maxSourcesPerListener = getCmdOption(argc, (const char**) argv, MAX_SOURCES_PER_LISTENER_OPTION);
+    if (maxSourcesPerListener) {
+        AudioMixer::setMaxSourcesPerListener(atoi(maxSourcesPerListener));
+    }
+
+    // how many bytes of avatar data a second each agent can be sent, for avatar mixers
+    const char RECEIVER_BYTES_PER_SECOND_OPTION[] = "--avatarBytesPerSecond";
+    const char* receiverBytesPerSecond = getCmdOption(argc, (const char**) argv, RECEIVER_BYTES_PER_SECOND_OPTION);
+    if (receiverBytesPerSecond) {
+        AvatarMixer::setReceiverBytesPerSecond(atoi(receiverBytesPerSecond));
+    }
+
+    // Finds how many listeners the audio mixer can mix in a frame, on one core and on all of them, instead of running
+    const char BENCHMARK_AUDIO_MIXER_OPTION[] = "--benchmarkAudioMixer";
+    if (cmdOptionExists(argc, (const char**) argv, BENCHMARK_AUDIO_MIXER_OPTION)) {
+        AudioMixer::runMixBenchmark();
+        return 0;
+    }
+
+    // Times encoding and decoding a frame of mixed audio with each codec, instead of running
+    const char BENCHMARK_AUDIO_CODECS_OPTION[] = "--benchmarkAudioCodecs";
+    if (cmdOptionExists(argc, (const char**) argv, BENCHMARK_AUDIO_CODECS_OPTION)) {
+        runAudioCodecBenchmark();
+        return 0;
+    }
+
     const char CUSTOM_ASSIGNMENT_SERVER_HOSTNAME_OPTION[] = "-a";
     const char CUSTOM_ASSIGNMENT_SERVER_PORT_OPTION[] = "-p";
     
@@ -3556,6 +3556,10 @@ void Application::displayStats() {
     QString maxString = locale.toString((int)_recentMaxPackets);
     voxelStats << "Voxel Packets to Process: " << packetsString.toLocal8Bit().constData() 
                 << " [Recent Max: " << maxString.toLocal8Bit().constData() << "]";
+    int voxelPacketsDropped = _voxelProcessor.getReceivedPacketsDropped();
+    if (voxelPacketsDropped > 0) {
+        voxelStats << " [Dropped: " << locale.toString(voxelPacketsDropped).toLocal8Bit().constData() << "]";
+    }
                 
     if (_resetRecentMaxPacketsSoon && voxelPacketsToProcess > 0) {
         _recentMaxPackets = 0;
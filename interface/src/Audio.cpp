@@ -14,6 +14,7 @@
 #include <sys/stat.h>
 
 #include <AngleUtil.h>
+#include <AudioCodec.h>
 #include <NodeList.h>
 #include <NodeTypes.h>
 #include <PacketHeaders.h>
@@ -49,6 +50,8 @@ static const float AUDIO_CALLBACK_MSECS = (float)BUFFER_LENGTH_SAMPLES_PER_CHANN
 
 static const int NODE_LOOPBACK_MODIFIER = 307;
 
+static const AudioCodec MICROPHONE_AUDIO_CODEC = AUDIO_CODEC_ADPCM;
+
 // Speex preprocessor and echo canceller adaption
 static const int   AEC_N_CHANNELS_MIC = 1;                                      // Number of microphone channels
 static const int   AEC_N_CHANNELS_PLAY = 2;                                     // Number of speaker channels
@@ -113,11 +116,6 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
                 glm::vec3 headPosition = interfaceAvatar->getHeadJointPosition();
                 glm::quat headOrientation = interfaceAvatar->getHead().getOrientation();
                 
-                int numBytesPacketHeader = numBytesForPacketHeader((unsigned char*) &PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO);
-                int leadingBytes = numBytesPacketHeader + sizeof(headPosition) + sizeof(headOrientation);
-                
-                // we need the amount of bytes in the buffer + 1 for type
-                // + 12 for 3 floats for position + float for bearing + 1 attenuation byte
                 unsigned char dataPacket[MAX_PACKET_SIZE];
                 
                 PACKET_TYPE packetType = Menu::getInstance()->isOptionChecked(MenuOption::EchoAudio)
@@ -130,7 +128,6 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
                 QByteArray rfcUUID = NodeList::getInstance()->getOwnerUUID().toRfc4122();
                 memcpy(currentPacketPtr, rfcUUID.constData(), rfcUUID.size());
                 currentPacketPtr += rfcUUID.size();
-                leadingBytes += rfcUUID.size();
                 
                 // memcpy the three float positions
                 memcpy(currentPacketPtr, &headPosition, sizeof(headPosition));
@@ -140,15 +137,17 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
                 memcpy(currentPacketPtr, &headOrientation, sizeof(headOrientation));
                 currentPacketPtr += sizeof(headOrientation);
                 
-                // copy the audio data to the last BUFFER_LENGTH_BYTES bytes of the data packet
-                memcpy(currentPacketPtr, inputLeft, BUFFER_LENGTH_BYTES_PER_CHANNEL);
+                // the codec we're sending with and the ones we can decode our mix with, then the encoded audio
+                *(currentPacketPtr++) = MICROPHONE_AUDIO_CODEC;
+                *(currentPacketPtr++) = SUPPORTED_AUDIO_CODECS;
+                currentPacketPtr += encodeAudioFrame(MICROPHONE_AUDIO_CODEC, inputLeft, 1, currentPacketPtr);
                 
                 nodeList->getNodeSocket()->send(audioMixer->getActiveSocket(),
                                                 dataPacket,
-                                                BUFFER_LENGTH_BYTES_PER_CHANNEL + leadingBytes);
+                                                currentPacketPtr - dataPacket);
                 
-                interface->getBandwidthMeter()->outputStream(BandwidthMeter::AUDIO).updateValue(BUFFER_LENGTH_BYTES_PER_CHANNEL
-                                                                                                + leadingBytes);
+                interface->getBandwidthMeter()->outputStream(BandwidthMeter::AUDIO).updateValue(currentPacketPtr
+                                                                                                - dataPacket);
             } else {
                 nodeList->pingPublicAndLocalSocketsForInactiveNode(audioMixer);
             }
@@ -482,10 +481,17 @@ void Audio::addReceivedAudioToBuffer(unsigned char* receivedData, int receivedBy
     
     //printf("Got audio packet %d\n", _packetsReceivedThisPlayback);
     
-    _ringBuffer.parseData((unsigned char*) receivedData, receivedBytes);
+    // the mix comes with the codec it was encoded with in front of it
+    int numBytesPacketHeader = numBytesForPacketHeader(receivedData);
+    unsigned char* mixedAudio = receivedData + numBytesPacketHeader + sizeof(unsigned char);
+    int16_t mixedSamples[PACKET_LENGTH_SAMPLES];
+    if (receivedBytes > numBytesPacketHeader
+        && decodeAudioFrame(receivedData[numBytesPacketHeader], mixedAudio, receivedBytes - (mixedAudio - receivedData),
+                            2, mixedSamples)) {
+        _ringBuffer.parseAudioSamples((unsigned char*) mixedSamples, sizeof(mixedSamples));
+    }
    
-    Application::getInstance()->getBandwidthMeter()->inputStream(BandwidthMeter::AUDIO)
-            .updateValue(PACKET_LENGTH_BYTES + sizeof(PACKET_TYPE));
+    Application::getInstance()->getBandwidthMeter()->inputStream(BandwidthMeter::AUDIO).updateValue(receivedBytes);
  
     _lastReceiveTime = currentReceiveTime;
 }
@@ -2141,6 +2141,12 @@ bool VoxelSystem::findCapsulePenetration(const glm::vec3& start, const glm::vec3
     return result;
 }
 
+void VoxelSystem::findPenetrations(VoxelCollisionQuery& query) {
+    lockTree();
+    _tree->findPenetrations(query);
+    unlockTree();
+}
+
 class falseColorizeRandomEveryOtherArgs {
 public:
     falseColorizeRandomEveryOtherArgs() : totalNodes(0), colorableNodes(0), coloredNodes(0), colorThis(true) {};
@@ -962,10 +962,12 @@ void MyAvatar::updateCollisionWithVoxels(float deltaTime) {
     const float VOXEL_ELASTICITY = 1.4f;
     const float VOXEL_DAMPING = 0.0;
     const float VOXEL_COLLISION_FREQUENCY = 0.5f;
-    glm::vec3 penetration;
-    if (Application::getInstance()->getVoxels()->findCapsulePenetration(
-            _position - glm::vec3(0.0f, _pelvisFloatingHeight - radius, 0.0f),
-            _position + glm::vec3(0.0f, _height - _pelvisFloatingHeight + radius, 0.0f), radius, penetration)) {
+    _voxelCollisionQuery.clearShapes();
+    int body = _voxelCollisionQuery.addCapsule(_position - glm::vec3(0.0f, _pelvisFloatingHeight - radius, 0.0f),
+        _position + glm::vec3(0.0f, _height - _pelvisFloatingHeight + radius, 0.0f), radius);
+    Application::getInstance()->getVoxels()->findPenetrations(_voxelCollisionQuery);
+    if (!_voxelCollisionQuery.getContacts(body).empty()) {
+        glm::vec3 penetration = _voxelCollisionQuery.getPenetration(body);
         _lastCollisionPosition = _position;
         updateCollisionSound(penetration, deltaTime, VOXEL_COLLISION_FREQUENCY);
         applyHardCollision(penetration, VOXEL_ELASTICITY, VOXEL_DAMPING);
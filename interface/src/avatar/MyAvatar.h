@@ -11,6 +11,8 @@
 
 #include <QSettings>
 
+#include <VoxelCollisionQuery.h>
+
 #include "Avatar.h"
 
 class MyAvatar : public Avatar {
@@ -75,6 +77,7 @@ private:
     float _elapsedTimeStopped;
     float _elapsedTimeSinceCollision;
     glm::vec3 _lastCollisionPosition;
+    VoxelCollisionQuery _voxelCollisionQuery; // keeps the voxels around us from one frame to the next
     bool _speedBrakes;
     bool _isThrustOn;
     float _thrustMultiplier;
@@ -0,0 +1,241 @@
+//
+//  AudioCodec.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Encoding and decoding frames of audio for the trip between the interface and the audio mixer.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <math.h>
+#include <stdlib.h>
+
+#include <QtCore/QDebug>
+
+#include <SharedUtil.h>
+
+#include "AudioRingBuffer.h"
+
+#include "AudioCodec.h"
+
+const int ADPCM_STEP_SIZES[] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107,
+    118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894,
+    6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+const int ADPCM_MAX_STEP_INDEX = sizeof(ADPCM_STEP_SIZES) / sizeof(ADPCM_STEP_SIZES[0]) - 1;
+const int ADPCM_STEP_INDEX_CHANGES[] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// each channel starts with the sample to predict from and the step index, so a lost packet doesn't throw off the next
+const int ADPCM_CHANNEL_HEADER_BYTES = sizeof(int16_t) + sizeof(uint16_t);
+const int ADPCM_CHANNEL_BYTES = ADPCM_CHANNEL_HEADER_BYTES + BUFFER_LENGTH_SAMPLES_PER_CHANNEL / 2;
+
+/// moves the predictor and step index on by one encoded sample, for both the encoder and the decoder
+static inline void applyAdpcmNibble(int nibble, int& predictor, int& stepIndex) {
+    int step = ADPCM_STEP_SIZES[stepIndex];
+    int difference = step >> 3;
+    if (nibble & 4) {
+        difference += step;
+    }
+    if (nibble & 2) {
+        difference += step >> 1;
+    }
+    if (nibble & 1) {
+        difference += step >> 2;
+    }
+    predictor += (nibble & 8) ? -difference : difference;
+    predictor = std::max(-32768, std::min(32767, predictor));
+
+    stepIndex += ADPCM_STEP_INDEX_CHANGES[nibble & 7];
+    stepIndex = std::max(0, std::min(ADPCM_MAX_STEP_INDEX, stepIndex));
+}
+
+static void encodeAdpcmChannel(const int16_t* samples, unsigned char* destination) {
+    // start the step at about the size of the first changes in the frame
+    const int STEP_ESTIMATE_SAMPLES = 8;
+    int firstChanges = 0;
+    for (int s = 1; s <= STEP_ESTIMATE_SAMPLES; s++) {
+        firstChanges += abs(samples[s] - samples[s - 1]);
+    }
+    int stepIndex = 0;
+    while (stepIndex < ADPCM_MAX_STEP_INDEX && ADPCM_STEP_SIZES[stepIndex] < firstChanges / STEP_ESTIMATE_SAMPLES) {
+        stepIndex++;
+    }
+    int predictor = samples[0];
+
+    int16_t firstSample = predictor;
+    uint16_t firstStepIndex = stepIndex;
+    memcpy(destination, &firstSample, sizeof(firstSample));
+    memcpy(destination + sizeof(firstSample), &firstStepIndex, sizeof(firstStepIndex));
+    unsigned char* nibbles = destination + ADPCM_CHANNEL_HEADER_BYTES;
+
+    for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
+        int step = ADPCM_STEP_SIZES[stepIndex];
+        int difference = samples[s] - predictor;
+        int nibble = 0;
+        if (difference < 0) {
+            nibble = 8;
+            difference = -difference;
+        }
+        if (difference >= step) {
+            nibble |= 4;
+            difference -= step;
+        }
+        if (difference >= (step >> 1)) {
+            nibble |= 2;
+            difference -= (step >> 1);
+        }
+        if (difference >= (step >> 2)) {
+            nibble |= 1;
+        }
+        applyAdpcmNibble(nibble, predictor, stepIndex);
+
+        // two samples to a byte, the first in the low bits
+        if (s % 2 == 0) {
+            nibbles[s / 2] = nibble;
+        } else {
+            nibbles[s / 2] |= nibble << 4;
+        }
+    }
+}
+
+static void decodeAdpcmChannel(const unsigned char* source, int16_t* samples) {
+    int16_t firstSample;
+    uint16_t firstStepIndex;
+    memcpy(&firstSample, source, sizeof(firstSample));
+    memcpy(&firstStepIndex, source + sizeof(firstSample), sizeof(firstStepIndex));
+    int predictor = firstSample;
+    int stepIndex = std::min((int) firstStepIndex, ADPCM_MAX_STEP_INDEX);
+    const unsigned char* nibbles = source + ADPCM_CHANNEL_HEADER_BYTES;
+
+    for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
+        applyAdpcmNibble((s % 2 == 0) ? (nibbles[s / 2] & 0x0F) : (nibbles[s / 2] >> 4), predictor, stepIndex);
+        samples[s] = predictor;
+    }
+}
+
+static void encodePcmChannel(const int16_t* samples, unsigned char* destination) {
+    memcpy(destination, samples, BUFFER_LENGTH_BYTES_PER_CHANNEL);
+}
+
+static void decodePcmChannel(const unsigned char* source, int16_t* samples) {
+    memcpy(samples, source, BUFFER_LENGTH_BYTES_PER_CHANNEL);
+}
+
+/// what it takes to add a codec: how big a channel's frame is, and how to encode and decode one
+class AudioCodecEntry {
+public:
+    const char* name;
+    int channelBytes;
+    void (*encodeChannel)(const int16_t* samples, unsigned char* destination);
+    void (*decodeChannel)(const unsigned char* source, int16_t* samples);
+};
+
+static const AudioCodecEntry AUDIO_CODECS[NUM_AUDIO_CODECS] = {
+    { "PCM", BUFFER_LENGTH_BYTES_PER_CHANNEL, encodePcmChannel, decodePcmChannel },
+    { "ADPCM", ADPCM_CHANNEL_BYTES, encodeAdpcmChannel, decodeAdpcmChannel }
+};
+
+AudioCodec smallestAudioCodec(AudioCodecMask codecs) {
+    AudioCodec smallest = AUDIO_CODEC_PCM;
+    for (int codec = 0; codec < NUM_AUDIO_CODECS; codec++) {
+        if ((codecs & SUPPORTED_AUDIO_CODECS & AUDIO_CODEC_BIT(codec))
+            && AUDIO_CODECS[codec].channelBytes < AUDIO_CODECS[smallest].channelBytes) {
+            smallest = (AudioCodec) codec;
+        }
+    }
+    return smallest;
+}
+
+const char* audioCodecName(AudioCodec codec) {
+    return AUDIO_CODECS[codec].name;
+}
+
+int encodedAudioFrameBytes(AudioCodec codec, int numChannels) {
+    return AUDIO_CODECS[codec].channelBytes * numChannels;
+}
+
+int encodeAudioFrame(AudioCodec codec, const int16_t* samples, int numChannels, unsigned char* destination) {
+    const AudioCodecEntry& entry = AUDIO_CODECS[codec];
+    for (int channel = 0; channel < numChannels; channel++) {
+        entry.encodeChannel(samples + channel * BUFFER_LENGTH_SAMPLES_PER_CHANNEL,
+                            destination + channel * entry.channelBytes);
+    }
+    return entry.channelBytes * numChannels;
+}
+
+int decodeAudioFrame(unsigned char codec, const unsigned char* source, int numBytes, int numChannels,
+                     int16_t* samples) {
+    if (codec >= NUM_AUDIO_CODECS || numBytes < AUDIO_CODECS[codec].channelBytes * numChannels) {
+        return 0;
+    }
+    const AudioCodecEntry& entry = AUDIO_CODECS[codec];
+    for (int channel = 0; channel < numChannels; channel++) {
+        entry.decodeChannel(source + channel * entry.channelBytes,
+                            samples + channel * BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+    }
+    return entry.channelBytes * numChannels;
+}
+
+void runAudioCodecBenchmark() {
+    // a few seconds of something like a mix of voices: tones that come and go, over a little noise
+    const int BENCHMARK_FRAMES = 1000;
+    const int FRAME_SAMPLES = BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2;
+    int16_t* input = new int16_t[BENCHMARK_FRAMES * FRAME_SAMPLES];
+    int16_t* output = new int16_t[BENCHMARK_FRAMES * FRAME_SAMPLES];
+    unsigned char* encoded = new unsigned char[BENCHMARK_FRAMES * BUFFER_LENGTH_BYTES_STEREO];
+
+    for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+        for (int channel = 0; channel < 2; channel++) {
+            for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
+                float t = (frame * BUFFER_LENGTH_SAMPLES_PER_CHANNEL + s) / SAMPLE_RATE;
+                float voices = 0.0f;
+                const int NUM_VOICES = 4;
+                for (int voice = 0; voice < NUM_VOICES; voice++) {
+                    float syllable = 0.5f + 0.5f * sinf(t * (3.0f + voice) * PI_TIMES_TWO);
+                    voices += syllable * sinf(t * (140.0f + 70.0f * voice + channel * 5.0f) * PI_TIMES_TWO);
+                }
+                input[frame * FRAME_SAMPLES + channel * BUFFER_LENGTH_SAMPLES_PER_CHANNEL + s] =
+                    voices * 4000.0f + (randFloat() - 0.5f) * 200.0f;
+            }
+        }
+    }
+
+    const float FRAME_USECS = BUFFER_LENGTH_SAMPLES_PER_CHANNEL / SAMPLE_RATE * 1000000.0f;
+
+    for (int codec = 0; codec < NUM_AUDIO_CODECS; codec++) {
+        int frameBytes = encodedAudioFrameBytes((AudioCodec) codec, 2);
+
+        uint64_t start = usecTimestampNow();
+        for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+            encodeAudioFrame((AudioCodec) codec, input + frame * FRAME_SAMPLES, 2, encoded + frame * frameBytes);
+        }
+        float encodeUsecs = (float) (usecTimestampNow() - start) / BENCHMARK_FRAMES;
+
+        start = usecTimestampNow();
+        for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+            decodeAudioFrame(codec, encoded + frame * frameBytes, frameBytes, 2, output + frame * FRAME_SAMPLES);
+        }
+        float decodeUsecs = (float) (usecTimestampNow() - start) / BENCHMARK_FRAMES;
+
+        double signal = 0.0, noise = 0.0;
+        for (int s = 0; s < BENCHMARK_FRAMES * FRAME_SAMPLES; s++) {
+            signal += (double) input[s] * input[s];
+            noise += (double) (input[s] - output[s]) * (input[s] - output[s]);
+        }
+
+        qDebug("%s: %d bytes per stereo frame (%.1fx smaller), encode %.2f usecs, decode %.2f usecs per frame, "
+               "SNR %.1f dB, %d listeners' encodes per core per frame\n", audioCodecName((AudioCodec) codec),
+               frameBytes, (float) BUFFER_LENGTH_BYTES_STEREO / frameBytes, encodeUsecs, decodeUsecs,
+               (noise > 0.0) ? 10.0 * log10(signal / noise) : INFINITY,
+               (encodeUsecs > 0.0f) ? (int) (FRAME_USECS / encodeUsecs) : 0);
+    }
+
+    delete[] input;
+    delete[] output;
+    delete[] encoded;
+}
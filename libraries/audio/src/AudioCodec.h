@@ -0,0 +1,51 @@
+//
+//  AudioCodec.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Encoding and decoding frames of audio for the trip between the interface and the audio mixer.
+//
+
+#ifndef __hifi__AudioCodec__
+#define __hifi__AudioCodec__
+
+#include <stdint.h>
+
+/// The codecs a frame of audio can be sent with. A frame goes out with the byte for its codec in front of it, and
+/// whoever sends microphone audio says which codecs it can decode with a byte of AUDIO_CODEC_BIT()s, so the mixer can
+/// pick one for their mix.
+enum AudioCodec {
+    AUDIO_CODEC_PCM, // raw 16 bit samples
+    AUDIO_CODEC_ADPCM, // IMA ADPCM, 4 bits a sample, every frame can be decoded on its own
+    NUM_AUDIO_CODECS
+};
+
+#define AUDIO_CODEC_BIT(codec) (1 << (codec))
+
+typedef unsigned char AudioCodecMask;
+
+/// the codecs this build can encode and decode
+const AudioCodecMask SUPPORTED_AUDIO_CODECS = AUDIO_CODEC_BIT(AUDIO_CODEC_PCM) | AUDIO_CODEC_BIT(AUDIO_CODEC_ADPCM);
+
+/// the codec in a mask of codecs that makes the smallest frames, PCM if there aren't any we support in it
+AudioCodec smallestAudioCodec(AudioCodecMask codecs);
+
+const char* audioCodecName(AudioCodec codec);
+
+/// the bytes a frame of BUFFER_LENGTH_SAMPLES_PER_CHANNEL samples for each channel takes, not counting the codec byte
+int encodedAudioFrameBytes(AudioCodec codec, int numChannels);
+
+/// Encodes a frame of BUFFER_LENGTH_SAMPLES_PER_CHANNEL samples for each channel, one channel after the other.
+/// \return int the number of bytes written to destination
+int encodeAudioFrame(AudioCodec codec, const int16_t* samples, int numChannels, unsigned char* destination);
+
+/// Decodes a frame encoded by encodeAudioFrame().
+/// \return int the number of bytes read from source, or 0 if the codec isn't one we know or there are too few bytes
+int decodeAudioFrame(unsigned char codec, const unsigned char* source, int numBytes, int numChannels, int16_t* samples);
+
+/// Times encoding and decoding a stereo frame of mixed audio with each codec, and prints how long each takes and how
+/// much of the signal makes it through
+void runAudioCodecBenchmark();
+
+#endif /* defined(__hifi__AudioCodec__) */
@@ -6,8 +6,10 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <limits>
 #include <stdint.h>
 
 #include <NodeList.h>
@@ -44,118 +46,427 @@ AvatarData::~AvatarData() {
     delete _handData;
 }
 
+// hand positions are sent relative to the body to within a millimeter, look ats to within a couple of centimeters
+const int HAND_POSITION_RADIX = 10;
+const int LOOK_AT_RADIX = 6;
+
+static glm::vec3 clampToSignedTwoByteFixed(const glm::vec3& vector, int radix) {
+    float limit = std::numeric_limits<int16_t>::max() / (float) (1 << radix);
+    return glm::clamp(vector, -limit, limit);
+}
+
+/// the cell of AVATAR_POSITION_CELL_SIZE meters a position is in, as far as a signed two byte cell index goes
+static glm::vec3 positionCell(const glm::vec3& position) {
+    return glm::clamp(glm::floor(position / AVATAR_POSITION_CELL_SIZE),
+                      (float) std::numeric_limits<int16_t>::min(), (float) std::numeric_limits<int16_t>::max());
+}
+
+static int packUnitFloatToByte(unsigned char* buffer, float value) {
+    *buffer = (unsigned char) roundf(glm::clamp(value, 0.0f, 1.0f) * std::numeric_limits<unsigned char>::max());
+    return sizeof(unsigned char);
+}
+
+static float unpackUnitFloatFromByte(const unsigned char* buffer) {
+    return *buffer / (float) std::numeric_limits<unsigned char>::max();
+}
+
+AvatarKeyframe::AvatarKeyframe() :
+    sequence(-1),
+    groupBytes()
+{
+    memset(groupOffsets, 0, sizeof(groupOffsets));
+}
+
 int AvatarData::getBroadcastData(unsigned char* destinationBuffer) {
+    int groupOffsets[NUM_AVATAR_DATA_GROUPS + 1];
+    *destinationBuffer = AVATAR_KEYFRAME_BIT;
+    return sizeof(unsigned char) + encodeGroups(destinationBuffer + sizeof(unsigned char), groupOffsets);
+}
+
+void AvatarData::encodeState(AvatarKeyframe& state) {
+    unsigned char groupBytes[MAX_PACKET_SIZE];
+    int numGroupBytes = encodeGroups(groupBytes, state.groupOffsets);
+    state.groupBytes.assign(groupBytes, groupBytes + numGroupBytes);
+}
+
+int AvatarData::getStateBroadcastData(unsigned char* destinationBuffer, const AvatarKeyframe& state) {
+    *destinationBuffer++ = AVATAR_KEYFRAME_BIT;
+    memcpy(destinationBuffer, state.groupBytes.data(), state.groupBytes.size());
+    return sizeof(unsigned char) + state.groupBytes.size();
+}
+
+int AvatarData::getKeyframeBroadcastData(unsigned char* destinationBuffer, const AvatarKeyframe& state,
+                                         AvatarKeyframe& keyframe) {
+    keyframe.sequence = (keyframe.sequence + 1) & AVATAR_KEYFRAME_SEQUENCE_MASK;
+    keyframe.groupBytes = state.groupBytes;
+    memcpy(keyframe.groupOffsets, state.groupOffsets, sizeof(keyframe.groupOffsets));
+    
+    *destinationBuffer++ = AVATAR_KEYFRAME_BIT | keyframe.sequence;
+    memcpy(destinationBuffer, state.groupBytes.data(), state.groupBytes.size());
+    return sizeof(unsigned char) + state.groupBytes.size();
+}
+
+int AvatarData::getDeltaBroadcastData(unsigned char* destinationBuffer, const AvatarKeyframe& state,
+                                      const AvatarKeyframe& keyframe) {
     unsigned char* bufferStart = destinationBuffer;
     
-    // TODO: DRY this up to a shared method
-    // that can pack any type given the number of bytes
-    // and return the number of bytes to push the pointer
+    *destinationBuffer++ = keyframe.sequence;
+    
+    uint16_t groupMask = 0;
+    unsigned char* groupMaskPosition = destinationBuffer;
+    destinationBuffer += sizeof(groupMask);
+    
+    // the groups go out whole if any of their bytes have changed
+    for (int group = 0; group < NUM_AVATAR_DATA_GROUPS; group++) {
+        int currentBytes = state.groupOffsets[group + 1] - state.groupOffsets[group];
+        int keyframeBytes = keyframe.groupOffsets[group + 1] - keyframe.groupOffsets[group];
+        
+        if (currentBytes != keyframeBytes || memcmp(state.groupBytes.data() + state.groupOffsets[group],
+                                                    keyframe.groupBytes.data() + keyframe.groupOffsets[group],
+                                                    currentBytes) != 0) {
+            groupMask |= (1 << group);
+            memcpy(destinationBuffer, state.groupBytes.data() + state.groupOffsets[group], currentBytes);
+            destinationBuffer += currentBytes;
+        }
+    }
+    memcpy(groupMaskPosition, &groupMask, sizeof(groupMask));
     
+    return destinationBuffer - bufferStart;
+}
+
+int AvatarData::encodeGroups(unsigned char* destinationBuffer, int* groupOffsets) {
     // lazily allocate memory for HeadData in case we're not an Avatar instance
     if (!_headData) {
         _headData = new HeadData(this);
     }
-    // lazily allocate memory for HeadData in case we're not an Avatar instance
+    // lazily allocate memory for HandData in case we're not an Avatar instance
     if (!_handData) {
         _handData = new HandData(this);
     }
     
-    // UUID
-    QByteArray uuidByteArray = _uuid.toRfc4122();
-    memcpy(destinationBuffer, uuidByteArray.constData(), uuidByteArray.size());
-    destinationBuffer += uuidByteArray.size();
-    
-    // Body world position
-    memcpy(destinationBuffer, &_position, sizeof(float) * 3);
-    destinationBuffer += sizeof(float) * 3;
+    int numBytes = 0;
+    for (int group = 0; group < NUM_AVATAR_DATA_GROUPS; group++) {
+        groupOffsets[group] = numBytes;
+        numBytes += encodeGroup(group, destinationBuffer + numBytes);
+    }
+    groupOffsets[NUM_AVATAR_DATA_GROUPS] = numBytes;
     
-    // Body rotation (NOTE: This needs to become a quaternion to save two bytes)
-    destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _bodyYaw);
-    destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _bodyPitch);
-    destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _bodyRoll);
+    return numBytes;
+}
 
-    // Body scale
-    destinationBuffer += packFloatRatioToTwoByte(destinationBuffer, _newScale);
+int AvatarData::encodeGroup(int group, unsigned char* destinationBuffer) {
+    unsigned char* bufferStart = destinationBuffer;
     
-    // Follow mode info
-    memcpy(destinationBuffer, _leaderUUID.toRfc4122().constData(), NUM_BYTES_RFC4122_UUID);
-    destinationBuffer += NUM_BYTES_RFC4122_UUID;
-
-    // Head rotation (NOTE: This needs to become a quaternion to save two bytes)
-    destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_yaw);
-    destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_pitch);
-    destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_roll);
+    switch (group) {
+        case AVATAR_IDENTITY_GROUP: {
+            QByteArray uuidByteArray = _uuid.toRfc4122();
+            memcpy(destinationBuffer, uuidByteArray.constData(), NUM_BYTES_RFC4122_UUID);
+            destinationBuffer += NUM_BYTES_RFC4122_UUID;
+            break;
+        }
+        case AVATAR_POSITION_CELL_GROUP: {
+            glm::vec3 cell = positionCell(_position);
+            for (int i = 0; i < 3; i++) {
+                int16_t cellIndex = cell[i];
+                memcpy(destinationBuffer, &cellIndex, sizeof(cellIndex));
+                destinationBuffer += sizeof(cellIndex);
+            }
+            break;
+        }
+        case AVATAR_POSITION_GROUP: {
+            glm::vec3 positionInCell = _position / AVATAR_POSITION_CELL_SIZE - positionCell(_position);
+            for (int i = 0; i < 3; i++) {
+                uint16_t offset = roundf(glm::clamp(positionInCell[i], 0.0f, 1.0f)
+                                         * std::numeric_limits<uint16_t>::max());
+                memcpy(destinationBuffer, &offset, sizeof(offset));
+                destinationBuffer += sizeof(offset);
+            }
+            break;
+        }
+        case AVATAR_BODY_ROTATION_GROUP:
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _bodyYaw);
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _bodyPitch);
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _bodyRoll);
+            break;
+        case AVATAR_SCALE_GROUP:
+            destinationBuffer += packFloatRatioToTwoByte(destinationBuffer, _newScale);
+            break;
+        case AVATAR_LEADER_GROUP: {
+            // the leader goes by the session ID the avatar mixer gave them, 0 for no leader
+            quint16 leaderSessionID = _leaderUUID.isNull() ? 0 : NodeList::getInstance()->sessionIDForUUID(_leaderUUID);
+            memcpy(destinationBuffer, &leaderSessionID, sizeof(leaderSessionID));
+            destinationBuffer += sizeof(leaderSessionID);
+            break;
+        }
+        case AVATAR_HEAD_ROTATION_GROUP:
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_yaw);
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_pitch);
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_roll);
+            break;
+        case AVATAR_LEAN_GROUP:
+            // head lean X,Z (head lateral and fwd/back motion relative to torso), in degrees
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_leanSideways);
+            destinationBuffer += packFloatAngleToTwoByte(destinationBuffer, _headData->_leanForward);
+            break;
+        case AVATAR_HAND_POSITION_GROUP:
+            destinationBuffer += packFloatVec3ToSignedTwoByteFixed(destinationBuffer,
+                clampToSignedTwoByteFixed(_handPosition - _position, HAND_POSITION_RADIX), HAND_POSITION_RADIX);
+            break;
+        case AVATAR_LOOK_AT_GROUP:
+            destinationBuffer += packFloatVec3ToSignedTwoByteFixed(destinationBuffer,
+                clampToSignedTwoByteFixed(_headData->_lookAtPosition - _position, LOOK_AT_RADIX), LOOK_AT_RADIX);
+            break;
+        case AVATAR_AUDIO_LOUDNESS_GROUP: {
+            // instantaneous audio loudness (used to drive facial animation)
+            uint16_t loudness = roundf(glm::clamp(_headData->_audioLoudness / MAX_AUDIO_LOUDNESS, 0.0f, 1.0f)
+                                       * std::numeric_limits<uint16_t>::max());
+            memcpy(destinationBuffer, &loudness, sizeof(loudness));
+            destinationBuffer += sizeof(loudness);
+            break;
+        }
+        case AVATAR_CHAT_GROUP: {
+            int chatMessageSize = std::min((int) _chatMessage.size(), (int) std::numeric_limits<unsigned char>::max());
+            *destinationBuffer++ = chatMessageSize;
+            memcpy(destinationBuffer, _chatMessage.data(), chatMessageSize);
+            destinationBuffer += chatMessageSize;
+            break;
+        }
+        case AVATAR_STATE_GROUP: {
+            // bitMask of less than byte wide items
+            unsigned char bitItems = 0;
+            
+            // key state
+            setSemiNibbleAt(bitItems,KEY_STATE_START_BIT,_keyState);
+            // hand state
+            setSemiNibbleAt(bitItems,HAND_STATE_START_BIT,_handState);
+            // faceshift state
+            if (_headData->_isFaceshiftConnected) { setAtBit(bitItems, IS_FACESHIFT_CONNECTED); }
+            *destinationBuffer++ = bitItems;
+            
+            // pupil dilation
+            destinationBuffer += packUnitFloatToByte(destinationBuffer, _headData->_pupilDilation);
+            break;
+        }
+        case AVATAR_FACESHIFT_GROUP:
+            // If it is connected, pack up the data
+            if (_headData->_isFaceshiftConnected) {
+                destinationBuffer += packUnitFloatToByte(destinationBuffer, _headData->_leftEyeBlink);
+                destinationBuffer += packUnitFloatToByte(destinationBuffer, _headData->_rightEyeBlink);
+                
+                memcpy(destinationBuffer, &_headData->_averageLoudness, sizeof(float));
+                destinationBuffer += sizeof(float);
+                
+                memcpy(destinationBuffer, &_headData->_browAudioLift, sizeof(float));
+                destinationBuffer += sizeof(float);
+                
+                int numCoefficients = std::min((int) _headData->_blendshapeCoefficients.size(),
+                                               (int) std::numeric_limits<unsigned char>::max());
+                *destinationBuffer++ = numCoefficients;
+                for (int i = 0; i < numCoefficients; i++) {
+                    destinationBuffer += packUnitFloatToByte(destinationBuffer, _headData->_blendshapeCoefficients[i]);
+                }
+            }
+            break;
+        case AVATAR_HAND_DATA_GROUP:
+            // leap hand data
+            destinationBuffer += _handData->encodeRemoteData(destinationBuffer);
+            break;
+        case AVATAR_JOINTS_GROUP:
+            // skeleton joints
+            *destinationBuffer++ = (unsigned char)_joints.size();
+            for (vector<JointData>::iterator it = _joints.begin(); it != _joints.end(); it++) {
+                *destinationBuffer++ = (unsigned char)it->jointID;
+                destinationBuffer += packOrientationQuatToSmallestThree(destinationBuffer, it->rotation);
+            }
+            break;
+    }
     
-    // Head lean X,Z (head lateral and fwd/back motion relative to torso)
-    memcpy(destinationBuffer, &_headData->_leanSideways, sizeof(_headData->_leanSideways));
-    destinationBuffer += sizeof(_headData->_leanSideways);
-    memcpy(destinationBuffer, &_headData->_leanForward, sizeof(_headData->_leanForward));
-    destinationBuffer += sizeof(_headData->_leanForward);
-
-    // Hand Position - is relative to body position
-    glm::vec3 handPositionRelative = _handPosition - _position;
-    memcpy(destinationBuffer, &handPositionRelative, sizeof(float) * 3);
-    destinationBuffer += sizeof(float) * 3;
-
-    // Lookat Position
-    memcpy(destinationBuffer, &_headData->_lookAtPosition, sizeof(_headData->_lookAtPosition));
-    destinationBuffer += sizeof(_headData->_lookAtPosition);
-     
-    // Instantaneous audio loudness (used to drive facial animation)
-    //destinationBuffer += packFloatToByte(destinationBuffer, std::min(MAX_AUDIO_LOUDNESS, _audioLoudness), MAX_AUDIO_LOUDNESS);
-    memcpy(destinationBuffer, &_headData->_audioLoudness, sizeof(float));
-    destinationBuffer += sizeof(float);
+    return destinationBuffer - bufferStart;
+}
 
-    // chat message
-    *destinationBuffer++ = _chatMessage.size();
-    memcpy(destinationBuffer, _chatMessage.data(), _chatMessage.size() * sizeof(char));
-    destinationBuffer += _chatMessage.size() * sizeof(char);
+int AvatarData::decodeGroup(int group, unsigned char* sourceBuffer, int numBytes) {
+    unsigned char* startPosition = sourceBuffer;
     
-    // bitMask of less than byte wide items
-    unsigned char bitItems = 0;
-
-    // key state
-    setSemiNibbleAt(bitItems,KEY_STATE_START_BIT,_keyState);
-    // hand state
-    setSemiNibbleAt(bitItems,HAND_STATE_START_BIT,_handState);
-    // faceshift state
-    if (_headData->_isFaceshiftConnected) { setAtBit(bitItems, IS_FACESHIFT_CONNECTED); }
-    *destinationBuffer++ = bitItems;
-
-    // If it is connected, pack up the data
-    if (_headData->_isFaceshiftConnected) {
-        memcpy(destinationBuffer, &_headData->_leftEyeBlink, sizeof(float));
-        destinationBuffer += sizeof(float);
-
-        memcpy(destinationBuffer, &_headData->_rightEyeBlink, sizeof(float));
-        destinationBuffer += sizeof(float);
-
-        memcpy(destinationBuffer, &_headData->_averageLoudness, sizeof(float));
-        destinationBuffer += sizeof(float);
-
-        memcpy(destinationBuffer, &_headData->_browAudioLift, sizeof(float));
-        destinationBuffer += sizeof(float);
-        
-        *destinationBuffer++ = _headData->_blendshapeCoefficients.size();
-        memcpy(destinationBuffer, _headData->_blendshapeCoefficients.data(),
-            _headData->_blendshapeCoefficients.size() * sizeof(float));
-        destinationBuffer += _headData->_blendshapeCoefficients.size() * sizeof(float);
+    switch (group) {
+        case AVATAR_IDENTITY_GROUP:
+            if (numBytes < NUM_BYTES_RFC4122_UUID) {
+                return -1;
+            }
+            _uuid = QUuid::fromRfc4122(QByteArray((char*) sourceBuffer, NUM_BYTES_RFC4122_UUID));
+            sourceBuffer += NUM_BYTES_RFC4122_UUID;
+            break;
+        case AVATAR_POSITION_CELL_GROUP:
+            if (numBytes < 3 * (int) sizeof(int16_t)) {
+                return -1;
+            }
+            // the position is left at the corner of the cell, for AVATAR_POSITION_GROUP to add to
+            for (int i = 0; i < 3; i++) {
+                int16_t cellIndex;
+                memcpy(&cellIndex, sourceBuffer, sizeof(cellIndex));
+                sourceBuffer += sizeof(cellIndex);
+                _position[i] = cellIndex * AVATAR_POSITION_CELL_SIZE;
+            }
+            break;
+        case AVATAR_POSITION_GROUP:
+            if (numBytes < 3 * (int) sizeof(uint16_t)) {
+                return -1;
+            }
+            for (int i = 0; i < 3; i++) {
+                uint16_t offset;
+                memcpy(&offset, sourceBuffer, sizeof(offset));
+                sourceBuffer += sizeof(offset);
+                _position[i] += offset * AVATAR_POSITION_CELL_SIZE / std::numeric_limits<uint16_t>::max();
+            }
+            break;
+        case AVATAR_BODY_ROTATION_GROUP:
+            if (numBytes < 3 * (int) sizeof(uint16_t)) {
+                return -1;
+            }
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_bodyYaw);
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_bodyPitch);
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_bodyRoll);
+            break;
+        case AVATAR_SCALE_GROUP:
+            if (numBytes < (int) sizeof(uint16_t)) {
+                return -1;
+            }
+            sourceBuffer += unpackFloatRatioFromTwoByte(sourceBuffer, _newScale);
+            break;
+        case AVATAR_LEADER_GROUP: {
+            quint16 leaderSessionID;
+            if (numBytes < (int) sizeof(leaderSessionID)) {
+                return -1;
+            }
+            memcpy(&leaderSessionID, sourceBuffer, sizeof(leaderSessionID));
+            sourceBuffer += sizeof(leaderSessionID);
+            _leaderUUID = (leaderSessionID == 0) ? QUuid() : NodeList::getInstance()->uuidForSessionID(leaderSessionID);
+            break;
+        }
+        case AVATAR_HEAD_ROTATION_GROUP: {
+            if (numBytes < 3 * (int) sizeof(uint16_t)) {
+                return -1;
+            }
+            float headYaw, headPitch, headRoll;
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &headYaw);
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &headPitch);
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &headRoll);
+            
+            _headData->setYaw(headYaw);
+            _headData->setPitch(headPitch);
+            _headData->setRoll(headRoll);
+            break;
+        }
+        case AVATAR_LEAN_GROUP:
+            if (numBytes < 2 * (int) sizeof(uint16_t)) {
+                return -1;
+            }
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_headData->_leanSideways);
+            sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_headData->_leanForward);
+            break;
+        case AVATAR_HAND_POSITION_GROUP: {
+            if (numBytes < 3 * (int) sizeof(int16_t)) {
+                return -1;
+            }
+            glm::vec3 handPositionRelative;
+            sourceBuffer += unpackFloatVec3FromSignedTwoByteFixed(sourceBuffer, handPositionRelative,
+                                                                  HAND_POSITION_RADIX);
+            _handPosition = _position + handPositionRelative;
+            break;
+        }
+        case AVATAR_LOOK_AT_GROUP: {
+            if (numBytes < 3 * (int) sizeof(int16_t)) {
+                return -1;
+            }
+            glm::vec3 lookAtRelative;
+            sourceBuffer += unpackFloatVec3FromSignedTwoByteFixed(sourceBuffer, lookAtRelative, LOOK_AT_RADIX);
+            _headData->_lookAtPosition = _position + lookAtRelative;
+            break;
+        }
+        case AVATAR_AUDIO_LOUDNESS_GROUP: {
+            uint16_t loudness;
+            if (numBytes < (int) sizeof(loudness)) {
+                return -1;
+            }
+            memcpy(&loudness, sourceBuffer, sizeof(loudness));
+            sourceBuffer += sizeof(loudness);
+            _headData->_audioLoudness = loudness * MAX_AUDIO_LOUDNESS / std::numeric_limits<uint16_t>::max();
+            break;
+        }
+        case AVATAR_CHAT_GROUP: {
+            if (numBytes < 1 || numBytes < 1 + *sourceBuffer) {
+                return -1;
+            }
+            int chatMessageSize = *sourceBuffer++;
+            _chatMessage = string((char*)sourceBuffer, chatMessageSize);
+            sourceBuffer += chatMessageSize * sizeof(char);
+            break;
+        }
+        case AVATAR_STATE_GROUP: {
+            if (numBytes < 2) {
+                return -1;
+            }
+            unsigned char bitItems = *sourceBuffer++;
+            
+            // key state, stored as a semi-nibble in the bitItems
+            _keyState = (KeyState)getSemiNibbleAt(bitItems,KEY_STATE_START_BIT);
+            
+            // hand state, stored as a semi-nibble in the bitItems
+            _handState = getSemiNibbleAt(bitItems,HAND_STATE_START_BIT);
+            
+            _headData->_isFaceshiftConnected = oneAtBit(bitItems, IS_FACESHIFT_CONNECTED);
+            
+            // pupil dilation
+            _headData->_pupilDilation = unpackUnitFloatFromByte(sourceBuffer++);
+            break;
+        }
+        case AVATAR_FACESHIFT_GROUP:
+            // If it is connected, unpack the data
+            if (_headData->_isFaceshiftConnected) {
+                const int NUM_FIXED_FACESHIFT_BYTES = 2 + 2 * sizeof(float) + 1;
+                if (numBytes < NUM_FIXED_FACESHIFT_BYTES
+                    || numBytes < NUM_FIXED_FACESHIFT_BYTES + sourceBuffer[NUM_FIXED_FACESHIFT_BYTES - 1]) {
+                    return -1;
+                }
+                _headData->_leftEyeBlink = unpackUnitFloatFromByte(sourceBuffer++);
+                _headData->_rightEyeBlink = unpackUnitFloatFromByte(sourceBuffer++);
+                
+                memcpy(&_headData->_averageLoudness, sourceBuffer, sizeof(float));
+                sourceBuffer += sizeof(float);
+                
+                memcpy(&_headData->_browAudioLift, sourceBuffer, sizeof(float));
+                sourceBuffer += sizeof(float);
+                
+                _headData->_blendshapeCoefficients.resize(*sourceBuffer++);
+                for (int i = 0; i < _headData->_blendshapeCoefficients.size(); i++) {
+                    _headData->_blendshapeCoefficients[i] = unpackUnitFloatFromByte(sourceBuffer++);
+                }
+            }
+            break;
+        case AVATAR_HAND_DATA_GROUP: {
+            // leap hand data, which ends with a byte for how long the rest of it is
+            const int MIN_HAND_DATA_BYTES = 4;
+            if (numBytes < MIN_HAND_DATA_BYTES) {
+                return -1;
+            }
+            sourceBuffer += _handData->decodeRemoteData(sourceBuffer);
+            break;
+        }
+        case AVATAR_JOINTS_GROUP: {
+            const int NUM_BYTES_PER_JOINT = 1 + sizeof(uint32_t);
+            if (numBytes < 1 || numBytes < 1 + *sourceBuffer * NUM_BYTES_PER_JOINT) {
+                return -1;
+            }
+            // skeleton joints
+            _joints.resize(*sourceBuffer++);
+            for (vector<JointData>::iterator it = _joints.begin(); it != _joints.end(); it++) {
+                it->jointID = *sourceBuffer++;
+                sourceBuffer += unpackOrientationQuatFromSmallestThree(sourceBuffer, it->rotation);
+            }
+            break;
+        }
     }
     
-    // pupil dilation
-    destinationBuffer += packFloatToByte(destinationBuffer, _headData->_pupilDilation, 1.0f);
-    
-    // leap hand data
-    destinationBuffer += _handData->encodeRemoteData(destinationBuffer);
-    
-    // skeleton joints
-    *destinationBuffer++ = (unsigned char)_joints.size();
-    for (vector<JointData>::iterator it = _joints.begin(); it != _joints.end(); it++) {
-        *destinationBuffer++ = (unsigned char)it->jointID;
-        destinationBuffer += packOrientationQuatToBytes(destinationBuffer, it->rotation);
-    }
-
-    return destinationBuffer - bufferStart;
+    return sourceBuffer - startPosition;
 }
 
 // called on the other nodes - assigns it to my views of the others
@@ -171,6 +482,8 @@ int AvatarData::parseData(unsigned char* sourceBuffer, int numBytes) {
         _handData = new HandData(this);
     }
     
+    unsigned char* endPosition = sourceBuffer + numBytes;
+    
     // increment to push past the packet header
     int numBytesPacketHeader = numBytesForPacketHeader(sourceBuffer);
     sourceBuffer += numBytesPacketHeader;
@@ -180,110 +493,49 @@ int AvatarData::parseData(unsigned char* sourceBuffer, int numBytes) {
     // push past the node session UUID
     sourceBuffer += NUM_BYTES_RFC4122_UUID;
     
-    // user UUID
-    _uuid = QUuid::fromRfc4122(QByteArray((char*) sourceBuffer, NUM_BYTES_RFC4122_UUID));
-    sourceBuffer += NUM_BYTES_RFC4122_UUID;
-    
-    // Body world position
-    memcpy(&_position, sourceBuffer, sizeof(float) * 3);
-    sourceBuffer += sizeof(float) * 3;
-    
-    // Body rotation (NOTE: This needs to become a quaternion to save two bytes)
-    sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_bodyYaw);
-    sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_bodyPitch);
-    sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &_bodyRoll);
-
-    // Body scale
-    sourceBuffer += unpackFloatRatioFromTwoByte(sourceBuffer, _newScale);
-
-    // Follow mode info
-    _leaderUUID = QUuid::fromRfc4122(QByteArray((char*) sourceBuffer, NUM_BYTES_RFC4122_UUID));
-    sourceBuffer += NUM_BYTES_RFC4122_UUID;
-
-    // Head rotation (NOTE: This needs to become a quaternion to save two bytes)
-    float headYaw, headPitch, headRoll;
-    sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &headYaw);
-    sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &headPitch);
-    sourceBuffer += unpackFloatAngleFromTwoByte((uint16_t*) sourceBuffer, &headRoll);
-    
-    _headData->setYaw(headYaw);
-    _headData->setPitch(headPitch);
-    _headData->setRoll(headRoll);
-
-    //  Head position relative to pelvis
-    memcpy(&_headData->_leanSideways, sourceBuffer, sizeof(_headData->_leanSideways));
-    sourceBuffer += sizeof(float);
-    memcpy(&_headData->_leanForward, sourceBuffer, sizeof(_headData->_leanForward));
-    sourceBuffer += sizeof(_headData->_leanForward);
-
-    // Hand Position - is relative to body position
-    glm::vec3 handPositionRelative;
-    memcpy(&handPositionRelative, sourceBuffer, sizeof(float) * 3);
-    _handPosition = _position + handPositionRelative;
-    sourceBuffer += sizeof(float) * 3;
-
-    // Lookat Position
-    memcpy(&_headData->_lookAtPosition, sourceBuffer, sizeof(_headData->_lookAtPosition));
-    sourceBuffer += sizeof(_headData->_lookAtPosition);
-
-    // Instantaneous audio loudness (used to drive facial animation)
-    //sourceBuffer += unpackFloatFromByte(sourceBuffer, _audioLoudness, MAX_AUDIO_LOUDNESS);
-    memcpy(&_headData->_audioLoudness, sourceBuffer, sizeof(float));
-    sourceBuffer += sizeof(float);
-
-    // the rest is a chat message
-    int chatMessageSize = *sourceBuffer++;
-    _chatMessage = string((char*)sourceBuffer, chatMessageSize);
-    sourceBuffer += chatMessageSize * sizeof(char);
-
-    // voxel sending features...
-    unsigned char bitItems = 0;
-    bitItems = (unsigned char)*sourceBuffer++;
-
-    // key state, stored as a semi-nibble in the bitItems
-    _keyState = (KeyState)getSemiNibbleAt(bitItems,KEY_STATE_START_BIT);
-
-    // hand state, stored as a semi-nibble in the bitItems
-    _handState = getSemiNibbleAt(bitItems,HAND_STATE_START_BIT);
-
-    _headData->_isFaceshiftConnected = oneAtBit(bitItems, IS_FACESHIFT_CONNECTED);
-
-    // If it is connected, pack up the data
-    if (_headData->_isFaceshiftConnected) {
-        memcpy(&_headData->_leftEyeBlink, sourceBuffer, sizeof(float));
-        sourceBuffer += sizeof(float);
-
-        memcpy(&_headData->_rightEyeBlink, sourceBuffer, sizeof(float));
-        sourceBuffer += sizeof(float);
-
-        memcpy(&_headData->_averageLoudness, sourceBuffer, sizeof(float));
-        sourceBuffer += sizeof(float);
-
-        memcpy(&_headData->_browAudioLift, sourceBuffer, sizeof(float));
-        sourceBuffer += sizeof(float);
-        
-        _headData->_blendshapeCoefficients.resize(*sourceBuffer++);
-        memcpy(_headData->_blendshapeCoefficients.data(), sourceBuffer,
-            _headData->_blendshapeCoefficients.size() * sizeof(float));
-        sourceBuffer += _headData->_blendshapeCoefficients.size() * sizeof(float);
+    if (endPosition - sourceBuffer < (int) sizeof(unsigned char)) {
+        return endPosition - startPosition;
     }
+    unsigned char keyframeByte = *sourceBuffer++;
     
-    // pupil dilation
-    sourceBuffer += unpackFloatFromByte(sourceBuffer, _headData->_pupilDilation, 1.0f);
-    
-    // leap hand data
-    if (sourceBuffer - startPosition < numBytes) {
-        // check passed, bytes match
-        sourceBuffer += _handData->decodeRemoteData(sourceBuffer);
-    }
-    
-    // skeleton joints
-    if (sourceBuffer - startPosition < numBytes) {
-        // check passed, bytes match
-        _joints.resize(*sourceBuffer++);
-        for (vector<JointData>::iterator it = _joints.begin(); it != _joints.end(); it++) {
-            it->jointID = *sourceBuffer++;
-            sourceBuffer += unpackOrientationQuatFromBytes(sourceBuffer, it->rotation); 
+    if (keyframeByte & AVATAR_KEYFRAME_BIT) {
+        // keep the groups as they came in, for the deltas after this keyframe to fill in the ones they leave out
+        unsigned char* groupsStart = sourceBuffer;
+        for (int group = 0; group < NUM_AVATAR_DATA_GROUPS; group++) {
+            _receivedKeyframe.groupOffsets[group] = sourceBuffer - groupsStart;
+            
+            int groupBytes = decodeGroup(group, sourceBuffer, endPosition - sourceBuffer);
+            if (groupBytes < 0) {
+                _receivedKeyframe.sequence = -1;
+                return endPosition - startPosition;
+            }
+            sourceBuffer += groupBytes;
+        }
+        _receivedKeyframe.groupOffsets[NUM_AVATAR_DATA_GROUPS] = sourceBuffer - groupsStart;
+        _receivedKeyframe.groupBytes.assign(groupsStart, sourceBuffer);
+        _receivedKeyframe.sequence = keyframeByte & AVATAR_KEYFRAME_SEQUENCE_MASK;
+    } else {
+        uint16_t groupMask;
+        if (endPosition - sourceBuffer < (int) sizeof(groupMask) || keyframeByte != _receivedKeyframe.sequence) {
+            // this is a delta against a keyframe we don't have, so there's nothing to apply it to
+            return endPosition - startPosition;
+        }
+        memcpy(&groupMask, sourceBuffer, sizeof(groupMask));
+        sourceBuffer += sizeof(groupMask);
+        
+        for (int group = 0; group < NUM_AVATAR_DATA_GROUPS; group++) {
+            if (groupMask & (1 << group)) {
+                int groupBytes = decodeGroup(group, sourceBuffer, endPosition - sourceBuffer);
+                if (groupBytes < 0) {
+                    return endPosition - startPosition;
+                }
+                sourceBuffer += groupBytes;
+            } else {
+                // the group is as it was in the keyframe
+                int keyframeOffset = _receivedKeyframe.groupOffsets[group];
+                decodeGroup(group, _receivedKeyframe.groupBytes.data() + keyframeOffset,
+                            _receivedKeyframe.groupOffsets[group + 1] - keyframeOffset);
+            }
         }
     }
 
@@ -40,6 +40,46 @@ enum KeyState
     DELETE_KEY_DOWN
 };
 
+// Each time an avatar is sent it starts with a byte for the keyframe it's a delta against, or with this bit set, the
+// sequence number of the keyframe it is
+const unsigned char AVATAR_KEYFRAME_BIT = 0x80;
+const int AVATAR_KEYFRAME_SEQUENCE_MASK = 0x7F;
+
+/// The parts of an avatar that are sent separately, so that a delta only needs the ones that have changed since its
+/// keyframe. A keyframe has them all, in this order, and a delta has the ones set in the 16 bit mask after its first
+/// byte.
+enum AvatarDataGroup {
+    AVATAR_IDENTITY_GROUP, // user UUID
+    AVATAR_POSITION_CELL_GROUP, // which cell of AVATAR_POSITION_CELL_SIZE meters the body is in
+    AVATAR_POSITION_GROUP, // where in that cell the body is, to within a fraction of a millimeter
+    AVATAR_BODY_ROTATION_GROUP,
+    AVATAR_SCALE_GROUP,
+    AVATAR_LEADER_GROUP, // session ID of the node being followed
+    AVATAR_HEAD_ROTATION_GROUP,
+    AVATAR_LEAN_GROUP,
+    AVATAR_HAND_POSITION_GROUP, // relative to the body
+    AVATAR_LOOK_AT_GROUP, // relative to the body
+    AVATAR_AUDIO_LOUDNESS_GROUP,
+    AVATAR_CHAT_GROUP,
+    AVATAR_STATE_GROUP, // key, hand and faceshift states, and pupil dilation
+    AVATAR_FACESHIFT_GROUP, // blinks and 8 bit blendshapes, if faceshift is connected
+    AVATAR_HAND_DATA_GROUP,
+    AVATAR_JOINTS_GROUP, // joint rotations as smallest three quats
+    NUM_AVATAR_DATA_GROUPS
+};
+
+const float AVATAR_POSITION_CELL_SIZE = 16.0f;
+
+/// an avatar as it was sent in full, which deltas after it are taken against
+class AvatarKeyframe {
+public:
+    AvatarKeyframe();
+    
+    int sequence; // -1 before there's been a keyframe
+    std::vector<unsigned char> groupBytes;
+    int groupOffsets[NUM_AVATAR_DATA_GROUPS + 1];
+};
+
 class JointData;
 
 class AvatarData : public NodeData {
@@ -61,7 +101,26 @@ public:
     const glm::vec3& getHandPosition() const { return _handPosition; }
     void setHandPosition(const glm::vec3 handPosition) { _handPosition = handPosition; }
     
+    /// writes everything about the avatar, as a keyframe that isn't kept for deltas to be taken against
     int getBroadcastData(unsigned char* destinationBuffer);
+    
+    /// Encodes every group of the avatar as it is now into state, leaving its sequence alone, so it can be broadcast
+    /// later without the avatar having to hold still.
+    void encodeState(AvatarKeyframe& state);
+    
+    /// writes an encoded state, as a keyframe that isn't kept for deltas to be taken against
+    static int getStateBroadcastData(unsigned char* destinationBuffer, const AvatarKeyframe& state);
+    
+    /// writes an encoded state, as the keyframe after the one passed, which it then becomes
+    static int getKeyframeBroadcastData(unsigned char* destinationBuffer, const AvatarKeyframe& state,
+                                        AvatarKeyframe& keyframe);
+    
+    /// writes what has changed in an encoded state since a keyframe that the receiver has been sent
+    static int getDeltaBroadcastData(unsigned char* destinationBuffer, const AvatarKeyframe& state,
+                                     const AvatarKeyframe& keyframe);
+    
+    /// Reads a keyframe, or a delta against the last keyframe read. Deltas against any other keyframe, which must have
+    /// been lost on the way, are skipped.
     int parseData(unsigned char* sourceBuffer, int numBytes);
     
     QUuid& getUUID() { return _uuid; }
@@ -126,6 +185,16 @@ protected:
     HandData* _handData;
     
 private:
+    /// writes every group, one after the other, and where each one starts
+    int encodeGroups(unsigned char* destinationBuffer, int* groupOffsets);
+    int encodeGroup(int group, unsigned char* destinationBuffer);
+    
+    /// \return int the bytes read, or -1 if there are too few for the group
+    int decodeGroup(int group, unsigned char* sourceBuffer, int numBytes);
+    
+    AvatarKeyframe _receivedKeyframe;
+    
+
     // privatize the copy constructor and assignment operator so they cannot be called
     AvatarData(const AvatarData&);
     AvatarData& operator= (const AvatarData&);
@@ -39,6 +39,10 @@ public:
     const sockaddr& getAddress() const { return _address; }
     const unsigned char* getData() const { return &_packetData[0]; }
 
+    /// replaces the contents of this packet, so that one packet buffer can be reused for many packets
+    void setContents(const sockaddr& address, const unsigned char* packetData, ssize_t packetLength)
+        { copyContents(address, packetData, packetLength); }
+
 private:
     void copyContents(const sockaddr& address, const unsigned char*  packetData, ssize_t packetLength);
     
@@ -31,7 +31,8 @@ Node::Node(const QUuid& uuid, char type, sockaddr* publicSocket, sockaddr* local
     _activeSocket(NULL),
     _bytesReceivedMovingAverage(NULL),
     _linkedData(NULL),
-    _isAlive(true)
+    _isAlive(true),
+    _handleCount(0)
 {
     setPublicSocket(publicSocket);
     setLocalSocket(localSocket);
@@ -153,6 +154,45 @@ float Node::getAverageKilobitsPerSecond() {
     }
 }
 
+NodeHandle::NodeHandle() :
+    _node(NULL)
+{
+    
+}
+
+NodeHandle::NodeHandle(Node* node) :
+    _node(node)
+{
+    if (_node) {
+        _node->_handleCount.ref();
+    }
+}
+
+NodeHandle::NodeHandle(const NodeHandle& otherHandle) :
+    _node(otherHandle._node)
+{
+    if (_node) {
+        _node->_handleCount.ref();
+    }
+}
+
+NodeHandle::~NodeHandle() {
+    if (_node) {
+        _node->_handleCount.deref();
+    }
+}
+
+NodeHandle& NodeHandle::operator=(const NodeHandle& otherHandle) {
+    if (otherHandle._node) {
+        otherHandle._node->_handleCount.ref();
+    }
+    if (_node) {
+        _node->_handleCount.deref();
+    }
+    _node = otherHandle._node;
+    return *this;
+}
+
 QDebug operator<<(QDebug debug, const Node &node) {
     char publicAddressBuffer[16] = {'\0'};
     unsigned short publicAddressPort = loadBufferWithSocketInfo(publicAddressBuffer, node.getPublicSocket());
@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 #endif
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QDebug>
 #include <QtCore/QUuid>
 
@@ -70,6 +71,9 @@ public:
     int getPingMs() const { return _pingMs; }
     void setPingMs(int pingMs) { _pingMs = pingMs; }
     
+    /// how many NodeHandles to this node are held, the NodeList only reclaims a killed node's data once there are none
+    int getHandleCount() const { return _handleCount.loadAcquire(); }
+    
     void lock() { pthread_mutex_lock(&_mutex); }
     
     /// returns false if lock failed, true if you got the lock
@@ -79,6 +83,9 @@ public:
     static void printLog(Node const&);
     
 private:
+    friend class NodeHandle;
+    
+
     // privatize copy and assignment operator to disallow Node copying
     Node(const Node &otherNode);
     Node& operator=(Node otherNode);
@@ -94,9 +101,31 @@ private:
     NodeData* _linkedData;
     bool _isAlive;
     int _pingMs;
+    QAtomicInt _handleCount;
     pthread_mutex_t _mutex;
 };
 
+/// A counted reference to a node. While any handle to a node is held its linked data isn't reclaimed, even if the node
+/// is killed, so whoever holds one can use the node and its linked data for as long as they like without locking the
+/// node. NodeList::nodeHandleWithUUID() hands them out for alive nodes.
+class NodeHandle {
+public:
+    NodeHandle();
+    explicit NodeHandle(Node* node);
+    NodeHandle(const NodeHandle& otherHandle);
+    ~NodeHandle();
+    
+    NodeHandle& operator=(const NodeHandle& otherHandle);
+    
+    Node* data() const { return _node; }
+    Node* operator->() const { return _node; }
+    Node& operator*() const { return *_node; }
+    bool isNull() const { return _node == NULL; }
+    
+private:
+    Node* _node;
+};
+
 int unpackNodeId(unsigned char *packedData, uint16_t *nodeId);
 int packNodeId(unsigned char *packStore, uint16_t nodeId);
 
@@ -65,6 +65,9 @@ NodeList::NodeList(char newOwnerType, unsigned short int newSocketListenPort) :
     _domainPort(DEFAULT_DOMAIN_SERVER_PORT),
     _nodeBuckets(),
     _numNodes(0),
+    _nodesByUUID(),
+    _nodesByAddress(),
+    _killedNodes(),
     _nodeSocket(newSocketListenPort),
     _ownerType(newOwnerType),
     _nodeTypesOfInterest(NULL),
@@ -74,9 +77,13 @@ NodeList::NodeList(char newOwnerType, unsigned short int newSocketListenPort) :
     _publicAddress(),
     _publicPort(0),
     _hasCompletedInitialSTUNFailure(false),
-    _stunRequestsSinceSuccess(0)
+    _stunRequestsSinceSuccess(0),
+    _sessionIDs(),
+    _sessionUUIDs(),
+    _lastSessionID(0)
 {
-    
+    pthread_mutex_init(&_sessionIDsMutex, NULL);
+    pthread_rwlock_init(&_nodeIndexLock, NULL);
 }
 
 NodeList::~NodeList() {
@@ -86,6 +93,18 @@ NodeList::~NodeList() {
     
     // stop the spawned threads, if they were started
     stopSilentNodeRemovalThread();
+    
+    pthread_mutex_destroy(&_sessionIDsMutex);
+    pthread_rwlock_destroy(&_nodeIndexLock);
+}
+
+/// an IPv4 address and port packed into one key for the address index, 0 for anything else
+static quint64 addressIndexKey(const sockaddr* address) {
+    if (!address || address->sa_family != AF_INET) {
+        return 0;
+    }
+    const sockaddr_in* addressIn = (const sockaddr_in*) address;
+    return ((quint64) addressIn->sin_addr.s_addr << 16) | addressIn->sin_port;
 }
 
 void NodeList::setDomainHostname(const QString& domainHostname) {
@@ -120,16 +139,16 @@ void NodeList::setDomainHostname(const QString& domainHostname) {
 }
 
 void NodeList::timePingReply(sockaddr *nodeAddress, unsigned char *packetData) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (socketMatch(node->getPublicSocket(), nodeAddress) || 
-            socketMatch(node->getLocalSocket(), nodeAddress)) {     
-
-            int pingTime = usecTimestampNow() - *(uint64_t*)(packetData + numBytesForPacketHeader(packetData));
-            
-            node->setPingMs(pingTime / 1000);
-            break;
-        }
+    quint64 key = addressIndexKey(nodeAddress);
+    
+    pthread_rwlock_rdlock(&_nodeIndexLock);
+    QMultiHash<quint64, Node*>::const_iterator node = _nodesByAddress.constFind(key);
+    if (node != _nodesByAddress.constEnd()) {
+        int pingTime = usecTimestampNow() - *(uint64_t*)(packetData + numBytesForPacketHeader(packetData));
+        
+        node.value()->setPingMs(pingTime / 1000);
     }
+    pthread_rwlock_unlock(&_nodeIndexLock);
 }
 
 void NodeList::processNodeData(sockaddr* senderAddress, unsigned char* packetData, size_t dataBytes) {
@@ -178,34 +197,104 @@ void NodeList::processBulkNodeData(sockaddr *senderAddress, unsigned char *packe
         
         unsigned char* startPosition = packetData;
         unsigned char* currentPosition = startPosition + numBytesPacketHeader;
-        unsigned char packetHolder[numTotalBytes];
+        unsigned char* endPosition = startPosition + numTotalBytes;
+        unsigned char packetHolder[numBytesPacketHeader + NUM_BYTES_RFC4122_UUID + numTotalBytes];
         
         // we've already verified packet version for the bulk packet, so all head data in the packet is also up to date
         populateTypeAndVersion(packetHolder, PACKET_TYPE_HEAD_DATA);
         
-        while ((currentPosition - startPosition) < numTotalBytes) {
-            
-            memcpy(packetHolder + numBytesPacketHeader,
-                   currentPosition,
-                   numTotalBytes - (currentPosition - startPosition));
+        // each entry is its length, the node's session ID, the node's UUID if we might not know the ID yet, and then
+        // the node's data
+        const int NUM_BYTES_ENTRY_HEADER = sizeof(uint16_t) + sizeof(quint16);
+        while (endPosition - currentPosition >= NUM_BYTES_ENTRY_HEADER) {
+            uint16_t entryBytes;
+            memcpy(&entryBytes, currentPosition, sizeof(entryBytes));
+            currentPosition += sizeof(entryBytes);
+            if (entryBytes < sizeof(quint16) || entryBytes > endPosition - currentPosition) {
+                break;
+            }
+            unsigned char* entryEnd = currentPosition + entryBytes;
             
-            QUuid nodeUUID = QUuid::fromRfc4122(QByteArray((char*)currentPosition, NUM_BYTES_RFC4122_UUID));
-            Node* matchingNode = nodeWithUUID(nodeUUID);
+            quint16 sessionID;
+            memcpy(&sessionID, currentPosition, sizeof(sessionID));
+            currentPosition += sizeof(sessionID);
             
-            if (!matchingNode) {
-                // we're missing this node, we need to add it to the list
-                matchingNode = addOrUpdateNode(nodeUUID, NODE_TYPE_AGENT, NULL, NULL);
+            QUuid nodeUUID;
+            if (sessionID & SESSION_ID_HAS_UUID) {
+                if (entryEnd - currentPosition < NUM_BYTES_RFC4122_UUID) {
+                    break;
+                }
+                nodeUUID = QUuid::fromRfc4122(QByteArray((char*) currentPosition, NUM_BYTES_RFC4122_UUID));
+                currentPosition += NUM_BYTES_RFC4122_UUID;
+                setSessionID(sessionID & ~SESSION_ID_HAS_UUID, nodeUUID);
+            } else {
+                nodeUUID = uuidForSessionID(sessionID);
             }
             
-            currentPosition += updateNodeWithData(matchingNode,
-                                                  NULL,
-                                                  packetHolder,
-                                                  numTotalBytes - (currentPosition - startPosition));
-            
+            // skip the entries for nodes we haven't been told the session IDs of yet
+            if (!nodeUUID.isNull()) {
+                Node* matchingNode = nodeWithUUID(nodeUUID);
+                
+                if (!matchingNode) {
+                    // we're missing this node, we need to add it to the list
+                    matchingNode = addOrUpdateNode(nodeUUID, NODE_TYPE_AGENT, NULL, NULL);
+                }
+                
+                // the node's data is parsed as if it had come in a head data packet of its own
+                QByteArray rfcUUID = nodeUUID.toRfc4122();
+                memcpy(packetHolder + numBytesPacketHeader, rfcUUID.constData(), NUM_BYTES_RFC4122_UUID);
+                memcpy(packetHolder + numBytesPacketHeader + NUM_BYTES_RFC4122_UUID, currentPosition,
+                       entryEnd - currentPosition);
+                
+                updateNodeWithData(matchingNode, NULL, packetHolder,
+                                   numBytesPacketHeader + NUM_BYTES_RFC4122_UUID + (entryEnd - currentPosition));
+            }
+            currentPosition = entryEnd;
         }
     }    
 }
 
+quint16 NodeList::assignSessionID(const QUuid& nodeUUID) {
+    pthread_mutex_lock(&_sessionIDsMutex);
+    quint16 sessionID = _sessionIDs.value(nodeUUID, 0);
+    if (sessionID == 0) {
+        // IDs aren't reused until they run out, by which time anyone holding an old one has been sent the new owner
+        _lastSessionID = (_lastSessionID % (SESSION_ID_HAS_UUID - 1)) + 1;
+        _sessionIDs.remove(_sessionUUIDs.value(_lastSessionID));
+        _sessionIDs.insert(nodeUUID, _lastSessionID);
+        _sessionUUIDs.insert(_lastSessionID, nodeUUID);
+        sessionID = _lastSessionID;
+    }
+    pthread_mutex_unlock(&_sessionIDsMutex);
+    return sessionID;
+}
+
+quint16 NodeList::sessionIDForUUID(const QUuid& nodeUUID) {
+    pthread_mutex_lock(&_sessionIDsMutex);
+    quint16 sessionID = _sessionIDs.value(nodeUUID, 0);
+    pthread_mutex_unlock(&_sessionIDsMutex);
+    return sessionID;
+}
+
+QUuid NodeList::uuidForSessionID(quint16 sessionID) {
+    pthread_mutex_lock(&_sessionIDsMutex);
+    QUuid nodeUUID = _sessionUUIDs.value(sessionID);
+    pthread_mutex_unlock(&_sessionIDsMutex);
+    return nodeUUID;
+}
+
+void NodeList::setSessionID(quint16 sessionID, const QUuid& nodeUUID) {
+    pthread_mutex_lock(&_sessionIDsMutex);
+    quint16 oldSessionID = _sessionIDs.value(nodeUUID, 0);
+    if (oldSessionID != sessionID) {
+        _sessionUUIDs.remove(oldSessionID);
+        _sessionIDs.remove(_sessionUUIDs.value(sessionID));
+        _sessionIDs.insert(nodeUUID, sessionID);
+        _sessionUUIDs.insert(sessionID, nodeUUID);
+    }
+    pthread_mutex_unlock(&_sessionIDsMutex);
+}
+
 int NodeList::updateNodeWithData(Node *node, sockaddr* senderAddress, unsigned char *packetData, int dataBytes) {
     node->lock();
     
@@ -222,7 +311,8 @@ int NodeList::updateNodeWithData(Node *node, sockaddr* senderAddress, unsigned c
             linkedDataCreateCallback(node);
         }
         
-        int numParsedBytes = node->getLinkedData()->parseData(packetData, dataBytes);
+        // without a callback, the node's data might not have been created yet, in which case this packet is dropped
+        int numParsedBytes = node->getLinkedData() ? node->getLinkedData()->parseData(packetData, dataBytes) : 0;
         
         node->unlock();
         
@@ -235,23 +325,38 @@ int NodeList::updateNodeWithData(Node *node, sockaddr* senderAddress, unsigned c
 }
 
 Node* NodeList::nodeWithAddress(sockaddr *senderAddress) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (node->getActiveSocket() && socketMatch(node->getActiveSocket(), senderAddress)) {
-            return &(*node);
+    quint64 key = addressIndexKey(senderAddress);
+    Node* matchingNode = NULL;
+    
+    // a node is indexed by both of its sockets, and it's the one it's talking to us on that has to match
+    pthread_rwlock_rdlock(&_nodeIndexLock);
+    for (QMultiHash<quint64, Node*>::const_iterator node = _nodesByAddress.constFind(key);
+         node != _nodesByAddress.constEnd() && node.key() == key; ++node) {
+        if (socketMatch(node.value()->getActiveSocket(), senderAddress)) {
+            matchingNode = node.value();
+            break;
         }
     }
+    pthread_rwlock_unlock(&_nodeIndexLock);
     
-    return NULL;
+    return matchingNode;
 }
 
 Node* NodeList::nodeWithUUID(const QUuid& nodeUUID) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (node->getUUID() == nodeUUID) {
-            return &(*node);
-        }
-    }
+    pthread_rwlock_rdlock(&_nodeIndexLock);
+    Node* matchingNode = _nodesByUUID.value(nodeUUID, NULL);
+    pthread_rwlock_unlock(&_nodeIndexLock);
+    
+    return matchingNode;
+}
 
-    return NULL;
+NodeHandle NodeList::nodeHandleWithUUID(const QUuid& nodeUUID) {
+    // the handle is taken while the node is still in the index, so it can't be reclaimed out from under it
+    pthread_rwlock_rdlock(&_nodeIndexLock);
+    NodeHandle matchingNode(_nodesByUUID.value(nodeUUID, NULL));
+    pthread_rwlock_unlock(&_nodeIndexLock);
+    
+    return matchingNode;
 }
 
 int NodeList::getNumAliveNodes() const {
@@ -269,8 +374,16 @@ int NodeList::getNumAliveNodes() const {
 void NodeList::clear() {
     qDebug() << "Clearing the NodeList. Deleting all nodes in list.\n";
     
+    pthread_rwlock_wrlock(&_nodeIndexLock);
+    _nodesByUUID.clear();
+    _nodesByAddress.clear();
+    _killedNodes.clear();
+    pthread_rwlock_unlock(&_nodeIndexLock);
+    
     // delete all of the nodes in the list, set the pointers back to NULL and the number of nodes to 0
-    for (int i = 0; i < _numNodes; i++) {
+    int numNodes = _numNodes.load();
+    _numNodes.storeRelease(0);
+    for (int i = 0; i < numNodes; i++) {
         Node** nodeBucket = _nodeBuckets[i / NODES_PER_BUCKET];
         Node* node = nodeBucket[i % NODES_PER_BUCKET];
         
@@ -279,8 +392,6 @@ void NodeList::clear() {
         
         node = NULL;
     }
-    
-    _numNodes = 0;
 }
 
 void NodeList::reset() {
@@ -292,6 +403,13 @@ void NodeList::reset() {
     
     // refresh the owner UUID
     _ownerUUID = QUuid::createUuid();
+    
+    // session IDs are only good for the session they were handed out in
+    pthread_mutex_lock(&_sessionIDsMutex);
+    _sessionIDs.clear();
+    _sessionUUIDs.clear();
+    _lastSessionID = 0;
+    pthread_mutex_unlock(&_sessionIDsMutex);
 }
 
 void NodeList::setNodeTypesOfInterest(const char* nodeTypesOfInterest, int numNodeTypesOfInterest) {
@@ -621,16 +739,9 @@ void NodeList::pingPublicAndLocalSocketsForInactiveNode(Node* node) const {
 }
 
 Node* NodeList::addOrUpdateNode(const QUuid& uuid, char nodeType, sockaddr* publicSocket, sockaddr* localSocket) {
-    NodeList::iterator node = end();
+    Node* node = nodeWithUUID(uuid);
     
-    for (node = begin(); node != end(); node++) {
-        if (node->getUUID() == uuid) {
-            // we already have this node, stop checking
-            break;
-        }
-    }
-    
-    if (node == end()) {
+    if (!node) {
         // we didn't have this node, so add them
         Node* newNode = new Node(uuid, nodeType, publicSocket, localSocket);
         
@@ -648,40 +759,76 @@ Node* NodeList::addOrUpdateNode(const QUuid& uuid, char nodeType, sockaddr* publ
         }
         
         // check if we need to change this node's public or local sockets
-        if (!socketMatch(publicSocket, node->getPublicSocket())) {
-            node->setPublicSocket(publicSocket);
-            qDebug() << "Public socket change for node" << *node << "\n";
-        }
+        bool isPublicSocketChanged = !socketMatch(publicSocket, node->getPublicSocket());
+        bool isLocalSocketChanged = !socketMatch(localSocket, node->getLocalSocket());
         
-        if (!socketMatch(localSocket, node->getLocalSocket())) {
-            node->setLocalSocket(localSocket);
-            qDebug() << "Local socket change for node" << *node << "\n";
+        if (isPublicSocketChanged || isLocalSocketChanged) {
+            pthread_rwlock_wrlock(&_nodeIndexLock);
+            unindexNodeAddresses(node);
+            
+            if (isPublicSocketChanged) {
+                node->setPublicSocket(publicSocket);
+                qDebug() << "Public socket change for node" << *node << "\n";
+            }
+            
+            if (isLocalSocketChanged) {
+                node->setLocalSocket(localSocket);
+                qDebug() << "Local socket change for node" << *node << "\n";
+            }
+            
+            indexNodeAddresses(node);
+            pthread_rwlock_unlock(&_nodeIndexLock);
         }
         
         node->unlock();
         
         // we had this node already, do nothing for now
-        return &*node;
+        return node;
     }    
 }
 
 void NodeList::addNodeToList(Node* newNode) {
     // find the correct array to add this node to
-    int bucketIndex = _numNodes / NODES_PER_BUCKET;
+    int numNodes = _numNodes.load();
+    int bucketIndex = numNodes / NODES_PER_BUCKET;
     
     if (!_nodeBuckets[bucketIndex]) {
         _nodeBuckets[bucketIndex] = new Node*[NODES_PER_BUCKET]();
     }
     
-    _nodeBuckets[bucketIndex][_numNodes % NODES_PER_BUCKET] = newNode;
+    _nodeBuckets[bucketIndex][numNodes % NODES_PER_BUCKET] = newNode;
+    
+    // only let iterators see the node once it's in its bucket
+    _numNodes.storeRelease(numNodes + 1);
     
-    ++_numNodes;
+    pthread_rwlock_wrlock(&_nodeIndexLock);
+    _nodesByUUID.insert(newNode->getUUID(), newNode);
+    indexNodeAddresses(newNode);
+    pthread_rwlock_unlock(&_nodeIndexLock);
     
     qDebug() << "Added" << *newNode << "\n";
     
     notifyHooksOfAddedNode(newNode);
 }
 
+void NodeList::indexNodeAddresses(Node* node) {
+    if (node->getPublicSocket()) {
+        _nodesByAddress.insert(addressIndexKey(node->getPublicSocket()), node);
+    }
+    if (node->getLocalSocket() && !socketMatch(node->getLocalSocket(), node->getPublicSocket())) {
+        _nodesByAddress.insert(addressIndexKey(node->getLocalSocket()), node);
+    }
+}
+
+void NodeList::unindexNodeAddresses(Node* node) {
+    if (node->getPublicSocket()) {
+        _nodesByAddress.remove(addressIndexKey(node->getPublicSocket()), node);
+    }
+    if (node->getLocalSocket()) {
+        _nodesByAddress.remove(addressIndexKey(node->getLocalSocket()), node);
+    }
+}
+
 unsigned NodeList::broadcastToNodes(unsigned char* broadcastData, size_t dataBytes, const char* nodeTypes, int numNodeTypes) {
     unsigned n = 0;
     for(NodeList::iterator node = begin(); node != end(); node++) {
@@ -725,19 +872,24 @@ sockaddr* NodeList::getNodeActiveSocketOrPing(Node* node) {
 }
 
 void NodeList::activateSocketFromNodeCommunication(sockaddr *nodeAddress) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (!node->getActiveSocket()) {
+    quint64 key = addressIndexKey(nodeAddress);
+    
+    pthread_rwlock_rdlock(&_nodeIndexLock);
+    for (QMultiHash<quint64, Node*>::const_iterator node = _nodesByAddress.constFind(key);
+         node != _nodesByAddress.constEnd() && node.key() == key; ++node) {
+        if (!node.value()->getActiveSocket()) {
             // check both the public and local addresses for each node to see if we find a match
             // prioritize the private address so that we prune erroneous local matches
-            if (socketMatch(node->getPublicSocket(), nodeAddress)) {
-                node->activatePublicSocket();
+            if (socketMatch(node.value()->getPublicSocket(), nodeAddress)) {
+                node.value()->activatePublicSocket();
                 break;
-            } else if (socketMatch(node->getLocalSocket(), nodeAddress)) {
-                node->activateLocalSocket();
+            } else if (socketMatch(node.value()->getLocalSocket(), nodeAddress)) {
+                node.value()->activateLocalSocket();
                 break;
             }
         }
     }
+    pthread_rwlock_unlock(&_nodeIndexLock);
 }
 
 Node* NodeList::soloNodeOfType(char nodeType) {
@@ -757,17 +909,63 @@ void NodeList::killNode(Node* node, bool mustLockNode) {
         node->lock();
     }
     
-    qDebug() << "Killed " << *node << "\n";
-    
-    notifyHooksOfKilledNode(&*node);
-    
-    node->setAlive(false);
+    // someone else may have killed it while we waited for the lock
+    if (node->isAlive()) {
+        qDebug() << "Killed " << *node << "\n";
+        
+        notifyHooksOfKilledNode(&*node);
+        
+        node->setAlive(false);
+        
+        // a killed node can't be looked up, and if it comes back it's as a new node
+        pthread_rwlock_wrlock(&_nodeIndexLock);
+        if (_nodesByUUID.value(node->getUUID(), NULL) == node) {
+            _nodesByUUID.remove(node->getUUID());
+        }
+        unindexNodeAddresses(node);
+        
+        KilledNode killedNode;
+        killedNode.node = node;
+        killedNode.killedAt = usecTimestampNow();
+        _killedNodes.push_back(killedNode);
+        pthread_rwlock_unlock(&_nodeIndexLock);
+    }
     
     if (mustLockNode) {
         node->unlock();
     }
 }
 
+void NodeList::reclaimKilledNodes() {
+    uint64_t now = usecTimestampNow();
+    std::vector<Node*> reclaimedNodes;
+    
+    // no new handles can be taken to a node once it's out of the index, so a node with none stays that way
+    pthread_rwlock_wrlock(&_nodeIndexLock);
+    for (int i = 0; i < _killedNodes.size(); ) {
+        if (now - _killedNodes[i].killedAt >= KILLED_NODE_RECLAIM_USECS && _killedNodes[i].node->getHandleCount() == 0) {
+            reclaimedNodes.push_back(_killedNodes[i].node);
+            _killedNodes[i] = _killedNodes.back();
+            _killedNodes.pop_back();
+        } else {
+            i++;
+        }
+    }
+    pthread_rwlock_unlock(&_nodeIndexLock);
+    
+    // linked data can take a while to clean up, like a voxel sender waiting for its last send, so it's done unlocked
+    for (int i = 0; i < reclaimedNodes.size(); i++) {
+        reclaimedNodes[i]->lock();
+        NodeData* linkedData = reclaimedNodes[i]->getLinkedData();
+        reclaimedNodes[i]->setLinkedData(NULL);
+        reclaimedNodes[i]->unlock();
+        
+        if (linkedData) {
+            linkedData->deleteOrDeleteLater();
+        }
+    }
+}
+
 void* removeSilentNodes(void *args) {
     NodeList* nodeList = (NodeList*) args;
     uint64_t checkTimeUsecs = 0;
@@ -788,6 +986,8 @@ void* removeSilentNodes(void *args) {
             node->unlock();
         }
         
+        nodeList->reclaimKilledNodes();
+        
         sleepTime = NODE_SILENCE_THRESHOLD_USECS - (usecTimestampNow() - checkTimeUsecs);
         
         #ifdef _WIN32
@@ -860,7 +1060,8 @@ void NodeList::saveData(QSettings* settings) {
 NodeList::iterator NodeList::begin() const {
     Node** nodeBucket = NULL;
     
-    for (int i = 0; i < _numNodes; i++) {
+    int numNodes = _numNodes.loadAcquire();
+    for (int i = 0; i < numNodes; i++) {
         if (i % NODES_PER_BUCKET == 0) {
             nodeBucket =  _nodeBuckets[i / NODES_PER_BUCKET];
         }
@@ -875,7 +1076,7 @@ NodeList::iterator NodeList::begin() const {
 }
 
 NodeList::iterator NodeList::end() const {
-    return NodeListIterator(this, _numNodes);
+    return NodeListIterator(this, _numNodes.loadAcquire());
 }
 
 NodeListIterator::NodeListIterator(const NodeList* nodeList, int nodeIndex) :
@@ -919,10 +1120,11 @@ NodeList::iterator NodeListIterator::operator++(int) {
 }
 
 void NodeListIterator::skipDeadAndStopIncrement() {
-    while (_nodeIndex != _nodeList->_numNodes) {
+    int numNodes = _nodeList->_numNodes.loadAcquire();
+    while (_nodeIndex < numNodes) {
         ++_nodeIndex;
         
-        if (_nodeIndex == _nodeList->_numNodes) {
+        if (_nodeIndex == numNodes) {
             break;
         } else if ((*(*this)).isAlive()) {
             // skip over the dead nodes
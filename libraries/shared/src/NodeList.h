@@ -15,6 +15,9 @@
 #include <unistd.h>
 
 #include <QtNetwork/QHostAddress>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
+#include <QtCore/QMultiHash>
 #include <QtCore/QSettings>
 
 #include "Node.h"
@@ -31,6 +34,9 @@ const int NODES_PER_BUCKET = 100;
 const int MAX_PACKET_SIZE = 1500;
 
 const uint64_t NODE_SILENCE_THRESHOLD_USECS = 2 * 1000 * 1000;
+
+// how long a killed node's data is kept at least, for anyone who was using the node without a handle when it was killed
+const uint64_t KILLED_NODE_RECLAIM_USECS = NODE_SILENCE_THRESHOLD_USECS;
 const int DOMAIN_SERVER_CHECK_IN_USECS = 1 * 1000000;
 
 extern const char SOLO_NODE_TYPES[2];
@@ -44,6 +50,9 @@ const char LOCAL_ASSIGNMENT_SERVER_HOSTNAME[] = "localhost";
 
 const int MAX_SILENT_DOMAIN_SERVER_CHECK_INS = 5;
 
+// set on the session ID in an entry of bulk node data when the node's UUID follows it
+const quint16 SESSION_ID_HAS_UUID = 0x8000;
+
 class Assignment;
 class NodeListIterator;
 
@@ -91,7 +100,7 @@ public:
     
     void(*linkedDataCreateCallback)(Node *);
     
-    int size() { return _numNodes; }
+    int size() { return _numNodes.loadAcquire(); }
     int getNumAliveNodes() const;
     
     int getNumNoReplyDomainCheckIns() const { return _numNoReplyDomainCheckIns; }
@@ -109,14 +118,37 @@ public:
     
     void pingPublicAndLocalSocketsForInactiveNode(Node* node) const;
     
+    /// the alive node whose active socket is senderAddress, found through the index of node addresses
     Node* nodeWithAddress(sockaddr *senderAddress);
+    
+    /// the alive node with a UUID, found through the index of node UUIDs
     Node* nodeWithUUID(const QUuid& nodeUUID);
     
+    /// A handle to the alive node with a UUID, or a null handle if there isn't one. The node's linked data stays put for
+    /// as long as the handle is held, even if the node is killed in the meantime.
+    NodeHandle nodeHandleWithUUID(const QUuid& nodeUUID);
+    
     Node* addOrUpdateNode(const QUuid& uuid, char nodeType, sockaddr* publicSocket, sockaddr* localSocket);
+    /// Marks a node dead and takes it out of the indices. Its linked data is reclaimed later, by
+    /// reclaimKilledNodes(), once no handles to it are held.
     void killNode(Node* node, bool mustLockNode = true);
     
+    /// Deletes the linked data of nodes that were killed at least KILLED_NODE_RECLAIM_USECS ago and that no one holds a
+    /// handle to anymore. The silent node removal thread calls this after each pass.
+    void reclaimKilledNodes();
+    
     void processNodeData(sockaddr *senderAddress, unsigned char *packetData, size_t dataBytes);
     void processBulkNodeData(sockaddr *senderAddress, unsigned char *packetData, int numTotalBytes);
+    
+    /// Gives the node a short ID for this session, if it doesn't have one, for whoever sends bulk node data to use in
+    /// place of its UUID. Entries only need the UUID until the receiver has been told which node has the ID.
+    quint16 assignSessionID(const QUuid& nodeUUID);
+    
+    /// the session ID the node was given or we were told about, 0 if it has none
+    quint16 sessionIDForUUID(const QUuid& nodeUUID);
+    
+    /// the node with a session ID, a null UUID if we haven't been told about it
+    QUuid uuidForSessionID(quint16 sessionID);
    
     int updateNodeWithData(Node *node, sockaddr* senderAddress, unsigned char *packetData, int dataBytes);
     
@@ -150,16 +182,41 @@ private:
     NodeList(NodeList const&); // Don't implement, needed to avoid copies of singleton
     void operator=(NodeList const&); // Don't implement, needed to avoid copies of singleton
     
+    /// Appends a node to the buckets and adds it to the indices. Nodes are only ever added by one thread, and are
+    /// never removed while other threads are running, so iterating needs no lock: a node is in its bucket before
+    /// _numNodes is raised to include it.
     void addNodeToList(Node* newNode);
     
+    /// adds a node's public and local sockets to the address index, called with _nodeIndexLock held for writing
+    void indexNodeAddresses(Node* node);
+    
+    /// takes a node's public and local sockets out of the address index, called with _nodeIndexLock held for writing
+    void unindexNodeAddresses(Node* node);
+    
     void sendSTUNRequest();
     void processSTUNResponse(unsigned char* packetData, size_t dataBytes);
     
+    void setSessionID(quint16 sessionID, const QUuid& nodeUUID);
+    
     QString _domainHostname;
     QHostAddress _domainIP;
     unsigned short _domainPort;
     Node** _nodeBuckets[MAX_NUM_NODES / NODES_PER_BUCKET];
-    int _numNodes;
+    QAtomicInt _numNodes;
+    
+    // Lookups of alive nodes by UUID, and by public and local socket. Packets are looked up on every thread that reads
+    // them, while nodes are only added and killed now and then, so the indices are behind a read-write lock.
+    QHash<QUuid, Node*> _nodesByUUID;
+    QMultiHash<quint64, Node*> _nodesByAddress;
+    pthread_rwlock_t _nodeIndexLock;
+    
+    /// a killed node whose linked data hasn't been reclaimed yet
+    class KilledNode {
+    public:
+        Node* node;
+        uint64_t killedAt;
+    };
+    std::vector<KilledNode> _killedNodes; // behind _nodeIndexLock
     UDPSocket _nodeSocket;
     char _ownerType;
     char* _nodeTypesOfInterest;
@@ -172,6 +229,10 @@ private:
     uint16_t _publicPort;
     bool _hasCompletedInitialSTUNFailure;
     unsigned int _stunRequestsSinceSuccess;
+    QHash<QUuid, quint16> _sessionIDs;
+    QHash<quint16, QUuid> _sessionUUIDs;
+    quint16 _lastSessionID;
+    pthread_mutex_t _sessionIDsMutex;
     
     void activateSocketFromNodeCommunication(sockaddr *nodeAddress);
     void timePingReply(sockaddr *nodeAddress, unsigned char *packetData);
@@ -15,19 +15,22 @@
 
 #include "SharedUtil.h"
 #include "OctalCode.h"
+#include "OctalKey.h"
 
 int numberOfThreeBitSectionsInCode(const unsigned char* octalCode, int maxBytes) {
-    if (maxBytes == OVERFLOWED_OCTCODE_BUFFER) {
-        return OVERFLOWED_OCTCODE_BUFFER;
-    }
-
-    assert(octalCode);
-    if (*octalCode == 255) {
-        int newMaxBytes = (maxBytes == UNKNOWN_OCTCODE_LENGTH) ? UNKNOWN_OCTCODE_LENGTH : maxBytes - 1;
-        return *octalCode + numberOfThreeBitSectionsInCode(octalCode + 1, newMaxBytes);
-    } else {
-        return *octalCode;
+    // a length of 255 or more is a run of 255s followed by the rest of the length
+    int sections = 0;
+    while (maxBytes != OVERFLOWED_OCTCODE_BUFFER) {
+        assert(octalCode);
+        if (*octalCode != 255) {
+            return sections + *octalCode;
+        }
+        sections += *octalCode++;
+        if (maxBytes != UNKNOWN_OCTCODE_LENGTH) {
+            maxBytes--;
+        }
     }
+    return OVERFLOWED_OCTCODE_BUFFER;
 }
 
 void printOctalCode(const unsigned char* octalCode) {
@@ -55,7 +58,7 @@ int bytesRequiredForCodeLength(unsigned char threeBitCodes) {
     if (threeBitCodes == 0) {
         return 1;
     } else {
-        return 1 + (int)ceilf((threeBitCodes * 3) / 8.0f);
+        return 1 + (threeBitCodes * BITS_IN_OCTAL + BITS_IN_BYTE - 1) / BITS_IN_BYTE;
     }
 }
 
@@ -67,6 +70,15 @@ int branchIndexWithDescendant(const unsigned char* ancestorOctalCode, const unsi
 }
 
 unsigned char* childOctalCode(const unsigned char* parentOctalCode, char childNumber) {
+    int parentCodeSections = parentOctalCode != NULL
+        ? numberOfThreeBitSectionsInCode(parentOctalCode)
+        : 0;
+    unsigned char* newCode = new unsigned char[bytesRequiredForCodeLength(parentCodeSections + 1)];
+    copyChildOctalCode(parentOctalCode, childNumber, newCode);
+    return newCode;
+}
+
+int copyChildOctalCode(const unsigned char* parentOctalCode, char childNumber, unsigned char* output) {
     
     // find the length (in number of three bit code sequences)
     // in the parent
@@ -80,24 +92,21 @@ unsigned char* childOctalCode(const unsigned char* parentOctalCode, char childNu
     // child code will have one more section than the parent
     int childCodeBytes = bytesRequiredForCodeLength(parentCodeSections + 1);
     
-    // create a new buffer to hold the new octal code
-    unsigned char* newCode = new unsigned char[childCodeBytes];
-    
     // copy the parent code to the child
     if (parentOctalCode != NULL) {
-        memcpy(newCode, parentOctalCode, parentCodeBytes);
+        memcpy(output, parentOctalCode, parentCodeBytes);
     }    
     
     // the child octal code has one more set of three bits
-    *newCode = parentCodeSections + 1;
+    *output = parentCodeSections + 1;
     
     if (childCodeBytes > parentCodeBytes) {
         // we have a new byte due to the addition of the child code
         // so set it to zero for correct results when shifting later
-        newCode[childCodeBytes - 1] = 0;
+        output[childCodeBytes - 1] = 0;
     }
     
-    // add the child code bits to newCode
+    // add the child code bits to output
     
     // find the start bit index
     int startBit = parentCodeSections * 3;
@@ -110,17 +119,23 @@ unsigned char* childOctalCode(const unsigned char* parentOctalCode, char childNu
         // we have a wrap-around to accomodate
         // right shift for the end of first byte
         // left shift for beginning of the second
-        newCode[(startBit / 8) + 1] += childNumber >> (-1 * leftShift);
-        newCode[(startBit / 8) + 2] += childNumber << (8 + leftShift);
+        output[(startBit / 8) + 1] += childNumber >> (-1 * leftShift);
+        output[(startBit / 8) + 2] += childNumber << (8 + leftShift);
     } else {
         // no wraparound, left shift and add
-        newCode[(startBit / 8) + 1] += (childNumber << leftShift);
+        output[(startBit / 8) + 1] += (childNumber << leftShift);
     }
     
-    return newCode;
+    return childCodeBytes;
 }
 
 void voxelDetailsForCode(const unsigned char* octalCode, VoxelPositionSize& voxelPositionSize) {
+    OctalKey key;
+    if (OctalKey::fromOctalCode(octalCode, key)) {
+        key.getPositionSize(voxelPositionSize);
+        return;
+    }
+
     float output[3];
     memset(&output[0], 0, 3 * sizeof(float));
     float currentScale = 1.0;
@@ -144,6 +159,16 @@ void voxelDetailsForCode(const unsigned char* octalCode, VoxelPositionSize& voxe
 }
 
 void copyFirstVertexForCode(const unsigned char* octalCode, float* output) {
+    OctalKey key;
+    if (OctalKey::fromOctalCode(octalCode, key)) {
+        VoxelPositionSize details;
+        key.getPositionSize(details);
+        output[0] = details.x;
+        output[1] = details.y;
+        output[2] = details.z;
+        return;
+    }
+
     memset(output, 0, 3 * sizeof(float));
     
     float currentScale = 0.5;
@@ -287,6 +312,43 @@ unsigned char* rebaseOctalCode(const unsigned char* originalOctalCode, const uns
     return newCode;
 }
 
+// how many of the first sections of two codes are the same, comparing a byte at a time and looking no further than
+// maxSections, which neither code may be shorter than
+static int numberOfMatchingSections(const unsigned char* codeA, const unsigned char* codeB, int maxSections) {
+    int sectionBytes = (maxSections * BITS_IN_OCTAL + BITS_IN_BYTE - 1) / BITS_IN_BYTE;
+    for (int i = 0; i < sectionBytes; i++) {
+        unsigned char differences = codeA[1 + i] ^ codeB[1 + i];
+        if (differences) {
+            int firstDifferentBit = i * BITS_IN_BYTE;
+            while (!(differences & 0x80)) {
+                differences <<= 1;
+                firstDifferentBit++;
+            }
+            return std::min(firstDifferentBit / BITS_IN_OCTAL, maxSections);
+        }
+    }
+    return maxSections;
+}
+
+int numberOfSharedSections(const unsigned char* codeA, const unsigned char* codeB) {
+    int shortestCodeLength = std::min(numberOfThreeBitSectionsInCode(codeA), numberOfThreeBitSectionsInCode(codeB));
+    return numberOfMatchingSections(codeA, codeB, shortestCodeLength);
+}
+
+unsigned char* ancestorOctalCode(const unsigned char* octalCode, int ancestorLength) {
+    int ancestorBytes = bytesRequiredForCodeLength(ancestorLength);
+    unsigned char* newCode = new unsigned char[ancestorBytes];
+    memcpy(newCode, octalCode, ancestorBytes);
+    *newCode = ancestorLength; // set the length byte
+
+    // clear the bits past the last section
+    int usedBitsInLastByte = (ancestorLength * BITS_IN_OCTAL) % BITS_IN_BYTE;
+    if (usedBitsInLastByte) {
+        newCode[ancestorBytes - 1] &= 0xFF << (BITS_IN_BYTE - usedBitsInLastByte);
+    }
+    return newCode;
+}
+
 bool isAncestorOf(const unsigned char* possibleAncestor, const unsigned char* possibleDescendent, int descendentsChild) {
     if (!possibleAncestor || !possibleDescendent) {
         return false;
@@ -300,8 +362,11 @@ bool isAncestorOf(const unsigned char* possibleAncestor, const unsigned char* po
     int descendentCodeLength = numberOfThreeBitSectionsInCode(possibleDescendent);
     
     // if the caller also include a child, then our descendent length is actually one extra!
-    if (descendentsChild != CHECK_NODE_ONLY) {
-        descendentCodeLength++;
+    if (descendentsChild != CHECK_NODE_ONLY && ancestorCodeLength == descendentCodeLength + 1) {
+        // the ancestor's last section is the child's, the rest are the descendent's
+        int sharedSections = numberOfMatchingSections(possibleAncestor, possibleDescendent, descendentCodeLength);
+        return sharedSections == descendentCodeLength
+            && getOctalCodeSectionValue(possibleAncestor, descendentCodeLength) == descendentsChild;
     }
     
     if (ancestorCodeLength > descendentCodeLength) {
@@ -309,22 +374,7 @@ bool isAncestorOf(const unsigned char* possibleAncestor, const unsigned char* po
     }
 
     // compare the sections for the ancestor to the descendent
-    for (int section = 0; section < ancestorCodeLength; section++) {
-        char sectionValueAncestor = getOctalCodeSectionValue(possibleAncestor, section);
-        char sectionValueDescendent;
-        if (ancestorCodeLength <= descendentCodeLength) {
-            sectionValueDescendent = getOctalCodeSectionValue(possibleDescendent, section);
-        } else {
-            assert(descendentsChild != CHECK_NODE_ONLY);
-            sectionValueDescendent = descendentsChild;
-        }
-        if (sectionValueAncestor != sectionValueDescendent) {
-            return false; // first non-match, means they don't match
-        }
-    }
-    
-    // they all match, so we are an ancestor
-    return true;
+    return numberOfMatchingSections(possibleAncestor, possibleDescendent, ancestorCodeLength) == ancestorCodeLength;
 }
 
 unsigned char* hexStringToOctalCode(const QString& input) {
@@ -25,6 +25,10 @@ int bytesRequiredForCodeLength(unsigned char threeBitCodes);
 int branchIndexWithDescendant(const unsigned char* ancestorOctalCode, const unsigned char* descendantOctalCode);
 unsigned char* childOctalCode(const unsigned char* parentOctalCode, char childNumber);
 
+/// same as childOctalCode() but writes into output, which must have room for the child's code, instead of allocating
+/// \return int the number of bytes written
+int copyChildOctalCode(const unsigned char* parentOctalCode, char childNumber, unsigned char* output);
+
 const int OVERFLOWED_OCTCODE_BUFFER = -1;
 const int UNKNOWN_OCTCODE_LENGTH = -2;
 
@@ -37,6 +41,14 @@ unsigned char* chopOctalCode(const unsigned char* originalOctalCode, int chopLev
 unsigned char* rebaseOctalCode(const unsigned char* originalOctalCode, const unsigned char* newParentOctalCode, 
                                bool includeColorSpace = false);
 
+char getOctalCodeSectionValue(const unsigned char* octalCode, int section);
+
+/// returns how many leading sections the two codes have in common, which is the length of their deepest common ancestor
+int numberOfSharedSections(const unsigned char* codeA, const unsigned char* codeB);
+
+/// returns a new code for octalCode's ancestor with ancestorLength sections, the caller must delete[] it
+unsigned char* ancestorOctalCode(const unsigned char* octalCode, int ancestorLength);
+
 const int CHECK_NODE_ONLY = -1;
 bool isAncestorOf(const unsigned char* possibleAncestor, const unsigned char* possibleDescendent, 
         int descendentsChild = CHECK_NODE_ONLY);
@@ -0,0 +1,176 @@
+//
+//  OctalKey.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cassert>
+
+#include "OctalKey.h"
+
+const uint64_t ALL_BITS = ~(uint64_t) 0;
+
+static inline int leadingZeros(uint64_t bits) {
+#ifdef __GNUC__
+    return bits ? __builtin_clzll(bits) : 64;
+#else
+    int zeros = 0;
+    for (uint64_t bit = (uint64_t) 1 << 63; bit && !(bits & bit); bit >>= 1) {
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+// gathers every third bit, starting with the lowest, into the low 21 bits
+static inline uint64_t compactEveryThirdBit(uint64_t bits) {
+    bits &= 0x1249249249249249ULL;
+    bits = (bits ^ (bits >> 2)) & 0x10c30c30c30c30c3ULL;
+    bits = (bits ^ (bits >> 4)) & 0x100f00f00f00f00fULL;
+    bits = (bits ^ (bits >> 8)) & 0x001f0000ff0000ffULL;
+    bits = (bits ^ (bits >> 16)) & 0x001f00000000ffffULL;
+    bits = (bits ^ (bits >> 32)) & 0x00000000001fffffULL;
+    return bits;
+}
+
+uint64_t OctalKey::highSectionMask(int length) {
+    int sections = (length < HIGH_SECTIONS) ? length : HIGH_SECTIONS;
+    return ~(ALL_BITS >> (BITS_IN_OCTAL * sections));
+}
+
+uint64_t OctalKey::lowSectionMask(int length) {
+    int sections = (length > HIGH_SECTIONS) ? length - HIGH_SECTIONS : 0;
+    return ~(ALL_BITS >> (BITS_IN_OCTAL * sections)) & ~LENGTH_BITS;
+}
+
+bool OctalKey::fromOctalCode(const unsigned char* octalCode, OctalKey& key) {
+    if (!octalCode || *octalCode > MAX_OCTAL_KEY_SECTIONS) {
+        return false;
+    }
+    int length = *octalCode;
+
+    // read the sections as one big endian string of bits, the first 64 of them and then the rest
+    uint64_t first = 0;
+    uint64_t second = 0;
+    int sectionBytes = bytesRequiredForCodeLength(length) - 1;
+    int firstBytes = std::min(sectionBytes, (int) sizeof(uint64_t));
+    for (int i = 0; i < firstBytes; i++) {
+        first |= (uint64_t) octalCode[1 + i] << (56 - BITS_IN_BYTE * i);
+    }
+    for (int i = firstBytes; i < sectionBytes; i++) {
+        second |= (uint64_t) octalCode[1 + i] << (120 - BITS_IN_BYTE * i);
+    }
+
+    // the 64th bit of the string is the first bit of the 22nd section, which starts the second word
+    key._high = first & highSectionMask(length);
+    key._low = (((first << 63) | (second >> 1)) & lowSectionMask(length)) | length;
+    return true;
+}
+
+int OctalKey::toOctalCode(unsigned char* output) const {
+    int length = getLength();
+    uint64_t first = _high | (_low >> 63);
+    uint64_t second = (_low & ~LENGTH_BITS) << 1;
+
+    output[0] = length;
+    int sectionBytes = bytesRequiredForCodeLength(length) - 1;
+    int firstBytes = std::min(sectionBytes, (int) sizeof(uint64_t));
+    for (int i = 0; i < firstBytes; i++) {
+        output[1 + i] = first >> (56 - BITS_IN_BYTE * i);
+    }
+    for (int i = firstBytes; i < sectionBytes; i++) {
+        output[1 + i] = second >> (120 - BITS_IN_BYTE * i);
+    }
+    return sectionBytes + 1;
+}
+
+int OctalKey::getSectionValue(int section) const {
+    if (section < HIGH_SECTIONS) {
+        return (_high >> (61 - BITS_IN_OCTAL * section)) & 7;
+    }
+    return (_low >> (61 - BITS_IN_OCTAL * (section - HIGH_SECTIONS))) & 7;
+}
+
+OctalKey OctalKey::child(int childIndex) const {
+    int length = getLength();
+    assert(length < MAX_OCTAL_KEY_SECTIONS);
+
+    // all ones when the new section goes in the second word
+    uint64_t inLow = (uint64_t) 0 - (uint64_t) (length >= HIGH_SECTIONS);
+    int sectionInWord = length - (int) (HIGH_SECTIONS & inLow);
+    uint64_t section = (uint64_t) childIndex << (61 - BITS_IN_OCTAL * sectionInWord);
+
+    OctalKey result;
+    result._high = _high | (section & ~inLow);
+    result._low = (_low | (section & inLow)) + 1;
+    return result;
+}
+
+OctalKey OctalKey::ancestor(int ancestorLength) const {
+    OctalKey result;
+    result._high = _high & highSectionMask(ancestorLength);
+    result._low = (_low & lowSectionMask(ancestorLength)) | ancestorLength;
+    return result;
+}
+
+bool OctalKey::isAncestorOf(const OctalKey& possibleDescendent) const {
+    int length = getLength();
+    uint64_t differences = ((_high ^ possibleDescendent._high) & highSectionMask(length))
+        | ((_low ^ possibleDescendent._low) & lowSectionMask(length));
+    return length <= possibleDescendent.getLength() && !differences;
+}
+
+int OctalKey::sharedSections(const OctalKey& other) const {
+    uint64_t highDifferences = _high ^ other._high;
+    int shared;
+    if (highDifferences) {
+        shared = leadingZeros(highDifferences) / BITS_IN_OCTAL;
+    } else {
+        shared = HIGH_SECTIONS + leadingZeros((_low ^ other._low) & ~LENGTH_BITS) / BITS_IN_OCTAL;
+    }
+    int shortestLength = std::min(getLength(), other.getLength());
+    return std::min(shared, shortestLength);
+}
+
+OctalCodeComparison OctalKey::compare(const OctalKey& other) const {
+    int length = getLength();
+    int otherLength = other.getLength();
+    if (length != otherLength) {
+        return (length < otherLength) ? LESS_THAN : GREATER_THAN;
+    }
+    if (_high != other._high) {
+        return (_high < other._high) ? LESS_THAN : GREATER_THAN;
+    }
+    if (_low != other._low) {
+        return (_low < other._low) ? LESS_THAN : GREATER_THAN;
+    }
+    return EXACT_MATCH;
+}
+
+bool OctalKey::isBeforeInTree(const OctalKey& keyA, const OctalKey& keyB) {
+    // the bits past the last section are zero, so an ancestor's sections are never more than its descendants'
+    if (keyA._high != keyB._high) {
+        return keyA._high < keyB._high;
+    }
+    uint64_t lowA = keyA._low & ~LENGTH_BITS;
+    uint64_t lowB = keyB._low & ~LENGTH_BITS;
+    if (lowA != lowB) {
+        return lowA < lowB;
+    }
+    return keyA.getLength() < keyB.getLength();
+}
+
+void OctalKey::getPositionSize(VoxelPositionSize& voxelPositionSize) const {
+    // every section's x bit sits at a multiple of three once each word is moved down by three, y by two and z by one,
+    // so each axis is one compaction per word, the first word's sections worth 1/2^21 each and the second's 1/2^42
+    const double HIGH_SCALE = 1.0 / (double) ((uint64_t) 1 << HIGH_SECTIONS);
+    const double LOW_SCALE = HIGH_SCALE * HIGH_SCALE;
+    uint64_t low = _low & ~LENGTH_BITS;
+
+    voxelPositionSize.x = compactEveryThirdBit(_high >> 3) * HIGH_SCALE + compactEveryThirdBit(low >> 3) * LOW_SCALE;
+    voxelPositionSize.y = compactEveryThirdBit(_high >> 2) * HIGH_SCALE + compactEveryThirdBit(low >> 2) * LOW_SCALE;
+    voxelPositionSize.z = compactEveryThirdBit(_high >> 1) * HIGH_SCALE + compactEveryThirdBit(low >> 1) * LOW_SCALE;
+    voxelPositionSize.s = 1.0f / (float) ((uint64_t) 1 << getLength());
+}
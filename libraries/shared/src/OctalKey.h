@@ -0,0 +1,80 @@
+//
+//  OctalKey.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  An octal code packed into two 64-bit words instead of a length byte followed by a string of 3-bit sections, so it
+//  can be kept by value, and compared, descended and climbed with a few word operations instead of a loop over the
+//  sections and a new[] for every result.
+//
+//  The sections are stored first section first from the top bit down, 21 of them in the first word and 19 in the
+//  second, with the number of sections in the low seven bits of the second word. Each section keeps the x, y, z bit
+//  order of the byte strings, so every third bit of a word is the x, y or z half that voxel is in, and the bits past
+//  the last section are always zero. Codes deeper than MAX_OCTAL_KEY_SECTIONS don't fit, and stay byte strings.
+//
+
+#ifndef __hifi__OctalKey__
+#define __hifi__OctalKey__
+
+#include <stdint.h>
+
+#include "OctalCode.h"
+
+const int MAX_OCTAL_KEY_SECTIONS = 40;
+
+/// the most bytes toOctalCode() writes, for a MAX_OCTAL_KEY_SECTIONS deep code
+const int MAX_OCTAL_KEY_CODE_BYTES = 16;
+
+class OctalKey {
+public:
+    OctalKey() : _high(0), _low(0) { } // the root
+
+    /// \return bool false, leaving key alone, if the code is deeper than MAX_OCTAL_KEY_SECTIONS
+    static bool fromOctalCode(const unsigned char* octalCode, OctalKey& key);
+
+    /// writes the key out as a regular octal code, which takes bytesRequiredForCodeLength(getLength()) bytes
+    /// \return int the number of bytes written
+    int toOctalCode(unsigned char* output) const;
+
+    int getLength() const { return _low & LENGTH_BITS; }
+    int getSectionValue(int section) const;
+
+    /// the key one section deeper, the caller makes sure getLength() is less than MAX_OCTAL_KEY_SECTIONS
+    OctalKey child(int childIndex) const;
+
+    /// the key for the first ancestorLength sections, the caller makes sure ancestorLength is at most getLength()
+    OctalKey ancestor(int ancestorLength) const;
+
+    /// same as the byte string isAncestorOf(), a key counts as its own ancestor
+    bool isAncestorOf(const OctalKey& possibleDescendent) const;
+
+    /// how many leading sections the two keys have in common, which is the length of their deepest common ancestor
+    int sharedSections(const OctalKey& other) const;
+
+    /// orders keys the same way compareOctalCodes() orders their codes, shallower first
+    OctalCodeComparison compare(const OctalKey& other) const;
+
+    /// depth first tree order, where a key comes right before its descendants and children go in index order, so the
+    /// keys of a subtree sit together when sorted, led by the subtree's root
+    static bool isBeforeInTree(const OctalKey& keyA, const OctalKey& keyB);
+
+    bool operator==(const OctalKey& other) const { return _high == other._high && _low == other._low; }
+    bool operator!=(const OctalKey& other) const { return _high != other._high || _low != other._low; }
+
+    /// same results as voxelDetailsForCode()
+    void getPositionSize(VoxelPositionSize& voxelPositionSize) const;
+
+private:
+    static const int HIGH_SECTIONS = 21;
+    static const uint64_t LENGTH_BITS = 0x7F;
+
+    // the bits of the first length sections in each word, not counting the length bits
+    static uint64_t highSectionMask(int length);
+    static uint64_t lowSectionMask(int length);
+
+    uint64_t _high;
+    uint64_t _low;
+};
+
+#endif /* defined(__hifi__OctalKey__) */
@@ -17,10 +17,16 @@ PACKET_VERSION versionForPacketType(PACKET_TYPE type) {
 
         case PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO:
         case PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO:
-            return 2;
+            return 3;
+        
+        case PACKET_TYPE_MIXED_AUDIO:
+            return 1;
 
         case PACKET_TYPE_HEAD_DATA:
-            return 11;
+            return 12;
+        
+        case PACKET_TYPE_BULK_AVATAR_DATA:
+            return 1;
         
         case PACKET_TYPE_AVATAR_URLS:
             return 2;
@@ -29,7 +35,7 @@ PACKET_VERSION versionForPacketType(PACKET_TYPE type) {
             return 2;
 
         case PACKET_TYPE_VOXEL_STATS:
-            return 2;
+            return 4;
        
         case PACKET_TYPE_DOMAIN:
         case PACKET_TYPE_DOMAIN_LIST_REQUEST:
@@ -0,0 +1,83 @@
+//
+//  PacketQueue.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A fixed size, lock free queue of network packets that any number of threads can add to and one thread takes from.
+//
+
+#include "PacketQueue.h"
+
+// positions count up forever and wrap around, so do the math unsigned where wrapping is well defined
+static inline int nextPosition(int position, int count) {
+    return (int)((unsigned int)position + (unsigned int)count);
+}
+
+PacketQueue::PacketQueue(int capacity) :
+    _pushPosition(0),
+    _popPosition(0),
+    _releasePosition(0),
+    _droppedCount(0)
+{
+    // positions wrap around at 2^32, so the capacity has to divide that evenly for a position to always map to one slot
+    _capacity = 1;
+    while (_capacity < capacity) {
+        _capacity <<= 1;
+    }
+    _positionMask = _capacity - 1;
+
+    _slots = new Slot[_capacity];
+    for (int i = 0; i < _capacity; i++) {
+        _slots[i].sequence.store(i);
+    }
+}
+
+PacketQueue::~PacketQueue() {
+    delete[] _slots;
+}
+
+bool PacketQueue::push(const sockaddr& address, const unsigned char* packetData, ssize_t packetLength) {
+    // claim the next push position, unless the slot it maps to hasn't been popped since the last time around
+    int position = _pushPosition.load();
+    Slot* slot;
+    while (true) {
+        slot = &_slots[position & _positionMask];
+        int wait = (int)((unsigned int)slot->sequence.loadAcquire() - (unsigned int)position);
+        if (wait == 0) {
+            if (_pushPosition.testAndSetOrdered(position, nextPosition(position, 1))) {
+                break;
+            }
+            position = _pushPosition.load();
+        } else if (wait < 0) {
+            _droppedCount.ref();
+            return false;
+        } else {
+            // another producer got this position first
+            position = _pushPosition.load();
+        }
+    }
+
+    // the slot is ours alone until we publish it to the consumer
+    slot->packet.setContents(address, packetData, packetLength);
+    slot->sequence.storeRelease(nextPosition(position, 1));
+    return true;
+}
+
+NetworkPacket* PacketQueue::take() {
+    int position = _popPosition.load();
+    Slot* slot = &_slots[position & _positionMask];
+    if (slot->sequence.loadAcquire() != nextPosition(position, 1)) {
+        return NULL; // empty, or the producer that claimed this position is still copying its packet in
+    }
+    _popPosition.storeRelease(nextPosition(position, 1));
+    return &slot->packet;
+}
+
+void PacketQueue::release() {
+    Slot* slot = &_slots[_releasePosition & _positionMask];
+
+    // the slot is free for the push position one time around the ring from here
+    slot->sequence.storeRelease(nextPosition(_releasePosition, _capacity));
+    _releasePosition = nextPosition(_releasePosition, 1);
+}
@@ -0,0 +1,72 @@
+//
+//  PacketQueue.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A fixed size, lock free queue of network packets that any number of threads can add to and one thread takes from.
+//
+
+#ifndef __shared__PacketQueue__
+#define __shared__PacketQueue__
+
+#include <QAtomicInt>
+
+#include "NetworkPacket.h"
+
+const int DEFAULT_PACKET_QUEUE_CAPACITY = 1024; // about 1.5MB of packet buffers
+
+/// Bounded multi-producer, single-consumer queue of NetworkPackets. All of the packet buffers are allocated up front and
+/// reused, a queued packet is copied once into its buffer and then handed to the consumer in place. When the queue is
+/// full push() turns new packets away and counts them, it's up to the caller to drop them or keep them elsewhere.
+class PacketQueue {
+public:
+    /// \param int capacity the most packets the queue will hold, rounded up to a power of two
+    PacketQueue(int capacity = DEFAULT_PACKET_QUEUE_CAPACITY);
+    ~PacketQueue();
+
+    /// Copies a packet into the queue.
+    /// \return bool false if the queue was full and the packet wasn't queued
+    /// \thread any thread
+    bool push(const sockaddr& address, const unsigned char* packetData, ssize_t packetLength);
+
+    /// Takes the oldest packet out of the queue, or returns NULL if it's empty. The packet's buffer stays valid, and
+    /// isn't reused for new packets, until it's given back with release().
+    /// \thread the consuming thread only
+    NetworkPacket* take();
+
+    /// Gives the buffer of the oldest packet that was taken, and not yet released, back to the producers.
+    /// \thread the consuming thread only
+    void release();
+
+    /// how many packets are waiting to be taken, may include packets that are still being copied in
+    int size() const { return (int)((unsigned int)_pushPosition.load() - (unsigned int)_popPosition.load()); }
+    bool isEmpty() const { return size() <= 0; }
+
+    int getCapacity() const { return _capacity; }
+
+    /// the number of packets push() turned away because the queue was full
+    int getDroppedCount() const { return _droppedCount.load(); }
+
+private:
+    // not copyable
+    PacketQueue(const PacketQueue&);
+    PacketQueue& operator=(const PacketQueue&);
+
+    /// A slot's sequence is the push position it's free for, or that position + 1 once its packet has been pushed.
+    class Slot {
+    public:
+        QAtomicInt sequence;
+        NetworkPacket packet;
+    };
+
+    Slot* _slots;
+    int _capacity;
+    int _positionMask;
+    QAtomicInt _pushPosition;
+    QAtomicInt _popPosition;
+    int _releasePosition; // only touched by the consumer
+    QAtomicInt _droppedCount;
+};
+
+#endif // __shared__PacketQueue__
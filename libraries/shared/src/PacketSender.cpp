@@ -24,6 +24,8 @@ const int PacketSender::DEFAULT_PACKETS_PER_SECOND = 30;
 const int PacketSender::MINIMUM_PACKETS_PER_SECOND = 1;
 const int PacketSender::MINIMAL_SLEEP_INTERVAL = (USECS_PER_SECOND / TARGET_FPS) / 2;
 
+const int PacketSender::PACKET_QUEUE_CAPACITY = 64; // about 100KB of packet buffers
+
 const int AVERAGE_CALL_TIME_SAMPLES = 10;
 
 PacketSender::PacketSender(PacketSenderNotify* notify, int packetsPerSecond) : 
@@ -31,6 +33,9 @@ PacketSender::PacketSender(PacketSenderNotify* notify, int packetsPerSecond) :
     _usecsPerProcessCallHint(0),
     _lastProcessCallTime(0),
     _averageProcessCallTime(AVERAGE_CALL_TIME_SAMPLES),
+    _packets(NULL),
+    _hasPacketQueue(0),
+    _overflowCount(0),
     _lastSendTime(0), // Note: we set this to 0 to indicate we haven't yet sent something
     _notify(notify),
     _lastPPSCheck(0),
@@ -39,16 +44,44 @@ PacketSender::PacketSender(PacketSenderNotify* notify, int packetsPerSecond) :
     _totalPacketsSent(0),
     _totalBytesSent(0),
     _totalPacketsQueued(0),
-    _totalBytesQueued(0)
+    _totalBytesQueued(0),
+    _totalPacketsOverflowed(0)
 {
 }
 
+PacketSender::~PacketSender() {
+    delete _packets;
+}
+
+PacketQueue* PacketSender::getPacketQueue() {
+    if (!_hasPacketQueue.loadAcquire()) {
+        lock();
+        if (!_packets) {
+            _packets = new PacketQueue(PACKET_QUEUE_CAPACITY);
+            _hasPacketQueue.storeRelease(1);
+        }
+        unlock();
+    }
+    return _packets;
+}
+
+int PacketSender::packetsToSendCount() const {
+    int count = _overflowCount.load();
+    if (_hasPacketQueue.loadAcquire()) {
+        count += _packets->size();
+    }
+    return count;
+}
 
 void PacketSender::queuePacketForSending(sockaddr& address, unsigned char* packetData, ssize_t packetLength) {
-    NetworkPacket packet(address, packetData, packetLength);
-    lock();
-    _packets.push_back(packet);
-    unlock();
+    // once packets are waiting in the overflow list, the ones after them have to wait there too to stay in order
+    if (_overflowCount.load() > 0 || !getPacketQueue()->push(address, packetData, packetLength)) {
+        lock();
+        _overflowPackets.push_back(NetworkPacket(address, packetData, packetLength));
+        _overflowCount.ref();
+        _totalPacketsOverflowed++;
+        unlock();
+    }
     _totalPacketsQueued++;
     _totalBytesQueued += packetLength;
 }
@@ -69,7 +102,7 @@ bool PacketSender::threadedProcess() {
     }
     
     // in threaded mode, we keep running and just empty our packet queue sleeping enough to keep our PPS on target
-    while (_packets.size() > 0) {
+    while (hasPacketsToSend()) {
         // Recalculate our SEND_INTERVAL_USECS each time, in case the caller has changed it on us..
         int packetsPerSecondTarget = (_packetsPerSecond > MINIMUM_PACKETS_PER_SECOND) 
                                             ? _packetsPerSecond : MINIMUM_PACKETS_PER_SECOND;
@@ -136,7 +169,7 @@ bool PacketSender::nonThreadedProcess() {
     
     bool wantDebugging = false;
     if (wantDebugging) {
-        printf("\n\nPacketSender::nonThreadedProcess() _packets.size()=%ld\n",_packets.size());
+        printf("\n\nPacketSender::nonThreadedProcess() packetsToSendCount()=%d\n", packetsToSendCount());
     }
     
     // keep track of our process call times, so we have a reliable account of how often our caller calls us
@@ -166,7 +199,7 @@ bool PacketSender::nonThreadedProcess() {
         printf("elapsedSinceLastCall=%llu averageCallTime=%f\n",elapsedSinceLastCall, averageCallTime);
     }
     
-    if (_packets.size() == 0) {
+    if (!hasPacketsToSend()) {
         // in non-threaded mode, if there's nothing to do, just return, keep running till they terminate us
         return isStillRunning(); 
     }
@@ -317,7 +350,7 @@ bool PacketSender::nonThreadedProcess() {
         }
     }
     
-    int packetsLeft = _packets.size();
+    int packetsLeft = packetsToSendCount();
 
     if (wantDebugging) {
         printf("packetsSentThisCall=%d packetsToSendThisCall=%d packetsLeft=%d\n",
@@ -326,28 +359,48 @@ bool PacketSender::nonThreadedProcess() {
     
     // Now that we know how many packets to send this call to process, just send them.
     while ((packetsSentThisCall < packetsToSendThisCall) && (packetsLeft > 0)) {
-        lock();
-        NetworkPacket& packet = _packets.front();
-        NetworkPacket temporary = packet; // make a copy
-        _packets.erase(_packets.begin());
-        packetsLeft = _packets.size();
-        unlock();
+        // the overflow list is only sent from once the queue is empty, it has the newer packets
+        NetworkPacket* packet = NULL;
+        bool isOverflowPacket = false;
+        if (_hasPacketQueue.loadAcquire()) {
+            packet = _packets->take();
+        }
+        if (!packet && _overflowCount.load() > 0 && (!_hasPacketQueue.loadAcquire() || _packets->isEmpty())) {
+            // only we pop the list, so its front stays put while other threads add to the back
+            lock();
+            packet = &_overflowPackets.front();
+            unlock();
+            isOverflowPacket = true;
+        }
+        if (!packet) {
+            break; // the packet we counted is still being queued
+        }
+        ssize_t packetLength = packet->getLength();
 
-        // send the packet through the NodeList...
+        // send the packet through the NodeList, straight from the queue's buffer
         UDPSocket* nodeSocket = NodeList::getInstance()->getNodeSocket();
 
-        nodeSocket->send(&temporary.getAddress(), temporary.getData(), temporary.getLength());
+        nodeSocket->send(&packet->getAddress(), packet->getData(), packetLength);
+        if (isOverflowPacket) {
+            lock();
+            _overflowPackets.pop_front();
+            _overflowCount.deref();
+            unlock();
+        } else {
+            _packets->release();
+        }
+        packetsLeft = packetsToSendCount();
         packetsSentThisCall++;
         _packetsOverCheckInterval++;
         _totalPacketsSent++;
-        _totalBytesSent += temporary.getLength();
+        _totalBytesSent += packetLength;
 
         if (wantDebugging) {
             printf("nodeSocket->send()... packetsSentThisCall=%d _packetsOverCheckInterval=%d\n",
                 packetsSentThisCall, _packetsOverCheckInterval);
         }
         if (_notify) {
-            _notify->packetSentNotification(temporary.getLength());
+            _notify->packetSentNotification(packetLength);
         }
         _lastSendTime = now;
     }
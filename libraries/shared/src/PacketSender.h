@@ -11,8 +11,13 @@
 #ifndef __shared__PacketSender__
 #define __shared__PacketSender__
 
+#include <deque>
+
+#include <QAtomicInt>
+
 #include "GenericThread.h"
 #include "NetworkPacket.h"
+#include "PacketQueue.h"
 #include "SharedUtil.h"
 
 /// Notification Hook for packets being sent by a PacketSender
@@ -35,9 +40,13 @@ public:
     static const int MINIMUM_PACKETS_PER_SECOND;
     static const int MINIMAL_SLEEP_INTERVAL;
 
+    static const int PACKET_QUEUE_CAPACITY;
+
     PacketSender(PacketSenderNotify* notify = NULL, int packetsPerSecond = DEFAULT_PACKETS_PER_SECOND);
+    virtual ~PacketSender();
 
-    /// Add packet to outbound queue.
+    /// Add packet to outbound queue. Packets are never dropped, once the lock free queue is full they wait in an
+    /// overflow list until it's been sent.
     /// \param sockaddr& address the destination address
     /// \param packetData pointer to data
     /// \param ssize_t packetLength size of data
@@ -54,10 +63,13 @@ public:
     virtual bool process();
 
     /// are there packets waiting in the send queue to be sent
-    bool hasPacketsToSend() const { return _packets.size() > 0; }
+    bool hasPacketsToSend() const { return packetsToSendCount() > 0; }
 
     /// how many packets are there in the send queue waiting to be sent
-    int packetsToSendCount() const { return _packets.size(); }
+    int packetsToSendCount() const;
+
+    /// the most packets that can be waiting in the lock free send queue, past that they wait in the overflow list
+    int getMaxPacketsToSend() const { return PACKET_QUEUE_CAPACITY; }
 
     /// If you're running in non-threaded mode, call this to give us a hint as to how frequently you will call process.
     /// This has no effect in threaded mode. This is only considered a hint in non-threaded mode.
@@ -98,6 +110,9 @@ public:
     /// returns the total bytes queued by this object over its lifetime
     uint64_t getLifetimeBytesQueued() const { return _totalBytesQueued; }
 
+    /// returns the total packets that had to wait in the overflow list over the lifetime of this object
+    uint64_t getLifetimePacketsOverflowed() const { return _totalPacketsOverflowed; }
+
 protected:
     int _packetsPerSecond;
     int _usecsPerProcessCallHint;
@@ -105,7 +120,12 @@ protected:
     SimpleMovingAverage _averageProcessCallTime;
     
 private:
-    std::vector<NetworkPacket> _packets;
+    PacketQueue* getPacketQueue();
+
+    PacketQueue* _packets; // created by the first packet queued, so that senders that never send don't pay for it
+    QAtomicInt _hasPacketQueue;
+    std::deque<NetworkPacket> _overflowPackets; // everything in here is newer than what's in _packets, under lock()
+    QAtomicInt _overflowCount;
     uint64_t _lastSendTime;
     PacketSenderNotify* _notify;
 
@@ -121,6 +141,7 @@ private:
 
     uint64_t _totalPacketsQueued;
     uint64_t _totalBytesQueued;
+    uint64_t _totalPacketsOverflowed;
 };
 
 #endif // __shared__PacketSender__
@@ -0,0 +1,168 @@
+//
+//  ParallelJobs.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "ParallelJobs.h"
+
+class ParallelJobBatch {
+public:
+    ParallelJob job;
+    int jobCount;
+    void* extraData;
+    int nextJob;
+    pthread_mutex_t nextJobLock;
+};
+
+static void* runJobsFromBatch(void* arg) {
+    ParallelJobBatch* batch = (ParallelJobBatch*)arg;
+    while (true) {
+        pthread_mutex_lock(&batch->nextJobLock);
+        int jobIndex = batch->nextJob++;
+        pthread_mutex_unlock(&batch->nextJobLock);
+
+        if (jobIndex >= batch->jobCount) {
+            return NULL;
+        }
+        batch->job(jobIndex, batch->extraData);
+    }
+}
+
+void runParallelJobs(ParallelJob job, int jobCount, int threadCount, void* extraData) {
+    if (threadCount <= 0) {
+        threadCount = getProcessorCount();
+    }
+    if (threadCount > jobCount) {
+        threadCount = jobCount;
+    }
+
+    ParallelJobBatch batch;
+    batch.job = job;
+    batch.jobCount = jobCount;
+    batch.extraData = extraData;
+    batch.nextJob = 0;
+    pthread_mutex_init(&batch.nextJobLock, NULL);
+
+    // if a thread can't be started, the ones we do have (at least this one) just run more of the jobs
+    std::vector<pthread_t> threads;
+    for (int i = 1; i < threadCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, runJobsFromBatch, &batch) == 0) {
+            threads.push_back(thread);
+        }
+    }
+    runJobsFromBatch(&batch);
+    for (int i = 0; i < threads.size(); i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&batch.nextJobLock);
+}
+
+int getProcessorCount() {
+#ifdef _WIN32
+    return 1;
+#else
+    int processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+    return (processorCount > 0) ? processorCount : 1;
+#endif
+}
+
+ParallelJobPool::ParallelJobPool(int threadCount) :
+    _job(NULL),
+    _jobCount(0),
+    _extraData(NULL),
+    _nextJob(0),
+    _finishedJobs(0),
+    _batchNumber(0),
+    _stopping(false)
+{
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_batchStarted, NULL);
+    pthread_cond_init(&_batchFinished, NULL);
+
+    if (threadCount <= 0) {
+        threadCount = getProcessorCount();
+    }
+    // the thread that calls run() is one of them, and if a thread can't be started the others just run more of the jobs
+    for (int i = 1; i < threadCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, poolThreadEntry, this) == 0) {
+            _threads.push_back(thread);
+        }
+    }
+}
+
+ParallelJobPool::~ParallelJobPool() {
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_batchStarted);
+    pthread_mutex_unlock(&_mutex);
+
+    for (int i = 0; i < _threads.size(); i++) {
+        pthread_join(_threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&_batchFinished);
+    pthread_cond_destroy(&_batchStarted);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void* ParallelJobPool::poolThreadEntry(void* pool) {
+    ParallelJobPool* jobPool = (ParallelJobPool*)pool;
+    pthread_mutex_lock(&jobPool->_mutex);
+    int lastBatchNumber = 0;
+    while (true) {
+        while (!jobPool->_stopping && jobPool->_batchNumber == lastBatchNumber) {
+            pthread_cond_wait(&jobPool->_batchStarted, &jobPool->_mutex);
+        }
+        if (jobPool->_stopping) {
+            break;
+        }
+        lastBatchNumber = jobPool->_batchNumber;
+        jobPool->runBatchJobs();
+    }
+    pthread_mutex_unlock(&jobPool->_mutex);
+    return NULL;
+}
+
+void ParallelJobPool::runBatchJobs() {
+    while (_nextJob < _jobCount) {
+        int jobIndex = _nextJob++;
+        ParallelJob job = _job;
+        void* extraData = _extraData;
+        pthread_mutex_unlock(&_mutex);
+        job(jobIndex, extraData);
+        pthread_mutex_lock(&_mutex);
+
+        if (++_finishedJobs == _jobCount) {
+            pthread_cond_signal(&_batchFinished);
+        }
+    }
+}
+
+void ParallelJobPool::run(ParallelJob job, int jobCount, void* extraData) {
+    if (jobCount <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&_mutex);
+    _job = job;
+    _jobCount = jobCount;
+    _extraData = extraData;
+    _nextJob = 0;
+    _finishedJobs = 0;
+    _batchNumber++;
+    pthread_cond_broadcast(&_batchStarted);
+
+    runBatchJobs();
+    while (_finishedJobs < _jobCount) {
+        pthread_cond_wait(&_batchFinished, &_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
@@ -0,0 +1,66 @@
+//
+//  ParallelJobs.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Runs batches of independent jobs on a handful of threads. runParallelJobs() starts its threads for each batch, for
+//  work like loading and saving whole voxel trees that's done rarely but is worth spreading over every core when it is.
+//  A ParallelJobPool keeps its threads around, for work that's split up again and again, like every audio frame.
+//
+
+#ifndef __shared__ParallelJobs__
+#define __shared__ParallelJobs__
+
+#include <pthread.h>
+#include <vector>
+
+/// A job gets its number, from 0 to the number of jobs - 1, and the extraData the batch was run with
+typedef void (*ParallelJob)(int jobIndex, void* extraData);
+
+/// Runs jobs 0 to jobCount - 1 on up to threadCount threads, the calling thread being one of them, and returns once
+/// they've all finished. Jobs are started in order, so with a threadCount of 1 they run one after another on this thread.
+/// A threadCount of 0 or less means one thread per core.
+void runParallelJobs(ParallelJob job, int jobCount, int threadCount, void* extraData);
+
+/// the number of cores we'd run on, at least 1
+int getProcessorCount();
+
+/// A fixed set of threads waiting to run batches of jobs
+class ParallelJobPool {
+public:
+    /// \param int threadCount how many threads run each batch, counting the one that calls run(). 0 or less means one
+    /// thread per core.
+    ParallelJobPool(int threadCount = 0);
+    ~ParallelJobPool();
+
+    int getThreadCount() const { return _threads.size() + 1; }
+
+    /// Runs jobs 0 to jobCount - 1 on the pool's threads and the calling thread, and returns once they've all finished.
+    /// Jobs are started in order. Only one thread at a time should run batches on a pool.
+    void run(ParallelJob job, int jobCount, void* extraData);
+
+private:
+    // not copyable
+    ParallelJobPool(const ParallelJobPool&);
+    ParallelJobPool& operator=(const ParallelJobPool&);
+
+    static void* poolThreadEntry(void* pool);
+
+    /// runs jobs from the current batch until there are none left to start, called and returns with _mutex held
+    void runBatchJobs();
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _batchStarted;
+    pthread_cond_t _batchFinished;
+    ParallelJob _job;
+    int _jobCount;
+    void* _extraData;
+    int _nextJob;
+    int _finishedJobs;
+    int _batchNumber;
+    bool _stopping;
+    std::vector<pthread_t> _threads;
+};
+
+#endif // __shared__ParallelJobs__
@@ -23,28 +23,22 @@ void ReceivedPacketProcessor::queueReceivedPacket(sockaddr& address, unsigned ch
         node->setLastHeardMicrostamp(usecTimestampNow());
     }
 
-    NetworkPacket packet(address, packetData, packetLength);
-    lock();
-    _packets.push_back(packet);
-    unlock();
+    _packets.push(address, packetData, packetLength);
 }
 
 bool ReceivedPacketProcessor::process() {
 
     // If a derived class handles process sleeping, like the JurisdiciontListener, then it can set
     // this _dontSleep member and we will honor that request.
-    if (_packets.size() == 0 && !_dontSleep) {
+    if (_packets.isEmpty() && !_dontSleep) {
         const uint64_t RECEIVED_THREAD_SLEEP_INTERVAL = (1000 * 1000)/60; // check at 60fps
         usleep(RECEIVED_THREAD_SLEEP_INTERVAL);
     }
-    while (_packets.size() > 0) {
-
-        lock(); // lock to make sure nothing changes on us
-        NetworkPacket& packet = _packets.front(); // get the oldest packet
-        NetworkPacket temporary = packet; // make a copy of the packet in case the vector is resized on us
-        _packets.erase(_packets.begin()); // remove the oldest packet
-        unlock(); // let others add to the packets
-        processPacket(temporary.getAddress(), temporary.getData(), temporary.getLength()); // process our temporary copy
+    NetworkPacket* packet;
+    while ((packet = _packets.take())) {
+        // process the oldest packet right where it sits in the queue's buffers, then give its buffer back
+        processPacket(packet->getAddress(), packet->getData(), packet->getLength());
+        _packets.release();
     }
     return isStillRunning();  // keep running till they terminate us
 }
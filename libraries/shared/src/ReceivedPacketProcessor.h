@@ -13,13 +13,14 @@
 
 #include "GenericThread.h"
 #include "NetworkPacket.h"
+#include "PacketQueue.h"
 
 /// Generalized threaded processor for handling received inbound packets. 
 class ReceivedPacketProcessor : public virtual GenericThread {
 public:
     ReceivedPacketProcessor();
 
-    /// Add packet from network receive thread to the processing queue.
+    /// Add packet from network receive thread to the processing queue. If the queue is full the packet is dropped.
     /// \param sockaddr& senderAddress the address of the sender
     /// \param packetData pointer to received data
     /// \param ssize_t packetLength size of received data
@@ -27,13 +28,20 @@ public:
     void queueReceivedPacket(sockaddr& senderAddress, unsigned char*  packetData, ssize_t packetLength);
 
     /// Are there received packets waiting to be processed
-    bool hasPacketsToProcess() const { return _packets.size() > 0; }
+    bool hasPacketsToProcess() const { return !_packets.isEmpty(); }
 
     /// How many received packets waiting are to be processed
     int packetsToProcessCount() const { return _packets.size(); }
 
+    /// The most received packets that can be waiting to be processed
+    int getMaxPacketsToProcess() const { return _packets.getCapacity(); }
+
+    /// How many received packets were dropped because the processing queue was full
+    int getReceivedPacketsDropped() const { return _packets.getDroppedCount(); }
+
 protected:
-    /// Callback for processing of recieved packets. Implement this to process the incoming packets.
+    /// Callback for processing of recieved packets. Implement this to process the incoming packets. The packet data is
+    /// only valid until this returns, copy anything that needs to be kept.
     /// \param sockaddr& senderAddress the address of the sender
     /// \param packetData pointer to received data
     /// \param ssize_t packetLength size of received data
@@ -47,7 +55,7 @@ protected:
 
 private:
 
-    std::vector<NetworkPacket> _packets;
+    PacketQueue _packets;
 };
 
 #endif // __shared__PacketReceiver__
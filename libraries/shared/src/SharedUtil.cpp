@@ -18,6 +18,11 @@
 
 #ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
+#include <mach/mach.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/resource.h>
 #endif
 
 #include <QtCore/QDebug>
@@ -140,6 +145,50 @@ bool isBetween(int64_t value, int64_t max, int64_t min) {
 
 
 
+uint64_t getResidentSetSize() {
+#ifdef _WIN32
+    return 0;
+#else
+#ifdef __APPLE__
+    mach_task_basic_info_data_t taskInfo;
+    mach_msg_type_number_t infoCount = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&taskInfo, &infoCount) == KERN_SUCCESS) {
+        return taskInfo.resident_size;
+    }
+#endif
+#ifdef __linux__
+    // second field of statm is the resident set size in pages
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        unsigned long totalPages = 0;
+        unsigned long residentPages = 0;
+        int fieldsRead = fscanf(statm, "%lu %lu", &totalPages, &residentPages);
+        fclose(statm);
+        if (fieldsRead == 2) {
+            return (uint64_t)residentPages * sysconf(_SC_PAGESIZE);
+        }
+    }
+#endif
+    return getPeakResidentSetSize();
+#endif
+}
+
+uint64_t getPeakResidentSetSize() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss; // already in bytes on OS X
+#else
+    return (uint64_t)usage.ru_maxrss * 1024; // in kilobytes everywhere else
+#endif
+#endif
+}
+
 void setSemiNibbleAt(unsigned char& byte, int bitIndex, int value) {
     //assert(value <= 3 && value >= 0);
     byte += ((value & 3) << (6 - bitIndex)); // semi-nibbles store 00, 01, 10, or 11
@@ -608,6 +657,57 @@ int unpackOrientationQuatFromBytes(unsigned char* buffer, glm::quat& quatOutput)
     return sizeof(quatParts);
 }
 
+const int SMALLEST_THREE_COMPONENT_BITS = 10;
+const int SMALLEST_THREE_COMPONENT_MAX = (1 << SMALLEST_THREE_COMPONENT_BITS) - 1;
+const float SMALLEST_THREE_COMPONENT_RANGE = 0.70710678f;
+
+int packOrientationQuatToSmallestThree(unsigned char* buffer, const glm::quat& quatInput) {
+    float components[4] = { quatInput.x, quatInput.y, quatInput.z, quatInput.w };
+    int largest = 0;
+    for (int i = 1; i < 4; i++) {
+        if (fabsf(components[i]) > fabsf(components[largest])) {
+            largest = i;
+        }
+    }
+    // q and -q are the same rotation, so flip the quat if need be to make the one we leave out positive
+    float sign = (components[largest] < 0.0f) ? -1.0f : 1.0f;
+    
+    uint32_t packed = largest;
+    for (int i = 0; i < 4; i++) {
+        if (i != largest) {
+            float ratio = (sign * components[i] / SMALLEST_THREE_COMPONENT_RANGE + 1.0f) * 0.5f;
+            int quantized = (int) roundf(ratio * SMALLEST_THREE_COMPONENT_MAX);
+            packed = (packed << SMALLEST_THREE_COMPONENT_BITS)
+                | std::max(0, std::min(SMALLEST_THREE_COMPONENT_MAX, quantized));
+        }
+    }
+    memcpy(buffer, &packed, sizeof(packed));
+    return sizeof(packed);
+}
+
+int unpackOrientationQuatFromSmallestThree(unsigned char* buffer, glm::quat& quatOutput) {
+    uint32_t packed;
+    memcpy(&packed, buffer, sizeof(packed));
+    
+    int largest = packed >> (SMALLEST_THREE_COMPONENT_BITS * 3);
+    float components[4];
+    float sumOfSquares = 0.0f;
+    int shift = SMALLEST_THREE_COMPONENT_BITS * 2;
+    for (int i = 0; i < 4; i++) {
+        if (i != largest) {
+            int quantized = (packed >> shift) & SMALLEST_THREE_COMPONENT_MAX;
+            components[i] = ((float) quantized / SMALLEST_THREE_COMPONENT_MAX * 2.0f - 1.0f)
+                * SMALLEST_THREE_COMPONENT_RANGE;
+            sumOfSquares += components[i] * components[i];
+            shift -= SMALLEST_THREE_COMPONENT_BITS;
+        }
+    }
+    components[largest] = sqrtf(std::max(0.0f, 1.0f - sumOfSquares));
+    
+    quatOutput = glm::quat(components[3], components[0], components[1], components[2]);
+    return sizeof(packed);
+}
+
 float SMALL_LIMIT = 10.0;
 float LARGE_LIMIT = 1000.0;
 
@@ -116,6 +116,13 @@ public:
 
 bool isBetween(int64_t value, int64_t max, int64_t min);
 
+/// returns the resident set size of this process in bytes, or the peak resident set size on platforms where the
+/// current size isn't easily available, returns 0 if unknown
+uint64_t getResidentSetSize();
+
+/// returns the largest resident set size this process has had in bytes, returns 0 if unknown
+uint64_t getPeakResidentSetSize();
+
 
 // These pack/unpack functions are designed to start specific known types in as efficient a manner
 // as possible. Taking advantage of the known characteristics of the semantic types.
@@ -129,6 +136,11 @@ int unpackFloatAngleFromTwoByte(uint16_t* byteAnglePointer, float* destinationPo
 int packOrientationQuatToBytes(unsigned char* buffer, const glm::quat& quatInput);
 int unpackOrientationQuatFromBytes(unsigned char* buffer, glm::quat& quatOutput);
 
+// The largest component of a normalized quat can be worked out from the other three, which are all within
+// +/- 1/sqrt(2), so this sends those three in 10 bits each and which one was left out in the other 2, in 32bits
+int packOrientationQuatToSmallestThree(unsigned char* buffer, const glm::quat& quatInput);
+int unpackOrientationQuatFromSmallestThree(unsigned char* buffer, glm::quat& quatOutput);
+
 // Ratios need the be highly accurate when less than 10, but not very accurate above 10, and they
 // are never greater than 1000 to 1, this allows us to encode each component in 16bits
 int packFloatRatioToTwoByte(unsigned char* buffer, float ratio);
@@ -6,6 +6,7 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cstdio>
 #include <errno.h>
@@ -28,6 +29,11 @@
 #include "Logging.h"
 #include "UDPSocket.h"
 
+// linux can send and receive a whole batch of datagrams in one system call
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_UDP_MMSG
+#endif
+
 sockaddr_in destSockaddr, senderAddress;
 
 bool socketMatch(const sockaddr* first, const sockaddr* second) {
@@ -291,3 +297,124 @@ int UDPSocket::send(const char* destAddress, int destPort, const void* data, siz
     
     return send((sockaddr *)&destSockaddr, data, byteLength);
 }
+
+#ifdef HAVE_UDP_MMSG
+static void prepareBatchMessages(const UDPDatagram* datagrams, int datagramCount, size_t dataLength,
+                                 mmsghdr* messages, iovec* vectors) {
+    memset(messages, 0, sizeof(mmsghdr) * datagramCount);
+    for (int i = 0; i < datagramCount; i++) {
+        vectors[i].iov_base = datagrams[i].data;
+        vectors[i].iov_len = dataLength ? dataLength : datagrams[i].length;
+        messages[i].msg_hdr.msg_name = (void*) &datagrams[i].address;
+        messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+#endif
+
+int UDPSocket::sendBatch(const UDPDatagram* datagrams, int datagramCount) const {
+    int sentCount = 0;
+#ifdef HAVE_UDP_MMSG
+    mmsghdr messages[MAX_PACKETS_PER_BATCH];
+    iovec vectors[MAX_PACKETS_PER_BATCH];
+    int next = 0;
+    while (next < datagramCount) {
+        int messageCount = std::min(datagramCount - next, MAX_PACKETS_PER_BATCH);
+        prepareBatchMessages(datagrams + next, messageCount, 0, messages, vectors);
+
+        int sent = sendmmsg(handle, messages, messageCount, 0);
+        if (sent > 0) {
+            sentCount += sent;
+            next += sent;
+        } else if (errno != EINTR) {
+            // like send(), skip the packet that failed and carry on with the rest
+            qDebug("Failed to send packet: %s\n", strerror(errno));
+            next++;
+        }
+    }
+#else
+    for (int i = 0; i < datagramCount; i++) {
+        if (send((sockaddr*) &datagrams[i].address, datagrams[i].data, datagrams[i].length) == datagrams[i].length) {
+            sentCount++;
+        }
+    }
+#endif
+    return sentCount;
+}
+
+int UDPSocket::receiveBatch(UDPDatagram* datagrams, int maxDatagrams) const {
+#ifdef HAVE_UDP_MMSG
+    mmsghdr messages[MAX_PACKETS_PER_BATCH];
+    iovec vectors[MAX_PACKETS_PER_BATCH];
+    int messageCount = std::min(maxDatagrams, MAX_PACKETS_PER_BATCH);
+    prepareBatchMessages(datagrams, messageCount, MAX_BUFFER_LENGTH_BYTES, messages, vectors);
+
+    // only wait for the first datagram, then take whatever else is already here
+    int receivedCount = recvmmsg(handle, messages, messageCount, MSG_WAITFORONE, NULL);
+    if (receivedCount <= 0) {
+        return 0;
+    }
+    for (int i = 0; i < receivedCount; i++) {
+        datagrams[i].length = messages[i].msg_len;
+    }
+    return receivedCount;
+#else
+    // without a way to not wait for each datagram, a blocking socket only gets one at a time
+    int receivedCount = 0;
+    while (receivedCount < maxDatagrams && (receivedCount == 0 || !blocking)
+           && receive(&datagrams[receivedCount].address, datagrams[receivedCount].data, &datagrams[receivedCount].length)) {
+        receivedCount++;
+    }
+    return receivedCount;
+#endif
+}
+
+UDPPacketBatch::UDPPacketBatch(UDPSocket* socket, int maxPackets) :
+    _socket(socket),
+    _maxPackets(maxPackets),
+    _packetCount(0)
+{
+    _packets = new UDPDatagram[_maxPackets];
+    _buffers = new unsigned char[_maxPackets * MAX_BUFFER_LENGTH_BYTES];
+    for (int i = 0; i < _maxPackets; i++) {
+        _packets[i].data = _buffers + (i * MAX_BUFFER_LENGTH_BYTES);
+        _packets[i].length = 0;
+    }
+}
+
+UDPPacketBatch::~UDPPacketBatch() {
+    delete[] _packets;
+    delete[] _buffers;
+}
+
+bool UDPPacketBatch::add(const sockaddr* destAddress, const void* data, size_t byteLength) {
+    if (!destAddress) {
+        qDebug("UDPPacketBatch add called with NULL destination address - Likely a node with no active socket.\n");
+        return false;
+    }
+    if (byteLength > MAX_BUFFER_LENGTH_BYTES) {
+        qDebug("UDPPacketBatch add called with a %lu byte packet, the most we can hold is %d.\n", byteLength,
+               MAX_BUFFER_LENGTH_BYTES);
+        return false;
+    }
+    if (_packetCount == _maxPackets) {
+        send();
+    }
+    UDPDatagram& packet = _packets[_packetCount++];
+    memcpy(&packet.address, destAddress, sizeof(packet.address));
+    memcpy(packet.data, data, byteLength);
+    packet.length = byteLength;
+    return true;
+}
+
+int UDPPacketBatch::send() {
+    int sentCount = _socket->sendBatch(_packets, _packetCount);
+    _packetCount = 0;
+    return sentCount;
+}
+
+int UDPPacketBatch::receive() {
+    _packetCount = _socket->receiveBatch(_packets, _maxPackets);
+    return _packetCount;
+}
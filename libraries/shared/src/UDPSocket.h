@@ -18,6 +18,15 @@
 
 #define MAX_BUFFER_LENGTH_BYTES 1500
 
+const int MAX_PACKETS_PER_BATCH = 32;
+
+/// A datagram to send with UDPSocket::sendBatch(), or one filled in by UDPSocket::receiveBatch()
+struct UDPDatagram {
+    sockaddr address; // where to send it, or who it was received from
+    unsigned char* data;
+    ssize_t length;
+};
+
 class UDPSocket {    
 public:
     UDPSocket(unsigned short int listeningPort);
@@ -35,12 +44,54 @@ public:
     
     bool receive(void* receivedData, ssize_t* receivedBytes) const;
     bool receive(sockaddr* recvAddress, void* receivedData, ssize_t* receivedBytes) const;
+
+    /// Sends a number of datagrams with as few system calls as the platform allows.
+    /// \return int the number of datagrams that were sent
+    int sendBatch(const UDPDatagram* datagrams, int datagramCount) const;
+
+    /// Receives up to maxDatagrams datagrams that are waiting, with as few system calls as the platform allows. Each
+    /// datagram's data needs room for MAX_BUFFER_LENGTH_BYTES. A blocking socket waits for the first datagram only.
+    /// \return int the number of datagrams that were received
+    int receiveBatch(UDPDatagram* datagrams, int maxDatagrams) const;
 private:
     int handle;
     unsigned short int _listeningPort;
     bool blocking;
 };
 
+/// Datagrams and the buffers for them, for collecting packets to send together or for receiving packets in bulk.
+class UDPPacketBatch {
+public:
+    UDPPacketBatch(UDPSocket* socket, int maxPackets = MAX_PACKETS_PER_BATCH);
+    ~UDPPacketBatch();
+
+    int getPacketCount() const { return _packetCount; }
+    UDPDatagram& getPacket(int index) { return _packets[index]; }
+
+    /// Copies a packet into the batch, sending the packets already in it first if it's full.
+    /// \return bool false if there was no destination address to send it to
+    bool add(const sockaddr* destAddress, const void* data, size_t byteLength);
+
+    /// Sends and then forgets all of the packets in the batch.
+    /// \return int the number of packets that were sent
+    int send();
+
+    /// Replaces the packets in the batch with as many as are waiting on the socket and fit in the batch.
+    /// \return int the number of packets that were received
+    int receive();
+
+private:
+    // not copyable
+    UDPPacketBatch(const UDPPacketBatch&);
+    UDPPacketBatch& operator=(const UDPPacketBatch&);
+
+    UDPSocket* _socket;
+    UDPDatagram* _packets;
+    unsigned char* _buffers;
+    int _maxPackets;
+    int _packetCount;
+};
+
 bool socketMatch(const sockaddr* first, const sockaddr* second);
 int packSocket(unsigned char* packStore, in_addr_t inAddress, in_port_t networkOrderPort);
 int packSocket(unsigned char* packStore, sockaddr* socketToPack);
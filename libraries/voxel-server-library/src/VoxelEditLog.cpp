@@ -0,0 +1,324 @@
+//
+//  VoxelEditLog.cpp
+//  voxel-server
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Append only log of voxel edits between snapshots
+//
+
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <QtCore/QDebug>
+
+#include <OctalCode.h>
+#include <PacketHeaders.h>
+#include <VoxelTree.h>
+
+#include "VoxelEditLog.h"
+
+const unsigned char EDIT_LOG_MAGIC[] = { 'H', 'V', 'E', 'L' };
+const int EDIT_LOG_MAGIC_SIZE = sizeof(EDIT_LOG_MAGIC);
+
+// each record is its payload length, a checksum of its type and payload, its type, and then the payload
+const int RECORD_LENGTH_OFFSET = 0;
+const int RECORD_CHECKSUM_OFFSET = RECORD_LENGTH_OFFSET + sizeof(uint32_t);
+const int RECORD_TYPE_OFFSET = RECORD_CHECKSUM_OFFSET + sizeof(uint32_t);
+const int RECORD_HEADER_SIZE = RECORD_TYPE_OFFSET + sizeof(unsigned char);
+
+// FNV-1a, we only need to catch records that were torn by a crash
+static uint32_t recordChecksum(unsigned char recordType, const unsigned char* data, int length) {
+    const uint32_t FNV_OFFSET_BASIS = 2166136261u;
+    const uint32_t FNV_PRIME = 16777619u;
+    uint32_t hash = (FNV_OFFSET_BASIS ^ recordType) * FNV_PRIME;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+bool VoxelEditLog::writeFully(int file, const unsigned char* data, int length) {
+    while (length > 0) {
+        ssize_t written = write(file, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool readEntireFile(const std::string& filename, std::vector<unsigned char>& contents) {
+    int file = ::open(filename.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat fileInfo;
+    bool success = (fstat(file, &fileInfo) == 0);
+    if (success) {
+        contents.resize(fileInfo.st_size);
+        off_t atByte = 0;
+        while (atByte < fileInfo.st_size) {
+            ssize_t bytesRead = pread(file, &contents[atByte], fileInfo.st_size - atByte, atByte);
+            if (bytesRead <= 0) {
+                success = (bytesRead < 0 && errno == EINTR);
+                if (!success) {
+                    break;
+                }
+                continue;
+            }
+            atByte += bytesRead;
+        }
+    }
+    ::close(file);
+    return success;
+}
+
+void VoxelEditLog::syncDirectoryOf(const std::string& filename) {
+    // renames and new files are only durable once the directory they're in is synced
+    size_t lastSlash = filename.rfind('/');
+    std::string directory = (lastSlash == std::string::npos) ? "." : filename.substr(0, lastSlash + 1);
+    int file = ::open(directory.c_str(), O_RDONLY);
+    if (file >= 0) {
+        fsync(file);
+        ::close(file);
+    }
+}
+
+VoxelEditLog::VoxelEditLog() :
+    _file(-1),
+    _logBytes(0),
+    _needsSync(false),
+    _recordsReplayed(0)
+{
+    pthread_mutex_init(&_lock, NULL);
+}
+
+VoxelEditLog::~VoxelEditLog() {
+    close();
+    pthread_mutex_destroy(&_lock);
+}
+
+bool VoxelEditLog::open(const char* snapshotFilename, VoxelTree* tree) {
+    close();
+    _logFilename = std::string(snapshotFilename) + ".log";
+    _compactingFilename = std::string(snapshotFilename) + ".log.compacting";
+    _recordsReplayed = 0;
+
+    // a compaction that didn't finish leaves the older edits in the compacting log
+    replayFile(_compactingFilename, tree, false);
+    replayFile(_logFilename, tree, true);
+    if (_recordsReplayed > 0) {
+        qDebug("VoxelEditLog replayed %llu edit records\n", _recordsReplayed);
+    }
+
+    pthread_mutex_lock(&_lock);
+    _file = openLogFile(_logFilename);
+    pthread_mutex_unlock(&_lock);
+    return isOpen();
+}
+
+void VoxelEditLog::close() {
+    pthread_mutex_lock(&_lock);
+    if (_file >= 0) {
+        fsync(_file);
+        ::close(_file);
+        _file = -1;
+    }
+    _needsSync = false;
+    pthread_mutex_unlock(&_lock);
+}
+
+// caller must hold _lock
+int VoxelEditLog::openLogFile(const std::string& filename) {
+    int file = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (file < 0) {
+        qDebug("VoxelEditLog unable to open %s, edits will not be logged\n", filename.c_str());
+        return file;
+    }
+    struct stat fileInfo;
+    fstat(file, &fileInfo);
+    if (fileInfo.st_size == 0) {
+        writeFully(file, EDIT_LOG_MAGIC, EDIT_LOG_MAGIC_SIZE);
+        fsync(file);
+        syncDirectoryOf(filename);
+        fileInfo.st_size = EDIT_LOG_MAGIC_SIZE;
+    }
+    _logBytes = fileInfo.st_size;
+    return file;
+}
+
+bool VoxelEditLog::replayFile(const std::string& filename, VoxelTree* tree, bool truncateTornRecord) {
+    std::vector<unsigned char> contents;
+    if (!readEntireFile(filename, contents) || contents.size() < EDIT_LOG_MAGIC_SIZE) {
+        return false;
+    }
+    if (memcmp(&contents[0], EDIT_LOG_MAGIC, EDIT_LOG_MAGIC_SIZE) != 0) {
+        qDebug("WARNING! %s is not a voxel edit log, ignoring it\n", filename.c_str());
+        return false;
+    }
+
+    int atByte = EDIT_LOG_MAGIC_SIZE;
+    int fileLength = contents.size();
+    while (atByte + RECORD_HEADER_SIZE <= fileLength) {
+        uint32_t length;
+        uint32_t checksum;
+        memcpy(&length, &contents[atByte + RECORD_LENGTH_OFFSET], sizeof(length));
+        memcpy(&checksum, &contents[atByte + RECORD_CHECKSUM_OFFSET], sizeof(checksum));
+        unsigned char recordType = contents[atByte + RECORD_TYPE_OFFSET];
+        if (length > fileLength - atByte - RECORD_HEADER_SIZE) {
+            break;
+        }
+        unsigned char* data = &contents[atByte + RECORD_HEADER_SIZE];
+        if (recordChecksum(recordType, data, length) != checksum || !applyRecord(recordType, data, length, tree)) {
+            break;
+        }
+        _recordsReplayed++;
+        atByte += RECORD_HEADER_SIZE + length;
+    }
+
+    if (atByte < fileLength) {
+        qDebug("WARNING! dropping %d bytes of torn or corrupt records from the end of %s\n",
+               fileLength - atByte, filename.c_str());
+        if (truncateTornRecord) {
+            // so that new records aren't appended after the garbage
+            truncate(filename.c_str(), atByte);
+        }
+    }
+    return true;
+}
+
+bool VoxelEditLog::applyRecord(unsigned char recordType, unsigned char* data, int length, VoxelTree* tree) {
+    if (recordType == PACKET_TYPE_SET_VOXEL || recordType == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE) {
+        const int COLOR_SIZE_IN_BYTES = 3;
+        std::vector<unsigned char*> codeColorBuffers;
+        int atByte = 0;
+        while (atByte < length) {
+            int octets = numberOfThreeBitSectionsInCode(data + atByte, length - atByte);
+            if (octets == OVERFLOWED_OCTCODE_BUFFER
+                || atByte + bytesRequiredForCodeLength(octets) + COLOR_SIZE_IN_BYTES > length) {
+                return false;
+            }
+            codeColorBuffers.push_back(data + atByte);
+            atByte += bytesRequiredForCodeLength(octets) + COLOR_SIZE_IN_BYTES;
+        }
+        tree->readCodeColorBuffersToTree(codeColorBuffers, recordType == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE);
+        return true;
+    }
+    if (recordType == PACKET_TYPE_ERASE_VOXEL) {
+        tree->processRemoveVoxelBitstream(data, length);
+        return true;
+    }
+    return false;
+}
+
+bool VoxelEditLog::appendRecord(unsigned char recordType, const unsigned char* data, int length) {
+    unsigned char header[RECORD_HEADER_SIZE];
+    uint32_t recordLength = length;
+    uint32_t checksum = recordChecksum(recordType, data, length);
+    memcpy(&header[RECORD_LENGTH_OFFSET], &recordLength, sizeof(recordLength));
+    memcpy(&header[RECORD_CHECKSUM_OFFSET], &checksum, sizeof(checksum));
+    header[RECORD_TYPE_OFFSET] = recordType;
+
+    bool success = false;
+    pthread_mutex_lock(&_lock);
+    if (_file >= 0) {
+        success = writeFully(_file, header, RECORD_HEADER_SIZE) && writeFully(_file, data, length);
+        if (success) {
+            _logBytes += RECORD_HEADER_SIZE + length;
+            _needsSync = true;
+        } else {
+            qDebug("WARNING! unable to write to voxel edit log %s\n", _logFilename.c_str());
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return success;
+}
+
+void VoxelEditLog::appendSetVoxels(const std::vector<unsigned char*>& codeColorBuffers, bool destructive) {
+    if (!isOpen() || codeColorBuffers.empty()) {
+        return;
+    }
+    const int COLOR_SIZE_IN_BYTES = 3;
+    std::vector<unsigned char> record;
+    for (int i = 0; i < codeColorBuffers.size(); i++) {
+        int codeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(codeColorBuffers[i]));
+        record.insert(record.end(), codeColorBuffers[i], codeColorBuffers[i] + codeBytes + COLOR_SIZE_IN_BYTES);
+    }
+    appendRecord(destructive ? PACKET_TYPE_SET_VOXEL_DESTRUCTIVE : PACKET_TYPE_SET_VOXEL, &record[0], record.size());
+}
+
+void VoxelEditLog::appendEraseVoxels(const unsigned char* packetData, int packetLength) {
+    if (!isOpen()) {
+        return;
+    }
+    appendRecord(PACKET_TYPE_ERASE_VOXEL, packetData, packetLength);
+}
+
+uint64_t VoxelEditLog::getLogBytes() const {
+    pthread_mutex_lock(&_lock);
+    uint64_t logBytes = _logBytes;
+    pthread_mutex_unlock(&_lock);
+    return logBytes;
+}
+
+void VoxelEditLog::sync() {
+    pthread_mutex_lock(&_lock);
+    if (_file >= 0 && _needsSync) {
+        fsync(_file);
+        _needsSync = false;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+bool VoxelEditLog::startCompaction() {
+    bool success = false;
+    pthread_mutex_lock(&_lock);
+    if (_file >= 0) {
+        fsync(_file);
+        struct stat compactingInfo;
+        if (stat(_compactingFilename.c_str(), &compactingInfo) != 0) {
+            // the usual case, just move the log aside
+            ::close(_file);
+            success = (rename(_logFilename.c_str(), _compactingFilename.c_str()) == 0);
+            syncDirectoryOf(_logFilename);
+            _file = openLogFile(_logFilename);
+        } else {
+            // The last compaction never finished, so the compacting log has edits the snapshot doesn't. Add ours to
+            // the end of it, and only then start our log over. Until we do, both logs have these edits, which is fine.
+            std::vector<unsigned char> log;
+            int compactingFile = ::open(_compactingFilename.c_str(), O_WRONLY | O_APPEND);
+            if (compactingFile >= 0 && readEntireFile(_logFilename, log) && log.size() >= EDIT_LOG_MAGIC_SIZE) {
+                success = writeFully(compactingFile, &log[EDIT_LOG_MAGIC_SIZE], log.size() - EDIT_LOG_MAGIC_SIZE)
+                    && fsync(compactingFile) == 0
+                    && ftruncate(_file, EDIT_LOG_MAGIC_SIZE) == 0;
+                if (success) {
+                    fsync(_file);
+                    _logBytes = EDIT_LOG_MAGIC_SIZE;
+                }
+            }
+            if (compactingFile >= 0) {
+                ::close(compactingFile);
+            }
+        }
+        _needsSync = false;
+    }
+    pthread_mutex_unlock(&_lock);
+    return success;
+}
+
+void VoxelEditLog::finishCompaction() {
+    pthread_mutex_lock(&_lock);
+    unlink(_compactingFilename.c_str());
+    syncDirectoryOf(_compactingFilename);
+    pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,81 @@
+//
+//  VoxelEditLog.h
+//  voxel-server
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Append only log of the edits applied to the server's tree since its last snapshot. Between snapshots the voxel
+//  server only has to get the edits themselves onto disk, instead of rewriting the whole world every time it saves.
+//
+//  The log lives next to the snapshot, in <snapshot>.log. Each record is a small header with the record's length and
+//  checksum, followed by the edit data. A crash can only tear the last record, which replay notices and throws away.
+//
+//  To compact, the persist thread moves the log aside to <snapshot>.log.compacting, writes a new snapshot to a temp
+//  file and renames it over the old one, and only then deletes the moved aside log. Replaying an edit that's already in
+//  the snapshot gives the same result, so at any point a crash leaves a snapshot and logs that replay to the right tree.
+//
+
+#ifndef __voxel_server__VoxelEditLog__
+#define __voxel_server__VoxelEditLog__
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+
+class VoxelTree;
+
+class VoxelEditLog {
+public:
+    VoxelEditLog();
+    ~VoxelEditLog();
+
+    /// Replays the edits left in the logs that go with snapshotFilename onto tree, which should already have the
+    /// snapshot loaded, and then opens the log for appending. The caller must hold tree's write lock.
+    bool open(const char* snapshotFilename, VoxelTree* tree);
+    void close();
+    bool isOpen() const { return _file >= 0; }
+
+    /// Logs a batch of set voxel edits, in the order they're applied. Does nothing if the log isn't open.
+    void appendSetVoxels(const std::vector<unsigned char*>& codeColorBuffers, bool destructive);
+
+    /// Logs an erase voxel packet. Does nothing if the log isn't open.
+    void appendEraseVoxels(const unsigned char* packetData, int packetLength);
+
+    /// Records are written straight through to the log, this makes sure they've made it to disk
+    void sync();
+
+    /// Moves the edits logged so far aside, so the log starts over. The snapshot written after this must include all of
+    /// the moved aside edits.
+    bool startCompaction();
+
+    /// Drops the moved aside edits, call this once the new snapshot is safely in place
+    void finishCompaction();
+
+    uint64_t getLogBytes() const;
+    uint64_t getRecordsReplayed() const { return _recordsReplayed; }
+
+    /// writes all of data to a file descriptor, retrying short writes
+    static bool writeFully(int file, const unsigned char* data, int length);
+
+    /// fsyncs the directory a file is in, so that creating, renaming or deleting the file is durable
+    static void syncDirectoryOf(const std::string& filename);
+
+private:
+    bool appendRecord(unsigned char recordType, const unsigned char* data, int length);
+    bool replayFile(const std::string& filename, VoxelTree* tree, bool truncateTornRecord);
+    bool applyRecord(unsigned char recordType, unsigned char* data, int length, VoxelTree* tree);
+    int openLogFile(const std::string& filename);
+
+    std::string _logFilename;
+    std::string _compactingFilename;
+    int _file;
+    uint64_t _logBytes;
+    bool _needsSync;
+    uint64_t _recordsReplayed;
+
+    mutable pthread_mutex_t _lock;
+};
+
+#endif // __voxel_server__VoxelEditLog__
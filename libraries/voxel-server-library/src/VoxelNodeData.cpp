@@ -24,6 +24,7 @@ VoxelNodeData::VoxelNodeData(Node* owningNode) :
     _viewFrustumJustStoppedChanging(true),
     _currentPacketIsColor(true),
     _voxelSendThread(NULL),
+    _voxelServer(NULL),
     _lastClientBoundaryLevelAdjust(0),
     _lastClientVoxelSizeScale(DEFAULT_VOXEL_SIZE_SCALE),
     _lodChanged(false),
@@ -38,10 +39,12 @@ VoxelNodeData::VoxelNodeData(Node* owningNode) :
 }
 
 void VoxelNodeData::initializeVoxelSendThread(VoxelServer* voxelServer) {
-    // Create voxel sending thread...
+    // Create voxel sender, and let the server's send workers run it...
     QUuid nodeUUID = getOwningNode()->getUUID();
+    _voxelServer = voxelServer;
     _voxelSendThread = new VoxelSendThread(nodeUUID, voxelServer);
-    _voxelSendThread->initialize(true);
+    _voxelSendThread->initialize(false);
+    _voxelServer->getSendScheduler().addJob(_voxelSendThread);
 }
 
 bool VoxelNodeData::packetIsDuplicate() const {
@@ -116,7 +119,7 @@ VoxelNodeData::~VoxelNodeData() {
     delete[] _lastVoxelPacket;
 
     if (_voxelSendThread) {
-        _voxelSendThread->terminate();
+        _voxelServer->getSendScheduler().removeJob(_voxelSendThread);
         delete _voxelSendThread;
     }
 }
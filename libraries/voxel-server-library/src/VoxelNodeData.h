@@ -13,9 +13,9 @@
 #include <NodeData.h>
 #include <VoxelQuery.h>
 
-#include <CoverageMap.h>
 #include <VoxelConstants.h>
 #include <VoxelNodeBag.h>
+#include <VoxelOcclusionCache.h>
 #include <VoxelSceneStats.h>
 
 class VoxelSendThread;
@@ -46,7 +46,7 @@ public:
     void setMaxLevelReached(int maxLevelReached) { _maxLevelReachedInLastSearch = maxLevelReached; }
 
     VoxelNodeBag nodeBag;
-    CoverageMap map;
+    VoxelOcclusionCache occlusionCache;
 
     ViewFrustum& getCurrentViewFrustum() { return _currentViewFrustum; };
     ViewFrustum& getLastKnownViewFrustum() { return _lastKnownViewFrustum; };
@@ -103,6 +103,7 @@ private:
     bool _currentPacketIsColor;
 
     VoxelSendThread* _voxelSendThread;
+    VoxelServer* _voxelServer;
 
     // watch for LOD changes
     int _lastClientBoundaryLevelAdjust;
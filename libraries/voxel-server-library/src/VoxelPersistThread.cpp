@@ -8,20 +8,343 @@
 //  Threaded or non-threaded voxel persistence
 //
 
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <QDebug>
 #include <NodeList.h>
+#include <ParallelJobs.h>
 #include <PerfStat.h>
 #include <SharedUtil.h>
 
 #include "VoxelPersistThread.h"
 #include "VoxelServer.h"
 
+// Snapshots are written as the levels down to this one, followed by the subtrees of each node on this level, which are
+// only encoded again when they've changed since the last snapshot
+const int SNAPSHOT_CHUNK_LEVEL = 3;
+
+// compact once the log is this big, and at least this big compared to the snapshot
+const uint64_t MIN_LOG_BYTES_TO_COMPACT = 1024 * 1024;
+const float LOG_BYTES_PER_SNAPSHOT_BYTE_TO_COMPACT = 0.5f;
+
+// The index, in <snapshot>.index, is this header followed by each chunk's octal code, offset and length. The header says
+// which snapshot the index goes with, since a crash can leave an index from before the last snapshot was renamed.
+const char SNAPSHOT_INDEX_MAGIC[] = { 'H', 'V', 'S', 'I' };
+const uint32_t SNAPSHOT_INDEX_VERSION = 1;
+
+class SnapshotIndexHeader {
+public:
+    char magic[sizeof(SNAPSHOT_INDEX_MAGIC)];
+    uint32_t version;
+    uint64_t snapshotBytes;
+    uint64_t snapshotInode;
+    uint64_t snapshotModified;
+    uint64_t topLevelsOffset;
+    uint64_t topLevelsLength;
+    uint32_t chunkCount;
+};
+
+class SnapshotIndexEntry {
+public:
+    uint64_t offset;
+    uint32_t length;
+};
+
 VoxelPersistThread::VoxelPersistThread(VoxelTree* tree, const char* filename, int persistInterval) :
     _tree(tree),
     _filename(filename),
     _persistInterval(persistInterval),
     _initialLoadComplete(false),
-    _loadTimeUSecs(0) {
+    _loadTimeUSecs(0),
+    _loadedLazily(false),
+    _snapshotBytes(0) {
+}
+
+void VoxelPersistThread::collectChunkCodes(VoxelNode* node, std::vector<std::string>& chunkCodes) const {
+    const unsigned char* octalCode = node->getOctalCode();
+    int level = numberOfThreeBitSectionsInCode(octalCode);
+    if (level == SNAPSHOT_CHUNK_LEVEL) {
+        const unsigned char* lazyData;
+        unsigned long lazyLength;
+        if (!node->isLeaf() || _tree->getLazySubtreeData(node, lazyData, lazyLength)) {
+            chunkCodes.push_back(std::string((const char*)octalCode, bytesRequiredForCodeLength(level)));
+        }
+        return;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* childNode = node->getChildAtIndex(i);
+        if (childNode) {
+            collectChunkCodes(childNode, chunkCodes);
+        }
+    }
+}
+
+bool VoxelPersistThread::readSnapshot() {
+    unsigned long topLevelsOffset;
+    unsigned long topLevelsLength;
+    std::vector<SVOSubtree> subtrees;
+    if (readSnapshotIndex(topLevelsOffset, topLevelsLength, subtrees)
+        && _tree->readFromSVOFileLazily(_filename, topLevelsOffset, topLevelsLength, subtrees)) {
+        _loadedLazily = true;
+        qDebug("mapped %s, %d chunks left on disk\n", _filename, _tree->getLazySubtreeCount());
+        return true;
+    }
+    return _tree->readFromSVOFile(_filename);
+}
+
+bool VoxelPersistThread::readSnapshotIndex(unsigned long& topLevelsOffset, unsigned long& topLevelsLength,
+                                           std::vector<SVOSubtree>& subtrees) {
+    std::string indexFilename = std::string(_filename) + ".index";
+    int indexFile = open(indexFilename.c_str(), O_RDONLY);
+    if (indexFile < 0) {
+        return false;
+    }
+    struct stat indexInfo;
+    std::vector<unsigned char> index;
+    if (fstat(indexFile, &indexInfo) == 0 && indexInfo.st_size >= sizeof(SnapshotIndexHeader)) {
+        index.resize(indexInfo.st_size);
+        if (read(indexFile, &index[0], index.size()) != index.size()) {
+            index.clear();
+        }
+    }
+    close(indexFile);
+
+    SnapshotIndexHeader header;
+    struct stat snapshotInfo;
+    if (index.empty() || stat(_filename, &snapshotInfo) != 0) {
+        return false;
+    }
+    memcpy(&header, &index[0], sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_INDEX_MAGIC, sizeof(SNAPSHOT_INDEX_MAGIC)) != 0
+        || header.version != SNAPSHOT_INDEX_VERSION
+        || header.snapshotBytes != snapshotInfo.st_size
+        || header.snapshotInode != snapshotInfo.st_ino
+        || header.snapshotModified != snapshotInfo.st_mtime) {
+        qDebug("%s doesn't match %s, loading all of it\n", indexFilename.c_str(), _filename);
+        return false;
+    }
+
+    topLevelsOffset = header.topLevelsOffset;
+    topLevelsLength = header.topLevelsLength;
+    int at = sizeof(header);
+    for (int i = 0; i < header.chunkCount; i++) {
+        if (at >= index.size()) {
+            return false;
+        }
+        int codeBytes = bytesRequiredForCodeLength(index[at]);
+        if (at + codeBytes + sizeof(SnapshotIndexEntry) > index.size()) {
+            return false;
+        }
+        SnapshotIndexEntry entry;
+        memcpy(&entry, &index[at + codeBytes], sizeof(entry));
+
+        SVOSubtree subtree;
+        subtree.octalCode = std::string((const char*)&index[at], codeBytes);
+        subtree.offset = entry.offset;
+        subtree.length = entry.length;
+        subtrees.push_back(subtree);
+        at += codeBytes + sizeof(entry);
+    }
+    return true;
+}
+
+bool VoxelPersistThread::writeSnapshotIndex(const struct stat& snapshotInfo, off_t topLevelsOffset,
+                                            off_t topLevelsLength, const SnapshotChunkMap& chunks) {
+    SnapshotIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_INDEX_MAGIC, sizeof(SNAPSHOT_INDEX_MAGIC));
+    header.version = SNAPSHOT_INDEX_VERSION;
+    header.snapshotBytes = snapshotInfo.st_size;
+    header.snapshotInode = snapshotInfo.st_ino;
+    header.snapshotModified = snapshotInfo.st_mtime;
+    header.topLevelsOffset = topLevelsOffset;
+    header.topLevelsLength = topLevelsLength;
+    header.chunkCount = chunks.size();
+
+    std::vector<unsigned char> index((unsigned char*)&header, (unsigned char*)&header + sizeof(header));
+    for (SnapshotChunkMap::const_iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk) {
+        SnapshotIndexEntry entry;
+        entry.offset = chunk->second.offset;
+        entry.length = chunk->second.length;
+        index.insert(index.end(), chunk->first.begin(), chunk->first.end());
+        index.insert(index.end(), (unsigned char*)&entry, (unsigned char*)&entry + sizeof(entry));
+    }
+
+    // a missing index only costs a slower load, so on any failure we just make sure there isn't a wrong one around
+    std::string indexFilename = std::string(_filename) + ".index";
+    std::string tempFilename = indexFilename + ".tmp";
+    int indexFile = open(tempFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    bool success = indexFile >= 0 && VoxelEditLog::writeFully(indexFile, &index[0], index.size())
+        && fsync(indexFile) == 0;
+    if (indexFile >= 0) {
+        close(indexFile);
+    }
+    if (success && rename(tempFilename.c_str(), indexFilename.c_str()) == 0) {
+        VoxelEditLog::syncDirectoryOf(indexFilename);
+        return true;
+    }
+    qDebug("unable to write %s\n", indexFilename.c_str());
+    unlink(tempFilename.c_str());
+    unlink(indexFilename.c_str());
+    return false;
+}
+
+void VoxelPersistThread::prepareSnapshotChunk(int chunkIndex, void* extraData) {
+    SnapshotChunkBatch* batch = (SnapshotChunkBatch*)extraData;
+    VoxelTree* tree = batch->persistThread->_tree;
+    const std::string& chunkCode = batch->chunkCodes[chunkIndex];
+    VoxelNode* chunkRoot = tree->lockForEncoding((const unsigned char*)chunkCode.data());
+    if (!chunkRoot) {
+        return;
+    }
+    PreparedChunk& prepared = batch->chunks[chunkIndex];
+    prepared.found = true;
+    prepared.chunk.lastChanged = chunkRoot->getLastChanged();
+    std::vector<unsigned char>& chunkBytes = prepared.bytes;
+
+    // a chunk that's still only on disk is exactly what we loaded, and still mapped
+    const unsigned char* lazyData;
+    unsigned long lazyLength;
+    if (tree->getLazySubtreeData(chunkRoot, lazyData, lazyLength)) {
+        chunkBytes.assign(lazyData, lazyData + lazyLength);
+        tree->unlockForEncoding(chunkRoot);
+        return;
+    }
+    const SnapshotChunkMap& oldChunks = batch->persistThread->_snapshotChunks;
+    SnapshotChunkMap::const_iterator oldChunk = oldChunks.find(chunkCode);
+    if (batch->oldSnapshotFile >= 0 && oldChunk != oldChunks.end() && oldChunk->second.lastChanged == prepared.chunk.lastChanged) {
+        chunkBytes.resize(oldChunk->second.length);
+        if (chunkBytes.empty() || pread(batch->oldSnapshotFile, &chunkBytes[0], oldChunk->second.length,
+                                        oldChunk->second.offset) == oldChunk->second.length) {
+            tree->unlockForEncoding(chunkRoot);
+            return;
+        }
+        chunkBytes.clear();
+    }
+
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    VoxelNodeBag chunkBag;
+    chunkBag.insert(chunkRoot);
+    while (!chunkBag.isEmpty()) {
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        int bytesWritten = tree->encodeTreeBitstream(chunkBag.extract(), &outputBuffer[0], sizeof(outputBuffer), chunkBag,
+                                                     params);
+        chunkBytes.insert(chunkBytes.end(), outputBuffer, outputBuffer + bytesWritten);
+    }
+    prepared.encoded = true;
+    tree->unlockForEncoding(chunkRoot);
+}
+
+bool VoxelPersistThread::writeSnapshot() {
+    std::string tempFilename = std::string(_filename) + ".tmp";
+    int snapshotFile = open(tempFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (snapshotFile < 0) {
+        qDebug("unable to create %s, not saving voxels\n", tempFilename.c_str());
+        return false;
+    }
+
+    // from here on the log only has edits that might not be in the new snapshot
+    bool wantEditLog = _editLog.isOpen();
+    if (wantEditLog && !_editLog.startCompaction()) {
+        qDebug("unable to start compacting the voxel edit log, not saving voxels\n");
+        close(snapshotFile);
+        unlink(tempFilename.c_str());
+        return false;
+    }
+
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    off_t snapshotBytes = 0;
+    bool success = true;
+
+    // the chunks are whatever nodes are on the chunk level when we start, ones added after that are in the log
+    std::vector<std::string> chunkCodes;
+    _tree->lockForEncoding(_tree->rootNode);
+    collectChunkCodes(_tree->rootNode, chunkCodes);
+    _tree->unlockForEncoding(_tree->rootNode);
+
+    // Chunks that haven't changed since the last snapshot are copied from it instead of encoded again. The ones that have
+    // are encoded on the tree's coding threads, a batch at a time, and written out in order after each batch.
+    const int CHUNKS_PER_THREAD_PER_BATCH = 4;
+    int threadCount = (_tree->getCodingThreads() > 0) ? _tree->getCodingThreads() : getProcessorCount();
+    int chunksPerBatch = threadCount * CHUNKS_PER_THREAD_PER_BATCH;
+    SnapshotChunkBatch batch;
+    batch.persistThread = this;
+    batch.oldSnapshotFile = open(_filename, O_RDONLY);
+    SnapshotChunkMap newChunks;
+    int chunksEncoded = 0;
+    uint64_t bytesEncoded = 0;
+    for (int firstChunk = 0; firstChunk < chunkCodes.size() && success; firstChunk += chunksPerBatch) {
+        int batchSize = std::min((int)chunkCodes.size() - firstChunk, chunksPerBatch);
+        batch.chunkCodes.assign(chunkCodes.begin() + firstChunk, chunkCodes.begin() + firstChunk + batchSize);
+        batch.chunks.assign(batchSize, PreparedChunk());
+        runParallelJobs(prepareSnapshotChunk, batchSize, threadCount, &batch);
+
+        for (int i = 0; i < batchSize && success; i++) {
+            PreparedChunk& prepared = batch.chunks[i];
+            if (!prepared.found) {
+                continue; // deleted since we looked
+            }
+            SnapshotChunk& chunk = prepared.chunk;
+            chunk.offset = snapshotBytes;
+            chunk.length = prepared.bytes.size();
+            if (chunk.length > 0) {
+                success = VoxelEditLog::writeFully(snapshotFile, &prepared.bytes[0], chunk.length);
+            }
+            if (prepared.encoded) {
+                chunksEncoded++;
+                bytesEncoded += chunk.length;
+            }
+            snapshotBytes += chunk.length;
+            newChunks[batch.chunkCodes[i]] = chunk;
+        }
+    }
+    if (batch.oldSnapshotFile >= 0) {
+        close(batch.oldSnapshotFile);
+    }
+
+    // The levels above the chunks are small, so they're written fresh every time, and last, so that their colors are
+    // averaged from chunks at least as new as the ones in the snapshot. Those are the only parts of the tree edits have
+    // to wait for us to finish with, the chunks are only locked one at a time.
+    off_t topLevelsOffset = snapshotBytes;
+    _tree->lockForEncoding(_tree->rootNode);
+    VoxelNodeBag topLevelsBag;
+    topLevelsBag.insert(_tree->rootNode);
+    while (!topLevelsBag.isEmpty() && success) {
+        VoxelNode* subTree = topLevelsBag.extract();
+        int maxEncodeLevel = SNAPSHOT_CHUNK_LEVEL + 1 - numberOfThreeBitSectionsInCode(subTree->getOctalCode());
+        EncodeBitstreamParams params(maxEncodeLevel, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        int bytesWritten = _tree->encodeTreeBitstream(subTree, &outputBuffer[0], sizeof(outputBuffer), topLevelsBag,
+                                                      params);
+        success = VoxelEditLog::writeFully(snapshotFile, &outputBuffer[0], bytesWritten);
+        snapshotBytes += bytesWritten;
+    }
+    _tree->unlockForEncoding(_tree->rootNode);
+
+    // the new snapshot only replaces the old one once it's entirely on disk
+    struct stat snapshotInfo;
+    success = (fsync(snapshotFile) == 0) && (fstat(snapshotFile, &snapshotInfo) == 0) && success;
+    close(snapshotFile);
+    if (success && rename(tempFilename.c_str(), _filename) == 0) {
+        VoxelEditLog::syncDirectoryOf(_filename);
+        if (wantEditLog) {
+            _editLog.finishCompaction();
+        }
+        writeSnapshotIndex(snapshotInfo, topLevelsOffset, snapshotBytes - topLevelsOffset, newChunks);
+        _snapshotChunks.swap(newChunks);
+        _snapshotBytes = snapshotBytes;
+        qDebug("saved voxels to %s, %llu bytes, encoded %d of %d chunks (%llu bytes)\n", _filename,
+               (uint64_t)snapshotBytes, chunksEncoded, (int)chunkCodes.size(), bytesEncoded);
+        return true;
+    }
+    // the edits we moved aside stay in the compacting log, and the next compaction picks them up
+    qDebug("unable to write %s, voxels not saved\n", tempFilename.c_str());
+    unlink(tempFilename.c_str());
+    return false;
 }
 
 bool VoxelPersistThread::process() {
@@ -35,10 +358,16 @@ bool VoxelPersistThread::process() {
         _tree->lockForWrite();
         {
             PerformanceWarning warn(true, "Loading Voxel File", true);
-            persistantFileRead = _tree->readFromSVOFile(_filename);
+            persistantFileRead = readSnapshot();
+
+            // then apply whatever edits were made since that snapshot was saved
+            _editLog.open(_filename, _tree);
         }
         _tree->unlock();
 
+        struct stat snapshotInfo;
+        _snapshotBytes = (stat(_filename, &snapshotInfo) == 0) ? snapshotInfo.st_size : 0;
+
         _loadCompleted = time(0);
         uint64_t loadDone = usecTimestampNow();
         _loadTimeUSecs = loadDone - loadStarted;
@@ -67,18 +396,28 @@ bool VoxelPersistThread::process() {
         uint64_t MSECS_TO_USECS = 1000;
         uint64_t USECS_TO_SLEEP = 100 * MSECS_TO_USECS; // every 100ms
         usleep(USECS_TO_SLEEP);
+
+        // saving the edits themselves is cheap, so do it often
+        _editLog.sync();
+
         uint64_t now = usecTimestampNow();
         uint64_t sinceLastSave = now - _lastCheck;
         uint64_t intervalToCheck = _persistInterval * MSECS_TO_USECS;
         
         if (sinceLastSave > intervalToCheck) {
-            // check the dirty bit and persist here...
             _lastCheck = usecTimestampNow();
-            if (_tree->isDirty()) {
+            if (_editLog.isOpen()) {
+                uint64_t compactAtLogBytes = std::max(MIN_LOG_BYTES_TO_COMPACT,
+                    (uint64_t)(_snapshotBytes * LOG_BYTES_PER_SNAPSHOT_BYTE_TO_COMPACT));
+                if (_editLog.getLogBytes() > compactAtLogBytes) {
+                    qDebug("compacting voxel edit log into %s...\n", _filename);
+                    writeSnapshot();
+                }
+            } else if (_tree->isDirty()) {
+                // without a log the only way to save edits is a whole new snapshot
                 qDebug("saving voxels to file %s...\n",_filename);
-                _tree->writeToSVOFile(_filename);
-                _tree->clearDirtyBit(); // tree is clean after saving
-                qDebug("DONE saving voxels to file...\n");
+                _tree->clearDirtyBit(); // edits from here on will set it again
+                writeSnapshot();
             }
         }
     }    
@@ -11,11 +11,21 @@
 #ifndef __voxel_server__VoxelPersistThread__
 #define __voxel_server__VoxelPersistThread__
 
+#include <map>
+#include <string>
+
+#include <sys/stat.h>
+
 #include <GenericThread.h>
 #include <NetworkPacket.h>
 #include <VoxelTree.h>
 
-/// Generalized threaded processor for handling received inbound packets. 
+#include "VoxelEditLog.h"
+
+/// Persists the server's tree as a snapshot file plus a log of the edits since then. The log is synced to disk every
+/// time the thread wakes up, and every persist interval, if the log has grown big enough compared to the snapshot, the
+/// thread compacts them into a new snapshot. Next to each snapshot is an index of where its chunks are, so that the
+/// next load can map the snapshot and only decode the chunks as they're needed.
 class VoxelPersistThread : public virtual GenericThread {
 public:
     static const int DEFAULT_PERSIST_INTERVAL = 1000 * 30; // every 30 seconds
@@ -27,10 +37,54 @@ public:
     time_t* getLoadCompleted() { return &_loadCompleted; }
     uint64_t getLoadElapsedTime() const { return _loadTimeUSecs; }
 
+    /// true if the snapshot was mapped and its subtrees left to be decoded as they're needed
+    bool wasLoadedLazily() const { return _loadedLazily; }
+
+    /// the log that edits must be recorded in, while holding the same tree lock they are applied under
+    VoxelEditLog& getEditLog() { return _editLog; }
+
 protected:
     /// Implements generic processing behavior for this thread.
     virtual bool process();
 private:
+    /// where a chunk of the tree was in the last snapshot, so that it can be copied from there if it hasn't changed
+    class SnapshotChunk {
+    public:
+        uint64_t lastChanged;
+        off_t offset;
+        int length;
+    };
+    typedef std::map<std::string, SnapshotChunk> SnapshotChunkMap;
+
+    /// a chunk of a new snapshot, and the bytes to write for it, once it's been copied or encoded
+    class PreparedChunk {
+    public:
+        SnapshotChunk chunk;
+        std::vector<unsigned char> bytes;
+        bool found; // false if the chunk was deleted since we collected the chunk codes
+        bool encoded;
+
+        PreparedChunk() : found(false), encoded(false) {}
+    };
+
+    /// the chunks of a new snapshot being prepared on the tree's coding threads together
+    class SnapshotChunkBatch {
+    public:
+        VoxelPersistThread* persistThread;
+        int oldSnapshotFile;
+        std::vector<std::string> chunkCodes;
+        std::vector<PreparedChunk> chunks;
+    };
+
+    bool readSnapshot();
+    bool readSnapshotIndex(unsigned long& topLevelsOffset, unsigned long& topLevelsLength,
+                           std::vector<SVOSubtree>& subtrees);
+    bool writeSnapshot();
+    bool writeSnapshotIndex(const struct stat& snapshotInfo, off_t topLevelsOffset, off_t topLevelsLength,
+                            const SnapshotChunkMap& chunks);
+    void collectChunkCodes(VoxelNode* node, std::vector<std::string>& chunkCodes) const;
+    static void prepareSnapshotChunk(int chunkIndex, void* extraData);
+
     VoxelTree* _tree;
     const char* _filename;
     int _persistInterval;
@@ -38,7 +92,12 @@ private:
 
     time_t _loadCompleted;
     uint64_t _loadTimeUSecs;
+    bool _loadedLazily;
     uint64_t _lastCheck;
+
+    VoxelEditLog _editLog;
+    uint64_t _snapshotBytes;
+    SnapshotChunkMap _snapshotChunks; // by the chunk's octal code
 };
 
 #endif // __voxel_server__VoxelPersistThread__
@@ -0,0 +1,255 @@
+//
+//  VoxelSendScheduler.cpp
+//  voxel-server
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Fixed pool of worker threads for sending voxels to clients
+//
+
+#include <unistd.h>
+
+#include <QtCore/QDebug>
+
+#include <SharedUtil.h>
+
+#include "VoxelSendScheduler.h"
+#include "VoxelSendThread.h"
+#include "VoxelServerConsts.h"
+
+// idle workers wake up at least this often to look for due jobs they can steal from busy workers
+const int IDLE_WORKER_STEAL_CHECK_USECS = 2 * 1000;
+
+VoxelSendWorker::VoxelSendWorker(VoxelSendScheduler* scheduler, int workerNumber) :
+    _scheduler(scheduler),
+    _workerNumber(workerNumber),
+    _currentJob(NULL),
+    _currentJobRemoved(false)
+{
+    pthread_mutex_init(&_jobsLock, NULL);
+    pthread_cond_init(&_jobsChanged, NULL);
+    resetStats();
+}
+
+VoxelSendWorker::~VoxelSendWorker() {
+    terminate(); // make sure we're not still running before our locks go away
+    pthread_cond_destroy(&_jobsChanged);
+    pthread_mutex_destroy(&_jobsLock);
+}
+
+float VoxelSendWorker::getUtilization() const {
+    uint64_t elapsed = usecTimestampNow() - _statsStarted;
+    return elapsed ? (float)_busyUsecs / (float)elapsed : 0.0f;
+}
+
+void VoxelSendWorker::resetStats() {
+    pthread_mutex_lock(&_jobsLock);
+    _statsStarted = usecTimestampNow();
+    _jobsRun = 0;
+    _jobsStolen = 0;
+    _lateJobs = 0;
+    _busyUsecs = 0;
+    _totalLatenessUsecs = 0;
+    pthread_mutex_unlock(&_jobsLock);
+}
+
+void VoxelSendWorker::addJob(VoxelSendThread* job, uint64_t deadline) {
+    pthread_mutex_lock(&_jobsLock);
+    _jobs.insert(JobQueue::value_type(deadline, job));
+    pthread_cond_broadcast(&_jobsChanged);
+    pthread_mutex_unlock(&_jobsLock);
+}
+
+bool VoxelSendWorker::removeJob(VoxelSendThread* job) {
+    bool found = false;
+    pthread_mutex_lock(&_jobsLock);
+    for (JobQueue::iterator i = _jobs.begin(); i != _jobs.end(); i++) {
+        if (i->second == job) {
+            _jobs.erase(i);
+            found = true;
+            break;
+        }
+    }
+    if (_currentJob == job) {
+        // it's running right now, tell process() not to put it back, and wait for it to finish
+        _currentJobRemoved = true;
+        while (_currentJob == job) {
+            pthread_cond_wait(&_jobsChanged, &_jobsLock);
+        }
+        found = true;
+    }
+    pthread_mutex_unlock(&_jobsLock);
+    return found;
+}
+
+VoxelSendThread* VoxelSendWorker::takeDueJob(uint64_t now, uint64_t& deadline, bool makeCurrent) {
+    VoxelSendThread* job = NULL;
+    pthread_mutex_lock(&_jobsLock);
+    if (!_jobs.empty() && _jobs.begin()->first <= now) {
+        deadline = _jobs.begin()->first;
+        job = _jobs.begin()->second;
+        _jobs.erase(_jobs.begin());
+        if (makeCurrent) {
+            _currentJob = job;
+        }
+    }
+    pthread_mutex_unlock(&_jobsLock);
+    return job;
+}
+
+void VoxelSendWorker::waitForWork(uint64_t now) {
+    pthread_mutex_lock(&_jobsLock);
+    uint64_t wakeAt = now + IDLE_WORKER_STEAL_CHECK_USECS;
+    if (!_jobs.empty() && _jobs.begin()->first < wakeAt) {
+        wakeAt = _jobs.begin()->first;
+    }
+    if (wakeAt > now) {
+        // usecTimestampNow() is based on gettimeofday(), the same clock pthread_cond_timedwait() uses
+        timespec wakeTime;
+        wakeTime.tv_sec = wakeAt / 1000000;
+        wakeTime.tv_nsec = (wakeAt % 1000000) * 1000;
+        pthread_cond_timedwait(&_jobsChanged, &_jobsLock, &wakeTime);
+    }
+    pthread_mutex_unlock(&_jobsLock);
+}
+
+bool VoxelSendWorker::process() {
+    uint64_t now = usecTimestampNow();
+    uint64_t deadline = now;
+    bool stolen = false;
+
+    VoxelSendThread* job = takeDueJob(now, deadline, true);
+    if (!job) {
+        job = _scheduler->stealDueJob(this, now, deadline);
+        stolen = (job != NULL);
+    }
+    if (!job) {
+        waitForWork(now);
+        return isStillRunning();
+    }
+
+    uint64_t started = usecTimestampNow();
+    job->threadRoutine(); // the job is in non-threaded mode, so this sends one interval's worth of packets
+    uint64_t finished = usecTimestampNow();
+
+    pthread_mutex_lock(&_jobsLock);
+    _jobsRun++;
+    if (stolen) {
+        _jobsStolen++;
+    }
+    uint64_t lateness = (started > deadline) ? started - deadline : 0;
+    _totalLatenessUsecs += lateness;
+    if (lateness > VOXEL_SEND_INTERVAL_USECS) {
+        _lateJobs++;
+    }
+    _busyUsecs += finished - started;
+
+    if (!_currentJobRemoved) {
+        _jobs.insert(JobQueue::value_type(job->getNextSendTime(), job));
+    }
+    _currentJob = NULL;
+    _currentJobRemoved = false;
+    pthread_cond_broadcast(&_jobsChanged); // wakes up anyone waiting in removeJob()
+    pthread_mutex_unlock(&_jobsLock);
+
+    return isStillRunning();
+}
+
+VoxelSendScheduler::VoxelSendScheduler() :
+    _nextWorker(0)
+{
+    pthread_mutex_init(&_stealLock, NULL);
+}
+
+VoxelSendScheduler::~VoxelSendScheduler() {
+    stop();
+    pthread_mutex_destroy(&_stealLock);
+}
+
+void VoxelSendScheduler::start(int workerCount) {
+    if (workerCount <= 0) {
+        workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workerCount <= 0) {
+            workerCount = 1;
+        }
+    }
+    qDebug("VoxelSendScheduler starting %d send workers\n", workerCount);
+    for (int i = 0; i < workerCount; i++) {
+        VoxelSendWorker* worker = new VoxelSendWorker(this, i);
+        _workers.push_back(worker);
+    }
+    // start them only after they're all in the list, since they steal from each other
+    for (int i = 0; i < _workers.size(); i++) {
+        _workers[i]->initialize(true);
+    }
+}
+
+void VoxelSendScheduler::stop() {
+    for (int i = 0; i < _workers.size(); i++) {
+        _workers[i]->terminate();
+    }
+    for (int i = 0; i < _workers.size(); i++) {
+        delete _workers[i];
+    }
+    _workers.clear();
+}
+
+void VoxelSendScheduler::addJob(VoxelSendThread* job) {
+    // new clients go to the least loaded worker, stealing evens things out from there
+    VoxelSendWorker* bestWorker = _workers[_nextWorker % _workers.size()];
+    for (int i = 0; i < _workers.size(); i++) {
+        if (_workers[i]->getJobCount() < bestWorker->getJobCount()) {
+            bestWorker = _workers[i];
+        }
+    }
+    _nextWorker++;
+    bestWorker->addJob(job, usecTimestampNow());
+}
+
+void VoxelSendScheduler::removeJob(VoxelSendThread* job) {
+    pthread_mutex_lock(&_stealLock);
+    for (int i = 0; i < _workers.size(); i++) {
+        if (_workers[i]->removeJob(job)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_stealLock);
+}
+
+VoxelSendThread* VoxelSendScheduler::stealDueJob(VoxelSendWorker* thief, uint64_t now, uint64_t& deadline) {
+    VoxelSendThread* job = NULL;
+    pthread_mutex_lock(&_stealLock);
+
+    // take the most overdue job from any other worker
+    VoxelSendWorker* victim = NULL;
+    for (int i = 0; i < _workers.size(); i++) {
+        VoxelSendWorker* worker = _workers[i];
+        if (worker == thief) {
+            continue;
+        }
+        pthread_mutex_lock(&worker->_jobsLock);
+        if (!worker->_jobs.empty() && worker->_jobs.begin()->first <= now
+            && (!victim || worker->_jobs.begin()->first < deadline)) {
+            victim = worker;
+            deadline = worker->_jobs.begin()->first;
+        }
+        pthread_mutex_unlock(&worker->_jobsLock);
+    }
+    if (victim) {
+        // the victim may have started on it in the meantime, so only take it if it's still due
+        job = victim->takeDueJob(now, deadline, false);
+        if (job) {
+            pthread_mutex_lock(&thief->_jobsLock);
+            thief->_currentJob = job;
+            pthread_mutex_unlock(&thief->_jobsLock);
+        }
+    }
+    pthread_mutex_unlock(&_stealLock);
+    return job;
+}
+
+void VoxelSendScheduler::resetStats() {
+    for (int i = 0; i < _workers.size(); i++) {
+        _workers[i]->resetStats();
+    }
+}
@@ -0,0 +1,109 @@
+//
+//  VoxelSendScheduler.h
+//  voxel-server
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Runs the VoxelSendThreads of all clients on a fixed pool of worker threads. Each client's sender is a job with a
+//  deadline (the next time it wants to send), and each worker keeps its own queue of jobs ordered by deadline. Workers
+//  run the earliest due job in their own queue, and when they have nothing due they steal the earliest due job from
+//  another worker. So the number of threads waking up and fighting over the tree lock is bounded by the number of
+//  cores, not the number of clients.
+//
+
+#ifndef __voxel_server__VoxelSendScheduler__
+#define __voxel_server__VoxelSendScheduler__
+
+#include <map>
+#include <vector>
+
+#include <pthread.h>
+
+#include <GenericThread.h>
+
+class VoxelSendScheduler;
+class VoxelSendThread;
+
+/// One worker thread of a VoxelSendScheduler
+class VoxelSendWorker : public virtual GenericThread {
+public:
+    VoxelSendWorker(VoxelSendScheduler* scheduler, int workerNumber);
+    ~VoxelSendWorker();
+
+    int getWorkerNumber() const { return _workerNumber; }
+    int getJobCount() const { return _jobs.size(); }
+    uint64_t getJobsRun() const { return _jobsRun; }
+    uint64_t getJobsStolen() const { return _jobsStolen; }
+    uint64_t getLateJobs() const { return _lateJobs; }
+    uint64_t getBusyUsecs() const { return _busyUsecs; }
+    uint64_t getAverageLatenessUsecs() const { return _jobsRun ? _totalLatenessUsecs / _jobsRun : 0; }
+
+    /// fraction of the time since the stats were last reset that this worker spent running jobs
+    float getUtilization() const;
+    void resetStats();
+
+protected:
+    virtual bool process();
+
+private:
+    friend class VoxelSendScheduler;
+    typedef std::multimap<uint64_t, VoxelSendThread*> JobQueue;
+
+    void addJob(VoxelSendThread* job, uint64_t deadline);
+    bool removeJob(VoxelSendThread* job);
+    VoxelSendThread* takeDueJob(uint64_t now, uint64_t& deadline, bool makeCurrent);
+    void waitForWork(uint64_t now);
+
+    VoxelSendScheduler* _scheduler;
+    int _workerNumber;
+
+    JobQueue _jobs;
+    VoxelSendThread* _currentJob;
+    bool _currentJobRemoved;
+    pthread_mutex_t _jobsLock;
+    pthread_cond_t _jobsChanged;
+
+    uint64_t _statsStarted;
+    uint64_t _jobsRun;
+    uint64_t _jobsStolen;
+    uint64_t _lateJobs;
+    uint64_t _busyUsecs;
+    uint64_t _totalLatenessUsecs;
+};
+
+class VoxelSendScheduler {
+public:
+    VoxelSendScheduler();
+    ~VoxelSendScheduler();
+
+    /// starts the worker threads, a workerCount of 0 means one worker per core
+    void start(int workerCount = 0);
+
+    /// stops the worker threads. Any jobs still scheduled are dropped, but not deleted.
+    void stop();
+
+    /// schedules a sender to run as soon as possible, the sender must be initialized in non-threaded mode
+    void addJob(VoxelSendThread* job);
+
+    /// unschedules a sender. If a worker is running it right now, this waits for it to finish, so when this returns
+    /// the caller is free to delete the sender.
+    void removeJob(VoxelSendThread* job);
+
+    int getWorkerCount() const { return _workers.size(); }
+    const VoxelSendWorker* getWorker(int workerNumber) const { return _workers[workerNumber]; }
+    void resetStats();
+
+private:
+    friend class VoxelSendWorker;
+
+    /// finds a due job in some other worker's queue, and makes it thief's current job
+    VoxelSendThread* stealDueJob(VoxelSendWorker* thief, uint64_t now, uint64_t& deadline);
+
+    std::vector<VoxelSendWorker*> _workers;
+    int _nextWorker;
+
+    // held while a job moves between workers, so that removeJob() always finds it in a queue or running somewhere
+    pthread_mutex_t _stealLock;
+};
+
+#endif // __voxel_server__VoxelSendScheduler__
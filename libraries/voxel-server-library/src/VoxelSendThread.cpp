@@ -20,37 +20,33 @@ extern EnvironmentData environmentData[3];
 
 VoxelSendThread::VoxelSendThread(const QUuid& nodeUUID, VoxelServer* myServer) :
     _nodeUUID(nodeUUID),
-    _myServer(myServer) {
+    _myServer(myServer),
+    _nextSendTime(0),
+    _packetBatch(NodeList::getInstance()->getNodeSocket()) {
 }
 
 bool VoxelSendThread::process() {
     uint64_t  start = usecTimestampNow();
-    bool gotLock = false;
     
     // don't do any send processing until the initial load of the voxels is complete...
     if (_myServer->isInitialLoadComplete()) {
-        Node* node = NodeList::getInstance()->nodeWithUUID(_nodeUUID);
+        // the handle keeps our node's data around even if the node list kills the node while we're sending to it
+        NodeHandle node = NodeList::getInstance()->nodeHandleWithUUID(_nodeUUID);
     
-        if (node) {
-            // make sure the node list doesn't kill our node while we're using it
-            if (node->trylock()) {
-                gotLock = true;
-                VoxelNodeData* nodeData = NULL;
-    
-                nodeData = (VoxelNodeData*) node->getLinkedData();
-    
-                int packetsSent = 0;
-
-                // Sometimes the node data has not yet been linked, in which case we can't really do anything
-                if (nodeData) {
-                    bool viewFrustumChanged = nodeData->updateCurrentViewFrustum();
-                    if (_myServer->wantsDebugVoxelSending()) {
-                        printf("nodeData->updateCurrentViewFrustum() changed=%s\n", debug::valueOf(viewFrustumChanged));
-                    }
-                    packetsSent = deepestLevelVoxelDistributor(node, nodeData, viewFrustumChanged);
+        if (!node.isNull()) {
+            VoxelNodeData* nodeData = (VoxelNodeData*) node->getLinkedData();
+
+            // Sometimes the node data has not yet been linked, in which case we can't really do anything
+            if (nodeData) {
+                // the node's view frustum is written under its lock as queries come in, so read it the same way
+                node->lock();
+                bool viewFrustumChanged = nodeData->updateCurrentViewFrustum();
+                node->unlock();
+                
+                if (_myServer->wantsDebugVoxelSending()) {
+                    printf("nodeData->updateCurrentViewFrustum() changed=%s\n", debug::valueOf(viewFrustumChanged));
                 }
-    
-                node->unlock(); // we're done with this node for now.
+                deepestLevelVoxelDistributor(node.data(), nodeData, viewFrustumChanged);
             }
         }
     } else {
@@ -59,8 +55,11 @@ bool VoxelSendThread::process() {
         }
     }
      
-    // Only sleep if we're still running and we got the lock last time we tried, otherwise try to get the lock asap
-    if (isStillRunning() && gotLock) {
+    _nextSendTime = start + VOXEL_SEND_INTERVAL_USECS;
+
+    // When we have our own thread, only sleep if we're still running. When scheduled, the scheduler waits until
+    // getNextSendTime() for us.
+    if (isThreaded() && isStillRunning()) {
         // dynamically sleep until we need to fire off the next set of voxels
         int elapsed = (usecTimestampNow() - start);
         int usecToSleep =  VOXEL_SEND_INTERVAL_USECS - elapsed;
@@ -103,22 +102,20 @@ int VoxelSendThread::handlePacketSend(Node* node, VoxelNodeData* nodeData, int&
             statsMessageLength += nodeData->getPacketLength();
 
             // actually send it
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(), statsMessage, statsMessageLength);
+            _packetBatch.add(node->getActiveSocket(), statsMessage, statsMessageLength);
         } else {
             // not enough room in the packet, send two packets
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(), statsMessage, statsMessageLength);
+            _packetBatch.add(node->getActiveSocket(), statsMessage, statsMessageLength);
             trueBytesSent += statsMessageLength;
             truePacketsSent++;
             packetsSent++;
 
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(),
-                                            nodeData->getPacket(), nodeData->getPacketLength());
+            _packetBatch.add(node->getActiveSocket(), nodeData->getPacket(), nodeData->getPacketLength());
         }
         nodeData->stats.markAsSent();
     } else {
         // just send the voxel packet
-        NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(),
-                                                       nodeData->getPacket(), nodeData->getPacketLength());
+        _packetBatch.add(node->getActiveSocket(), nodeData->getPacket(), nodeData->getPacketLength());
     }
     // remember to track our stats
     nodeData->stats.packetSent(nodeData->getPacketLength());
@@ -205,9 +202,17 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
         // if our view has changed, we need to reset these things...
         if (viewFrustumChanged) {
             if (_myServer->wantDumpVoxelsOnMove() || nodeData->moveShouldDump() || nodeData->hasLodChanged()) {
+                // keep edits from deleting nodes while they're moved between bags
+                VoxelNode* rootNode = _myServer->getServerTree().rootNode;
+                _myServer->getServerTree().lockForEncoding(rootNode);
                 nodeData->dumpOutOfView();
+                _myServer->getServerTree().unlockForEncoding(rootNode);
+            }
+            // the occluders are reprojected into the new view when the scene starts, unless the client's LOD changed
+            // what it has of them
+            if (nodeData->hasLodChanged()) {
+                nodeData->occlusionCache.erase();
             }
-            nodeData->map.erase();
         } 
         
         if (!viewFrustumChanged && !nodeData->getWantDelta()) {
@@ -232,6 +237,19 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
         }
         nodeData->stats.sceneStarted(isFullScene, viewFrustumChanged, _myServer->getServerTree().rootNode, _myServer->getJurisdiction());
 
+        // start the scene with what the client has already been sent in front of it hiding what's behind
+        if (nodeData->getWantOcclusionCulling()) {
+            VoxelNode* rootNode = _myServer->getServerTree().rootNode;
+            _myServer->getServerTree().lockForEncoding(rootNode);
+            nodeData->occlusionCache.sceneStarted(rootNode, nodeData->getCurrentViewFrustum());
+            _myServer->getServerTree().unlockForEncoding(rootNode);
+            nodeData->stats.occludersReused(nodeData->occlusionCache.getOccludersReused(),
+                                            nodeData->occlusionCache.getOccludersDropped(),
+                                            nodeData->occlusionCache.getRebuildTime());
+        } else {
+            nodeData->occlusionCache.erase();
+        }
+
         // This is the start of "resending" the scene.
         bool dontRestartSceneOnMove = false; // this is experimental
         if (dontRestartSceneOnMove) {
@@ -281,10 +299,12 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
                 break;
             }            
             
-            if (!nodeData->nodeBag.isEmpty()) {
-                VoxelNode* subTree = nodeData->nodeBag.extract();
+            // lock just the subtree we're about to encode, so edits elsewhere in the tree can proceed while we encode
+            VoxelNode* subTree = _myServer->getServerTree().extractAndLockForEncoding(nodeData->nodeBag);
+            if (subTree) {
                 bool wantOcclusionCulling = nodeData->getWantOcclusionCulling();
-                CoverageMap* coverageMap = wantOcclusionCulling ? &nodeData->map : IGNORE_COVERAGE_MAP;
+                VoxelOcclusionCache* occlusionCache = wantOcclusionCulling
+                    ? &nodeData->occlusionCache : IGNORE_OCCLUSION_CACHE;
 
                 float voxelSizeScale = nodeData->getVoxelSizeScale();
                 int boundaryLevelAdjustClient = nodeData->getBoundaryLevelAdjust();
@@ -298,17 +318,17 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
                 
                 EncodeBitstreamParams params(INT_MAX, &nodeData->getCurrentViewFrustum(), wantColor, 
                                              WANT_EXISTS_BITS, DONT_CHOP, wantDelta, lastViewFrustum,
-                                             wantOcclusionCulling, coverageMap, boundaryLevelAdjust, voxelSizeScale,
+                                             wantOcclusionCulling, IGNORE_COVERAGE_MAP, boundaryLevelAdjust, voxelSizeScale,
                                              nodeData->getLastTimeBagEmpty(),
-                                             isFullScene, &nodeData->stats, _myServer->getJurisdiction());
+                                             isFullScene, &nodeData->stats, _myServer->getJurisdiction(),
+                                             _myServer->getEncodeCache(), occlusionCache);
                       
 
-                _myServer->getServerTree().lockForRead();
                 nodeData->stats.encodeStarted();
                 bytesWritten = _myServer->getServerTree().encodeTreeBitstream(subTree, _tempOutputBuffer, MAX_VOXEL_PACKET_SIZE - 1,
                                                               nodeData->nodeBag, params);
                 nodeData->stats.encodeStopped();
-                _myServer->getServerTree().unlock();
+                _myServer->getServerTree().unlockForEncoding(subTree);
 
                 if (nodeData->getAvailable() >= bytesWritten) {
                     nodeData->writeToPacket(_tempOutputBuffer, bytesWritten);
@@ -325,6 +345,9 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
             }
         }
         
+        // parts of a lazily loaded tree that we just sent as leaves get decoded now, so the next pass sends what's in them
+        _myServer->getServerTree().decodeRequestedLazySubtrees();
+
         // send the environment packet
         if (shouldSendEnvironments) {
             int numBytesPacketHeader = populateTypeAndVersion(_tempOutputBuffer, PACKET_TYPE_ENVIRONMENT_DATA);
@@ -335,7 +358,7 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
                 envPacketLength += _myServer->getEnvironmentData(i)->getBroadcastData(_tempOutputBuffer + envPacketLength);
             }
             
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(), _tempOutputBuffer, envPacketLength);
+            _packetBatch.add(node->getActiveSocket(), _tempOutputBuffer, envPacketLength);
             trueBytesSent += envPacketLength;
             truePacketsSent++;
             packetsSentThisInterval++;
@@ -363,9 +386,8 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
             nodeData->updateLastKnownViewFrustum();
             nodeData->setViewSent(true);
             if (_myServer->wantsDebugVoxelSending()) {
-                nodeData->map.printStats();
+                nodeData->occlusionCache.printStats();
             }
-            nodeData->map.erase(); // It would be nice if we could save this, and only reset it when the view frustum changes
         }
 
         if (_myServer->wantsDebugVoxelSending()) {
@@ -376,6 +398,9 @@ int VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nod
         
     } // end if bag wasn't empty, and so we sent stuff...
 
+    // everything this pass queued goes out together
+    _packetBatch.send();
+
     return truePacketsSent;
 }
 
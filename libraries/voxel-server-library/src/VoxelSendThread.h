@@ -13,15 +13,20 @@
 
 #include <GenericThread.h>
 #include <NetworkPacket.h>
+#include <UDPSocket.h>
 #include <VoxelTree.h>
 #include <VoxelNodeBag.h>
 #include "VoxelNodeData.h"
 #include "VoxelServer.h"
 
-/// Threaded processor for sending voxel packets to a single client
+/// Threaded processor for sending voxel packets to a single client. The voxel server runs these in non-threaded mode
+/// on the workers of its VoxelSendScheduler.
 class VoxelSendThread : public virtual GenericThread {
 public:
     VoxelSendThread(const QUuid& nodeUUID, VoxelServer* myServer);
+
+    /// when the next call to process() should happen
+    uint64_t getNextSendTime() const { return _nextSendTime; }
 protected:
     /// Implements generic processing behavior for this thread.
     virtual bool process();
@@ -29,11 +34,13 @@ protected:
 private:
     QUuid _nodeUUID;
     VoxelServer* _myServer;
+    uint64_t _nextSendTime;
 
     int handlePacketSend(Node* node, VoxelNodeData* nodeData, int& trueBytesSent, int& truePacketsSent);
     int deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nodeData, bool viewFrustumChanged);
     
     unsigned char _tempOutputBuffer[MAX_VOXEL_PACKET_SIZE];
+    UDPPacketBatch _packetBatch; // the packets from one pass of the distributor, sent together at the end of it
 };
 
 #endif // __voxel_server__VoxelSendThread__
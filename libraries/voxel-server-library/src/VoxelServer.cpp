@@ -69,6 +69,7 @@ VoxelServer::VoxelServer(const unsigned char* dataBuffer, int numBytes) : Assign
     _sendMinimalEnvironment = false;
     _dumpVoxelsOnMove = false;
     _verboseDebug = false;
+    _wantEncodeCache = true;
     _jurisdiction = NULL;
     _jurisdictionSender = NULL;
     _voxelServerPacketProcessor = NULL;
@@ -135,6 +136,8 @@ int VoxelServer::civetwebRequestHandler(struct mg_connection* connection) {
 
     if (strcmp(ri->uri, "/resetStats") == 0 && strcmp(ri->request_method, "GET") == 0) {
         theServer->_voxelServerPacketProcessor->resetStats();
+        theServer->_encodeCache.resetStats();
+        theServer->_sendScheduler.resetStats();
         showStats = true;
     }
     
@@ -221,6 +224,13 @@ int VoxelServer::civetwebRequestHandler(struct mg_connection* connection) {
             }
             mg_printf(connection, "%s", "\r\n");
 
+            if (theServer->wasLoadedLazily()) {
+                const float MEGABYTES = 1000000.f;
+                mg_printf(connection, "Voxels Still On Disk: %d chunks, %.2f MB\r\n",
+                          theServer->_serverTree.getLazySubtreeCount(),
+                          theServer->_serverTree.getLazySubtreeBytes() / MEGABYTES);
+            }
+
         } else {
             mg_printf(connection, "%s", "Voxels not yet loaded...\r\n");
         }
@@ -266,6 +276,8 @@ int VoxelServer::civetwebRequestHandler(struct mg_connection* connection) {
         uint64_t averageLockWaitTimePerVoxel = theServer->_voxelServerPacketProcessor->getAverageLockWaitTimePerVoxel();
         uint64_t totalVoxelsProcessed = theServer->_voxelServerPacketProcessor->getTotalVoxelsProcessed();
         uint64_t totalPacketsProcessed = theServer->_voxelServerPacketProcessor->getTotalPacketsProcessed();
+        uint64_t totalBatchesProcessed = theServer->_voxelServerPacketProcessor->getTotalBatchesProcessed();
+        float averageVoxelsPerBatch = theServer->_voxelServerPacketProcessor->getAverageVoxelsPerBatch();
 
         float averageVoxelsPerPacket = totalPacketsProcessed == 0 ? 0 : totalVoxelsProcessed / totalPacketsProcessed;
 
@@ -275,6 +287,9 @@ int VoxelServer::civetwebRequestHandler(struct mg_connection* connection) {
         mg_printf(connection, "            Total Inbound Voxels: %s voxels\r\n",
             locale.toString((uint)totalVoxelsProcessed).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
         mg_printf(connection, "   Average Inbound Voxels/Packet: %f voxels/packet\r\n", averageVoxelsPerPacket);
+        mg_printf(connection, "              Total Edit Batches: %s batches\r\n",
+            locale.toString((uint)totalBatchesProcessed).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+        mg_printf(connection, "       Average Edit Voxels/Batch: %f voxels/batch\r\n", averageVoxelsPerBatch);
         mg_printf(connection, "     Average Transit Time/Packet: %s usecs\r\n", 
             locale.toString((uint)averageTransitTimePerPacket).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
         mg_printf(connection, "     Average Process Time/Packet: %s usecs\r\n",
@@ -285,6 +300,13 @@ int VoxelServer::civetwebRequestHandler(struct mg_connection* connection) {
             locale.toString((uint)averageProcessTimePerVoxel).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
         mg_printf(connection, "    Average Wait Lock Time/Voxel: %s usecs\r\n", 
             locale.toString((uint)averageLockWaitTimePerVoxel).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+        mg_printf(connection, "     Inbound Packets Waiting Now: %s packets (of %d)\r\n",
+            locale.toString(theServer->_voxelServerPacketProcessor->packetsToProcessCount())
+                .rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData(),
+            theServer->_voxelServerPacketProcessor->getMaxPacketsToProcess());
+        mg_printf(connection, "  Inbound Packets Dropped (Full): %s packets\r\n",
+            locale.toString(theServer->_voxelServerPacketProcessor->getReceivedPacketsDropped())
+                .rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
 
 
         int senderNumber = 0;
@@ -327,6 +349,53 @@ int VoxelServer::civetwebRequestHandler(struct mg_connection* connection) {
         mg_printf(connection, "%s", "\r\n");
         mg_printf(connection, "%s", "\r\n");
 
+        // display send worker stats
+        mg_printf(connection, "%s", "<b>Send Worker Statistics... <a href='/resetStats'>[RESET]</a></b>\r\n");
+        for (int i = 0; i < theServer->_sendScheduler.getWorkerCount(); i++) {
+            const VoxelSendWorker* worker = theServer->_sendScheduler.getWorker(i);
+            mg_printf(connection, "\r\n             Stats for send worker %d\r\n", worker->getWorkerNumber());
+            mg_printf(connection, "                         Clients: %s clients\r\n",
+                locale.toString(worker->getJobCount()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+            mg_printf(connection, "                     Utilization: %s %%\r\n",
+                locale.toString(worker->getUtilization() * AS_PERCENT, 'f', 2).rightJustified(COLUMN_WIDTH, ' ')
+                    .toLocal8Bit().constData());
+            mg_printf(connection, "                        Jobs Run: %s jobs\r\n",
+                locale.toString((uint)worker->getJobsRun()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+            mg_printf(connection, "                     Jobs Stolen: %s jobs\r\n",
+                locale.toString((uint)worker->getJobsStolen()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+            mg_printf(connection, "                       Late Jobs: %s jobs\r\n",
+                locale.toString((uint)worker->getLateJobs()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+            mg_printf(connection, "                Average Lateness: %s usecs\r\n",
+                locale.toString((uint)worker->getAverageLatenessUsecs()).rightJustified(COLUMN_WIDTH, ' ')
+                    .toLocal8Bit().constData());
+        }
+        mg_printf(connection, "%s", "\r\n");
+        mg_printf(connection, "%s", "\r\n");
+
+        // display encode cache stats
+        mg_printf(connection, "%s", "<b>Encode Cache Statistics... <a href='/resetStats'>[RESET]</a></b>\r\n");
+        if (theServer->_wantEncodeCache) {
+            const VoxelEncodeCache& encodeCache = theServer->_encodeCache;
+            mg_printf(connection, "                         Lookups: %s lookups\r\n",
+                locale.toString((uint)encodeCache.getLookups()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+            mg_printf(connection, "                            Hits: %s hits (%5.2f%%)\r\n",
+                locale.toString((uint)encodeCache.getHits()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData(),
+                encodeCache.getHitRate() * AS_PERCENT);
+            mg_printf(connection, "                   Stale Entries: %s entries\r\n",
+                locale.toString((uint)encodeCache.getStaleEntries()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+            mg_printf(connection, "                    Bytes Served: %s bytes\r\n",
+                locale.toString((qulonglong)encodeCache.getBytesServed()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+            mg_printf(connection, "                    Bytes Cached: %s of %s bytes\r\n",
+                locale.toString((qulonglong)encodeCache.getBytesCached()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData(),
+                locale.toString((qulonglong)encodeCache.getMaxBytes()).toLocal8Bit().constData());
+            mg_printf(connection, "                         Entries: %s entries\r\n",
+                locale.toString(encodeCache.getEntryCount()).rightJustified(COLUMN_WIDTH, ' ').toLocal8Bit().constData());
+        } else {
+            mg_printf(connection, "%s", "    Encode cache is disabled (--noEncodeCache)\r\n");
+        }
+        mg_printf(connection, "%s", "\r\n");
+        mg_printf(connection, "%s", "\r\n");
+
         // display memory usage stats
         mg_printf(connection, "%s", "<b>Current Memory Usage Statistics</b>\r\n");
         mg_printf(connection, "\r\nVoxelNode size... %ld bytes\r\n", sizeof(VoxelNode));
@@ -354,6 +423,25 @@ int VoxelServer::civetwebRequestHandler(struct mg_connection* connection) {
         mg_printf(connection, "                         Total:  %8.2f %s\r\n", 
             VoxelNode::getTotalMemoryUsage() / memoryScale, memoryScaleLabel);
 
+        uint64_t residentBytes = getResidentSetSize();
+        uint64_t peakResidentBytes = getPeakResidentSetSize();
+        if (residentBytes > 0) {
+            mg_printf(connection, "%s", "\r\n");
+            mg_printf(connection, "Process Resident Memory:         %8.2f %s\r\n",
+                residentBytes / memoryScale, memoryScaleLabel);
+            mg_printf(connection, "Process Peak Resident Memory:    %8.2f %s\r\n",
+                peakResidentBytes / memoryScale, memoryScaleLabel);
+        }
+
+        const VoxelNodeAllocator& nodeAllocator = theServer->_serverTree.getNodeAllocator();
+        mg_printf(connection, "%s", "\r\n");
+        mg_printf(connection, "Voxel Node Slabs:                %s slabs\r\n",
+            locale.toString(nodeAllocator.getNodeSlabCount()).rightJustified(8, ' ').toLocal8Bit().constData());
+        mg_printf(connection, "External Children Slabs:         %s slabs\r\n",
+            locale.toString(nodeAllocator.getChildrenSlabCount()).rightJustified(8, ' ').toLocal8Bit().constData());
+        mg_printf(connection, "Voxel Nodes Allocated:           %s nodes\r\n",
+            locale.toString((uint)nodeAllocator.getNodesInUse()).rightJustified(8, ' ').toLocal8Bit().constData());
+
         mg_printf(connection, "%s", "\r\n");
         mg_printf(connection, "%s", "VoxelNode Children Population Statistics...\r\n");
         checkSum = 0;
@@ -536,8 +624,6 @@ void VoxelServer::run() {
     
     setvbuf(stdout, NULL, _IOLBF, 0);
 
-    // tell our NodeList about our desire to get notifications
-    nodeList->addHook(&_nodeWatcher);
     nodeList->linkedDataCreateCallback = &attachVoxelNodeDataToNode;
 
     nodeList->startSilentNodeRemovalThread();
@@ -551,6 +637,10 @@ void VoxelServer::run() {
     _verboseDebug =  cmdOptionExists(_argc, _argv, VERBOSE_DEBUG);
     qDebug("verboseDebug=%s\n", debug::valueOf(_verboseDebug));
 
+    const char* NO_ENCODE_CACHE = "--noEncodeCache";
+    _wantEncodeCache = !cmdOptionExists(_argc, _argv, NO_ENCODE_CACHE);
+    qDebug("wantEncodeCache=%s\n", debug::valueOf(_wantEncodeCache));
+
     const char* DEBUG_VOXEL_SENDING = "--debugVoxelSending";
     _debugVoxelSending =  cmdOptionExists(_argc, _argv, DEBUG_VOXEL_SENDING);
     qDebug("debugVoxelSending=%s\n", debug::valueOf(_debugVoxelSending));
@@ -563,6 +653,16 @@ void VoxelServer::run() {
     _shouldShowAnimationDebug =  cmdOptionExists(_argc, _argv, WANT_ANIMATION_DEBUG);
     qDebug("shouldShowAnimationDebug=%s\n", debug::valueOf(_shouldShowAnimationDebug));
 
+    // Loading and saving the whole tree is spread over one thread per core, unless the user asks for some other number
+    const char* CODING_THREADS = "--codingThreads";
+    const char* codingThreads = getCmdOption(_argc, _argv, CODING_THREADS);
+    int codingThreadCount = 0; // one per core
+    if (codingThreads) {
+        codingThreadCount = atoi(codingThreads);
+        qDebug("codingThreads=%d\n", codingThreadCount);
+    }
+    _serverTree.setCodingThreads(codingThreadCount);
+
     // By default we will voxel persist, if you want to disable this, then pass in this parameter
     const char* NO_VOXEL_PERSIST = "--NoVoxelPersist";
     if (cmdOptionExists(_argc, _argv, NO_VOXEL_PERSIST)) {
@@ -611,6 +711,16 @@ void VoxelServer::run() {
         qDebug("packetsPerSecond=%s PACKETS_PER_CLIENT_PER_INTERVAL=%d\n", packetsPerSecond, _packetsPerClientPerInterval);
     }
 
+    // Check to see if the user passed in a command line option for the number of send worker threads
+    const char* SEND_WORKERS = "--sendWorkers";
+    const char* sendWorkers = getCmdOption(_argc, _argv, SEND_WORKERS);
+    int sendWorkerCount = 0; // one per core
+    if (sendWorkers) {
+        sendWorkerCount = atoi(sendWorkers);
+        qDebug("sendWorkers=%d\n", sendWorkerCount);
+    }
+    _sendScheduler.start(sendWorkerCount);
+
     sockaddr senderAddress;
     
     unsigned char* packetData = new unsigned char[MAX_PACKET_SIZE];
@@ -734,6 +844,7 @@ void VoxelServer::run() {
     // call NodeList::clear() so that all of our node specific objects, including our sending threads, are
     // properly shutdown and cleaned up.
     NodeList::getInstance()->clear();
+    _sendScheduler.stop();
     
     if (_jurisdictionSender) {
         _jurisdictionSender->terminate();
@@ -750,9 +861,6 @@ void VoxelServer::run() {
         delete _voxelPersistThread;
     }
     
-    // tell our NodeList we're done with notifications
-    nodeList->removeHook(&_nodeWatcher);
-
     delete _jurisdiction;
     _jurisdiction = NULL;
 
@@ -19,8 +19,8 @@
 
 #include "civetweb.h"
 
-#include "NodeWatcher.h"
 #include "VoxelPersistThread.h"
+#include "VoxelSendScheduler.h"
 #include "VoxelSendThread.h"
 #include "VoxelServerConsts.h"
 #include "VoxelServerPacketProcessor.h"
@@ -48,6 +48,10 @@ public:
 
     VoxelTree& getServerTree() { return _serverTree; }
     JurisdictionMap* getJurisdiction() { return _jurisdiction; }
+    VoxelSendScheduler& getSendScheduler() { return _sendScheduler; }
+
+    /// the encoded subtree cache shared by all send threads, or NULL if it's been turned off with --noEncodeCache
+    VoxelEncodeCache* getEncodeCache() { return _wantEncodeCache ? &_encodeCache : IGNORE_ENCODE_CACHE; }
     
     int getPacketsPerClientPerInterval() const { return _packetsPerClientPerInterval; }
     bool getSendMinimalEnvironment() const { return _sendMinimalEnvironment; }
@@ -59,6 +63,8 @@ public:
     bool isInitialLoadComplete() const { return (_voxelPersistThread) ? _voxelPersistThread->isInitialLoadComplete() : true; }
     time_t* getLoadCompleted() { return (_voxelPersistThread) ? _voxelPersistThread->getLoadCompleted() : NULL; }
     uint64_t getLoadElapsedTime() const { return (_voxelPersistThread) ? _voxelPersistThread->getLoadElapsedTime() : 0; }
+    bool wasLoadedLazily() const { return (_voxelPersistThread) ? _voxelPersistThread->wasLoadedLazily() : false; }
+    VoxelEditLog* getEditLog() { return (_voxelPersistThread) ? &_voxelPersistThread->getEditLog() : NULL; }
     
 private:
     int _argc;
@@ -78,14 +84,15 @@ private:
     bool _sendMinimalEnvironment;
     bool _dumpVoxelsOnMove;
     bool _verboseDebug;
+    bool _wantEncodeCache;
+    VoxelEncodeCache _encodeCache;
     JurisdictionMap* _jurisdiction;
     JurisdictionSender* _jurisdictionSender;
     VoxelServerPacketProcessor* _voxelServerPacketProcessor;
     VoxelPersistThread* _voxelPersistThread;
+    VoxelSendScheduler _sendScheduler;
     EnvironmentData _environmentData[3];
     
-    NodeWatcher _nodeWatcher; // used to cleanup AGENT data when agents are killed
-    
     void parsePayload();
 
     void initMongoose(int port);
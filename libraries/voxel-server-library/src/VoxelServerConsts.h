@@ -22,6 +22,7 @@ const int INTERVALS_PER_SECOND = 60;
 const int VOXEL_SEND_INTERVAL_USECS = (1000 * 1000)/INTERVALS_PER_SECOND;
 const int SENDING_TIME_TO_SPARE = 5 * 1000; // usec of sending interval to spare for calculating voxels
 const int ENVIRONMENT_SEND_INTERVAL_USECS = 1000000;
+const int MAX_VOXEL_EDITS_PER_BATCH = 2000; // bounds how long a batch of edits keeps its part of the tree locked
 
 extern const char* LOCAL_VOXELS_PERSIST_FILE;
 extern const char* VOXELS_PERSIST_FILE;
@@ -8,6 +8,10 @@
 //  Threaded or non-threaded network packet processor for the voxel-server
 //
 
+#include <algorithm>
+#include <cstring>
+
+#include <OctalCode.h>
 #include <PacketHeaders.h>
 #include <PerfStat.h>
 
@@ -24,16 +28,27 @@ VoxelServerPacketProcessor::VoxelServerPacketProcessor(VoxelServer* myServer) :
     _totalProcessTime(0),
     _totalLockWaitTime(0),
     _totalVoxelsInPacket(0),
-    _totalPackets(0)
+    _totalPackets(0),
+    _totalBatches(0),
+    _totalBatchedVoxels(0),
+    _pendingEditsDestructive(false)
 {
 }
 
+VoxelServerPacketProcessor::~VoxelServerPacketProcessor() {
+    for (int i = 0; i < _pendingPackets.size(); i++) {
+        delete[] _pendingPackets[i].editData;
+    }
+}
+
 void VoxelServerPacketProcessor::resetStats() {
     _totalTransitTime = 0;
     _totalProcessTime = 0;
     _totalLockWaitTime = 0;
     _totalVoxelsInPacket = 0;
     _totalPackets = 0;
+    _totalBatches = 0;
+    _totalBatchedVoxels = 0;
     
     _singleSenderStats.clear();
 }
@@ -48,8 +63,16 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
     }
 
     int numBytesPacketHeader = numBytesForPacketHeader(packetData);
+    bool isSetVoxel = (packetData[0] == PACKET_TYPE_SET_VOXEL || packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE);
+
+    // edits have to be applied in the order they arrived, so anything other than more of the same kind of edits
+    // has to wait for the pending batch to go in first
+    if (!_pendingPackets.empty()
+        && (!isSetVoxel || _pendingEditsDestructive != (packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE))) {
+        applyPendingEdits();
+    }
     
-    if (packetData[0] == PACKET_TYPE_SET_VOXEL || packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE) {
+    if (isSetVoxel) {
         bool destructive = (packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE);
         PerformanceWarning warn(_myServer->wantShowAnimationDebug(),
                                 destructive ? "PACKET_TYPE_SET_VOXEL_DESTRUCTIVE" : "PACKET_TYPE_SET_VOXEL",
@@ -62,8 +85,6 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
         uint64_t arrivedAt = usecTimestampNow();
         uint64_t transitTime = arrivedAt - sentAt;
         int voxelsInPacket = 0;
-        uint64_t processTime = 0;
-        uint64_t lockWaitTime = 0;
         
         if (_myServer->wantShowAnimationDebug() || _myServer->wantsDebugVoxelReceiving()) {
             printf("PROCESSING THREAD: got %s - %d command from client receivedBytes=%ld sequence=%d transitTime=%llu usecs\n",
@@ -71,6 +92,12 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
                 _receivedPacketCount, packetLength, sequence, transitTime);
         }
         int atByte = numBytesPacketHeader + sizeof(sequence) + sizeof(sentAt);
+
+        // the packet's buffer goes away when we return, so the batch keeps its own copy of the edit records
+        int editDataOffset = atByte;
+        unsigned char* editData = new unsigned char[std::max((int)packetLength - editDataOffset, 1)];
+        memcpy(editData, packetData + editDataOffset, std::max((int)packetLength - editDataOffset, 0));
+
         unsigned char* voxelData = (unsigned char*)&packetData[atByte];
         while (atByte < packetLength) {
             int maxSize = packetLength - atByte;
@@ -104,21 +131,9 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
                     delete[] vertices;
                 }
 
-                uint64_t startLock = usecTimestampNow();
-                _myServer->getServerTree().lockForWrite();
-                uint64_t startProcess = usecTimestampNow();
-                _myServer->getServerTree().readCodeColorBufferToTree(voxelData, destructive);
-                _myServer->getServerTree().unlock();
-                uint64_t endProcess = usecTimestampNow();
-                
+                _pendingEdits.push_back(editData + (atByte - editDataOffset));
                 voxelsInPacket++;
 
-                uint64_t thisProcessTime = endProcess - startProcess;
-                uint64_t thisLockWaitTime = startProcess - startLock;
-
-                processTime += thisProcessTime;
-                lockWaitTime += thisLockWaitTime;
-
                 // skip to next voxel edit record in the packet
                 voxelData += voxelDataSize;
                 atByte += voxelDataSize;
@@ -148,7 +163,19 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
                 qDebug() << "sender has no known nodeUUID.\n";
             }
         }
-        trackInboundPackets(nodeUUID, sequence, transitTime, voxelsInPacket, processTime, lockWaitTime);
+
+        PendingEditPacket pendingPacket;
+        pendingPacket.nodeUUID = nodeUUID;
+        pendingPacket.sequence = sequence;
+        pendingPacket.transitTime = transitTime;
+        pendingPacket.voxelsInPacket = voxelsInPacket;
+        pendingPacket.editData = editData;
+        _pendingPackets.push_back(pendingPacket);
+        _pendingEditsDestructive = destructive;
+
+        if (!hasPacketsToProcess() || _pendingEdits.size() >= MAX_VOXEL_EDITS_PER_BATCH) {
+            applyPendingEdits();
+        }
 
     } else if (packetData[0] == PACKET_TYPE_ERASE_VOXEL) {
 
@@ -164,8 +191,13 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
                 _receivedPacketCount, packetLength, sequence, transitTime);
         }
 
-        // Send these bits off to the VoxelTree class to process them
+        // Send these bits off to the VoxelTree class to process them, logging them while we hold the lock so that a
+        // snapshot started after they're logged can't miss them
         _myServer->getServerTree().lockForWrite();
+        VoxelEditLog* editLog = _myServer->getEditLog();
+        if (editLog) {
+            editLog->appendEraseVoxels(packetData, packetLength);
+        }
         _myServer->getServerTree().processRemoveVoxelBitstream((unsigned char*)packetData, packetLength);
         _myServer->getServerTree().unlock();
 
@@ -208,6 +240,52 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
     }
 }
 
+void VoxelServerPacketProcessor::applyPendingEdits() {
+    uint64_t processTime = 0;
+    uint64_t lockWaitTime = 0;
+    int voxelsInBatch = _pendingEdits.size();
+
+    if (voxelsInBatch > 0) {
+        // only lock the part of the tree that all of the edits are in
+        int sharedSections = numberOfThreeBitSectionsInCode(_pendingEdits[0]);
+        for (int i = 1; i < voxelsInBatch && sharedSections > 0; i++) {
+            sharedSections = std::min(sharedSections, numberOfSharedSections(_pendingEdits[0], _pendingEdits[i]));
+        }
+        unsigned char* batchCode = ancestorOctalCode(_pendingEdits[0], sharedSections);
+
+        uint64_t startLock = usecTimestampNow();
+        _myServer->getServerTree().lockForEdit(batchCode);
+        uint64_t startProcess = usecTimestampNow();
+
+        // the edits are logged under the edit lock, so a snapshot either waits for them or they're in its new log
+        VoxelEditLog* editLog = _myServer->getEditLog();
+        if (editLog) {
+            editLog->appendSetVoxels(_pendingEdits, _pendingEditsDestructive);
+        }
+        _myServer->getServerTree().readCodeColorBuffersToTree(_pendingEdits, _pendingEditsDestructive);
+        _myServer->getServerTree().unlockForEdit();
+        uint64_t endProcess = usecTimestampNow();
+        delete[] batchCode;
+
+        processTime = endProcess - startProcess;
+        lockWaitTime = startProcess - startLock;
+        _totalBatches++;
+        _totalBatchedVoxels += voxelsInBatch;
+    }
+
+    // each packet is charged its share of the batch's time, by how many of the batch's voxels it had
+    for (int i = 0; i < _pendingPackets.size(); i++) {
+        PendingEditPacket& packet = _pendingPackets[i];
+        uint64_t packetProcessTime = voxelsInBatch ? processTime * packet.voxelsInPacket / voxelsInBatch : 0;
+        uint64_t packetLockWaitTime = voxelsInBatch ? lockWaitTime * packet.voxelsInPacket / voxelsInBatch : 0;
+        trackInboundPackets(packet.nodeUUID, packet.sequence, packet.transitTime, packet.voxelsInPacket,
+                            packetProcessTime, packetLockWaitTime);
+        delete[] packet.editData;
+    }
+    _pendingPackets.clear();
+    _pendingEdits.clear();
+}
+
 void VoxelServerPacketProcessor::trackInboundPackets(const QUuid& nodeUUID, int sequence, uint64_t transitTime, 
             int voxelsInPacket, uint64_t processTime, uint64_t lockWaitTime) {
             
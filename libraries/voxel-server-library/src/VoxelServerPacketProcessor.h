@@ -12,6 +12,7 @@
 #define __voxel_server__VoxelServerPacketProcessor__
 
 #include <map>
+#include <vector>
 
 #include <ReceivedPacketProcessor.h>
 class VoxelServer;
@@ -47,6 +48,7 @@ class VoxelServerPacketProcessor : public ReceivedPacketProcessor {
 
 public:
     VoxelServerPacketProcessor(VoxelServer* myServer);
+    ~VoxelServerPacketProcessor();
 
     uint64_t getAverateTransitTimePerPacket() const { return _totalPackets == 0 ? 0 : _totalTransitTime / _totalPackets; }
     uint64_t getAverageProcessTimePerPacket() const { return _totalPackets == 0 ? 0 : _totalProcessTime / _totalPackets; }
@@ -57,6 +59,9 @@ public:
                 { return _totalVoxelsInPacket == 0 ? 0 : _totalProcessTime / _totalVoxelsInPacket; }
     uint64_t getAverageLockWaitTimePerVoxel() const 
                 { return _totalVoxelsInPacket == 0 ? 0 : _totalLockWaitTime / _totalVoxelsInPacket; }
+    uint64_t getTotalBatchesProcessed() const { return _totalBatches; }
+    float getAverageVoxelsPerBatch() const
+                { return _totalBatches == 0 ? 0 : (float)_totalBatchedVoxels / (float)_totalBatches; }
 
     void resetStats();
 
@@ -66,6 +71,19 @@ protected:
     virtual void processPacket(sockaddr& senderAddress, unsigned char*  packetData, ssize_t packetLength);
 
 private:
+    /// a set voxel packet whose edits are waiting in the current batch
+    class PendingEditPacket {
+    public:
+        QUuid nodeUUID;
+        int sequence;
+        uint64_t transitTime;
+        int voxelsInPacket;
+        unsigned char* editData; // our copy of the packet's edit records
+    };
+
+    /// applies all of the pending edits to the tree under a single lock, and tracks their packets' stats
+    void applyPendingEdits();
+
     void trackInboundPackets(const QUuid& nodeUUID, int sequence, uint64_t transitTime, 
             int voxelsInPacket, uint64_t processTime, uint64_t lockWaitTime);
 
@@ -78,6 +96,15 @@ private:
     uint64_t _totalVoxelsInPacket;
     uint64_t _totalPackets;
     
+    uint64_t _totalBatches;
+    uint64_t _totalBatchedVoxels;
+
     NodeToSenderStatsMap _singleSenderStats;
+
+    // Edits of queued set voxel packets are batched up, and applied together when the queue runs dry or the batch is
+    // full, so the tree is locked and walked once per batch instead of once per voxel
+    std::vector<PendingEditPacket> _pendingPackets;
+    std::vector<unsigned char*> _pendingEdits; // points into the pending packets' editData
+    bool _pendingEditsDestructive;
 };
 #endif // __voxel_server__VoxelServerPacketProcessor__
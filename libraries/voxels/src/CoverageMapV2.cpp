@@ -15,9 +15,6 @@
 
 #include "CoverageMapV2.h"
 
-int CoverageMapV2::_mapCount = 0;
-int CoverageMapV2::_checkMapRootCalls = 0;
-int CoverageMapV2::_notAllInView = 0;
 bool CoverageMapV2::wantDebugging = false;
 
 const BoundingBox CoverageMapV2::ROOT_BOUNDING_BOX = BoundingBox(glm::vec2(-1.f,-1.f), glm::vec2(2.f,2.f));
@@ -57,11 +54,11 @@ CoverageMapV2::CoverageMapV2(BoundingBox boundingBox, bool isRoot, bool isCovere
     _isRoot(isRoot), 
     _myBoundingBox(boundingBox),
     _isCovered(isCovered),
-    _coveredDistance(coverageDistance)
+    _coveredDistance(coverageDistance),
+    _checkMapRootCalls(0),
+    _notAllInView(0)
 { 
-    _mapCount++;
     init(); 
-    //qDebug("CoverageMapV2 created... _mapCount=%d\n",_mapCount);
 };
 
 CoverageMapV2::~CoverageMapV2() {
@@ -79,14 +76,32 @@ void CoverageMapV2::erase() {
 
     if (_isRoot && wantDebugging) {
         qDebug("CoverageMapV2 last to be deleted...\n");
-        qDebug("MINIMUM_POLYGON_AREA_TO_STORE=%f\n",MINIMUM_POLYGON_AREA_TO_STORE);
-        qDebug("_mapCount=%d\n",_mapCount);
-        qDebug("_checkMapRootCalls=%d\n",_checkMapRootCalls);
-        qDebug("_notAllInView=%d\n",_notAllInView);
-        _mapCount = 0;
-        _checkMapRootCalls = 0;
-        _notAllInView = 0;
+        printStats();
     }
+
+    // with the children gone, nothing is covered any more, the root included
+    _isCovered = false;
+    _coveredDistance = NOT_COVERED;
+    _checkMapRootCalls = 0;
+    _notAllInView = 0;
+}
+
+int CoverageMapV2::getMapCount() const {
+    int mapCount = 1;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (_childMaps[i]) {
+            mapCount += _childMaps[i]->getMapCount();
+        }
+    }
+    return mapCount;
+}
+
+void CoverageMapV2::printStats() {
+    qDebug("CoverageMapV2::printStats()...\n");
+    qDebug("MINIMUM_POLYGON_AREA_TO_STORE=%f\n",MINIMUM_POLYGON_AREA_TO_STORE);
+    qDebug("mapCount=%d\n", getMapCount());
+    qDebug("_checkMapRootCalls=%d\n",_checkMapRootCalls);
+    qDebug("_notAllInView=%d\n",_notAllInView);
 }
 
 void CoverageMapV2::init() {
@@ -155,6 +170,12 @@ CoverageMapV2StorageResult CoverageMapV2::checkMap(const VoxelProjectedPolygon*
 void CoverageMapV2::recurseMap(const VoxelProjectedPolygon* polygon, bool storeIt, 
                 bool& seenOccludedMapNodes, bool& allOccludedMapNodesCovered) {
 
+    // once one part of the polygon is known not to be covered, the polygon isn't occluded, and if we aren't storing it
+    // there's nothing left to find out
+    if (!storeIt && seenOccludedMapNodes && !allOccludedMapNodesCovered) {
+        return;
+    }
+
     // if we are really small, then we act like we don't intersect, this allows us to stop
     // recusing as we get to the smalles edge of the polygon
     if (_myBoundingBox.area() < MINIMUM_OCCLUSION_CHECK_AREA) {
@@ -217,11 +238,33 @@ void CoverageMapV2::recurseMap(const VoxelProjectedPolygon* polygon, bool storeI
     // Another case is that we aren't yet marked as covered, and so we should recurse and process smaller quad tree nodes.
     // Note: we use this to determine if we can collapse the child quad trees and mark this node as covered
     bool allChildrenOccluded = true; 
-    float maxChildCoveredDepth = NOT_COVERED;
+    float maxChildCoveredDepth = 0.0f; // the furthest of the children's covered distances
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
         BoundingBox childMapBoundingBox = getChildBoundingBox(i);
-        // if no child map exists yet, then create it
+
+        // A child map that doesn't exist yet would be created with our coverage. If the polygon doesn't reach it, it
+        // would stay that way, so leave it uncreated and count our coverage as its coverage.
         if (!_childMaps[i]) {
+            bool childIsReached = childMapBoundingBox.area() >= MINIMUM_OCCLUSION_CHECK_AREA
+                && (polygon->intersects(childMapBoundingBox) || polygon->occludes(childMapBoundingBox));
+            if (!childIsReached) {
+                if (allChildrenOccluded && _isCovered) {
+                    maxChildCoveredDepth = std::max(maxChildCoveredDepth, _coveredDistance);
+                } else {
+                    allChildrenOccluded = false;
+                }
+                continue;
+            }
+
+            // We know our coverage doesn't cover the polygon, so all a new child could tell us is that the polygon
+            // isn't occluded. When only checking, say so instead of creating it. This can call a sliver of a polygon
+            // not occluded that the child maps would have let through, which only means it gets sent.
+            if (!storeIt) {
+                seenOccludedMapNodes = true;
+                allOccludedMapNodesCovered = false;
+                return;
+            }
+
             // children get created with the coverage state of their parent.
             _childMaps[i] = new CoverageMapV2(childMapBoundingBox, NOT_ROOT, _isCovered, _coveredDistance);
         }
@@ -45,7 +45,10 @@ public:
     void erase(); // erase the coverage map
 
     void render();
-    
+
+    int getMapCount() const; // this map and all of the child maps under it
+    void printStats();
+
 
 private:
     void recurseMap(const VoxelProjectedPolygon* polygon, bool storeIt, 
@@ -60,9 +63,9 @@ private:
     bool                    _isCovered;
     float                   _coveredDistance;
     
-    static int  _mapCount;
-    static int  _checkMapRootCalls;
-    static int  _notAllInView;
+    // only kept by the root, each voxel server send thread has its own map
+    int _checkMapRootCalls;
+    int _notAllInView;
 };
 
 
@@ -0,0 +1,90 @@
+//
+//  JurisdictionIndex.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+
+#include "JurisdictionIndex.h"
+
+JurisdictionIndex::JurisdictionIndex() :
+    _jurisdictions(NULL),
+    _isBuilt(false),
+    _builtAtChangeCount(0) {
+}
+
+void JurisdictionIndex::setJurisdictions(const NodeToJurisdictionMap* jurisdictions) {
+    _jurisdictions = jurisdictions;
+    _isBuilt = false;
+}
+
+bool JurisdictionIndex::isRootBefore(const IndexedRoot& rootA, const IndexedRoot& rootB) {
+    return OctalKey::isBeforeInTree(rootA.key, rootB.key);
+}
+
+void JurisdictionIndex::rebuildIfChanged() {
+    // read before the maps are, so that a map changing while we're building makes us build again next time
+    int changeCount = JurisdictionMap::getChangeCount();
+    if (_isBuilt && _builtAtChangeCount == changeCount) {
+        return;
+    }
+    _roots.clear();
+    _rootLengths.clear();
+    _unindexedMaps.clear();
+
+    if (_jurisdictions) {
+        for (NodeToJurisdictionMap::const_iterator server = _jurisdictions->begin(); server != _jurisdictions->end();
+                server++) {
+            IndexedRoot root;
+            root.key = server->second.getRootKey();
+            root.serverUUID = server->first;
+            root.map = &server->second;
+            if (server->second.hasKeys()) {
+                _roots.push_back(root);
+                _rootLengths.push_back(root.key.getLength());
+            } else {
+                _unindexedMaps.push_back(root);
+            }
+        }
+    }
+    std::sort(_roots.begin(), _roots.end(), isRootBefore);
+    std::sort(_rootLengths.begin(), _rootLengths.end());
+    _rootLengths.erase(std::unique(_rootLengths.begin(), _rootLengths.end()), _rootLengths.end());
+
+    _isBuilt = true;
+    _builtAtChangeCount = changeCount;
+}
+
+void JurisdictionIndex::findServersWithin(const unsigned char* octalCode, std::vector<QUuid>& serverUUIDs) {
+    rebuildIfChanged();
+
+    IndexedRoot ancestor;
+    if (!OctalKey::fromOctalCode(octalCode, ancestor.key)) {
+        // too deep for a key, so every map has to be asked
+        for (int i = 0; i < _roots.size(); i++) {
+            if (_roots[i].map->isMyJurisdiction(octalCode, CHECK_NODE_ONLY) == JurisdictionMap::WITHIN) {
+                serverUUIDs.push_back(_roots[i].serverUUID);
+            }
+        }
+    } else {
+        OctalKey key = ancestor.key;
+        for (int i = 0; i < _rootLengths.size() && _rootLengths[i] <= key.getLength(); i++) {
+            ancestor.key = key.ancestor(_rootLengths[i]);
+            std::vector<IndexedRoot>::const_iterator root = std::lower_bound(_roots.begin(), _roots.end(), ancestor,
+                isRootBefore);
+            for (; root != _roots.end() && root->key == ancestor.key; root++) {
+                if (root->map->isMyJurisdiction(key, CHECK_NODE_ONLY) == JurisdictionMap::WITHIN) {
+                    serverUUIDs.push_back(root->serverUUID);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < _unindexedMaps.size(); i++) {
+        if (_unindexedMaps[i].map->isMyJurisdiction(octalCode, CHECK_NODE_ONLY) == JurisdictionMap::WITHIN) {
+            serverUUIDs.push_back(_unindexedMaps[i].serverUUID);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+//
+//  JurisdictionIndex.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Finds which voxel servers a code is within the jurisdiction of, without asking each server's JurisdictionMap.
+//
+//  The roots of the maps are kept as keys in tree order. A server can only be WITHIN for a code if its root is one of
+//  the code's ancestors, so only those ancestors that are as long as some root are looked up, and only the maps they
+//  turn up are asked about their end nodes. Maps without keys are asked one by one.
+//
+
+#ifndef __hifi__JurisdictionIndex__
+#define __hifi__JurisdictionIndex__
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <QtCore/QUuid>
+
+#include <OctalKey.h>
+
+#include "JurisdictionMap.h"
+
+class JurisdictionIndex {
+public:
+    JurisdictionIndex();
+
+    /// The maps to index, or NULL for none. Their contents can change at any time, the index is rebuilt the next time
+    /// it's used after JurisdictionMap::getChangeCount() has gone up.
+    void setJurisdictions(const NodeToJurisdictionMap* jurisdictions);
+
+    /// adds the UUIDs of the servers the code is WITHIN the jurisdiction of to serverUUIDs
+    void findServersWithin(const unsigned char* octalCode, std::vector<QUuid>& serverUUIDs);
+
+private:
+    class IndexedRoot {
+    public:
+        OctalKey key;
+        QUuid serverUUID;
+        const JurisdictionMap* map;
+    };
+    static bool isRootBefore(const IndexedRoot& rootA, const IndexedRoot& rootB);
+
+    void rebuildIfChanged();
+
+    const NodeToJurisdictionMap* _jurisdictions;
+    bool _isBuilt;
+    int _builtAtChangeCount;
+
+    std::vector<IndexedRoot> _roots; // in tree order
+    std::vector<int> _rootLengths; // every length a root has, shortest first
+    std::vector<IndexedRoot> _unindexedMaps; // maps without keys, which are asked one by one
+};
+
+#endif /* defined(__hifi__JurisdictionIndex__) */
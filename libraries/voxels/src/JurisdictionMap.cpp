@@ -6,6 +6,8 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
+
 #include <QtCore/QSettings>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
@@ -17,6 +19,8 @@
 #include "VoxelNode.h"
 
 
+QAtomicInt JurisdictionMap::_changeCount(0);
+
 // standard assignment
 // copy assignment 
 JurisdictionMap& JurisdictionMap::operator=(const JurisdictionMap& other) {
@@ -26,10 +30,11 @@ JurisdictionMap& JurisdictionMap::operator=(const JurisdictionMap& other) {
 
 #ifdef HAS_MOVE_SEMANTICS
 // Move constructor
-JurisdictionMap::JurisdictionMap(JurisdictionMap&& other) : _rootOctalCode(NULL) {
+JurisdictionMap::JurisdictionMap(JurisdictionMap&& other) : _rootOctalCode(NULL), _hasKeys(false) {
     init(other._rootOctalCode, other._endNodes);
     other._rootOctalCode = NULL;
     other._endNodes.clear();
+    other.updateKeys();
 }
 
 // move assignment
@@ -37,12 +42,13 @@ JurisdictionMap& JurisdictionMap::operator=(JurisdictionMap&& other) {
     init(other._rootOctalCode, other._endNodes);
     other._rootOctalCode = NULL;
     other._endNodes.clear();
+    other.updateKeys();
     return *this;
 }
 #endif
 
 // Copy constructor
-JurisdictionMap::JurisdictionMap(const JurisdictionMap& other) : _rootOctalCode(NULL) {
+JurisdictionMap::JurisdictionMap(const JurisdictionMap& other) : _rootOctalCode(NULL), _hasKeys(false) {
     copyContents(other);
 }
 
@@ -89,9 +95,10 @@ void JurisdictionMap::clear() {
         }
     }
     _endNodes.clear();
+    updateKeys();
 }
 
-JurisdictionMap::JurisdictionMap() : _rootOctalCode(NULL) {
+JurisdictionMap::JurisdictionMap() : _rootOctalCode(NULL), _hasKeys(false) {
     unsigned char* rootCode = new unsigned char[1];
     *rootCode = 0;
     
@@ -99,13 +106,13 @@ JurisdictionMap::JurisdictionMap() : _rootOctalCode(NULL) {
     init(rootCode, emptyEndNodes);
 }
 
-JurisdictionMap::JurisdictionMap(const char* filename) : _rootOctalCode(NULL) {
+JurisdictionMap::JurisdictionMap(const char* filename) : _rootOctalCode(NULL), _hasKeys(false) {
     clear(); // clean up our own memory
     readFromFile(filename);
 }
 
 JurisdictionMap::JurisdictionMap(unsigned char* rootOctalCode, const std::vector<unsigned char*>& endNodes)  
-    : _rootOctalCode(NULL) {
+    : _rootOctalCode(NULL), _hasKeys(false) {
     init(rootOctalCode, endNodes);
 }
 
@@ -141,7 +148,7 @@ void myDebugPrintOctalCode(const unsigned char* octalCode, bool withNewLine) {
 }
 
 
-JurisdictionMap::JurisdictionMap(const char* rootHexCode, const char* endNodesHexCodes) {
+JurisdictionMap::JurisdictionMap(const char* rootHexCode, const char* endNodesHexCodes) : _hasKeys(false) {
 
     qDebug("JurisdictionMap::JurisdictionMap(const char* rootHexCode=[%p] %s, const char* endNodesHexCodes=[%p] %s)\n",
         rootHexCode, rootHexCode, endNodesHexCodes, endNodesHexCodes);
@@ -170,6 +177,7 @@ JurisdictionMap::JurisdictionMap(const char* rootHexCode, const char* endNodesHe
         myDebugPrintOctalCode(endNodeOctcode, true);
 
     }    
+    updateKeys();
 }
 
 
@@ -177,9 +185,40 @@ void JurisdictionMap::init(unsigned char* rootOctalCode, const std::vector<unsig
     clear(); // clean up our own memory
     _rootOctalCode = rootOctalCode;
     _endNodes = endNodes;
+    updateKeys();
+}
+
+void JurisdictionMap::updateKeys() {
+    _endNodeKeys.clear();
+    _hasKeys = OctalKey::fromOctalCode(_rootOctalCode, _rootKey);
+    for (int i = 0; _hasKeys && i < _endNodes.size(); i++) {
+        OctalKey endNodeKey;
+        _hasKeys = OctalKey::fromOctalCode(_endNodes[i], endNodeKey);
+        _endNodeKeys.push_back(endNodeKey);
+    }
+
+    // In tree order, an end node's descendants follow right after it, so once the ones under other end nodes are left
+    // out, the only end node a node can be under is the last one that comes before it.
+    std::sort(_endNodeKeys.begin(), _endNodeKeys.end(), OctalKey::isBeforeInTree);
+    int outermostEndNodes = 0;
+    for (int i = 0; i < _endNodeKeys.size(); i++) {
+        if (outermostEndNodes == 0 || !_endNodeKeys[outermostEndNodes - 1].isAncestorOf(_endNodeKeys[i])) {
+            _endNodeKeys[outermostEndNodes++] = _endNodeKeys[i];
+        }
+    }
+    _endNodeKeys.resize(outermostEndNodes);
+
+    // only once the keys are done, so an index that sees the new count also sees them
+    _changeCount.fetchAndAddOrdered(1);
 }
 
 JurisdictionMap::Area JurisdictionMap::isMyJurisdiction(const unsigned char* nodeOctalCode, int childIndex) const {
+    OctalKey nodeKey;
+    if (_hasKeys && OctalKey::fromOctalCode(nodeOctalCode, nodeKey)
+            && (childIndex == CHECK_NODE_ONLY || nodeKey.getLength() < MAX_OCTAL_KEY_SECTIONS)) {
+        return isMyJurisdiction(nodeKey, childIndex);
+    }
+
     // to be in our jurisdiction, we must be under the root...
 
     // if the node is an ancestor of my root, then we return ABOVE
@@ -202,6 +241,28 @@ JurisdictionMap::Area JurisdictionMap::isMyJurisdiction(const unsigned char* nod
     return isInJurisdiction ? WITHIN : BELOW;
 }
 
+JurisdictionMap::Area JurisdictionMap::isMyJurisdiction(const OctalKey& nodeKey, int childIndex) const {
+    if (!_hasKeys || (childIndex != CHECK_NODE_ONLY && nodeKey.getLength() == MAX_OCTAL_KEY_SECTIONS)) {
+        unsigned char nodeOctalCode[MAX_OCTAL_KEY_CODE_BYTES];
+        nodeKey.toOctalCode(nodeOctalCode);
+        return isMyJurisdiction(nodeOctalCode, childIndex);
+    }
+
+    // the same checks as for the codes, each a couple of word compares, and a binary search for the end node
+    if (nodeKey.isAncestorOf(_rootKey)) {
+        return ABOVE;
+    }
+    bool isInJurisdiction = _rootKey.isAncestorOf(childIndex == CHECK_NODE_ONLY ? nodeKey : nodeKey.child(childIndex));
+    if (isInJurisdiction) {
+        std::vector<OctalKey>::const_iterator endNodeAfter = std::upper_bound(_endNodeKeys.begin(),
+            _endNodeKeys.end(), nodeKey, OctalKey::isBeforeInTree);
+        if (endNodeAfter != _endNodeKeys.begin() && (endNodeAfter - 1)->isAncestorOf(nodeKey)) {
+            isInJurisdiction = false;
+        }
+    }
+    return isInJurisdiction ? WITHIN : BELOW;
+}
+
 
 bool JurisdictionMap::readFromFile(const char* filename) {
     QString     settingsFile(filename);
@@ -226,6 +287,7 @@ bool JurisdictionMap::readFromFile(const char* filename) {
         _endNodes.push_back(octcode);
     }
     settings.endGroup();
+    updateKeys();
     return true;
 }
 
@@ -348,6 +410,7 @@ int JurisdictionMap::unpackFromMessage(unsigned char* sourceBuffer, int availabl
             }
         }
     }
+    updateKeys();
     
     return sourceBuffer - startPosition; // includes header!
 }
@@ -13,9 +13,12 @@
 #include <stdint.h>
 #include <vector>
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QString>
 #include <QtCore/QUuid>
 
+#include <OctalKey.h>
+
 class JurisdictionMap {
 public:
     enum Area {
@@ -45,6 +48,17 @@ public:
 
     Area isMyJurisdiction(const unsigned char* nodeOctalCode, int childIndex) const;
 
+    /// same as above for a node whose code is already a key, for callers checking one code against many maps
+    Area isMyJurisdiction(const OctalKey& nodeKey, int childIndex) const;
+
+    /// whether the root and end nodes are kept as keys, which they are unless there's no root or a code is too deep
+    bool hasKeys() const { return _hasKeys; }
+    const OctalKey& getRootKey() const { return _rootKey; }
+
+    /// goes up every time any map's root or end nodes change, or a map goes away, so indices of maps can tell when
+    /// they're out of date. Maps can change on any thread, so compare counts for equality only, they wrap around.
+    static int getChangeCount() { return _changeCount.loadAcquire(); }
+
     bool writeToFile(const char* filename);
     bool readFromFile(const char* filename);
 
@@ -67,8 +81,17 @@ private:
     void clear();
     void init(unsigned char* rootOctalCode, const std::vector<unsigned char*>& endNodes);
 
+    // keeps keys for the root and end nodes in step with their codes, call whenever the codes change
+    void updateKeys();
+
     unsigned char* _rootOctalCode;
     std::vector<unsigned char*> _endNodes;
+
+    bool _hasKeys; // false when there's no root, or a code is too deep for a key, so the codes have to be used
+    OctalKey _rootKey;
+    std::vector<OctalKey> _endNodeKeys; // in tree order, leaving out end nodes under other end nodes
+
+    static QAtomicInt _changeCount;
 };
 
 /// Map between node IDs and their reported JurisdictionMap. Typically used by classes that need to know which nodes are 
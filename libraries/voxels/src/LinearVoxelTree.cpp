@@ -0,0 +1,497 @@
+//
+//  LinearVoxelTree.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <QtCore/QDebug>
+
+#include <OctalCode.h>
+#include <SharedUtil.h>
+
+#include "JurisdictionMap.h"
+#include "LinearVoxelTree.h"
+
+// appends a three bit section for childIndex to an octal code that has room for it
+static void appendOctalCodeSection(unsigned char* octalCode, int childIndex) {
+    int startBit = octalCode[0] * BITS_IN_OCTAL;
+    for (int i = 0; i < BITS_IN_OCTAL; i++) {
+        int bit = startBit + i;
+        unsigned char& byte = octalCode[1 + (bit / BITS_IN_BYTE)];
+        unsigned char mask = 1 << (BITS_IN_BYTE - 1 - (bit % BITS_IN_BYTE));
+        if (childIndex & (1 << (BITS_IN_OCTAL - 1 - i))) {
+            byte |= mask;
+        } else {
+            byte &= ~mask;
+        }
+    }
+    octalCode[0]++;
+}
+
+// releases any excess capacity, since these vectors are never added to after being built
+template<typename T> static void trimVector(std::vector<T>& vector) {
+    std::vector<T>(vector).swap(vector);
+}
+
+LinearVoxelTree::LinearVoxelTree() :
+    _lastChanged(0)
+{
+    memset(&_rootCode[0], 0, sizeof(_rootCode));
+}
+
+void LinearVoxelTree::clear() {
+    std::vector<unsigned char>().swap(_childMasks);
+    std::vector<uint32_t>().swap(_firstChildren);
+    std::vector<unsigned char>().swap(_colors);
+    memset(&_rootCode[0], 0, sizeof(_rootCode));
+    _rootCorner = glm::vec3(0.0f, 0.0f, 0.0f);
+    _lastChanged = 0;
+}
+
+void LinearVoxelTree::buildFromTree(const VoxelNode* sourceRoot) {
+    clear();
+    if (!sourceRoot) {
+        return;
+    }
+
+    const unsigned char* rootCode = sourceRoot->getOctalCode();
+    int rootSections = numberOfThreeBitSectionsInCode(rootCode);
+    if (rootSections > MAX_LINEAR_VOXEL_TREE_SECTIONS) {
+        qDebug("LinearVoxelTree::buildFromTree() root is deeper than %d levels, nothing to build\n",
+               MAX_LINEAR_VOXEL_TREE_SECTIONS);
+        return;
+    }
+    memcpy(&_rootCode[0], rootCode, bytesRequiredForCodeLength(rootSections));
+    _rootCorner = sourceRoot->getCorner();
+
+    // walk the source tree one level at a time, each level's children are appended in parent order, so the children
+    // of any node end up contiguous and in child index order
+    std::vector<const VoxelNode*> thisLevel;
+    std::vector<const VoxelNode*> nextLevel;
+    thisLevel.push_back(sourceRoot);
+    uint32_t nextIndex = 1;
+    bool droppedDeepNodes = false;
+
+    for (int sections = rootSections; !thisLevel.empty(); sections++) {
+        bool canHaveChildren = sections < MAX_LINEAR_VOXEL_TREE_SECTIONS;
+        nextLevel.clear();
+
+        for (size_t i = 0; i < thisLevel.size(); i++) {
+            const VoxelNode* node = thisLevel[i];
+            unsigned char childMask = 0;
+
+            _firstChildren.push_back(nextIndex);
+            if (canHaveChildren) {
+                for (int childIndex = 0; childIndex < NUMBER_OF_CHILDREN; childIndex++) {
+                    VoxelNode* childNode = node->getChildAtIndex(childIndex);
+                    if (childNode) {
+                        setAtBit(childMask, childIndex);
+                        nextLevel.push_back(childNode);
+                        nextIndex++;
+                    }
+                }
+            } else if (!node->isLeaf()) {
+                droppedDeepNodes = true;
+            }
+            _childMasks.push_back(childMask);
+
+            const nodeColor& color = node->getColor();
+            _colors.push_back(color[RED_INDEX]);
+            _colors.push_back(color[GREEN_INDEX]);
+            _colors.push_back(color[BLUE_INDEX]);
+            _colors.push_back(node->isColored() ? 1 : 0);
+
+            _lastChanged = std::max(_lastChanged, node->getLastChanged());
+        }
+        thisLevel.swap(nextLevel);
+    }
+
+    if (droppedDeepNodes) {
+        qDebug("LinearVoxelTree::buildFromTree() dropped nodes deeper than %d levels\n", MAX_LINEAR_VOXEL_TREE_SECTIONS);
+    }
+
+    trimVector(_childMasks);
+    trimVector(_firstChildren);
+    trimVector(_colors);
+}
+
+uint64_t LinearVoxelTree::getMemoryUsage() const {
+    return sizeof(*this) + _childMasks.capacity() * sizeof(unsigned char)
+        + _firstChildren.capacity() * sizeof(uint32_t) + _colors.capacity() * sizeof(unsigned char);
+}
+
+LinearVoxelNodeRef LinearVoxelTree::getRoot() const {
+    LinearVoxelNodeRef root;
+    root.index = 0;
+    root.corner = _rootCorner;
+    memcpy(&root.octalCode[0], &_rootCode[0], sizeof(root.octalCode));
+    return root;
+}
+
+void LinearVoxelTree::makeChildRef(const LinearVoxelNodeRef& node, int childIndex, uint32_t index,
+                                   LinearVoxelNodeRef& childRef) const {
+    float halfScale = node.getScale() * 0.5f;
+    childRef = node;
+    childRef.index = index;
+    // the three bits of the child index are the x, y and z halves of the parent, same as copyFirstVertexForCode()
+    childRef.corner.x += (childIndex & 4) ? halfScale : 0.0f;
+    childRef.corner.y += (childIndex & 2) ? halfScale : 0.0f;
+    childRef.corner.z += (childIndex & 1) ? halfScale : 0.0f;
+    appendOctalCodeSection(&childRef.octalCode[0], childIndex);
+}
+
+bool LinearVoxelTree::getChildAtIndex(const LinearVoxelNodeRef& node, int childIndex, LinearVoxelNodeRef& childRef) const {
+    unsigned char childMask = _childMasks[node.index];
+    if (!oneAtBit(childMask, childIndex)) {
+        return false;
+    }
+    // children are stored in child index order, so our offset is the number of children before us
+    unsigned char childrenBefore = childIndex ? (childMask >> (BITS_IN_BYTE - childIndex)) : 0;
+    makeChildRef(node, childIndex, _firstChildren[node.index] + numberOfOnes(childrenBefore), childRef);
+    return true;
+}
+
+// matches VoxelNode::calculateShouldRender(), scaledBox is the node's box in meters
+bool LinearVoxelTree::calculateShouldRender(const LinearVoxelNodeRef& node, const AABox& scaledBox,
+                                            const ViewFrustum& viewFrustum, float voxelSizeScale,
+                                            int boundaryLevelAdjust) const {
+    bool shouldRender = false;
+    if (isColored(node)) {
+        glm::vec3 temp = viewFrustum.getPosition() - viewFrustum.getFurthestPointFromCamera(scaledBox);
+        float furthestDistance = sqrtf(glm::dot(temp, temp));
+        float boundary         = boundaryDistanceForRenderLevel(node.getLevel() + boundaryLevelAdjust, voxelSizeScale);
+        float childBoundary    = boundaryDistanceForRenderLevel(node.getLevel() + 1 + boundaryLevelAdjust, voxelSizeScale);
+        bool  inBoundary       = (furthestDistance <= boundary);
+        bool  inChildBoundary  = (furthestDistance <= childBoundary);
+        shouldRender = (isLeaf(node) && inChildBoundary) || (inBoundary && !inChildBoundary);
+    }
+    return shouldRender;
+}
+
+static float distanceToCamera(const AABox& scaledBox, const ViewFrustum& viewFrustum) {
+    glm::vec3 temp = viewFrustum.getPosition() - scaledBox.calcCenter();
+    return sqrtf(glm::dot(temp, temp));
+}
+
+int LinearVoxelTree::encodeTreeBitstream(const LinearVoxelNodeRef& node, unsigned char* outputBuffer, int availableBytes,
+                                         LinearVoxelNodeBag& bag, EncodeBitstreamParams& params) const {
+
+    // How many bytes have we written so far at this level;
+    int bytesWritten = 0;
+
+    if (isEmpty()) {
+        return bytesWritten;
+    }
+
+    // If we're at a node that is out of view, then we can return, because no nodes below us will be in view!
+    if (params.viewFrustum) {
+        AABox box = node.getAABox();
+        box.scale(TREE_SCALE);
+        if (params.viewFrustum->boxInFrustum(box) == ViewFrustum::OUTSIDE) {
+            return bytesWritten;
+        }
+    }
+
+    // write the octal code
+    int codeLength;
+    if (params.chopLevels) {
+        unsigned char* newCode = chopOctalCode(node.getOctalCode(), params.chopLevels);
+        if (newCode) {
+            codeLength = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(newCode));
+            memcpy(outputBuffer, newCode, codeLength);
+            delete[] newCode;
+        } else {
+            codeLength = 1; // chopped to root!
+            *outputBuffer = 0; // root
+        }
+    } else {
+        codeLength = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(node.getOctalCode()));
+        memcpy(outputBuffer, node.getOctalCode(), codeLength);
+    }
+
+    outputBuffer += codeLength; // move the pointer
+    bytesWritten += codeLength; // keep track of byte count
+    availableBytes -= codeLength; // keep track or remaining space
+
+    int currentEncodeLevel = 0;
+    int childBytesWritten = encodeTreeBitstreamRecursion(node, outputBuffer, availableBytes, bag, params,
+                                                         currentEncodeLevel);
+
+    // if includeColor and childBytesWritten == 2, then it can only mean that the lower level trees don't exist or for
+    // some reason couldn't be written... so reset them here... This isn't true for the non-color included case
+    if (params.includeColor && childBytesWritten == 2) {
+        childBytesWritten = 0;
+    }
+
+    // if we wrote child bytes, then return our result of all bytes written, otherwise pretend like we also didn't
+    // write our octal code
+    if (childBytesWritten) {
+        bytesWritten += childBytesWritten;
+    } else {
+        bytesWritten = 0;
+    }
+    return bytesWritten;
+}
+
+// This follows VoxelTree::encodeTreeBitstreamRecursion() decision for decision, see the comments there for the details.
+int LinearVoxelTree::encodeTreeBitstreamRecursion(const LinearVoxelNodeRef& node, unsigned char* outputBuffer,
+                                                  int availableBytes, LinearVoxelNodeBag& bag,
+                                                  EncodeBitstreamParams& params, int& currentEncodeLevel) const {
+    int bytesAtThisLevel = 0;
+
+    currentEncodeLevel++;
+    params.maxLevelReached = std::max(currentEncodeLevel, params.maxLevelReached);
+    if (currentEncodeLevel >= params.maxEncodeLevel) {
+        return bytesAtThisLevel;
+    }
+
+    // the node's jurisdiction holds for its children too, see VoxelTree::encodeTreeBitstreamRecursion()
+    JurisdictionMap::Area nodeJurisdiction = JurisdictionMap::WITHIN;
+    if (params.jurisdictionMap) {
+        nodeJurisdiction = params.jurisdictionMap->isMyJurisdiction(node.getOctalCode(), CHECK_NODE_ONLY);
+        if (JurisdictionMap::BELOW == nodeJurisdiction) {
+            return bytesAtThisLevel;
+        }
+    }
+
+    bool nodeIsLeaf = isLeaf(node);
+    bool deltaViewFrustum = params.deltaViewFrustum && params.lastViewFrustum;
+    bool nodeHasChanged = hasChangedSince(params.lastViewFrustumSent - CHANGE_FUDGE);
+
+    if (params.viewFrustum) {
+        AABox box = node.getAABox();
+        box.scale(TREE_SCALE);
+
+        float distance = distanceToCamera(box, *params.viewFrustum);
+        float boundaryDistance = boundaryDistanceForRenderLevel(node.getLevel() + params.boundaryLevelAdjust,
+                                                                params.voxelSizeScale);
+        if (distance >= boundaryDistance) {
+            return bytesAtThisLevel;
+        }
+        if (params.viewFrustum->boxInFrustum(box) == ViewFrustum::OUTSIDE) {
+            return bytesAtThisLevel;
+        }
+
+        bool wasInView = false;
+        if (deltaViewFrustum) {
+            ViewFrustum::location location = params.lastViewFrustum->boxInFrustum(box);
+            if (nodeIsLeaf) {
+                wasInView = location != ViewFrustum::OUTSIDE;
+            } else {
+                wasInView = location == ViewFrustum::INSIDE;
+            }
+            if (wasInView && distanceToCamera(box, *params.lastViewFrustum) >= boundaryDistance) {
+                wasInView = false;
+            }
+        }
+        if (wasInView && !(params.deltaViewFrustum && nodeHasChanged)) {
+            return bytesAtThisLevel;
+        }
+        if (!params.forceSendScene && !params.deltaViewFrustum && !nodeHasChanged) {
+            return bytesAtThisLevel;
+        }
+    }
+
+    unsigned char childrenExistInTreeBits = 0;
+    unsigned char childrenExistInPacketBits = 0;
+    unsigned char childrenColoredBits = 0;
+
+    const int CHILD_COLOR_MASK_BYTES = sizeof(childrenColoredBits);
+    const int BYTES_PER_COLOR = 3;
+    const int CHILD_TREE_EXISTS_BYTES = sizeof(childrenExistInTreeBits) + sizeof(childrenExistInPacketBits);
+    const int MAX_LEVEL_BYTES = CHILD_COLOR_MASK_BYTES + NUMBER_OF_CHILDREN * BYTES_PER_COLOR + CHILD_TREE_EXISTS_BYTES;
+
+    unsigned char thisLevelBuffer[MAX_LEVEL_BYTES];
+    unsigned char* writeToThisLevelBuffer = &thisLevelBuffer[0];
+
+    int inViewNotLeafCount = 0;
+
+    unsigned char childMask = _childMasks[node.index];
+    uint32_t nextChildIndex = _firstChildren[node.index];
+    LinearVoxelNodeRef children[NUMBER_OF_CHILDREN];
+
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        bool childExists = oneAtBit(childMask, i);
+
+        bool notMyJurisdiction = false;
+        if (params.jurisdictionMap) {
+            notMyJurisdiction = (nodeJurisdiction != JurisdictionMap::WITHIN);
+        }
+        if (params.includeExistsBits && (childExists || notMyJurisdiction)) {
+            childrenExistInTreeBits += (1 << (7 - i));
+        }
+
+        if (!childExists) {
+            continue;
+        }
+        LinearVoxelNodeRef& child = children[i];
+        makeChildRef(node, i, nextChildIndex++, child);
+        bool childIsLeaf = isLeaf(child);
+
+        AABox childBox = child.getAABox();
+        childBox.scale(TREE_SCALE);
+        if (params.viewFrustum && params.viewFrustum->boxInFrustum(childBox) == ViewFrustum::OUTSIDE) {
+            continue;
+        }
+
+        if (!childIsLeaf) {
+            childrenExistInPacketBits += (1 << (7 - i));
+            inViewNotLeafCount++;
+        }
+
+        bool shouldRender = !params.viewFrustum
+                            ? true
+                            : calculateShouldRender(child, childBox, *params.viewFrustum,
+                                                    params.voxelSizeScale, params.boundaryLevelAdjust);
+        if (shouldRender) {
+            bool childWasInView = false;
+            if (deltaViewFrustum) {
+                ViewFrustum::location location = params.lastViewFrustum->boxInFrustum(childBox);
+                if (childIsLeaf) {
+                    childWasInView = location != ViewFrustum::OUTSIDE;
+                } else {
+                    childWasInView = location == ViewFrustum::INSIDE;
+                }
+            }
+            if (!childWasInView || (params.deltaViewFrustum && nodeHasChanged)) {
+                childrenColoredBits += (1 << (7 - i));
+            }
+        }
+    }
+
+    *writeToThisLevelBuffer = childrenColoredBits;
+    writeToThisLevelBuffer += sizeof(childrenColoredBits);
+    bytesAtThisLevel += sizeof(childrenColoredBits);
+
+    if (params.includeColor) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(childrenColoredBits, i)) {
+                memcpy(writeToThisLevelBuffer, &getColor(children[i]), BYTES_PER_COLOR);
+                writeToThisLevelBuffer += BYTES_PER_COLOR;
+                bytesAtThisLevel += BYTES_PER_COLOR;
+            }
+        }
+    }
+
+    if (params.includeExistsBits) {
+        *writeToThisLevelBuffer = childrenExistInTreeBits;
+        writeToThisLevelBuffer += sizeof(childrenExistInTreeBits);
+        bytesAtThisLevel += sizeof(childrenExistInTreeBits);
+    }
+
+    *writeToThisLevelBuffer = childrenExistInPacketBits;
+    bytesAtThisLevel += sizeof(childrenExistInPacketBits);
+
+    if (availableBytes >= bytesAtThisLevel) {
+        memcpy(outputBuffer, &thisLevelBuffer[0], bytesAtThisLevel);
+        outputBuffer   += bytesAtThisLevel;
+        availableBytes -= bytesAtThisLevel;
+    } else {
+        bag.insert(node);
+        return 0;
+    }
+
+    if (inViewNotLeafCount > 0) {
+        unsigned char* childExistsPlaceHolder = outputBuffer - sizeof(childrenExistInPacketBits);
+
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(childrenExistInPacketBits, i)) {
+                int thisLevel = currentEncodeLevel;
+                int childTreeBytesOut = encodeTreeBitstreamRecursion(children[i], outputBuffer, availableBytes, bag,
+                                                                     params, thisLevel);
+
+                // a child tree of just 2 bytes had no colors and no child trees, so treat it as empty
+                if (params.includeColor && !params.includeExistsBits && childTreeBytesOut == 2) {
+                    childTreeBytesOut = 0;
+                }
+
+                bytesAtThisLevel += childTreeBytesOut;
+                availableBytes -= childTreeBytesOut;
+                outputBuffer += childTreeBytesOut;
+
+                // if the child didn't write anything, take its bit back out of our exists in packet mask
+                if (childTreeBytesOut == 0) {
+                    childrenExistInPacketBits -= (1 << (7 - i));
+                    *childExistsPlaceHolder = childrenExistInPacketBits;
+                }
+            }
+        }
+    }
+
+    return bytesAtThisLevel;
+}
+
+bool LinearVoxelTree::findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
+                                          LinearVoxelNodeRef& node, float& distance, BoxFace& face) const {
+    if (isEmpty()) {
+        return false;
+    }
+    glm::vec3 scaledOrigin = origin / (float)TREE_SCALE;
+    bool found = false;
+    float foundDistance = 0.0f; // in voxel units
+
+    std::vector<LinearVoxelNodeRef> stack;
+    stack.push_back(getRoot());
+    while (!stack.empty()) {
+        LinearVoxelNodeRef current = stack.back();
+        stack.pop_back();
+
+        float boxDistance;
+        BoxFace boxFace;
+        if (!current.getAABox().findRayIntersection(scaledOrigin, direction, boxDistance, boxFace)) {
+            continue;
+        }
+        // nothing in this box can be closer than what we already have
+        if (found && boxDistance >= foundDistance) {
+            continue;
+        }
+        unsigned char childMask = _childMasks[current.index];
+        if (childMask) {
+            uint32_t nextChildIndex = _firstChildren[current.index];
+            for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+                if (oneAtBit(childMask, i)) {
+                    stack.push_back(LinearVoxelNodeRef());
+                    makeChildRef(current, i, nextChildIndex++, stack.back());
+                }
+            }
+        } else if (isColored(current)) {
+            node = current;
+            foundDistance = boxDistance;
+            face = boxFace;
+            found = true;
+        }
+    }
+    if (found) {
+        distance = foundDistance * TREE_SCALE;
+    }
+    return found;
+}
+
+void LinearVoxelTree::writeToSVOFile(const char* fileName) const {
+    std::ofstream file(fileName, std::ios::out|std::ios::binary);
+
+    if (file.is_open()) {
+        qDebug("saving to file %s...\n", fileName);
+
+        LinearVoxelNodeBag nodeBag;
+        if (!isEmpty()) {
+            nodeBag.insert(getRoot());
+        }
+
+        static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
+        int bytesWritten = 0;
+
+        while (!nodeBag.isEmpty()) {
+            LinearVoxelNodeRef subTree = nodeBag.extract();
+            EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+            bytesWritten = encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, nodeBag, params);
+            file.write((const char*)&outputBuffer[0], bytesWritten);
+        }
+    }
+    file.close();
+}
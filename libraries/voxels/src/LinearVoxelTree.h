@@ -0,0 +1,116 @@
+//
+//  LinearVoxelTree.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A compact, read only snapshot of a VoxelTree. Nodes are laid out breadth first in flat arrays of child masks,
+//  colors and first child offsets, and the children of a node are stored contiguously in child index order. Boxes,
+//  levels and octal codes aren't stored at all, they're computed on the fly while walking down from the root. This is
+//  intended for servers serving a mostly static world, where the per node overhead of VoxelNode (box, octal code,
+//  child pointers, and client only rendering state) dominates memory use.
+//
+
+#ifndef __hifi__LinearVoxelTree__
+#define __hifi__LinearVoxelTree__
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "AABox.h"
+#include "VoxelNode.h"
+#include "VoxelTree.h"
+
+/// deepest level (in octal code sections) that a LinearVoxelTree will hold, deeper nodes are dropped when building
+const int MAX_LINEAR_VOXEL_TREE_SECTIONS = 32;
+const int MAX_LINEAR_VOXEL_TREE_CODE_BYTES = 1 + ((MAX_LINEAR_VOXEL_TREE_SECTIONS * 3) + 7) / 8;
+
+/// A lightweight handle to a node in a LinearVoxelTree. Carries everything about the node that depends on its path
+/// from the root, so that the tree itself doesn't have to store it.
+class LinearVoxelNodeRef {
+public:
+    uint32_t index;
+    glm::vec3 corner; // in voxel units (0.0 to 1.0)
+    unsigned char octalCode[MAX_LINEAR_VOXEL_TREE_CODE_BYTES];
+
+    const unsigned char* getOctalCode() const { return &octalCode[0]; }
+    int getLevel() const { return octalCode[0] + 1; } // matches VoxelNode::getLevel()
+    float getScale() const { return ldexpf(1.0f, -octalCode[0]); } // a shift would overflow at 32 sections
+    AABox getAABox() const { return AABox(corner, getScale()); }
+};
+
+/// Holds subtrees of a LinearVoxelTree that didn't fit in a packet, like VoxelNodeBag does for VoxelTree. Since a
+/// LinearVoxelTree never changes, this doesn't need to listen for deletes.
+class LinearVoxelNodeBag {
+public:
+    void insert(const LinearVoxelNodeRef& node) { _elements.push_back(node); }
+    LinearVoxelNodeRef extract() { LinearVoxelNodeRef node = _elements.back(); _elements.pop_back(); return node; }
+    bool isEmpty() const { return _elements.empty(); }
+    int count() const { return _elements.size(); }
+    void deleteAll() { _elements.clear(); }
+
+private:
+    std::vector<LinearVoxelNodeRef> _elements;
+};
+
+class LinearVoxelTree {
+public:
+    LinearVoxelTree();
+
+    /// replaces the contents of this tree with a snapshot of the subtree starting at sourceRoot, caller must hold at
+    /// least a read lock on the source tree
+    void buildFromTree(const VoxelNode* sourceRoot);
+    void clear();
+
+    bool isEmpty() const { return _childMasks.empty(); }
+    unsigned long getNodeCount() const { return _childMasks.size(); }
+    uint64_t getMemoryUsage() const;
+
+    /// the most recent VoxelNode::getLastChanged() of any node in the snapshot, used for all nodes when deciding if
+    /// a node has changed since it was last sent
+    uint64_t getLastChanged() const { return _lastChanged; }
+    bool hasChangedSince(uint64_t time) const { return (_lastChanged > time); }
+
+    LinearVoxelNodeRef getRoot() const;
+    unsigned char getChildMask(const LinearVoxelNodeRef& node) const { return _childMasks[node.index]; }
+    bool isLeaf(const LinearVoxelNodeRef& node) const { return _childMasks[node.index] == 0; }
+    bool isColored(const LinearVoxelNodeRef& node) const { return getColor(node)[3] == 1; }
+    const nodeColor& getColor(const LinearVoxelNodeRef& node) const {
+        return *(const nodeColor*)&_colors[node.index * sizeof(nodeColor)];
+    }
+
+    /// fills in childRef for the child at childIndex, returns false if there is no such child
+    bool getChildAtIndex(const LinearVoxelNodeRef& node, int childIndex, LinearVoxelNodeRef& childRef) const;
+
+    /// produces the same wire format as VoxelTree::encodeTreeBitstream(). Note: occlusion culling and scene stats are
+    /// not supported, wantOcclusionCulling and stats are ignored.
+    int encodeTreeBitstream(const LinearVoxelNodeRef& node, unsigned char* outputBuffer, int availableBytes,
+                            LinearVoxelNodeBag& bag, EncodeBitstreamParams& params) const;
+
+    bool findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
+                             LinearVoxelNodeRef& node, float& distance, BoxFace& face) const;
+
+    void writeToSVOFile(const char* filename) const;
+
+private:
+    int encodeTreeBitstreamRecursion(const LinearVoxelNodeRef& node, unsigned char* outputBuffer, int availableBytes,
+                                     LinearVoxelNodeBag& bag, EncodeBitstreamParams& params, int& currentEncodeLevel) const;
+
+    void makeChildRef(const LinearVoxelNodeRef& node, int childIndex, uint32_t index, LinearVoxelNodeRef& childRef) const;
+    bool calculateShouldRender(const LinearVoxelNodeRef& node, const AABox& scaledBox, const ViewFrustum& viewFrustum,
+                               float voxelSizeScale, int boundaryLevelAdjust) const;
+
+    // one entry per node, in breadth first order. Child masks use the same bit order as the wire format.
+    std::vector<unsigned char> _childMasks;
+    std::vector<uint32_t> _firstChildren;
+    std::vector<unsigned char> _colors; // sizeof(nodeColor) bytes per node
+
+    unsigned char _rootCode[MAX_LINEAR_VOXEL_TREE_CODE_BYTES];
+    glm::vec3 _rootCorner;
+
+    uint64_t _lastChanged;
+};
+
+#endif /* defined(__hifi__LinearVoxelTree__) */
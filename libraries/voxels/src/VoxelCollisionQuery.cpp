@@ -0,0 +1,68 @@
+//
+//  VoxelCollisionQuery.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include "GeometryUtil.h"
+#include "VoxelConstants.h"
+
+#include "VoxelCollisionQuery.h"
+
+VoxelCollisionQuery::VoxelCollisionQuery() :
+    _shapeCount(0),
+    _cachedTree(NULL),
+    _cachedAt(0),
+    _wasCacheUsed(false)
+{
+}
+
+void VoxelCollisionQuery::clearShapes() {
+    _shapeCount = 0;
+}
+
+int VoxelCollisionQuery::addSphere(const glm::vec3& center, float radius) {
+    int shape = addCapsule(center, center, radius);
+    _shapes[shape].isSphere = true;
+    return shape;
+}
+
+int VoxelCollisionQuery::addCapsule(const glm::vec3& start, const glm::vec3& end, float radius) {
+    if (_shapeCount == _shapes.size()) {
+        _shapes.push_back(Shape());
+    }
+    Shape& shape = _shapes[_shapeCount];
+    shape.start = start / (float)TREE_SCALE;
+    shape.end = end / (float)TREE_SCALE;
+    shape.radius = radius / TREE_SCALE;
+    shape.isSphere = false;
+    shape.contacts.clear();
+    return _shapeCount++;
+}
+
+glm::vec3 VoxelCollisionQuery::getPenetration(int shape) const {
+    const std::vector<VoxelContact>& contacts = _shapes[shape].contacts;
+    glm::vec3 penetration;
+    for (int i = 0; i < contacts.size(); i++) {
+        penetration = addPenetrations(penetration, contacts[i].penetration);
+    }
+    return penetration;
+}
+
+void VoxelCollisionQuery::clearCache() {
+    _cachedTree = NULL;
+    _cachedNodes.clear();
+    _cachedLeaves.clear();
+}
+
+void VoxelCollisionQuery::getBounds(glm::vec3& minimum, glm::vec3& maximum) const {
+    for (int i = 0; i < _shapeCount; i++) {
+        const Shape& shape = _shapes[i];
+        glm::vec3 radius(shape.radius, shape.radius, shape.radius);
+        glm::vec3 shapeMinimum = glm::min(shape.start, shape.end) - radius;
+        glm::vec3 shapeMaximum = glm::max(shape.start, shape.end) + radius;
+        minimum = (i == 0) ? shapeMinimum : glm::min(minimum, shapeMinimum);
+        maximum = (i == 0) ? shapeMaximum : glm::max(maximum, shapeMaximum);
+    }
+}
@@ -0,0 +1,98 @@
+//
+//  VoxelCollisionQuery.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  The spheres and capsules of one colliding body, like an avatar, to find voxel penetrations for in one pass. Instead
+//  of a single summed penetration, each shape gets the list of leaves it's in and how far it's in each.
+//
+//  A query also remembers the colored leaves around the body that it found last time, in a region a little bigger
+//  than the shapes. While the shapes stay inside that region, the next query tests them against just those leaves
+//  instead of walking the tree again. The nodes that were walked to find the leaves are remembered too, in the order
+//  they were walked, and the leaves are only reused if none of those nodes has changed since. Adding, removing or
+//  recoloring a node marks it or its parent with markWithChangedTime(), and a parent comes before its children in the
+//  walk, so a deleted node's parent is always seen to have changed before the deleted node would be looked at.
+//
+
+#ifndef __hifi__VoxelCollisionQuery__
+#define __hifi__VoxelCollisionQuery__
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "AABox.h"
+
+class VoxelNode;
+class VoxelTree;
+
+/// how much bigger than the shapes, in proportion to their size, the region of leaves a query remembers is
+const float COLLISION_CACHE_MARGIN_PROPORTION = 0.25f;
+
+/// a leaf a shape is in, and how far the shape has to move to get back out of it, all in meters
+class VoxelContact {
+public:
+    glm::vec3 corner;
+    float scale;
+    glm::vec3 penetration;
+};
+
+/// Keep one of these for each colliding body from frame to frame, see VoxelTree::findPenetrations()
+class VoxelCollisionQuery {
+public:
+    VoxelCollisionQuery();
+
+    void clearShapes();
+
+    /// \return int the index of the shape, for getContacts() and getPenetration()
+    int addSphere(const glm::vec3& center, float radius);
+
+    /// \return int the index of the shape, for getContacts() and getPenetration()
+    int addCapsule(const glm::vec3& start, const glm::vec3& end, float radius);
+
+    int getShapeCount() const { return _shapeCount; }
+
+    /// the leaves the shape was in after the last VoxelTree::findPenetrations(), in tree order
+    const std::vector<VoxelContact>& getContacts(int shape) const { return _shapes[shape].contacts; }
+
+    /// the shape's contacts added together like VoxelTree::findCapsulePenetration() adds them
+    glm::vec3 getPenetration(int shape) const;
+
+    /// forgets the leaves around the body, for when the tree they came from is gone
+    void clearCache();
+
+    /// whether the last VoxelTree::findPenetrations() tested the remembered leaves instead of walking the tree
+    bool wasCacheUsed() const { return _wasCacheUsed; }
+    int getCachedLeafCount() const { return _cachedLeaves.size(); }
+
+private:
+    friend class VoxelTree;
+
+    class Shape {
+    public:
+        glm::vec3 start; // in tree units, the same as end for a sphere
+        glm::vec3 end;
+        float radius;
+        bool isSphere;
+        std::vector<VoxelContact> contacts;
+    };
+
+    // the corners of the box around all the shapes, in tree units
+    void getBounds(glm::vec3& minimum, glm::vec3& maximum) const;
+
+    std::vector<Shape> _shapes; // kept around between queries so their contact lists keep their space
+    int _shapeCount;
+
+    const VoxelTree* _cachedTree;
+    glm::vec3 _cachedMinimum; // the region the leaves were found in, in tree units
+    glm::vec3 _cachedMaximum;
+    uint64_t _cachedAt;
+    std::vector<VoxelNode*> _cachedNodes; // every node walked to find the leaves, parents before children
+    std::vector<AABox> _cachedLeaves; // the colored leaves in the region, in tree units
+    bool _wasCacheUsed;
+};
+
+#endif /* defined(__hifi__VoxelCollisionQuery__) */
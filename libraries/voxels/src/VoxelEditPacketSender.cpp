@@ -212,19 +212,23 @@ void VoxelEditPacketSender::queuePacketToNodes(unsigned char* buffer, ssize_t le
     // But we can't really do that with a packed message, since each edit message could be destined 
     // for a different voxel server... So we need to actually manage multiple queued packets... one
     // for each voxel server
+    _editServerUUIDs.clear();
+    _jurisdictionIndex.findServersWithin(octCode, _editServerUUIDs);
     NodeList* nodeList = NodeList::getInstance();
-    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+    for (int i = 0; i < _editServerUUIDs.size(); i++) {
+        Node* node = nodeList->nodeWithUUID(_editServerUUIDs[i]);
         // only send to the NodeTypes that are NODE_TYPE_VOXEL_SERVER
-        if (node->getActiveSocket() != NULL && node->getType() == NODE_TYPE_VOXEL_SERVER) {
-            QUuid nodeUUID = node->getUUID();
-            bool isMyJurisdiction = true;
-            // we need to get the jurisdiction for this 
-            // here we need to get the "pending packet" for this server
-            const JurisdictionMap& map = (*_voxelServerJurisdictions)[nodeUUID];
-            isMyJurisdiction = (map.isMyJurisdiction(octCode, CHECK_NODE_ONLY) == JurisdictionMap::WITHIN);
-            if (isMyJurisdiction) {
-                queuePacketToNode(nodeUUID, buffer, length);
-            }
+        if (node && node->getActiveSocket() != NULL && node->getType() == NODE_TYPE_VOXEL_SERVER) {
+            queuePacketToNode(_editServerUUIDs[i], buffer, length);
+        }
+    }
+
+    // the index only knows the servers we have a jurisdiction for, any others are treated as WITHIN and get it too
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->getActiveSocket() != NULL && node->getType() == NODE_TYPE_VOXEL_SERVER &&
+            (!_voxelServerJurisdictions ||
+             _voxelServerJurisdictions->find(node->getUUID()) == _voxelServerJurisdictions->end())) {
+            queuePacketToNode(node->getUUID(), buffer, length);
         }
     }
 }
@@ -259,41 +263,37 @@ void VoxelEditPacketSender::queueVoxelEditMessage(PACKET_TYPE type, unsigned cha
     // for a different voxel server... So we need to actually manage multiple queued packets... one
     // for each voxel server
     NodeList* nodeList = NodeList::getInstance();
-    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+    _editServerUUIDs.clear();
+    if (_voxelServerJurisdictions) {
+        _jurisdictionIndex.findServersWithin(codeColorBuffer, _editServerUUIDs);
+    } else {
+        // without jurisdictions, every server gets every edit
+        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+            _editServerUUIDs.push_back(node->getUUID());
+        }
+    }
+    for (int i = 0; i < _editServerUUIDs.size(); i++) {
+        Node* node = nodeList->nodeWithUUID(_editServerUUIDs[i]);
         // only send to the NodeTypes that are NODE_TYPE_VOXEL_SERVER
-        if (node->getActiveSocket() != NULL && node->getType() == NODE_TYPE_VOXEL_SERVER) {
+        if (node && node->getActiveSocket() != NULL && node->getType() == NODE_TYPE_VOXEL_SERVER) {
             QUuid nodeUUID = node->getUUID();
-            bool isMyJurisdiction = true;
-
-            if (_voxelServerJurisdictions) {
-                // we need to get the jurisdiction for this 
-                // here we need to get the "pending packet" for this server
-                if ((*_voxelServerJurisdictions).find(nodeUUID) != (*_voxelServerJurisdictions).end()) {
-                    const JurisdictionMap& map = (*_voxelServerJurisdictions)[nodeUUID];
-                    isMyJurisdiction = (map.isMyJurisdiction(codeColorBuffer, CHECK_NODE_ONLY) == JurisdictionMap::WITHIN);
-                } else {
-                    isMyJurisdiction = false;
-                }
+            EditPacketBuffer& packetBuffer = _pendingEditPackets[nodeUUID];
+            packetBuffer._nodeUUID = nodeUUID;
+        
+            // If we're switching type, then we send the last one and start over
+            if ((type != packetBuffer._currentType && packetBuffer._currentSize > 0) || 
+                (packetBuffer._currentSize + length >= _maxPacketSize)) {
+                releaseQueuedPacket(packetBuffer);
+                initializePacket(packetBuffer, type);
             }
-            if (isMyJurisdiction) {
-                EditPacketBuffer& packetBuffer = _pendingEditPackets[nodeUUID];
-                packetBuffer._nodeUUID = nodeUUID;
-            
-                // If we're switching type, then we send the last one and start over
-                if ((type != packetBuffer._currentType && packetBuffer._currentSize > 0) || 
-                    (packetBuffer._currentSize + length >= _maxPacketSize)) {
-                    releaseQueuedPacket(packetBuffer);
-                    initializePacket(packetBuffer, type);
-                }
-
-                // If the buffer is empty and not correctly initialized for our type...
-                if (type != packetBuffer._currentType && packetBuffer._currentSize == 0) {
-                    initializePacket(packetBuffer, type);
-                }
 
-                memcpy(&packetBuffer._currentBuffer[packetBuffer._currentSize], codeColorBuffer, length);
-                packetBuffer._currentSize += length;
+            // If the buffer is empty and not correctly initialized for our type...
+            if (type != packetBuffer._currentType && packetBuffer._currentSize == 0) {
+                initializePacket(packetBuffer, type);
             }
+
+            memcpy(&packetBuffer._currentBuffer[packetBuffer._currentSize], codeColorBuffer, length);
+            packetBuffer._currentSize += length;
         }
     }
 }
@@ -15,6 +15,7 @@
 #include <PacketHeaders.h>
 #include <SharedUtil.h> // for VoxelDetail
 #include "JurisdictionMap.h"
+#include "JurisdictionIndex.h"
 
 /// Used for construction of edit voxel packets
 class EditPacketBuffer {
@@ -69,6 +70,7 @@ public:
     /// known jurisdictions.
     void setVoxelServerJurisdictions(NodeToJurisdictionMap* voxelServerJurisdictions) { 
         _voxelServerJurisdictions = voxelServerJurisdictions;
+        _jurisdictionIndex.setJurisdictions(voxelServerJurisdictions);
     }
 
     /// if you're running in non-threaded mode, you must call this method regularly
@@ -112,6 +114,8 @@ private:
     std::vector<EditPacketBuffer*> _preServerSingleMessagePackets; // these will go out as is
 
     NodeToJurisdictionMap* _voxelServerJurisdictions;
+    JurisdictionIndex _jurisdictionIndex; // which servers each edit goes to, in one lookup
+    std::vector<QUuid> _editServerUUIDs; // kept around so finding an edit's servers doesn't allocate
     
     unsigned short int _sequenceNumber;
     int _maxPacketSize;
@@ -0,0 +1,130 @@
+//
+//  VoxelEncodeCache.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+
+#include <OctalCode.h>
+#include <SharedUtil.h>
+
+#include "VoxelEncodeCache.h"
+#include "VoxelNode.h"
+
+VoxelEncodeCache::VoxelEncodeCache(uint64_t maxBytes) :
+    _maxBytes(maxBytes),
+    _bytesCached(0),
+    _lookups(0),
+    _hits(0),
+    _staleEntries(0),
+    _stores(0),
+    _bytesServed(0)
+{
+    pthread_mutex_init(&_lock, NULL);
+}
+
+VoxelEncodeCache::~VoxelEncodeCache() {
+    pthread_mutex_destroy(&_lock);
+}
+
+void VoxelEncodeCache::makeKey(const VoxelNode* node, int band, bool includeColor, bool includeExistsBits,
+                               std::string& key) {
+    const unsigned char* octalCode = node->getOctalCode();
+    key.assign((const char*)octalCode, bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(octalCode)));
+    key.append((const char*)&band, sizeof(band));
+    key.push_back((includeColor ? 1 : 0) | (includeExistsBits ? 2 : 0));
+}
+
+bool VoxelEncodeCache::lookup(const VoxelNode* node, int band, bool includeColor, bool includeExistsBits,
+                              unsigned char* outputBuffer, int availableBytes, int& bytesWritten) {
+    std::string key;
+    makeKey(node, band, includeColor, includeExistsBits, key);
+
+    bool found = false;
+    pthread_mutex_lock(&_lock);
+    _lookups++;
+    EntryMap::iterator entry = _entries.find(key);
+    if (entry != _entries.end()) {
+        if (entry->second.lastChanged != node->getLastChanged()) {
+            // something in this subtree changed since we stored it
+            _staleEntries++;
+            removeEntry(entry);
+        } else if (entry->second.fragment.size() <= availableBytes) {
+            bytesWritten = entry->second.fragment.size();
+            memcpy(outputBuffer, entry->second.fragment.data(), bytesWritten);
+            entry->second.lastUsed = usecTimestampNow();
+            _hits++;
+            _bytesServed += bytesWritten;
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return found;
+}
+
+void VoxelEncodeCache::store(const VoxelNode* node, int band, bool includeColor, bool includeExistsBits,
+                             const unsigned char* fragment, int bytes) {
+    std::string key;
+    makeKey(node, band, includeColor, includeExistsBits, key);
+    uint64_t now = usecTimestampNow();
+
+    pthread_mutex_lock(&_lock);
+    EntryMap::iterator entry = _entries.find(key);
+    if (entry != _entries.end()) {
+        removeEntry(entry);
+    }
+    makeRoom(bytes, now);
+    if (_bytesCached + bytes <= _maxBytes) {
+        Entry& newEntry = _entries[key];
+        newEntry.fragment.assign((const char*)fragment, bytes);
+        newEntry.lastChanged = node->getLastChanged();
+        newEntry.lastUsed = now;
+        _bytesCached += bytes;
+        _stores++;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+void VoxelEncodeCache::removeEntry(EntryMap::iterator entry) {
+    _bytesCached -= entry->second.fragment.size();
+    _entries.erase(entry);
+}
+
+void VoxelEncodeCache::makeRoom(uint64_t bytesNeeded, uint64_t now) {
+    if (_bytesCached + bytesNeeded <= _maxBytes) {
+        return;
+    }
+    // first drop anything nobody has asked for in a while
+    EntryMap::iterator entry = _entries.begin();
+    while (entry != _entries.end()) {
+        if (now - entry->second.lastUsed > ENCODE_CACHE_STALE_USECS) {
+            removeEntry(entry++);
+        } else {
+            ++entry;
+        }
+    }
+    // if everything is still in use, then just start over, the clients that need it will fill it back in
+    if (_bytesCached + bytesNeeded > _maxBytes) {
+        _entries.clear();
+        _bytesCached = 0;
+    }
+}
+
+void VoxelEncodeCache::clear() {
+    pthread_mutex_lock(&_lock);
+    _entries.clear();
+    _bytesCached = 0;
+    pthread_mutex_unlock(&_lock);
+}
+
+void VoxelEncodeCache::resetStats() {
+    pthread_mutex_lock(&_lock);
+    _lookups = 0;
+    _hits = 0;
+    _staleEntries = 0;
+    _stores = 0;
+    _bytesServed = 0;
+    pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,90 @@
+//
+//  VoxelEncodeCache.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Shared cache of encoded subtree bitstreams. When many clients look at the same part of the scene, each of their
+//  send threads ends up encoding the same subtrees with the same results. VoxelTree::encodeTreeBitstream() stores the
+//  bytes it produced for a subtree here, and other send threads can splice those bytes into their packets instead of
+//  walking the subtree again.
+//
+//  A subtree's encoding only depends on the viewer when the view frustum cuts through it, or when the LOD boundary
+//  for some level falls inside it. So fragments are only cached for subtrees that are entirely in view and that lie
+//  within a single LOD band for the viewer (see encodeCacheBand() in VoxelTree.cpp), and entries are keyed by octal
+//  code, color/exists bits mode and that LOD band. Entries remember the subtree root's last changed time. Since changes to
+//  a node mark all of its ancestors with markWithChangedTime(), an entry whose root has changed since it was stored
+//  is stale and is dropped on lookup.
+//
+
+#ifndef __hifi__VoxelEncodeCache__
+#define __hifi__VoxelEncodeCache__
+
+#include <climits>
+#include <map>
+#include <string>
+
+#include <pthread.h>
+#include <stdint.h>
+
+class VoxelNode;
+
+const int NOT_CACHEABLE = INT_MIN;
+const uint64_t DEFAULT_ENCODE_CACHE_MAX_BYTES = 32 * 1024 * 1024;
+const uint64_t ENCODE_CACHE_STALE_USECS = 10 * 1000 * 1000; // entries not used for this long are the first to go
+
+class VoxelEncodeCache {
+public:
+    VoxelEncodeCache(uint64_t maxBytes = DEFAULT_ENCODE_CACHE_MAX_BYTES);
+    ~VoxelEncodeCache();
+
+    /// If there's a current fragment for this subtree and it fits in availableBytes, copies it into outputBuffer, sets
+    /// bytesWritten to its size and returns true. Note: a fragment may legitimately be zero bytes long.
+    bool lookup(const VoxelNode* node, int band, bool includeColor, bool includeExistsBits,
+                unsigned char* outputBuffer, int availableBytes, int& bytesWritten);
+
+    /// Stores the complete encoding of a subtree. Callers must only store encodings that didn't leave any of the
+    /// subtree in the bag.
+    void store(const VoxelNode* node, int band, bool includeColor, bool includeExistsBits,
+               const unsigned char* fragment, int bytes);
+
+    void clear();
+    void resetStats();
+
+    uint64_t getLookups() const { return _lookups; }
+    uint64_t getHits() const { return _hits; }
+    uint64_t getStaleEntries() const { return _staleEntries; }
+    uint64_t getStores() const { return _stores; }
+    uint64_t getBytesServed() const { return _bytesServed; }
+    uint64_t getBytesCached() const { return _bytesCached; }
+    uint64_t getMaxBytes() const { return _maxBytes; }
+    int getEntryCount() const { return _entries.size(); }
+    float getHitRate() const { return _lookups ? (float)_hits / (float)_lookups : 0.0f; }
+
+private:
+    class Entry {
+    public:
+        std::string fragment;
+        uint64_t lastChanged; // the subtree root's last changed time when this was stored
+        uint64_t lastUsed;
+    };
+    typedef std::map<std::string, Entry> EntryMap;
+
+    static void makeKey(const VoxelNode* node, int band, bool includeColor, bool includeExistsBits, std::string& key);
+    void removeEntry(EntryMap::iterator entry);
+    void makeRoom(uint64_t bytesNeeded, uint64_t now);
+
+    EntryMap _entries;
+    uint64_t _maxBytes;
+    uint64_t _bytesCached;
+
+    uint64_t _lookups;
+    uint64_t _hits;
+    uint64_t _staleEntries;
+    uint64_t _stores;
+    uint64_t _bytesServed;
+
+    pthread_mutex_t _lock;
+};
+
+#endif /* defined(__hifi__VoxelEncodeCache__) */
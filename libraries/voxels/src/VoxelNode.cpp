@@ -8,6 +8,7 @@
 
 #include <cmath>
 #include <cstring>
+#include <new>
 #include <stdio.h>
 
 #include <QtCore/QDebug>
@@ -20,6 +21,7 @@
 #include "SharedUtil.h"
 #include "VoxelConstants.h"
 #include "VoxelNode.h"
+#include "VoxelNodeBag.h"
 #include "VoxelTree.h"
 
 uint64_t VoxelNode::_voxelMemoryUsage = 0;
@@ -98,14 +100,15 @@ void VoxelNode::init(unsigned char * octalCode) {
     _sourceUUIDKey = 0;
     calculateAABox();
     markWithChangedTime();
-
-    _voxelMemoryUsage += sizeof(VoxelNode);
 }
 
 VoxelNode::~VoxelNode() {
     notifyDeleteHooks();
 
-    _voxelMemoryUsage -= sizeof(VoxelNode);
+    // only nodes that are actually sitting in a bag need to go looking for it
+    if (_bagReferences.load() > 0) {
+        VoxelNodeBag::voxelDeleted(this);
+    }
 
     _voxelNodeCount--;
     if (isLeaf()) {
@@ -121,6 +124,23 @@ VoxelNode::~VoxelNode() {
     deleteAllChildren();
 }
 
+void* VoxelNode::operator new(size_t size, VoxelNodeAllocator& allocator) {
+    void* node = allocator.allocateNode();
+    if (!node) {
+        throw std::bad_alloc();
+    }
+    return node;
+}
+
+// only called if a constructor throws after our placement operator new
+void VoxelNode::operator delete(void* node, VoxelNodeAllocator& allocator) {
+    VoxelNodeAllocator::freeNode(node);
+}
+
+void VoxelNode::operator delete(void* node) {
+    VoxelNodeAllocator::freeNode(node);
+}
+
 void VoxelNode::markWithChangedTime() { 
     _lastChanged = usecTimestampNow(); 
     notifyUpdateHooks(); // if the node has changed, notify our hooks
@@ -232,14 +252,10 @@ void VoxelNode::setShouldRender(bool shouldRender) {
 }
 
 void VoxelNode::calculateAABox() {
-    glm::vec3 corner;
-    
-    // copy corner into box
-    copyFirstVertexForCode(getOctalCode(),(float*)&corner);
-    
-    // this tells you the "size" of the voxel
-    float voxelScale = 1 / powf(2, numberOfThreeBitSectionsInCode(getOctalCode()));
-    _box.setBox(corner,voxelScale);
+    // the corner and "size" of the voxel in one pass over the code
+    VoxelPositionSize details;
+    voxelDetailsForCode(getOctalCode(), details);
+    _box.setBox(glm::vec3(details.x, details.y, details.z), details.s);
 }
 
 void VoxelNode::deleteChildAtIndex(int childIndex) {
@@ -682,6 +698,14 @@ void VoxelNode::deleteAllChildren() {
         }
     }
 
+#ifdef SIMPLE_EXTERNAL_CHILDREN
+    // If we had externally stored children, give the child array back to our allocator
+    if (getChildCount() > 1) {
+        VoxelNodeAllocator::freeChildren(_children.external);
+    }
+    _children.single = NULL;
+#endif // def SIMPLE_EXTERNAL_CHILDREN
+
 #ifdef BLENDED_UNION_CHILDREN
     // now, reset our internal state and ANY and all population data
     int childCount = getChildCount();
@@ -774,19 +798,20 @@ void VoxelNode::setChildAtIndex(int childIndex, VoxelNode* child) {
         _children.single = child;
     } else if (previousChildCount == 1 && newChildCount == 2) {
         VoxelNode* previousChild = _children.single;
-        _children.external = new VoxelNode*[NUMBER_OF_CHILDREN];
+        // Note: the child array comes from the same allocator as this node, which tracks external children memory usage
+        _children.external = (VoxelNode**)VoxelNodeAllocator::allocatorFor(this)->allocateChildren();
+        if (!_children.external) {
+            throw std::bad_alloc();
+        }
         memset(_children.external, 0, sizeof(VoxelNode*) * NUMBER_OF_CHILDREN);
         _children.external[firstIndex] = previousChild;
         _children.external[childIndex] = child;
 
-        _externalChildrenMemoryUsage += NUMBER_OF_CHILDREN * sizeof(VoxelNode*);
-        
     } else if (previousChildCount == 2 && newChildCount == 1) {
         assert(child == NULL); // we are removing a child, so this must be true!
         VoxelNode* previousFirstChild = _children.external[firstIndex];
         VoxelNode* previousSecondChild = _children.external[secondIndex];
-        delete[] _children.external;
-        _externalChildrenMemoryUsage -= NUMBER_OF_CHILDREN * sizeof(VoxelNode*);
+        VoxelNodeAllocator::freeChildren(_children.external);
         if (childIndex == firstIndex) {
             _children.single = previousSecondChild;
         } else {
@@ -1152,7 +1177,7 @@ VoxelNode* VoxelNode::addChildAtIndex(int childIndex) {
             _voxelNodeLeafCount--;
         }
     
-        childAt = new VoxelNode(childOctalCode(getOctalCode(), childIndex));
+        childAt = new (*VoxelNodeAllocator::allocatorFor(this)) VoxelNode(childOctalCode(getOctalCode(), childIndex));
         childAt->setVoxelSystem(getVoxelSystem()); // our child is always part of our voxel system NULL ok
         setChildAtIndex(childIndex, childAt);
 
@@ -1306,6 +1331,7 @@ bool VoxelNode::collapseIdenticalLeaves() {
             delete childAt; // delete all the child nodes
             setChildAtIndex(i, NULL); // set it to NULL
         }
+        markWithChangedTime(); // the color may not change, but the children are gone
         nodeColor collapsedColor;
         collapsedColor[0]=red;        
         collapsedColor[1]=green;        
@@ -13,12 +13,14 @@
 //#define SIMPLE_CHILD_ARRAY
 #define SIMPLE_EXTERNAL_CHILDREN
 
+#include <QAtomicInt>
 #include <QReadWriteLock>
 
 #include <SharedUtil.h>
 #include "AABox.h"
 #include "ViewFrustum.h"
 #include "VoxelConstants.h"
+#include "VoxelNodeAllocator.h"
 
 class VoxelTree; // forward declaration
 class VoxelNode; // forward declaration
@@ -46,6 +48,11 @@ public:
     VoxelNode(); // root node constructor
     VoxelNode(unsigned char * octalCode); // regular constructor
     ~VoxelNode();
+
+    // nodes are always carved out of their tree's VoxelNodeAllocator, and are returned to it on delete
+    static void* operator new(size_t size, VoxelNodeAllocator& allocator);
+    static void operator delete(void* node, VoxelNodeAllocator& allocator);
+    static void operator delete(void* node);
     
     const unsigned char* getOctalCode() const { return (_octcodePointer) ? _octalCode.pointer : &_octalCode.buffer[0]; }
     VoxelNode* getChildAtIndex(int childIndex) const;
@@ -155,6 +162,9 @@ public:
 #endif // def BLENDED_UNION_CHILDREN
 
 private:
+    friend class VoxelNodeAllocator; // allocator reports its slab usage through our memory usage stats
+    friend class VoxelNodeBag; // bags keep our _bagReferences count up to date
+
     void deleteAllChildren();
     void setChildAtIndex(int childIndex, VoxelNode* child);
 
@@ -241,6 +251,8 @@ private:
          _unknownBufferIndex : 1,
          _childrenExternal : 1; /// Client only, is this voxel's VBO buffer the unknown buffer index, 1 bit
 
+    QAtomicInt _bagReferences; /// Client and server, number of VoxelNodeBags this voxel is in, 4 bytes
+
     static QReadWriteLock _deleteHooksLock;
     static std::vector<VoxelNodeDeleteHook*> _deleteHooks;
 
@@ -0,0 +1,254 @@
+//
+//  VoxelNodeAllocator.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include <QtCore/QDebug>
+
+#include "VoxelConstants.h"
+#include "VoxelNode.h"
+#include "VoxelNodeAllocator.h"
+
+const size_t BLOCK_ALIGNMENT = 16;
+
+static size_t alignedSize(size_t size) {
+    return (size + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1);
+}
+
+// orphaned slabs have no pool, and so no pool lock, but blocks in them can still be freed from any thread
+static pthread_mutex_t orphanedSlabsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* allocateAlignedSlab(size_t slabSize) {
+#ifdef _WIN32
+    return _aligned_malloc(slabSize, slabSize);
+#else
+    void* memory = NULL;
+    if (posix_memalign(&memory, slabSize, slabSize) != 0) {
+        return NULL;
+    }
+    return memory;
+#endif
+}
+
+VoxelNodeSlabPool::VoxelNodeSlabPool(VoxelNodeAllocator* allocator, size_t blockSize, uint64_t* memoryUsage) :
+    _allocator(allocator),
+    _blockSize(alignedSize(blockSize)),
+    _headerSize(alignedSize(sizeof(Slab))),
+    _available(NULL),
+    _allSlabs(NULL),
+    _slabCount(0),
+    _blocksInUse(0),
+    _memoryUsage(memoryUsage)
+{
+    _blocksPerSlab = (SLAB_SIZE - _headerSize) / _blockSize;
+    pthread_mutex_init(&_lock, NULL);
+}
+
+VoxelNodeSlabPool::~VoxelNodeSlabPool() {
+    pthread_mutex_lock(&_lock);
+    pthread_mutex_lock(&orphanedSlabsLock);
+    Slab* slab = _allSlabs;
+    while (slab) {
+        Slab* nextSlab = slab->allNext;
+        *_memoryUsage -= SLAB_SIZE;
+        if (slab->blocksInUse == 0) {
+            freeSlab(slab);
+        } else {
+            // Someone still holds nodes from this slab (for example the client's bag of removed voxels). Orphan the
+            // slab, it will be freed when its last block is deallocated.
+            slab->pool = NULL;
+        }
+        slab = nextSlab;
+    }
+    _allSlabs = NULL;
+    _available = NULL;
+    pthread_mutex_unlock(&orphanedSlabsLock);
+    pthread_mutex_unlock(&_lock);
+    pthread_mutex_destroy(&_lock);
+}
+
+void VoxelNodeSlabPool::freeSlab(Slab* slab) {
+#ifdef _WIN32
+    _aligned_free(slab);
+#else
+    free(slab);
+#endif
+}
+
+VoxelNodeSlabPool::Slab* VoxelNodeSlabPool::createSlab() {
+    Slab* slab = (Slab*)allocateAlignedSlab(SLAB_SIZE);
+    if (!slab) {
+        return NULL;
+    }
+    slab->pool = this;
+    slab->previous = NULL;
+    slab->next = NULL;
+    slab->freeList = NULL;
+    slab->blocksInUse = 0;
+    slab->blocksCarved = 0;
+    slab->isAvailable = false;
+
+    slab->allPrevious = NULL;
+    slab->allNext = _allSlabs;
+    if (_allSlabs) {
+        _allSlabs->allPrevious = slab;
+    }
+    _allSlabs = slab;
+
+    _slabCount++;
+    *_memoryUsage += SLAB_SIZE;
+
+    addAvailable(slab);
+    return slab;
+}
+
+void VoxelNodeSlabPool::destroySlab(Slab* slab) {
+    if (slab->isAvailable) {
+        removeAvailable(slab);
+    }
+    if (slab->allPrevious) {
+        slab->allPrevious->allNext = slab->allNext;
+    } else {
+        _allSlabs = slab->allNext;
+    }
+    if (slab->allNext) {
+        slab->allNext->allPrevious = slab->allPrevious;
+    }
+    _slabCount--;
+    *_memoryUsage -= SLAB_SIZE;
+    freeSlab(slab);
+}
+
+void VoxelNodeSlabPool::addAvailable(Slab* slab) {
+    slab->previous = NULL;
+    slab->next = _available;
+    if (_available) {
+        _available->previous = slab;
+    }
+    _available = slab;
+    slab->isAvailable = true;
+}
+
+void VoxelNodeSlabPool::removeAvailable(Slab* slab) {
+    if (slab->previous) {
+        slab->previous->next = slab->next;
+    } else {
+        _available = slab->next;
+    }
+    if (slab->next) {
+        slab->next->previous = slab->previous;
+    }
+    slab->previous = slab->next = NULL;
+    slab->isAvailable = false;
+}
+
+void* VoxelNodeSlabPool::allocate() {
+    pthread_mutex_lock(&_lock);
+    Slab* slab = _available;
+    if (!slab) {
+        slab = createSlab();
+        if (!slab) {
+            pthread_mutex_unlock(&_lock);
+            qDebug("VoxelNodeSlabPool::allocate() unable to allocate a new slab!\n");
+            return NULL;
+        }
+    }
+
+    void* block;
+    if (slab->freeList) {
+        block = slab->freeList;
+        slab->freeList = *(void**)block;
+    } else {
+        // carve blocks lazily, so we don't touch pages of the slab until we need them
+        block = firstBlock(slab) + (slab->blocksCarved * _blockSize);
+        slab->blocksCarved++;
+    }
+    slab->blocksInUse++;
+    _blocksInUse++;
+
+    if (slab->blocksInUse == _blocksPerSlab) {
+        removeAvailable(slab);
+    }
+    pthread_mutex_unlock(&_lock);
+    return block;
+}
+
+void VoxelNodeSlabPool::releaseBlock(Slab* slab, void* block) {
+    pthread_mutex_lock(&_lock);
+    *(void**)block = slab->freeList;
+    slab->freeList = block;
+    slab->blocksInUse--;
+    _blocksInUse--;
+
+    if (slab->blocksInUse == 0 && _available && _available != slab) {
+        // we already have another slab with room, so give this one back rather than letting empty slabs pile up
+        destroySlab(slab);
+    } else if (!slab->isAvailable) {
+        addAvailable(slab);
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+void VoxelNodeSlabPool::deallocate(void* block) {
+    if (!block) {
+        return;
+    }
+    Slab* slab = slabFor(block);
+    if (slab->pool) {
+        slab->pool->releaseBlock(slab, block);
+    } else {
+        // our pool has been destroyed, free the orphaned slab once its last block is gone
+        pthread_mutex_lock(&orphanedSlabsLock);
+        slab->blocksInUse--;
+        bool isEmpty = (slab->blocksInUse == 0);
+        pthread_mutex_unlock(&orphanedSlabsLock);
+        if (isEmpty) {
+            freeSlab(slab);
+        }
+    }
+}
+
+VoxelNodeSlabPool* VoxelNodeSlabPool::poolFor(const void* block) {
+    return slabFor(block)->pool;
+}
+
+void VoxelNodeSlabPool::releaseEmptySlabs() {
+    pthread_mutex_lock(&_lock);
+    Slab* slab = _allSlabs;
+    while (slab) {
+        Slab* nextSlab = slab->allNext;
+        if (slab->blocksInUse == 0) {
+            destroySlab(slab);
+        }
+        slab = nextSlab;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+VoxelNodeAllocator::VoxelNodeAllocator() :
+    _nodePool(this, sizeof(VoxelNode), &VoxelNode::_voxelMemoryUsage),
+    _childrenPool(this, NUMBER_OF_CHILDREN * sizeof(VoxelNode*), &VoxelNode::_externalChildrenMemoryUsage)
+{
+}
+
+// for nodes that outlive their tree, like the ones in a client's bag of removed voxels, when they need more nodes
+static VoxelNodeAllocator orphanedNodeAllocator;
+
+VoxelNodeAllocator* VoxelNodeAllocator::allocatorFor(const void* block) {
+    VoxelNodeSlabPool* pool = VoxelNodeSlabPool::poolFor(block);
+    return pool ? pool->getAllocator() : &orphanedNodeAllocator;
+}
+
+void VoxelNodeAllocator::releaseEmptySlabs() {
+    _nodePool.releaseEmptySlabs();
+    _childrenPool.releaseEmptySlabs();
+}
@@ -0,0 +1,112 @@
+//
+//  VoxelNodeAllocator.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Slab allocator for VoxelNode objects and their external child arrays. Each VoxelTree owns one allocator, and
+//  every node in that tree is carved out of one of its slabs. Slabs are SLAB_SIZE aligned, so the slab (and from
+//  there the owning allocator) for any node can be found by masking the node's address. This means nodes don't
+//  need to carry a pointer back to their tree, and a plain delete on a node still returns it to the right pool.
+//
+
+#ifndef __hifi__VoxelNodeAllocator__
+#define __hifi__VoxelNodeAllocator__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+class VoxelNodeAllocator;
+
+/// A pool of fixed size blocks carved from SLAB_SIZE aligned slabs. Each slab keeps its own free list so that a
+/// slab whose blocks have all been returned can be handed back to the system.
+class VoxelNodeSlabPool {
+public:
+    static const size_t SLAB_SIZE = 64 * 1024;
+
+    VoxelNodeSlabPool(VoxelNodeAllocator* allocator, size_t blockSize, uint64_t* memoryUsage);
+    ~VoxelNodeSlabPool();
+
+    void* allocate();
+    static void deallocate(void* block);
+
+    /// returns the pool that a block was allocated from, or NULL if that pool has since been destroyed
+    static VoxelNodeSlabPool* poolFor(const void* block);
+
+    /// frees any slabs that no longer contain any live blocks
+    void releaseEmptySlabs();
+
+    VoxelNodeAllocator* getAllocator() const { return _allocator; }
+    size_t getBlockSize() const { return _blockSize; }
+    int getSlabCount() const { return _slabCount; }
+    uint64_t getBlocksInUse() const { return _blocksInUse; }
+
+private:
+    struct Slab {
+        VoxelNodeSlabPool* pool;
+        Slab* previous; // links in our list of slabs with free blocks
+        Slab* next;
+        Slab* allPrevious; // links in our list of all slabs
+        Slab* allNext;
+        void* freeList;
+        int blocksInUse;
+        int blocksCarved;
+        bool isAvailable; // is this slab in our list of slabs with free blocks
+    };
+
+    static Slab* slabFor(const void* block) { return (Slab*)((uintptr_t)block & ~(uintptr_t)(SLAB_SIZE - 1)); }
+    static void freeSlab(Slab* slab);
+
+    Slab* createSlab();
+    void destroySlab(Slab* slab);
+    void addAvailable(Slab* slab);
+    void removeAvailable(Slab* slab);
+    void releaseBlock(Slab* slab, void* block);
+    unsigned char* firstBlock(Slab* slab) const { return (unsigned char*)slab + _headerSize; }
+
+    VoxelNodeAllocator* _allocator;
+    size_t _blockSize;
+    size_t _headerSize;
+    int _blocksPerSlab;
+
+    Slab* _available; /// slabs that have at least one free block
+    Slab* _allSlabs;
+    int _slabCount;
+    uint64_t _blocksInUse;
+    uint64_t* _memoryUsage;
+
+    pthread_mutex_t _lock;
+};
+
+/// Per VoxelTree allocator for nodes and for the external child arrays used by SIMPLE_EXTERNAL_CHILDREN
+class VoxelNodeAllocator {
+public:
+    VoxelNodeAllocator();
+
+    void* allocateNode() { return _nodePool.allocate(); }
+    void* allocateChildren() { return _childrenPool.allocate(); }
+    static void freeNode(void* node) { VoxelNodeSlabPool::deallocate(node); }
+    static void freeChildren(void* children) { VoxelNodeSlabPool::deallocate(children); }
+
+    /// returns the allocator that owns the slab this node (or child array) lives in, or if that allocator has been
+    /// destroyed along with its tree, a shared allocator for the nodes that outlived their trees
+    static VoxelNodeAllocator* allocatorFor(const void* block);
+
+    /// bulk free any slabs that are completely empty, called after large deletes like VoxelTree::eraseAllVoxels()
+    void releaseEmptySlabs();
+
+    uint64_t getNodesInUse() const { return _nodePool.getBlocksInUse(); }
+    int getNodeSlabCount() const { return _nodePool.getSlabCount(); }
+    int getChildrenSlabCount() const { return _childrenPool.getSlabCount(); }
+
+private:
+    // not copyable
+    VoxelNodeAllocator(const VoxelNodeAllocator&);
+    VoxelNodeAllocator& operator=(const VoxelNodeAllocator&);
+
+    VoxelNodeSlabPool _nodePool;
+    VoxelNodeSlabPool _childrenPool;
+};
+
+#endif /* defined(__hifi__VoxelNodeAllocator__) */
@@ -9,126 +9,206 @@
 #include "VoxelNodeBag.h"
 #include <OctalCode.h>
 
-VoxelNodeBag::VoxelNodeBag() : 
+const int EMPTY_SLOT = -1;
+const int INITIAL_BAG_SIZE = 128;
+
+QReadWriteLock VoxelNodeBag::_bagsLock;
+std::vector<VoxelNodeBag*> VoxelNodeBag::_bags;
+
+VoxelNodeBag::VoxelNodeBag() :
     _bagElements(NULL),
     _elementsInUse(0),
-    _sizeOfElementsArray(0) {
-    VoxelNode::addDeleteHook(this);
+    _sizeOfElementsArray(0),
+    _slots(NULL),
+    _numberOfSlots(0) {
+    pthread_mutex_init(&_lock, NULL);
+    _bagsLock.lockForWrite();
+    _bags.push_back(this);
+    _bagsLock.unlock();
 };
 
 VoxelNodeBag::~VoxelNodeBag() {
-    VoxelNode::removeDeleteHook(this);
-    deleteAll();
+    _bagsLock.lockForWrite();
+    for (int i = 0; i < _bags.size(); i++) {
+        if (_bags[i] == this) {
+            _bags.erase(_bags.begin() + i);
+            break;
+        }
+    }
+    _bagsLock.unlock();
+    deleteAllElements();
+    pthread_mutex_destroy(&_lock);
 }
 
 void VoxelNodeBag::deleteAll() {
+    pthread_mutex_lock(&_lock);
+    deleteAllElements();
+    pthread_mutex_unlock(&_lock);
+}
+
+void VoxelNodeBag::deleteAllElements() {
+    // the nodes still in the bag are alive (deleted nodes remove themselves), so let them know they've left the bag
+    for (int i = 0; i < _elementsInUse; i++) {
+        _bagElements[i]->_bagReferences.deref();
+    }
     if (_bagElements) {
         delete[] _bagElements;
     }
+    if (_slots) {
+        delete[] _slots;
+    }
     _bagElements = NULL;
     _elementsInUse = 0;
     _sizeOfElementsArray = 0;
+    _slots = NULL;
+    _numberOfSlots = 0;
+}
+
+int VoxelNodeBag::hashSlot(VoxelNode* node) const {
+    // nodes are at least 16 byte aligned, so skip the low bits, then spread the rest out with a multiplicative hash
+    uint32_t key = (uint32_t)((uintptr_t)node >> 4);
+    return (int)((key * 2654435761u) & (_numberOfSlots - 1));
+}
+
+int VoxelNodeBag::findSlot(VoxelNode* node) const {
+    int slot = hashSlot(node);
+    while (_slots[slot] != EMPTY_SLOT && _bagElements[_slots[slot]] != node) {
+        slot = (slot + 1) & (_numberOfSlots - 1);
+    }
+    return slot;
 }
 
+// empties a slot, and shifts back any later slots in its probe sequence so that lookups don't stop early
+void VoxelNodeBag::removeSlot(int slot) {
+    int mask = _numberOfSlots - 1;
+    int hole = slot;
+    int next = (slot + 1) & mask;
+    while (_slots[next] != EMPTY_SLOT) {
+        int ideal = hashSlot(_bagElements[_slots[next]]);
+        // the entry can move into the hole unless its ideal slot lies cyclically in (hole, next]
+        bool idealAfterHole = (next > hole) ? (ideal > hole && ideal <= next) : (ideal > hole || ideal <= next);
+        if (!idealAfterHole) {
+            _slots[hole] = _slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    _slots[hole] = EMPTY_SLOT;
+}
 
-const int GROW_BAG_BY = 100;
+void VoxelNodeBag::growElements() {
+    int newSize = _sizeOfElementsArray ? _sizeOfElementsArray * 2 : INITIAL_BAG_SIZE;
+    VoxelNode** oldBag = _bagElements;
+    _bagElements = new VoxelNode * [newSize];
+    _sizeOfElementsArray = newSize;
+    if (oldBag) {
+        memcpy(_bagElements, oldBag, _elementsInUse * sizeof(VoxelNode*));
+        delete[] oldBag;
+    }
+}
+
+void VoxelNodeBag::growSlots() {
+    if (_slots) {
+        delete[] _slots;
+    }
+    _numberOfSlots = _numberOfSlots ? _numberOfSlots * 2 : INITIAL_BAG_SIZE * 2;
+    _slots = new int[_numberOfSlots];
+    for (int i = 0; i < _numberOfSlots; i++) {
+        _slots[i] = EMPTY_SLOT;
+    }
+    for (int i = 0; i < _elementsInUse; i++) {
+        _slots[findSlot(_bagElements[i])] = i;
+    }
+}
 
 // put a node into the bag
 void VoxelNodeBag::insert(VoxelNode* node) {
+    pthread_mutex_lock(&_lock);
 
-    // Search for where we should live in the bag (sorted)
-    // Note: change this to binary search... instead of linear!
-    int insertAt = _elementsInUse;
-    for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            return; // exit early!!
-        }
-        
-        if (_bagElements[i] > node) {
-            insertAt = i;
-            break;
-        }
+    // keep the hash at most half full
+    if ((_elementsInUse + 1) * 2 > _numberOfSlots) {
+        growSlots();
     }
-    // at this point, inserAt will be the location we want to insert at.
-    
-    // If we don't have room in our bag, then grow the bag
-    if (_sizeOfElementsArray < _elementsInUse + 1) {
-        VoxelNode** oldBag = _bagElements;
-        _bagElements = new VoxelNode * [_sizeOfElementsArray + GROW_BAG_BY];
-        _sizeOfElementsArray += GROW_BAG_BY;
-        
-        // If we had an old bag...
-        if (oldBag) {
-            // copy old elements into the new bag, but leave a space where we need to
-            // insert the new node
-            memcpy(_bagElements, oldBag, insertAt * sizeof(VoxelNode*));
-            memcpy(&_bagElements[insertAt + 1], &oldBag[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNode*));
-            delete[] oldBag;
+
+    int slot = findSlot(node);
+    if (_slots[slot] == EMPTY_SLOT) {
+        if (_elementsInUse == _sizeOfElementsArray) {
+            growElements();
         }
-    } else {
-        // move existing elements further back in the bag array, leave a space where we need to
-        // insert the new node
-        memmove(&_bagElements[insertAt + 1], &_bagElements[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNode*));
-    }
-    _bagElements[insertAt] = node;
-    _elementsInUse++;
+        _bagElements[_elementsInUse] = node;
+        _slots[slot] = _elementsInUse;
+        _elementsInUse++;
+        node->_bagReferences.ref();
+    } // otherwise it's already in the bag
+
+    pthread_mutex_unlock(&_lock);
 }
- 
+
 // pull a node out of the bag (could come in any order)
 VoxelNode* VoxelNodeBag::extract() {
+    VoxelNode* node = NULL;
+    pthread_mutex_lock(&_lock);
     // pull the last node out, and shrink our list...
     if (_elementsInUse) {
-        
-        // get the last element
-        VoxelNode* node = _bagElements[_elementsInUse - 1];
-        
-        // reduce the count
-        _elementsInUse--;
-
-        return node;
+        node = _bagElements[_elementsInUse - 1];
+        removeElement(findSlot(node));
     }
-    return NULL;
+    pthread_mutex_unlock(&_lock);
+    return node;
 }
 
-bool VoxelNodeBag::contains(VoxelNode* node) {
-    for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            return true; // exit early!!
-        }
-        // if we're past where it should be, then it's not here!
-        if (_bagElements[i] > node) {
-            return false;
+VoxelNode* VoxelNodeBag::extractMatching(bool (*acceptNode)(VoxelNode* node, void* extraData), void* extraData) {
+    VoxelNode* node = NULL;
+    pthread_mutex_lock(&_lock);
+    for (int i = _elementsInUse - 1; i >= 0; i--) {
+        if (acceptNode(_bagElements[i], extraData)) {
+            node = _bagElements[i];
+            removeElement(findSlot(node));
+            break;
         }
     }
-    // if we made it through the entire bag, it's not here!
-    return false;
+    pthread_mutex_unlock(&_lock);
+    return node;
+}
+
+bool VoxelNodeBag::contains(VoxelNode* node) const {
+    pthread_mutex_lock(&_lock);
+    bool found = _elementsInUse && _slots[findSlot(node)] != EMPTY_SLOT;
+    pthread_mutex_unlock(&_lock);
+    return found;
 }
 
 void VoxelNodeBag::remove(VoxelNode* node) {
-    int foundAt = -1;
-    for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            foundAt = i;
-            break;
-        }
-        // if we're past where it should be, then it's not here!
-        if (_bagElements[i] > node) {
-            break;
+    pthread_mutex_lock(&_lock);
+    if (_elementsInUse) {
+        int slot = findSlot(node);
+        if (_slots[slot] != EMPTY_SLOT) {
+            removeElement(slot);
         }
     }
-    // if we found it, then we need to remove it....
-    if (foundAt != -1) {
-        memmove(&_bagElements[foundAt], &_bagElements[foundAt + 1], (_elementsInUse - foundAt) * sizeof(VoxelNode*));
-        _elementsInUse--;
-    }
+    pthread_mutex_unlock(&_lock);
 }
 
+void VoxelNodeBag::removeElement(int slot) {
+    int foundAt = _slots[slot];
+    VoxelNode* node = _bagElements[foundAt];
+    removeSlot(slot);
 
-void VoxelNodeBag::voxelDeleted(VoxelNode* node) {
-    remove(node); // note: remove can safely handle nodes that aren't in it, so we don't need to check contains()
+    // fill the gap with our last element
+    int lastElement = _elementsInUse - 1;
+    if (foundAt != lastElement) {
+        VoxelNode* lastNode = _bagElements[lastElement];
+        _slots[findSlot(lastNode)] = foundAt;
+        _bagElements[foundAt] = lastNode;
+    }
+    _elementsInUse--;
+    node->_bagReferences.deref();
 }
 
-
+void VoxelNodeBag::voxelDeleted(VoxelNode* node) {
+    _bagsLock.lockForRead();
+    for (int i = 0; i < _bags.size() && node->_bagReferences.load() > 0; i++) {
+        _bags[i]->remove(node); // note: remove can safely handle nodes that aren't in it, so we don't need to check contains()
+    }
+    _bagsLock.unlock();
+}
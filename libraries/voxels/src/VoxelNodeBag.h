@@ -14,9 +14,19 @@
 #ifndef __hifi__VoxelNodeBag__
 #define __hifi__VoxelNodeBag__
 
+#include <vector>
+
+#include <pthread.h>
+
+#include <QReadWriteLock>
+
 #include "VoxelNode.h"
 
-class VoxelNodeBag : public VoxelNodeDeleteHook {
+/// Nodes are kept in a dense array, with an open addressed hash from node pointer to array index, so that insert, 
+/// dedupe, extract and remove are all O(1). Every node tracks how many bags it's in, so deleting a node that isn't in
+/// any bag doesn't need to visit any bags at all. Bags lock themselves, since nodes can be deleted (and so removed
+/// from every bag) by editing threads while the bag's owner is using it.
+class VoxelNodeBag {
 
 public:
     VoxelNodeBag();
@@ -24,7 +34,11 @@ public:
     
     void insert(VoxelNode* node); // put a node into the bag
     VoxelNode* extract(); // pull a node out of the bag (could come in any order)
-    bool contains(VoxelNode* node); // is this node in the bag?
+
+    /// pulls out the most recently inserted node for which acceptNode(node, extraData) returns true, or returns NULL
+    /// if there is no such node. Nodes in the bag can't be deleted while acceptNode() looks at them.
+    VoxelNode* extractMatching(bool (*acceptNode)(VoxelNode* node, void* extraData), void* extraData);
+    bool contains(VoxelNode* node) const; // is this node in the bag?
     void remove(VoxelNode* node); // remove a specific item from the bag
     
     bool isEmpty() const { return (_elementsInUse == 0); }
@@ -32,16 +46,34 @@ public:
 
     void deleteAll();
 
-    static void voxelNodeDeleteHook(VoxelNode* node, void* extraData);
-
-    virtual void voxelDeleted(VoxelNode* node);
+    /// called by VoxelNode when a node that is in at least one bag is deleted, removes it from all bags
+    static void voxelDeleted(VoxelNode* node);
 
 private:
-    
+    // not copyable
+    VoxelNodeBag(const VoxelNodeBag&);
+    VoxelNodeBag& operator=(const VoxelNodeBag&);
+
+    void removeElement(int slot); // removes the node in slot from the bag, caller must hold _lock
+    void deleteAllElements();
+
+    int hashSlot(VoxelNode* node) const;
+    int findSlot(VoxelNode* node) const; // slot holding node, or the empty slot where it would go
+    void removeSlot(int slot);
+    void growElements();
+    void growSlots();
+
     VoxelNode** _bagElements;
     int         _elementsInUse;
     int         _sizeOfElementsArray;
-    int         _hookID;
+
+    int*        _slots; // indexes into _bagElements, or EMPTY_SLOT
+    int         _numberOfSlots; // always a power of two
+
+    mutable pthread_mutex_t _lock;
+
+    static QReadWriteLock _bagsLock;
+    static std::vector<VoxelNodeBag*> _bags;
 };
 
 #endif /* defined(__hifi__VoxelNodeBag__) */
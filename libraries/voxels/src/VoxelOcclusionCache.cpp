@@ -0,0 +1,120 @@
+//
+//  VoxelOcclusionCache.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+
+#include <QtCore/QDebug>
+
+#include <SharedUtil.h>
+
+#include "VoxelConstants.h"
+#include "VoxelNode.h"
+#include "VoxelOcclusionCache.h"
+
+VoxelOcclusionCache::VoxelOcclusionCache(int maxOccluders) :
+    _maxOccluders(maxOccluders),
+    _hasForgottenOccluders(false),
+    _sceneStartedAt(0),
+    _isBuilt(false),
+    _occludersReused(0),
+    _occludersDropped(0),
+    _rebuildTime(0) {
+}
+
+void VoxelOcclusionCache::erase() {
+    _map.erase();
+    _occluders.clear();
+    _hasForgottenOccluders = false;
+    _isBuilt = false;
+}
+
+bool VoxelOcclusionCache::isStillOccluder(const VoxelNode* rootNode, const OctalKey& key) const {
+    const VoxelNode* node = rootNode;
+    for (int section = 0; node && section < key.getLength(); section++) {
+        node = node->getChildAtIndex(key.getSectionValue(section));
+    }
+    return node && node->isLeaf() && node->isColored() && !node->hasChangedSince(_sceneStartedAt);
+}
+
+void VoxelOcclusionCache::sceneStarted(const VoxelNode* rootNode, const ViewFrustum& viewFrustum) {
+    uint64_t start = usecTimestampNow();
+
+    // a scene in the same view stores the leaves it already had again
+    std::sort(_occluders.begin(), _occluders.end(), OctalKey::isBeforeInTree);
+    _occluders.erase(std::unique(_occluders.begin(), _occluders.end()), _occluders.end());
+
+    // the leaves were all stored after the last scene started, so a change since then may have come after they were
+    int kept = 0;
+    for (int i = 0; i < _occluders.size(); i++) {
+        if (isStillOccluder(rootNode, _occluders[i])) {
+            _occluders[kept++] = _occluders[i];
+        }
+    }
+    _occludersDropped = _occluders.size() - kept;
+    _occluders.resize(kept);
+    _sceneStartedAt = start;
+
+    // the map only needs rebuilding when it's for another view, or it has coverage from leaves that are gone
+    if (_isBuilt && viewFrustum.isVerySimilar(_builtForViewFrustum) && _occludersDropped == 0
+            && !_hasForgottenOccluders) {
+        _occludersReused = kept;
+        _rebuildTime = usecTimestampNow() - start;
+        return;
+    }
+
+    _map.erase();
+    _isBuilt = true;
+    _builtForViewFrustum = viewFrustum;
+    _hasForgottenOccluders = false;
+    kept = 0;
+    for (int i = 0; i < _occluders.size(); i++) {
+        VoxelPositionSize positionSize;
+        _occluders[i].getPositionSize(positionSize);
+        AABox voxelBox(glm::vec3(positionSize.x, positionSize.y, positionSize.z) * (float) TREE_SCALE,
+                       positionSize.s * TREE_SCALE);
+        VoxelProjectedPolygon voxelPolygon = viewFrustum.getProjectedPolygon(voxelBox);
+
+        if (voxelPolygon.getAllInView() && _map.checkMap(&voxelPolygon, true) != V2_OCCLUDED) {
+            _occluders[kept++] = _occluders[i];
+        }
+    }
+    _occludersDropped += _occluders.size() - kept;
+    _occluders.resize(kept);
+    _occludersReused = kept;
+    _rebuildTime = usecTimestampNow() - start;
+}
+
+bool VoxelOcclusionCache::isOccluded(const VoxelNode* node, const ViewFrustum& viewFrustum, bool storeIt) {
+    AABox voxelBox = node->getAABox();
+    voxelBox.scale(TREE_SCALE);
+    VoxelProjectedPolygon voxelPolygon = viewFrustum.getProjectedPolygon(voxelBox);
+
+    // In order to check occlusion culling, the shadow has to be "all in view" otherwise, we will ignore occlusion
+    // culling and proceed as normal
+    if (!voxelPolygon.getAllInView()) {
+        return false;
+    }
+
+    // the map only keeps how near it's covered where, not the polygon, so the polygon doesn't need to be on the heap
+    CoverageMapV2StorageResult result = _map.checkMap(&voxelPolygon, storeIt);
+    if (result == V2_STORED && node->isLeaf()) {
+        OctalKey key;
+        if (_occluders.size() < _maxOccluders && OctalKey::fromOctalCode(node->getOctalCode(), key)) {
+            _occluders.push_back(key);
+        } else {
+            _hasForgottenOccluders = true;
+        }
+    }
+    return result == V2_OCCLUDED;
+}
+
+void VoxelOcclusionCache::printStats() {
+    qDebug("VoxelOcclusionCache::printStats()... occluders=%d reused=%d dropped=%d forgotten=%s rebuild=%llu usecs\n",
+           getOccluderCount(), _occludersReused, _occludersDropped, debug::valueOf(_hasForgottenOccluders),
+           (long long unsigned int)_rebuildTime);
+    _map.printStats();
+}
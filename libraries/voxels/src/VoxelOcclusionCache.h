@@ -0,0 +1,78 @@
+//
+//  VoxelOcclusionCache.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A voxel server client's coverage map, kept from one scene to the next. The map itself is a CoverageMapV2, which
+//  only keeps how near each part of the screen is covered, so the leaves that were stored in it are also remembered,
+//  by octal key. When a scene starts, the map is rebuilt by projecting the remembered leaves into the current view,
+//  instead of starting out empty and letting everything behind them be sent again.
+//
+//  Reprojecting every remembered leaf isn't free, so the map is kept as it is while the view stays very similar to the
+//  one it was built for, the same test the voxel server uses to decide the client's view has changed. Only a real
+//  change of view reprojects the leaves, and leaves that aren't all in the new view, or that are behind other leaves in
+//  it, drop out.
+//
+//  Every scene, the remembered leaves are looked up in the tree again, and a leaf is forgotten unless it's still a
+//  colored leaf that hasn't changed since the last scene started. Otherwise a deleted voxel would keep hiding what's
+//  behind it, and a recolored one would hide its own parent, which the client already has all of the visible leaves
+//  of, and never be sent again. Since the map can't forget a leaf, it's rebuilt whenever one is dropped.
+//
+
+#ifndef __hifi__VoxelOcclusionCache__
+#define __hifi__VoxelOcclusionCache__
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <OctalKey.h>
+
+#include "CoverageMapV2.h"
+#include "ViewFrustum.h"
+
+class VoxelNode;
+
+const int DEFAULT_MAX_REMEMBERED_OCCLUDERS = 50000;
+
+class VoxelOcclusionCache {
+public:
+    VoxelOcclusionCache(int maxOccluders = DEFAULT_MAX_REMEMBERED_OCCLUDERS);
+
+    /// Rebuilds the map for a scene seen through viewFrustum from the remembered leaves that are still in the tree.
+    /// Call with the tree locked for encoding. If the view is very similar to the one the map was built for and no leaf
+    /// was dropped, the map is kept as it is.
+    void sceneStarted(const VoxelNode* rootNode, const ViewFrustum& viewFrustum);
+
+    /// forgets the map and the remembered leaves
+    void erase();
+
+    /// Whether the node is hidden behind the leaves stored so far. When storeIt is set, a leaf that isn't is stored,
+    /// and remembered for later scenes. Nodes that aren't all in view are never occluded.
+    bool isOccluded(const VoxelNode* node, const ViewFrustum& viewFrustum, bool storeIt);
+
+    int getOccluderCount() const { return _occluders.size(); }
+    int getOccludersReused() const { return _occludersReused; } // by the last sceneStarted()
+    int getOccludersDropped() const { return _occludersDropped; } // by the last sceneStarted()
+    uint64_t getRebuildTime() const { return _rebuildTime; } // usecs spent by the last sceneStarted()
+
+    void printStats();
+
+private:
+    bool isStillOccluder(const VoxelNode* rootNode, const OctalKey& key) const;
+
+    CoverageMapV2 _map;
+    std::vector<OctalKey> _occluders; // the leaves stored in _map that fit in a key
+    int _maxOccluders;
+    bool _hasForgottenOccluders; // some leaves in _map were too deep for a key, or past _maxOccluders
+    uint64_t _sceneStartedAt;
+    bool _isBuilt;
+    ViewFrustum _builtForViewFrustum;
+
+    int _occludersReused;
+    int _occludersDropped;
+    uint64_t _rebuildTime;
+};
+
+#endif /* defined(__hifi__VoxelOcclusionCache__) */
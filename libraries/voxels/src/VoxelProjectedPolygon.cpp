@@ -196,6 +196,13 @@ bool VoxelProjectedPolygon::occludes(const VoxelProjectedPolygon& occludee, bool
 }
 
 bool VoxelProjectedPolygon::occludes(const BoundingBox& boxOccludee) const {
+    // the same bounding box check occludes() starts with, before going to the trouble of making a polygon of the box
+    if ((boxOccludee.getMaxX() > getMaxX()) ||
+        (boxOccludee.getMaxY() > getMaxY()) ||
+        (boxOccludee.getMinX() < getMinX()) ||
+        (boxOccludee.getMinY() < getMinY())) {
+        return false;
+    }
     VoxelProjectedPolygon testee(boxOccludee);
     return occludes(testee);
 }
@@ -273,8 +280,28 @@ void VoxelProjectedPolygon::printDebugDetails() const {
 }
 
 bool VoxelProjectedPolygon::intersects(const BoundingBox& box) const {
-    VoxelProjectedPolygon testee(box);
-    return intersects(testee);
+    // a box past our bounding box is separated from us by one of its own edges, and that's the only way one of its
+    // edges can separate us, so after this only our own edges are left to try
+    if ((box.getMinX() > getMaxX()) ||
+        (box.getMinY() > getMaxY()) ||
+        (box.getMaxX() < getMinX()) ||
+        (box.getMaxY() < getMinY())) {
+        return false;
+    }
+
+    // intersectsOnAxes() with the box's corners, without making a polygon of it
+    for (int i = 0; i < getVertexCount(); i++) {
+        glm::vec2 start = getVertex(i);
+        glm::vec2 end   = getVertex((i + 1) % getVertexCount());
+        float a = start.y - end.y;
+        float b = end.x - start.x;
+        float c = a * start.x + b * start.y;
+        if (a * box.getMinX() + b * box.getMinY() < c && a * box.getMaxX() + b * box.getMinY() < c &&
+            a * box.getMaxX() + b * box.getMaxY() < c && a * box.getMinX() + b * box.getMaxY() < c) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool VoxelProjectedPolygon::intersects(const VoxelProjectedPolygon& testee) const {
@@ -124,6 +124,13 @@ void VoxelSceneStats::reset() {
     _internalSkippedOccluded = 0;
     _leavesSkippedOccluded = 0;
 
+    _occlusionChecks = 0;
+    _occlusionCheckTime = 0;
+    _occlusionRebuildTime = 0;
+    _occludedBytes = 0;
+    _occludersReused = 0;
+    _occludersDropped = 0;
+
     _colorSent = 0;
     _internalColorSent = 0;
     _leavesColorSent = 0;
@@ -206,6 +213,20 @@ void VoxelSceneStats::skippedOccluded(const VoxelNode* node) {
     } else {
         _internalSkippedOccluded++;
     }
+    _occludedBytes += SIZE_OF_COLOR_DATA;
+}
+
+void VoxelSceneStats::occlusionChecked(uint64_t checkUsecs) {
+    if (shouldTimeOcclusionCheck()) {
+        _occlusionCheckTime += checkUsecs * OCCLUSION_CHECK_TIMING_SAMPLE;
+    }
+    _occlusionChecks++;
+}
+
+void VoxelSceneStats::occludersReused(int reused, int dropped, uint64_t rebuildUsecs) {
+    _occludersReused = reused;
+    _occludersDropped = dropped;
+    _occlusionRebuildTime = rebuildUsecs;
 }
 
 void VoxelSceneStats::colorSent(const VoxelNode* node) {
@@ -316,6 +337,18 @@ int VoxelSceneStats::packIntoMessage(unsigned char* destinationBuffer, int avail
     destinationBuffer += sizeof(_existsInPacketBitsWritten);
     memcpy(destinationBuffer, &_treesRemoved, sizeof(_treesRemoved));
     destinationBuffer += sizeof(_treesRemoved);
+    memcpy(destinationBuffer, &_occlusionChecks, sizeof(_occlusionChecks));
+    destinationBuffer += sizeof(_occlusionChecks);
+    memcpy(destinationBuffer, &_occlusionCheckTime, sizeof(_occlusionCheckTime));
+    destinationBuffer += sizeof(_occlusionCheckTime);
+    memcpy(destinationBuffer, &_occlusionRebuildTime, sizeof(_occlusionRebuildTime));
+    destinationBuffer += sizeof(_occlusionRebuildTime);
+    memcpy(destinationBuffer, &_occludedBytes, sizeof(_occludedBytes));
+    destinationBuffer += sizeof(_occludedBytes);
+    memcpy(destinationBuffer, &_occludersReused, sizeof(_occludersReused));
+    destinationBuffer += sizeof(_occludersReused);
+    memcpy(destinationBuffer, &_occludersDropped, sizeof(_occludersDropped));
+    destinationBuffer += sizeof(_occludersDropped);
 
     // add the root jurisdiction
     if (_jurisdictionRoot) {
@@ -435,6 +468,18 @@ int VoxelSceneStats::unpackFromMessage(unsigned char* sourceBuffer, int availabl
     sourceBuffer += sizeof(_existsInPacketBitsWritten);
     memcpy(&_treesRemoved, sourceBuffer, sizeof(_treesRemoved));
     sourceBuffer += sizeof(_treesRemoved);
+    memcpy(&_occlusionChecks, sourceBuffer, sizeof(_occlusionChecks));
+    sourceBuffer += sizeof(_occlusionChecks);
+    memcpy(&_occlusionCheckTime, sourceBuffer, sizeof(_occlusionCheckTime));
+    sourceBuffer += sizeof(_occlusionCheckTime);
+    memcpy(&_occlusionRebuildTime, sourceBuffer, sizeof(_occlusionRebuildTime));
+    sourceBuffer += sizeof(_occlusionRebuildTime);
+    memcpy(&_occludedBytes, sourceBuffer, sizeof(_occludedBytes));
+    sourceBuffer += sizeof(_occludedBytes);
+    memcpy(&_occludersReused, sourceBuffer, sizeof(_occludersReused));
+    sourceBuffer += sizeof(_occludersReused);
+    memcpy(&_occludersDropped, sourceBuffer, sizeof(_occludersDropped));
+    sourceBuffer += sizeof(_occludersDropped);
 
     // read the root jurisdiction
     int bytes = 0;
@@ -510,6 +555,12 @@ void VoxelSceneStats::printDebugDetails() {
     qDebug("    skipped occluded    : %lu\n", _skippedOccluded          );
     qDebug("        internal        : %lu\n", _internalSkippedOccluded  );
     qDebug("        leaves          : %lu\n", _leavesSkippedOccluded    );
+    qDebug("    occlusion checks    : %lu\n", _occlusionChecks          );
+    qDebug("        check usecs     : %llu\n", (long long unsigned int)_occlusionCheckTime);
+    qDebug("        bytes culled    : %lu\n", _occludedBytes            );
+    qDebug("        occluders reused: %d\n", _occludersReused           );
+    qDebug("        dropped         : %d\n", _occludersDropped          );
+    qDebug("        rebuild usecs   : %llu\n", (long long unsigned int)_occlusionRebuildTime);
 
     qDebug("\n");
     qDebug("    color sent          : %lu\n", _colorSent                );
@@ -539,8 +590,9 @@ VoxelSceneStats::ItemInfo VoxelSceneStats::_ITEMS[] = {
     { "Skipped - Was in View", GREYISH   , 3 , "Total,Internal,Leaves" },
     { "Skipped - No Change"  , GREENISH  , 3 , "Total,Internal,Leaves" },
     { "Skipped - Occluded"   , YELLOWISH , 3 , "Total,Internal,Leaves" },
-    { "Didn't fit in packet" , GREYISH   , 4 , "Total,Internal,Leaves,Removed" },
-    { "Mode"                 , GREENISH  , 4 , "Moving,Stationary,Partial,Full" },
+    { "Occlusion"            , GREYISH   , 6 , "Bytes Culled,Checks,Check Time,Occluders Reused,Dropped,Rebuild Time" },
+    { "Didn't fit in packet" , GREENISH  , 4 , "Total,Internal,Leaves,Removed" },
+    { "Mode"                 , YELLOWISH , 4 , "Moving,Stationary,Partial,Full" },
 };
 
 const char* VoxelSceneStats::getItemValue(Item item) {
@@ -623,6 +675,14 @@ const char* VoxelSceneStats::getItemValue(Item item) {
                     _skippedOccluded, _internalSkippedOccluded, _leavesSkippedOccluded);
             break;
         }
+        case ITEM_OCCLUSION: {
+            snprintf(_itemValueBuffer, sizeof(_itemValueBuffer),
+                     "at least %lu bytes culled (%lu checks in about %llu usecs) "
+                     "%d occluders reused %d dropped in %llu usecs",
+                     _occludedBytes, _occlusionChecks, (long long unsigned int)_occlusionCheckTime,
+                     _occludersReused, _occludersDropped, (long long unsigned int)_occlusionRebuildTime);
+            break;
+        }
         case ITEM_COLORS: {
             sprintf(_itemValueBuffer, "%lu total %lu internal %lu leaves", 
                     _colorSent, _internalColorSent, _leavesColorSent);
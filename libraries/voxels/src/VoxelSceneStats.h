@@ -20,6 +20,8 @@
 
 class VoxelNode;
 
+const unsigned long OCCLUSION_CHECK_TIMING_SAMPLE = 16;
+
 /// Collects statistics for calculating and sending a scene from a voxel server to an interface client
 class VoxelSceneStats {
 public:
@@ -62,6 +64,17 @@ public:
     /// Track that a node was skipped as part of computation of a scene due to being occluded
     void skippedOccluded(const VoxelNode* node);
 
+    /// Whether the next occlusion check should be timed, only one in OCCLUSION_CHECK_TIMING_SAMPLE checks is timed so
+    /// that the timer doesn't cost more than the checks themselves
+    bool shouldTimeOcclusionCheck() const { return (_occlusionChecks % OCCLUSION_CHECK_TIMING_SAMPLE) == 0; }
+
+    /// Track that a node was checked for occlusion, checkUsecs is only used when the check was timed
+    void occlusionChecked(uint64_t checkUsecs);
+
+    /// Track how many occluders the scene started out with from earlier scenes, how many were no longer usable, and the
+    /// time it took to project them into the scene's view
+    void occludersReused(int reused, int dropped, uint64_t rebuildUsecs);
+
     /// Track that a node's color was was sent as part of computation of a scene
     void colorSent(const VoxelNode* node);
 
@@ -111,6 +124,7 @@ public:
         ITEM_SKIPPED_WAS_IN_VIEW,
         ITEM_SKIPPED_NO_CHANGE,
         ITEM_SKIPPED_OCCLUDED,
+        ITEM_OCCLUSION,
         ITEM_DIDNT_FIT,
         ITEM_MODE,
         ITEM_COUNT
@@ -189,6 +203,13 @@ private:
     unsigned long _internalSkippedOccluded;
     unsigned long _leavesSkippedOccluded;
 
+    unsigned long _occlusionChecks;
+    uint64_t _occlusionCheckTime; // usecs spent checking nodes for occlusion, scaled up from the timed sample
+    uint64_t _occlusionRebuildTime; // usecs spent projecting the occluders into the view when the scene started
+    unsigned long _occludedBytes; // at least this many bytes weren't sent, the color of each occluded node
+    int _occludersReused;
+    int _occludersDropped;
+
     unsigned long _colorSent;
     unsigned long _internalColorSent;
     unsigned long _leavesColorSent;
@@ -10,11 +10,20 @@
 #define _USE_MATH_DEFINES
 #endif
 
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
+#include <cfloat>
 #include <cmath>
 #include <fstream> // to load voxels from file
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <glm/gtc/noise.hpp>
 
 #include <QtCore/QDebug>
@@ -25,6 +34,7 @@
 #include "GeometryUtil.h"
 #include "OctalCode.h"
 #include "PacketHeaders.h"
+#include "ParallelJobs.h"
 #include "SharedUtil.h"
 #include "Tags.h"
 #include "ViewFrustum.h"
@@ -46,24 +56,31 @@ VoxelTree::VoxelTree(bool shouldReaverage) :
     voxelsBytesReadStats(100),
     _isDirty(true),
     _shouldReaverage(shouldReaverage),
-    _stopImport(false) {
-    rootNode = new VoxelNode();
+    _stopImport(false),
+    _codingThreads(DEFAULT_CODING_THREADS),
+    _codingSplitLevel(DEFAULT_CODING_SPLIT_LEVEL),
+    _lazySubtreeBytes(0),
+    _lazySubtreeLevel(-1),
+    _mappedFile(NULL),
+    _mappedFileLength(0) {
+    rootNode = new (_nodeAllocator) VoxelNode();
     
-    pthread_mutex_init(&_encodeSetLock, NULL);
-    pthread_mutex_init(&_deleteSetLock, NULL);
-    pthread_mutex_init(&_deletePendingSetLock, NULL);
+    _codeBeingEdited = NULL;
+    pthread_mutex_init(&_subtreeLocksLock, NULL);
+    pthread_cond_init(&_subtreeLocksChanged, NULL);
+    pthread_mutex_init(&_editLock, NULL);
+    pthread_mutex_init(&_lazySubtreesLock, NULL);
 }
 
 VoxelTree::~VoxelTree() {
-    // delete the children of the root node
-    // this recursively deletes the tree
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        delete rootNode->getChildAtIndex(i);
-    }
-
-    pthread_mutex_destroy(&_encodeSetLock);
-    pthread_mutex_destroy(&_deleteSetLock);
-    pthread_mutex_destroy(&_deletePendingSetLock);
+    // delete the root node, this recursively deletes the tree and returns all the nodes to our allocator
+    delete rootNode;
+    releaseLazySubtrees();
+
+    pthread_mutex_destroy(&_subtreeLocksLock);
+    pthread_cond_destroy(&_subtreeLocksChanged);
+    pthread_mutex_destroy(&_editLock);
+    pthread_mutex_destroy(&_lazySubtreesLock);
 }
 
 // Recurses voxel tree calling the RecurseVoxelTreeOperation function for each node.
@@ -194,7 +211,7 @@ VoxelNode* VoxelTree::createMissingNode(VoxelNode* lastParentNode, unsigned char
 }
 
 int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData, int bytesLeftToRead,
-                            ReadBitstreamToTreeParams& args) {
+                            ReadBitstreamToTreeParams& args, ReadBitstreamToTreeResults& results) {
     // give this destination node the child mask from the packet
     const unsigned char ALL_CHILDREN_ASSUMED_TO_EXIST = 0xFF;
     unsigned char colorInPacketMask = *nodeData;
@@ -208,11 +225,13 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
             if (!destinationNode->getChildAtIndex(i)) {
                 destinationNode->addChildAtIndex(i);
                 if (destinationNode->isDirty()) {
-                    _isDirty = true;
-                    _nodesChangedFromBitstream++;
+                    results.isDirty = true;
+                    results.nodesChanged++;
+                }
+                results.voxelsCreated++;
+                if (results.wantMovingAverages) {
+                    voxelsCreatedStats.updateAverage(1);
                 }
-                voxelsCreated++;
-                voxelsCreatedStats.updateAverage(1);
             }
 
             // pull the color for this child
@@ -238,13 +257,15 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
                 nodeIsDirty = childNodeAt->isDirty();
             }
             if (nodeIsDirty) {
-                _isDirty = true;
+                results.isDirty = true;
             }
             if (!nodeWasDirty && nodeIsDirty) {
-                _nodesChangedFromBitstream++;
+                results.nodesChanged++;
+            }
+            results.voxelsColored++;
+            if (results.wantMovingAverages) {
+                this->voxelsColoredStats.updateAverage(1);
             }
-            this->voxelsColored++;
-            this->voxelsColoredStats.updateAverage(1);
         }
     }
 
@@ -265,18 +286,20 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
                 destinationNode->addChildAtIndex(childIndex);
                 bool nodeIsDirty = destinationNode->isDirty();
                 if (nodeIsDirty) {
-                    _isDirty = true;
+                    results.isDirty = true;
                 }
                 if (!nodeWasDirty && nodeIsDirty) {
-                    _nodesChangedFromBitstream++;
+                    results.nodesChanged++;
+                }
+                results.voxelsCreated++;
+                if (results.wantMovingAverages) {
+                    this->voxelsCreatedStats.updateAverage(this->voxelsCreated + results.voxelsCreated);
                 }
-                this->voxelsCreated++;
-                this->voxelsCreatedStats.updateAverage(this->voxelsCreated);
             }
 
             // tell the child to read the subsequent data
             bytesRead += readNodeData(destinationNode->getChildAtIndex(childIndex),
-                                      nodeData + bytesRead, bytesLeftToRead - bytesRead, args);
+                                      nodeData + bytesRead, bytesLeftToRead - bytesRead, args, results);
         }
         childIndex++;
     }
@@ -287,16 +310,70 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
             // subtree/node, because it shouldn't actually exist in the tree.
             if (!oneAtBit(childrenInTreeMask, i) && destinationNode->getChildAtIndex(i)) {
                 destinationNode->safeDeepDeleteChildAtIndex(i);
-                _isDirty = true; // by definition!
+                results.isDirty = true; // by definition!
             }
         }
     }
     return bytesRead;
 }
 
+// Reads the node data of the node the bitstream's root relative octal code is for, creating the node if it's missing.
+// Returns the number of bytes read, including the octal code.
+int VoxelTree::readRootRelativeBitstream(unsigned char* bitstream, int bytesLeftToRead, ReadBitstreamToTreeParams& args,
+                                         ReadBitstreamToTreeResults& results) {
+    VoxelNode* bitstreamRootNode = nodeForOctalCode(args.destinationNode, bitstream, NULL);
+    if (*bitstream != *bitstreamRootNode->getOctalCode()) {
+        // if the octal code returned is not on the same level as
+        // the code being searched for, we have VoxelNodes to create
+
+        // Note: we need to create this node relative to root, because we're assuming that the bitstream for the initial
+        // octal code is always relative to root!
+        bitstreamRootNode = createMissingNode(args.destinationNode, bitstream);
+        if (bitstreamRootNode->isDirty()) {
+            results.isDirty = true;
+            results.nodesChanged++;
+        }
+    }
+
+    int octalCodeBytes = bytesRequiredForCodeLength(*bitstream);
+    return octalCodeBytes + readNodeData(bitstreamRootNode, bitstream + octalCodeBytes, bytesLeftToRead - octalCodeBytes,
+                                         args, results);
+}
+
+// Returns the number of bytes readNodeData() would read for this node, without reading any of it into the tree
+int VoxelTree::skipNodeData(const unsigned char* nodeData, int bytesLeftToRead, const ReadBitstreamToTreeParams& args) {
+    unsigned char colorInPacketMask = *nodeData;
+    int bytesRead = sizeof(colorInPacketMask);
+    if (args.includeColor) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(colorInPacketMask, i)) {
+                bytesRead += 3;
+            }
+        }
+    }
+
+    unsigned char childMask = *(nodeData + bytesRead + (args.includeExistsBits ? sizeof(unsigned char) : 0));
+    bytesRead += args.includeExistsBits ? 2 * sizeof(unsigned char) : sizeof(childMask);
+
+    for (int childIndex = 0; bytesLeftToRead - bytesRead > 0 && childIndex < NUMBER_OF_CHILDREN; childIndex++) {
+        if (oneAtBit(childMask, childIndex)) {
+            bytesRead += skipNodeData(nodeData + bytesRead, bytesLeftToRead - bytesRead, args);
+        }
+    }
+    return bytesRead;
+}
+
+void VoxelTree::addReadBitstreamResults(const ReadBitstreamToTreeResults& results) {
+    if (results.isDirty) {
+        _isDirty = true;
+    }
+    _nodesChangedFromBitstream += results.nodesChanged;
+    voxelsCreated += results.voxelsCreated;
+    voxelsColored += results.voxelsColored;
+}
+
 void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int bufferSizeBytes, 
                                     ReadBitstreamToTreeParams& args) {
-    int bytesRead = 0;
     unsigned char* bitstreamAt = bitstream;
 
     // If destination node is not included, set it to root
@@ -305,40 +382,127 @@ void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int
     }
 
     _nodesChangedFromBitstream = 0;
+    ReadBitstreamToTreeResults results;
 
     // Keep looping through the buffer calling readNodeData() this allows us to pack multiple root-relative Octal codes
     // into a single network packet. readNodeData() basically goes down a tree from the root, and fills things in from there
     // if there are more bytes after that, it's assumed to be another root relative tree
 
     while (bitstreamAt < bitstream + bufferSizeBytes) {
-        VoxelNode* bitstreamRootNode = nodeForOctalCode(args.destinationNode, (unsigned char *)bitstreamAt, NULL);
-        if (*bitstreamAt != *bitstreamRootNode->getOctalCode()) {
-            // if the octal code returned is not on the same level as
-            // the code being searched for, we have VoxelNodes to create
-
-            // Note: we need to create this node relative to root, because we're assuming that the bitstream for the initial
-            // octal code is always relative to root!
-            bitstreamRootNode = createMissingNode(args.destinationNode, (unsigned char*) bitstreamAt);
-            if (bitstreamRootNode->isDirty()) {
-                _isDirty = true;
-                _nodesChangedFromBitstream++;
-            }
+        // skip bitstream to new startPoint
+        bitstreamAt += readRootRelativeBitstream(bitstreamAt, bufferSizeBytes - (bitstreamAt - bitstream), args, results);
+
+        if (args.wantImportProgress) {
+            emit importProgress((100 * (bitstreamAt - bitstream)) / bufferSizeBytes);
         }
+    }
+    addReadBitstreamResults(results);
 
-        int octalCodeBytes = bytesRequiredForCodeLength(*bitstreamAt);
-        int theseBytesRead = 0;
-        theseBytesRead += octalCodeBytes;
-        theseBytesRead += readNodeData(bitstreamRootNode, bitstreamAt + octalCodeBytes, 
-                                       bufferSizeBytes - (bytesRead + octalCodeBytes), args);
+    this->voxelsBytesRead += bufferSizeBytes;
+    this->voxelsBytesReadStats.updateAverage(bufferSizeBytes);
+}
 
-        // skip bitstream to new startPoint
-        bitstreamAt += theseBytesRead;
-        bytesRead +=  theseBytesRead;
+void VoxelTree::setCodingThreads(int threadCount, int splitLevel) {
+    _codingThreads = threadCount;
+    _codingSplitLevel = splitLevel;
+}
 
-        if (args.wantImportProgress) {
+/// the subtrees on the coding split level that are being decoded together, and the bitstreams in each of them
+class ParallelReadBatch {
+public:
+    class Subtree {
+    public:
+        std::vector<unsigned char*> bitstreams;
+        std::vector<int> bytesLeftToRead;
+        ReadBitstreamToTreeResults results;
+    };
+
+    VoxelTree* tree;
+    ReadBitstreamToTreeParams* args;
+    std::vector<Subtree> subtrees;
+    std::map<VoxelNode*, int> subtreeIndexes;
+};
+
+void VoxelTree::readCodingSubtree(int subtreeIndex, void* extraData) {
+    ParallelReadBatch* batch = (ParallelReadBatch*)extraData;
+    ParallelReadBatch::Subtree& subtree = batch->subtrees[subtreeIndex];
+    for (int i = 0; i < subtree.bitstreams.size(); i++) {
+        batch->tree->readRootRelativeBitstream(subtree.bitstreams[i], subtree.bytesLeftToRead[i], *batch->args,
+                                               subtree.results);
+    }
+}
+
+void VoxelTree::readParallelReadBatch(ParallelReadBatch& batch) {
+    if (!batch.subtrees.empty()) {
+        runParallelJobs(readCodingSubtree, batch.subtrees.size(), _codingThreads, &batch);
+        for (int i = 0; i < batch.subtrees.size(); i++) {
+            addReadBitstreamResults(batch.subtrees[i].results);
+        }
+        batch.subtrees.clear();
+        batch.subtreeIndexes.clear();
+    }
+}
+
+void VoxelTree::readBitstreamToTreeInParallel(unsigned char* bitstream, unsigned long int bufferSizeBytes,
+                                              ReadBitstreamToTreeParams& args) {
+    if (!args.destinationNode) {
+        args.destinationNode = rootNode;
+    }
+    // bitstreams are sorted into subtrees by where their codes are below the root, so other destinations decode as usual
+    if (_codingThreads == 1 || args.destinationNode != rootNode) {
+        readBitstreamToTree(bitstream, bufferSizeBytes, args);
+        return;
+    }
+
+    _nodesChangedFromBitstream = 0;
+    ReadBitstreamToTreeResults results;
+    ParallelReadBatch batch;
+    batch.tree = this;
+    batch.args = &args;
+
+    unsigned char* bitstreamAt = bitstream;
+    while (bitstreamAt < bitstream + bufferSizeBytes) {
+        int bytesLeftToRead = bufferSizeBytes - (bitstreamAt - bitstream);
+        int bitstreamLevel = numberOfThreeBitSectionsInCode(bitstreamAt);
+        int octalCodeBytes = bytesRequiredForCodeLength(bitstreamLevel);
+        int bitstreamBytes = octalCodeBytes + skipNodeData(bitstreamAt + octalCodeBytes, bytesLeftToRead - octalCodeBytes,
+                                                           args);
+
+        if (bitstreamLevel >= _codingSplitLevel) {
+            // Find this bitstream's subtree, creating its root the way decoding the bitstream would have. Only this thread
+            // changes the levels above the subtrees, the coding threads only read them on their way down.
+            unsigned char* subtreeCode = ancestorOctalCode(bitstreamAt, _codingSplitLevel);
+            VoxelNode* subtreeRoot = nodeForOctalCode(rootNode, subtreeCode, NULL);
+            if (*subtreeRoot->getOctalCode() != *subtreeCode) {
+                subtreeRoot = createMissingNode(rootNode, subtreeCode);
+                if (subtreeRoot->isDirty()) {
+                    results.isDirty = true;
+                    results.nodesChanged++;
+                }
+            }
+            delete[] subtreeCode;
+
+            std::map<VoxelNode*, int>::iterator subtreeIndex = batch.subtreeIndexes.find(subtreeRoot);
+            if (subtreeIndex == batch.subtreeIndexes.end()) {
+                subtreeIndex = batch.subtreeIndexes.insert(std::make_pair(subtreeRoot, (int)batch.subtrees.size())).first;
+                batch.subtrees.push_back(ParallelReadBatch::Subtree());
+                batch.subtrees.back().results.wantMovingAverages = false;
+            }
+            batch.subtrees[subtreeIndex->second].bitstreams.push_back(bitstreamAt);
+            batch.subtrees[subtreeIndex->second].bytesLeftToRead.push_back(bytesLeftToRead);
+        } else {
+            // this bitstream is above the subtrees, so everything before it has to be decoded first
+            readParallelReadBatch(batch);
+            readRootRelativeBitstream(bitstreamAt, bytesLeftToRead, args, results);
+        }
+        bitstreamAt += bitstreamBytes;
+
+        if (args.wantImportProgress && batch.subtrees.empty()) {
             emit importProgress((100 * (bitstreamAt - bitstream)) / bufferSizeBytes);
         }
     }
+    readParallelReadBatch(batch);
+    addReadBitstreamResults(results);
 
     this->voxelsBytesRead += bufferSizeBytes;
     this->voxelsBytesReadStats.updateAverage(bufferSizeBytes);
@@ -371,17 +535,10 @@ void VoxelTree::deleteVoxelCodeFromTree(unsigned char* codeBuffer, bool collapse
     args.deleteLastChild    = false;
     args.pathChanged        = false;
 
+    decodeLazySubtreesOverlapping(codeBuffer);
     VoxelNode* node = rootNode;
     
-    // We can't encode and delete nodes at the same time, so we guard against deleting any node that is actively
-    // being encoded. And we stick that code on our pendingDelete list.
-    if (isEncoding(codeBuffer)) {
-        queueForLaterDelete(codeBuffer);
-    } else {
-        startDeleting(codeBuffer);
-        deleteVoxelCodeFromTreeRecursion(node, &args);
-        doneDeleting(codeBuffer);
-    }
+    deleteVoxelCodeFromTreeRecursion(node, &args);
 }
 
 void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraData) {
@@ -481,9 +638,14 @@ void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraDat
 
 void VoxelTree::eraseAllVoxels() {
     // XXXBHG Hack attack - is there a better way to erase the voxel tree?
-    delete rootNode; // this will recurse and delete all children
     VoxelSystem* voxelSystem = rootNode->getVoxelSystem();
-    rootNode = new VoxelNode();
+    delete rootNode; // this will recurse and delete all children
+    releaseLazySubtrees();
+
+    // now that all of our nodes are gone, hand our empty slabs back in bulk
+    _nodeAllocator.releaseEmptySlabs();
+
+    rootNode = new (_nodeAllocator) VoxelNode();
     rootNode->setVoxelSystem(voxelSystem);
     _isDirty = true;
 }
@@ -503,7 +665,7 @@ void VoxelTree::readCodeColorBufferToTree(unsigned char* codeColorBuffer, bool d
     args.destructive     = destructive;
     args.pathChanged     = false;
 
-
+    decodeLazySubtreesOverlapping(codeColorBuffer);
     VoxelNode* node = rootNode;
 
     readCodeColorBufferToTreeRecursion(node, &args);
@@ -518,39 +680,9 @@ void VoxelTree::readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraD
     // Since we traverse the tree in code order, we know that if our code
     // matches, then we've reached  our target node.
     if (lengthOfNodeCode == args->lengthOfCode) {
-        // we've reached our target -- we might have found our node, but that node might have children.
-        // in this case, we only allow you to set the color if you explicitly asked for a destructive
-        // write.
-        if (!node->isLeaf() && args->destructive) {
-            // if it does exist, make sure it has no children
-            for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-                node->deleteChildAtIndex(i);
-            }
-        } else {
-            if (!node->isLeaf()) {
-                qDebug("WARNING! operation would require deleting children, add Voxel ignored!\n ");
-            }
-        }
-
-        // If we get here, then it means, we either had a true leaf to begin with, or we were in
-        // destructive mode and we deleted all the child trees. So we can color.
-        if (node->isLeaf()) {
-            // give this node its color
-            int octalCodeBytes = bytesRequiredForCodeLength(args->lengthOfCode);
-
-            nodeColor newColor;
-            memcpy(newColor, args->codeColorBuffer + octalCodeBytes, SIZE_OF_COLOR_DATA);
-            newColor[SIZE_OF_COLOR_DATA] = 1;
-            node->setColor(newColor);
-
-            // It's possible we just reset the node to it's exact same color, in
-            // which case we don't consider this to be dirty...
-            if (node->isDirty()) {
-                // track our tree dirtiness
-                _isDirty = true;
-                // track that path has changed
-                args->pathChanged = true;
-            }
+        if (setNodeColorFromCodeColorBuffer(node, args->codeColorBuffer, args->destructive)) {
+            // track that path has changed
+            args->pathChanged = true;
         }
         return;
     }
@@ -576,6 +708,128 @@ void VoxelTree::readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraD
     }
 }
 
+// returns true if the node's color actually changed
+bool VoxelTree::setNodeColorFromCodeColorBuffer(VoxelNode* node, const unsigned char* codeColorBuffer, bool destructive) {
+    // we've reached our target -- we might have found our node, but that node might have children.
+    // in this case, we only allow you to set the color if you explicitly asked for a destructive
+    // write.
+    if (!node->isLeaf() && destructive) {
+        // if it does exist, make sure it has no children
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            node->deleteChildAtIndex(i);
+        }
+    } else {
+        if (!node->isLeaf()) {
+            qDebug("WARNING! operation would require deleting children, add Voxel ignored!\n ");
+        }
+    }
+
+    // If we get here, then it means, we either had a true leaf to begin with, or we were in
+    // destructive mode and we deleted all the child trees. So we can color.
+    if (node->isLeaf()) {
+        // give this node its color
+        int octalCodeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(codeColorBuffer));
+
+        nodeColor newColor;
+        memcpy(newColor, codeColorBuffer + octalCodeBytes, SIZE_OF_COLOR_DATA);
+        newColor[SIZE_OF_COLOR_DATA] = 1;
+        node->setColor(newColor);
+
+        // It's possible we just reset the node to it's exact same color, in
+        // which case we don't consider this to be dirty...
+        if (node->isDirty()) {
+            // track our tree dirtiness
+            _isDirty = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+// depth first order of octal codes: ancestors come before their descendants, and siblings are in child index order
+static bool octalCodeComesFirst(const unsigned char* codeA, const unsigned char* codeB) {
+    int sharedSections = numberOfSharedSections(codeA, codeB);
+    int lengthOfCodeA = numberOfThreeBitSectionsInCode(codeA);
+    int lengthOfCodeB = numberOfThreeBitSectionsInCode(codeB);
+    if (sharedSections == lengthOfCodeA || sharedSections == lengthOfCodeB) {
+        return lengthOfCodeA < lengthOfCodeB;
+    }
+    return getOctalCodeSectionValue(codeA, sharedSections) < getOctalCodeSectionValue(codeB, sharedSections);
+}
+
+void VoxelTree::readCodeColorBuffersToTree(const std::vector<unsigned char*>& codeColorBuffers, bool destructive) {
+    if (codeColorBuffers.empty()) {
+        return;
+    }
+    for (int i = 0; i < codeColorBuffers.size(); i++) {
+        decodeLazySubtreesOverlapping(codeColorBuffers[i]);
+    }
+
+    // stable, so that edits of the same voxel stay in the order they were sent
+    std::vector<unsigned char*> sortedBuffers(codeColorBuffers);
+    std::stable_sort(sortedBuffers.begin(), sortedBuffers.end(), octalCodeComesFirst);
+
+    // In depth first order, if any edit is of an ancestor of another edit's voxel, then it's also the ancestor of the
+    // edit right after it (unless that's an edit of the same voxel).
+    for (int i = 0; i + 1 < sortedBuffers.size(); i++) {
+        int lengthOfCode = numberOfThreeBitSectionsInCode(sortedBuffers[i]);
+        if (lengthOfCode < numberOfThreeBitSectionsInCode(sortedBuffers[i + 1])
+            && isAncestorOf(sortedBuffers[i], sortedBuffers[i + 1])) {
+            for (int j = 0; j < codeColorBuffers.size(); j++) {
+                readCodeColorBufferToTree(codeColorBuffers[j], destructive);
+            }
+            return;
+        }
+    }
+
+    readCodeColorBuffersToTreeRecursion(rootNode, &sortedBuffers[0], sortedBuffers.size(), destructive);
+}
+
+// codeColorBuffers are the depth first sorted edits of node and its descendants. Returns true if any of them changed
+// the subtree.
+bool VoxelTree::readCodeColorBuffersToTreeRecursion(VoxelNode* node, unsigned char** codeColorBuffers, int count,
+                                                    bool destructive) {
+    int lengthOfNodeCode = numberOfThreeBitSectionsInCode(node->getOctalCode());
+    bool subtreeChanged = false;
+    bool childrenChanged = false;
+
+    // edits of this node itself come first
+    int i = 0;
+    while (i < count && numberOfThreeBitSectionsInCode(codeColorBuffers[i]) == lengthOfNodeCode) {
+        if (setNodeColorFromCodeColorBuffer(node, codeColorBuffers[i], destructive)) {
+            subtreeChanged = true;
+        }
+        i++;
+    }
+
+    // then the edits of each child's subtree, which are next to each other
+    while (i < count) {
+        int childIndex = branchIndexWithDescendant(node->getOctalCode(), codeColorBuffers[i]);
+        int endOfChild = i + 1;
+        while (endOfChild < count
+               && branchIndexWithDescendant(node->getOctalCode(), codeColorBuffers[endOfChild]) == childIndex) {
+            endOfChild++;
+        }
+
+        // If the branch we need to traverse does not exist, then create it on the way down...
+        VoxelNode* childNode = node->getChildAtIndex(childIndex);
+        if (!childNode) {
+            childNode = node->addChildAtIndex(childIndex);
+        }
+        if (readCodeColorBuffersToTreeRecursion(childNode, codeColorBuffers + i, endOfChild - i, destructive)) {
+            childrenChanged = true;
+        }
+        i = endOfChild;
+    }
+
+    // like readCodeColorBufferToTreeRecursion(), but once for all of the edits below us
+    if (childrenChanged) {
+        node->handleSubtreeChanged(this);
+        subtreeChanged = true;
+    }
+    return subtreeChanged;
+}
+
 void VoxelTree::processRemoveVoxelBitstream(unsigned char* bitstream, int bufferSizeBytes) {
     //unsigned short int itemNumber = (*((unsigned short int*)&bitstream[sizeof(PACKET_HEADER)]));
 
@@ -908,43 +1162,150 @@ void VoxelTree::createSphere(float radius, float xc, float yc, float zc, float v
     }
 }
 
-// combines the ray cast arguments into a single object
+// a ray in tree units, with what it takes to test it against many boxes quickly
 class RayArgs {
 public:
+    RayArgs(const glm::vec3& origin, const glm::vec3& direction);
+
     glm::vec3 origin;
     glm::vec3 direction;
-    VoxelNode*& node;
-    float& distance;
-    BoxFace& face;
-    bool found;
+    glm::vec3 inverseDirection;
+    
+    // Each axis bit of a child index (x is 4, y is 2, z is 1) changes at most once along a ray, from the near half of
+    // the parent to the far one. So visiting children in order of index ^ childOrder, which flips the bits of the axes
+    // the ray goes down, visits every child the ray passes through in the order it passes through them.
+    int childOrder;
 };
 
-bool findRayIntersectionOp(VoxelNode* node, void* extraData) {
-    RayArgs* args = static_cast<RayArgs*>(extraData);
-    AABox box = node->getAABox();
-    float distance;
-    BoxFace face;
-    if (!box.findRayIntersection(args->origin, args->direction, distance, face)) {
-        return false;
+RayArgs::RayArgs(const glm::vec3& origin, const glm::vec3& direction) :
+    origin(origin / (float)TREE_SCALE),
+    direction(direction),
+    childOrder((direction.x < 0.0f ? 4 : 0) | (direction.y < 0.0f ? 2 : 0) | (direction.z < 0.0f ? 1 : 0))
+{
+    // a ray along an axis never crosses that axis' planes, which FLT_MAX gets us without dividing by zero
+    for (int i = 0; i < 3; i++) {
+        inverseDirection[i] = (direction[i] == 0.0f) ? FLT_MAX : 1.0f / direction[i];
     }
-    if (!node->isLeaf()) {
-        return true; // recurse on children
+}
+
+// whether the ray passes through the box, by where it enters and leaves the slabs between each pair of faces
+static inline bool rayPassesThroughBox(const RayArgs& ray, const AABox& box) {
+    glm::vec3 toNearCorner = (box.getCorner() - ray.origin) * ray.inverseDirection;
+    glm::vec3 toFarCorner = (box.getCorner() + glm::vec3(box.getScale()) - ray.origin) * ray.inverseDirection;
+    glm::vec3 entries = glm::min(toNearCorner, toFarCorner);
+    glm::vec3 exits = glm::max(toNearCorner, toFarCorner);
+    float lastExit = glm::min(glm::min(exits.x, exits.y), exits.z);
+    return lastExit >= 0.0f && glm::max(glm::max(entries.x, entries.y), entries.z) <= lastExit;
+}
+
+// Takes the ray's distance and face from the leaf the way the box test always has, so a hit is the same as it was when
+// every box the ray touched was tested.
+static inline bool findRayIntersectionWithLeaf(const RayArgs& ray, VoxelNode* leaf, float& distance, BoxFace& face) {
+    if (!leaf->isColored() || !leaf->getAABox().findRayIntersection(ray.origin, ray.direction, distance, face)) {
+        return false;
     }
     distance *= TREE_SCALE;
-    if (node->isColored() && (!args->found || distance < args->distance)) {
-        args->node = node;
-        args->distance = distance;
-        args->face = face;
-        args->found = true;
+    return true;
+}
+
+// visits the nodes the ray passes through front to back, so the first colored leaf it reaches is the nearest one
+static VoxelNode* findRayIntersectionInNode(const RayArgs& ray, VoxelNode* node, float& distance, BoxFace& face,
+                                            int recursionCount = 0) {
+    if (recursionCount > DANGEROUSLY_DEEP_RECURSION) {
+        qDebug() << "findRayIntersectionInNode() reached DANGEROUSLY_DEEP_RECURSION, bailing!\n";
+        return NULL;
     }
-    return false;
+    if (node->isLeaf()) {
+        return findRayIntersectionWithLeaf(ray, node, distance, face) ? node : NULL;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i ^ ray.childOrder);
+        if (child && rayPassesThroughBox(ray, child->getAABox())) {
+            VoxelNode* hit = findRayIntersectionInNode(ray, child, distance, face, recursionCount + 1);
+            if (hit) {
+                return hit;
+            }
+        }
+    }
+    return NULL;
 }
 
 bool VoxelTree::findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
                                     VoxelNode*& node, float& distance, BoxFace& face) {
-    RayArgs args = { origin / (float)TREE_SCALE, direction, node, distance, face };
-    recurseTreeWithOperation(findRayIntersectionOp, &args);
-    return args.found;
+    RayArgs ray(origin, direction);
+    if (!rayPassesThroughBox(ray, rootNode->getAABox())) {
+        return false;
+    }
+    VoxelNode* hit = findRayIntersectionInNode(ray, rootNode, distance, face);
+    if (hit) {
+        node = hit;
+    }
+    return hit != NULL;
+}
+
+// the rays of a batch going the same way, and the scratch space for the lists of them still looking in each node
+class RayBatchArgs {
+public:
+    std::vector<RayArgs> rays;
+    std::vector<VoxelRayCast*> casts;
+    std::vector<int> active; // a list for each node on the way down, one after another
+};
+
+// Like findRayIntersectionInNode(), for every ray in active from first on, which all pass through node. The rays all
+// go down the same axes, so they agree on the child order and each child is visited once for all that pass through it.
+static void findRayIntersectionsInNode(RayBatchArgs& batch, VoxelNode* node, int first, int recursionCount = 0) {
+    if (recursionCount > DANGEROUSLY_DEEP_RECURSION) {
+        qDebug() << "findRayIntersectionsInNode() reached DANGEROUSLY_DEEP_RECURSION, bailing!\n";
+        return;
+    }
+    int last = batch.active.size();
+    if (node->isLeaf()) {
+        for (int i = first; i < last; i++) {
+            VoxelRayCast* cast = batch.casts[batch.active[i]];
+            if (findRayIntersectionWithLeaf(batch.rays[batch.active[i]], node, cast->distance, cast->face)) {
+                cast->node = node;
+            }
+        }
+        return;
+    }
+    int childOrder = batch.rays[batch.active[first]].childOrder;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i ^ childOrder);
+        if (!child) {
+            continue;
+        }
+        // rays that hit something in an earlier child are done
+        for (int j = first; j < last; j++) {
+            int ray = batch.active[j];
+            if (!batch.casts[ray]->node && rayPassesThroughBox(batch.rays[ray], child->getAABox())) {
+                batch.active.push_back(ray);
+            }
+        }
+        if (batch.active.size() > last) {
+            findRayIntersectionsInNode(batch, child, last, recursionCount + 1);
+            batch.active.resize(last);
+        }
+    }
+}
+
+void VoxelTree::findRayIntersections(std::vector<VoxelRayCast>& casts) {
+    const int CHILD_ORDERS = NUMBER_OF_CHILDREN;
+    RayBatchArgs batches[CHILD_ORDERS];
+    for (int i = 0; i < casts.size(); i++) {
+        casts[i].node = NULL;
+        RayArgs ray(casts[i].origin, casts[i].direction);
+        if (rayPassesThroughBox(ray, rootNode->getAABox())) {
+            RayBatchArgs& batch = batches[ray.childOrder];
+            batch.active.push_back(batch.rays.size());
+            batch.rays.push_back(ray);
+            batch.casts.push_back(&casts[i]);
+        }
+    }
+    for (int i = 0; i < CHILD_ORDERS; i++) {
+        if (!batches[i].rays.empty()) {
+            findRayIntersectionsInNode(batches[i], rootNode, 0);
+        }
+    }
 }
 
 class SphereArgs {
@@ -1020,6 +1381,88 @@ bool VoxelTree::findCapsulePenetration(const glm::vec3& start, const glm::vec3&
     return args.found;
 }
 
+// finds the colored leaves that touch the region, and remembers every node walked to find them, parents first
+static void findLeavesInRegion(VoxelNode* node, const glm::vec3& minimum, const glm::vec3& maximum,
+                               std::vector<VoxelNode*>& nodes, std::vector<AABox>& leaves, int recursionCount = 0) {
+    if (recursionCount > DANGEROUSLY_DEEP_RECURSION) {
+        qDebug() << "findLeavesInRegion() reached DANGEROUSLY_DEEP_RECURSION, bailing!\n";
+        return;
+    }
+    const AABox& box = node->getAABox();
+    glm::vec3 farCorner = box.getCorner() + glm::vec3(box.getScale());
+    if (glm::any(glm::greaterThan(box.getCorner(), maximum)) || glm::any(glm::lessThan(farCorner, minimum))) {
+        return;
+    }
+    nodes.push_back(node);
+    if (node->isLeaf()) {
+        if (node->isColored()) {
+            leaves.push_back(box);
+        }
+        return;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i);
+        if (child) {
+            findLeavesInRegion(child, minimum, maximum, nodes, leaves, recursionCount + 1);
+        }
+    }
+}
+
+void VoxelTree::findPenetrations(VoxelCollisionQuery& query) {
+    if (query._shapeCount == 0) {
+        return;
+    }
+    glm::vec3 minimum, maximum;
+    query.getBounds(minimum, maximum);
+
+    // the leaves from last time will do if the shapes are still among them and nothing on the way to them has changed
+    query._wasCacheUsed = query._cachedTree == this && !query._cachedNodes.empty() && query._cachedNodes[0] == rootNode
+        && glm::all(glm::greaterThanEqual(minimum, query._cachedMinimum))
+        && glm::all(glm::lessThanEqual(maximum, query._cachedMaximum));
+    for (int i = 0; query._wasCacheUsed && i < query._cachedNodes.size(); i++) {
+        if (query._cachedNodes[i]->getLastChanged() >= query._cachedAt) {
+            query._wasCacheUsed = false;
+        }
+    }
+    if (!query._wasCacheUsed) {
+        glm::vec3 size = maximum - minimum;
+        glm::vec3 margin(glm::max(glm::max(size.x, size.y), size.z) * COLLISION_CACHE_MARGIN_PROPORTION);
+        query._cachedTree = this;
+        query._cachedMinimum = minimum - margin;
+        query._cachedMaximum = maximum + margin;
+        query._cachedAt = usecTimestampNow();
+        query._cachedNodes.clear();
+        query._cachedLeaves.clear();
+        findLeavesInRegion(rootNode, query._cachedMinimum, query._cachedMaximum, query._cachedNodes, query._cachedLeaves);
+    }
+
+    // the same tests findSpherePenetration() and findCapsulePenetration() make of each leaf, after a quick check that
+    // the leaf is near the shape at all
+    for (int i = 0; i < query._shapeCount; i++) {
+        VoxelCollisionQuery::Shape& shape = query._shapes[i];
+        glm::vec3 radius(shape.radius, shape.radius, shape.radius);
+        glm::vec3 shapeMinimum = glm::min(shape.start, shape.end) - radius;
+        glm::vec3 shapeMaximum = glm::max(shape.start, shape.end) + radius;
+        for (int j = 0; j < query._cachedLeaves.size(); j++) {
+            const AABox& box = query._cachedLeaves[j];
+            if (glm::any(glm::greaterThan(box.getCorner(), shapeMaximum))
+                    || glm::any(glm::lessThan(box.getCorner() + glm::vec3(box.getScale()), shapeMinimum))) {
+                continue;
+            }
+            VoxelContact contact;
+            if (shape.isSphere ? (box.expandedContains(shape.start, shape.radius) &&
+                                  box.findSpherePenetration(shape.start, shape.radius, contact.penetration)) :
+                    (box.expandedIntersectsSegment(shape.start, shape.end, shape.radius) &&
+                     box.findCapsulePenetration(shape.start, shape.end, shape.radius, contact.penetration))) {
+                contact.corner = box.getCorner() * (float)TREE_SCALE;
+                contact.scale = box.getScale() * TREE_SCALE;
+                contact.penetration *= (float)TREE_SCALE;
+                shape.contacts.push_back(contact);
+            }
+        }
+    }
+}
+
 int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag,
                                    EncodeBitstreamParams& params) {
 
@@ -1032,11 +1475,8 @@ int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer,
         return bytesWritten;
     }
 
-    startEncoding(node);
-    
     // If we're at a node that is out of view, then we can return, because no nodes below us will be in view!
     if (params.viewFrustum && !node->isInView(*params.viewFrustum)) {
-        doneEncoding(node);
         return bytesWritten;
     }
     
@@ -1069,7 +1509,8 @@ int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer,
         params.stats->traversed(node);
     }
     
-    int childBytesWritten = encodeTreeBitstreamRecursion(node, outputBuffer, availableBytes, bag, params, currentEncodeLevel);
+    int childBytesWritten = encodeTreeBitstreamRecursionCached(node, outputBuffer, availableBytes, bag, params,
+                                                               currentEncodeLevel);
 
     // if childBytesWritten == 1 then something went wrong... that's not possible
     assert(childBytesWritten != 1);
@@ -1088,10 +1529,111 @@ int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer,
         bytesWritten = 0;
     }
     
-    doneEncoding(node);
     return bytesWritten;
 }
 
+// Returns the LOD band that the whole subtree under node falls in for this viewer, or NOT_CACHEABLE if its encoding
+// depends on anything more than that. Nodes are rendered based on how their distance to the camera compares to 
+// boundaryDistanceForRenderLevel() of their level, so if the nearest and furthest points of the subtree are both
+// between the boundaries for two adjacent render levels, then every one of those decisions inside the subtree comes
+// out the same for any viewer with the same band.
+static int encodeCacheBand(const VoxelNode* node, const EncodeBitstreamParams& params) {
+    // delta sending, occlusion culling and partial scenes all depend on what this particular client was sent before
+    if (!params.viewFrustum || params.deltaViewFrustum || params.wantOcclusionCulling || !params.forceSendScene
+            || params.maxEncodeLevel != INT_MAX) {
+        return NOT_CACHEABLE;
+    }
+
+    AABox box = node->getAABox();
+    box.scale(TREE_SCALE);
+    if (params.viewFrustum->boxInFrustum(box) != ViewFrustum::INSIDE) {
+        return NOT_CACHEABLE;
+    }
+
+    const glm::vec3& position = params.viewFrustum->getPosition();
+    glm::vec3 nearestPoint = glm::clamp(position, box.getCorner(), box.calcTopFarLeft());
+    float nearestDistance = glm::distance(position, nearestPoint);
+    float furthestDistance = glm::distance(position, params.viewFrustum->getFurthestPointFromCamera(box));
+    if (nearestDistance <= 0.0f || furthestDistance >= params.voxelSizeScale) {
+        return NOT_CACHEABLE;
+    }
+
+    // the deepest render level whose boundary is still beyond our furthest point
+    int renderLevel = (int)floorf(log2f(params.voxelSizeScale / furthestDistance));
+    while (renderLevel > 0 && boundaryDistanceForRenderLevel(renderLevel, params.voxelSizeScale) <= furthestDistance) {
+        renderLevel--;
+    }
+    if (boundaryDistanceForRenderLevel(renderLevel, params.voxelSizeScale) <= furthestDistance
+            || boundaryDistanceForRenderLevel(renderLevel + 1, params.voxelSizeScale) >= nearestDistance) {
+        return NOT_CACHEABLE;
+    }
+    // in terms of node levels, so that clients with different boundary adjusts can share
+    return renderLevel - params.boundaryLevelAdjust;
+}
+
+int VoxelTree::encodeTreeBitstreamRecursionCached(VoxelNode* node, unsigned char* outputBuffer, int availableBytes,
+                                                  VoxelNodeBag& bag, EncodeBitstreamParams& params,
+                                                  int& currentEncodeLevel) const {
+    int band = NOT_CACHEABLE;
+    if (params.encodeCache && !params.encodingCacheFragment) {
+        band = encodeCacheBand(node, params);
+    }
+    if (band == NOT_CACHEABLE) {
+        return encodeTreeBitstreamRecursion(node, outputBuffer, availableBytes, bag, params, currentEncodeLevel);
+    }
+
+    int bytesWritten = 0;
+    if (params.encodeCache->lookup(node, band, params.includeColor, params.includeExistsBits,
+                                   outputBuffer, availableBytes, bytesWritten)) {
+        return bytesWritten;
+    }
+
+    // encode it ourselves, and if all of it fit then let the other clients have it
+    int subTreesDeferred = params.subTreesDeferred;
+    params.encodingCacheFragment = true;
+    bytesWritten = encodeTreeBitstreamRecursion(node, outputBuffer, availableBytes, bag, params, currentEncodeLevel);
+    params.encodingCacheFragment = false;
+
+    if (params.subTreesDeferred == subTreesDeferred) {
+        params.encodeCache->store(node, band, params.includeColor, params.includeExistsBits, outputBuffer, bytesWritten);
+    }
+    return bytesWritten;
+}
+
+// Checks the node's shadow against the shadows stored so far, in the occlusion cache if there is one, and otherwise in
+// the coverage map. Shadows that aren't all in view are never occluded.
+bool VoxelTree::isOccluded(const VoxelNode* node, EncodeBitstreamParams& params, bool storeIt) const {
+    bool occluded = false;
+    bool timeIt = params.stats && params.stats->shouldTimeOcclusionCheck();
+    uint64_t start = timeIt ? usecTimestampNow() : 0;
+
+    if (params.occlusionCache) {
+        occluded = params.occlusionCache->isOccluded(node, *params.viewFrustum, storeIt);
+    } else {
+        AABox voxelBox = node->getAABox();
+        voxelBox.scale(TREE_SCALE);
+        VoxelProjectedPolygon* voxelPolygon = new VoxelProjectedPolygon(params.viewFrustum->getProjectedPolygon(voxelBox));
+
+        if (voxelPolygon->getAllInView()) {
+            CoverageMapStorageResult result = params.map->checkMap(voxelPolygon, storeIt);
+
+            // In all cases where the shadow wasn't stored, we need to free our own memory.
+            // In the case where it is stored, the CoverageMap will free memory for us later.
+            if (result != STORED) {
+                delete voxelPolygon;
+            }
+            occluded = (result == OCCLUDED);
+        } else {
+            delete voxelPolygon;
+        }
+    }
+
+    if (params.stats) {
+        params.stats->occlusionChecked(timeIt ? usecTimestampNow() - start : 0);
+    }
+    return occluded;
+}
+
 int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag,
                                             EncodeBitstreamParams& params, int& currentEncodeLevel) const {
 
@@ -1115,10 +1657,14 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
     }
 
     // If we've been provided a jurisdiction map, then we need to honor it.
+    // A child is only ever WITHIN when its parent is (a parent above the root is ABOVE no matter which child is asked
+    // about, and end nodes are checked against the parent), so the node's answer is kept for its children too.
+    JurisdictionMap::Area nodeJurisdiction = JurisdictionMap::WITHIN;
     if (params.jurisdictionMap) {
         // here's how it works... if we're currently above our root jurisdiction, then we proceed normally.
         // but once we're in our own jurisdiction, then we need to make sure we're not below it.
-        if (JurisdictionMap::BELOW == params.jurisdictionMap->isMyJurisdiction(node->getOctalCode(), CHECK_NODE_ONLY)) {
+        nodeJurisdiction = params.jurisdictionMap->isMyJurisdiction(node->getOctalCode(), CHECK_NODE_ONLY);
+        if (JurisdictionMap::BELOW == nodeJurisdiction) {
             return bytesAtThisLevel;
         }
     }
@@ -1198,30 +1744,11 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
 
         // If the user also asked for occlusion culling, check if this node is occluded, but only if it's not a leaf.
         // leaf occlusion is handled down below when we check child nodes
-        if (params.wantOcclusionCulling && !node->isLeaf()) {
-            //node->printDebugDetails("upper section, params.wantOcclusionCulling...  node=");
-            AABox voxelBox = node->getAABox();
-            voxelBox.scale(TREE_SCALE);
-            VoxelProjectedPolygon* voxelPolygon = new VoxelProjectedPolygon(params.viewFrustum->getProjectedPolygon(voxelBox));
-
-            // In order to check occlusion culling, the shadow has to be "all in view" otherwise, we will ignore occlusion
-            // culling and proceed as normal
-            if (voxelPolygon->getAllInView()) {
-                //node->printDebugDetails("upper section, voxelPolygon->getAllInView() node=");
-
-                CoverageMapStorageResult result = params.map->checkMap(voxelPolygon, false);
-                delete voxelPolygon; // cleanup
-                if (result == OCCLUDED) {
-                    if (params.stats) {
-                        params.stats->skippedOccluded(node);
-                    }
-                    return bytesAtThisLevel;
-                }
-            } else {
-                // If this shadow wasn't "all in view" then we ignored it for occlusion culling, but
-                // we do need to clean up memory and proceed as normal...
-                delete voxelPolygon;
+        if (params.wantOcclusionCulling && !node->isLeaf() && isOccluded(node, params, false)) {
+            if (params.stats) {
+                params.stats->skippedOccluded(node);
             }
+            return bytesAtThisLevel;
         }
     }
 
@@ -1261,7 +1788,7 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
         // even if they don't in our local tree
         bool notMyJurisdiction = false;
         if (params.jurisdictionMap) {
-            notMyJurisdiction = (JurisdictionMap::WITHIN != params.jurisdictionMap->isMyJurisdiction(node->getOctalCode(), i));
+            notMyJurisdiction = (nodeJurisdiction != JurisdictionMap::WITHIN);
         }
         if (params.includeExistsBits) {
             // If the child is known to exist, OR, it's not my jurisdiction, then we mark the bit as existing
@@ -1326,6 +1853,11 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
             } else {
                 inViewCount++;
 
+                // a lazily loaded subtree looks like a leaf until it's decoded, so ask for it to be
+                if (childNode->isLeaf()) {
+                    requestLazySubtree(childNode);
+                }
+
                 // track children in view as existing and not a leaf, if they're a leaf,
                 // we don't care about recursing deeper on them, and we don't consider their
                 // subtree to exist
@@ -1338,33 +1870,9 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
 
                 // If the user also asked for occlusion culling, check if this node is occluded
                 if (params.wantOcclusionCulling && childNode->isLeaf()) {
-                    // Don't check occlusion here, just add them to our distance ordered array...
-
-                    AABox voxelBox = childNode->getAABox();
-                    voxelBox.scale(TREE_SCALE);
-                    VoxelProjectedPolygon* voxelPolygon = new VoxelProjectedPolygon(
-                                params.viewFrustum->getProjectedPolygon(voxelBox));
-
-                    // In order to check occlusion culling, the shadow has to be "all in view" otherwise, we will ignore occlusion
-                    // culling and proceed as normal
-                    if (voxelPolygon->getAllInView()) {
-                        CoverageMapStorageResult result = params.map->checkMap(voxelPolygon, true);
-
-                        // In all cases where the shadow wasn't stored, we need to free our own memory.
-                        // In the case where it is stored, the CoverageMap will free memory for us later.
-                        if (result != STORED) {
-                            delete voxelPolygon;
-                        }
-
-                        // If while attempting to add this voxel's shadow, we determined it was occluded, then
-                        // we don't need to process it further and we can exit early.
-                        if (result == OCCLUDED) {
-                            childIsOccluded = true;
-                        }
-                    } else {
-                        delete voxelPolygon;
-                    }
-                } // wants occlusion culling & isLeaf()
+                    // the leaf's shadow is stored for the leaves after it, unless it's hidden behind the ones before it
+                    childIsOccluded = isOccluded(childNode, params, true);
+                }
 
 
                 bool shouldRender = !params.viewFrustum 
@@ -1477,6 +1985,7 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
         availableBytes -= bytesAtThisLevel;
     } else {
         bag.insert(node);
+        params.subTreesDeferred++;
 
         // don't need to check node here, because we can't get here with no node
         if (params.stats) {
@@ -1520,8 +2029,8 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
                 // remember this for reshuffling
                 recursiveSliceStarts[originalIndex] = outputBuffer;
 
-                int childTreeBytesOut = encodeTreeBitstreamRecursion(childNode, outputBuffer, availableBytes, bag,
-                                                                     params, thisLevel);
+                int childTreeBytesOut = encodeTreeBitstreamRecursionCached(childNode, outputBuffer, availableBytes, bag,
+                                                                           params, thisLevel);
 
                 // remember this for reshuffling
                 recursiveSliceSizes[originalIndex] = childTreeBytesOut;
@@ -1622,7 +2131,7 @@ bool VoxelTree::readFromSVOFile(const char* fileName) {
         file.read((char*)entireFile, fileLength);
         bool wantImportProgress = true;
         ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS, NULL, 0, wantImportProgress);
-        readBitstreamToTree(entireFile, fileLength, args);
+        readBitstreamToTreeInParallel(entireFile, fileLength, args);
         delete[] entireFile;
 
         emit importProgress(100);
@@ -1633,6 +2142,255 @@ bool VoxelTree::readFromSVOFile(const char* fileName) {
     return false;
 }
 
+// Maps the whole file read only, so that only the parts that get used are paged in. Without mmap the whole file is
+// read into memory instead. Returns NULL if the file can't be read or is empty.
+static unsigned char* mapFileForReading(const char* fileName, unsigned long& fileLength) {
+#ifdef _WIN32
+    std::ifstream file(fileName, std::ios::in|std::ios::binary|std::ios::ate);
+    if (!file.is_open()) {
+        return NULL;
+    }
+    fileLength = file.tellg();
+    if (fileLength == 0) {
+        return NULL;
+    }
+    unsigned char* fileData = new unsigned char[fileLength];
+    file.seekg(0, std::ios::beg);
+    if (!file.read((char*)fileData, fileLength)) {
+        delete[] fileData;
+        return NULL;
+    }
+    return fileData;
+#else
+    int file = open(fileName, O_RDONLY);
+    if (file < 0) {
+        return NULL;
+    }
+    struct stat fileInfo;
+    if (fstat(file, &fileInfo) != 0 || fileInfo.st_size == 0) {
+        close(file);
+        return NULL;
+    }
+    fileLength = fileInfo.st_size;
+
+    void* mappedFile = mmap(NULL, fileLength, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); // the mapping keeps the file open
+    if (mappedFile == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(mappedFile, fileLength, MADV_RANDOM); // we only page in the subtrees that get used
+    return (unsigned char*)mappedFile;
+#endif
+}
+
+static void unmapFile(unsigned char* fileData, unsigned long fileLength) {
+#ifdef _WIN32
+    delete[] fileData;
+#else
+    munmap(fileData, fileLength);
+#endif
+}
+
+bool VoxelTree::readFromSVOFileLazily(const char* fileName, unsigned long topLevelsOffset,
+                                      unsigned long topLevelsLength, const std::vector<SVOSubtree>& subtrees) {
+    unsigned long fileLength = 0;
+    unsigned char* fileData = mapFileForReading(fileName, fileLength);
+    if (!fileData) {
+        qDebug("unable to map %s\n", fileName);
+        return false;
+    }
+
+    // make sure everything we were told about is actually in the file, before we've changed anything
+    bool extentsFit = (topLevelsOffset + topLevelsLength <= fileLength);
+    for (int i = 0; i < subtrees.size() && extentsFit; i++) {
+        extentsFit = subtrees[i].offset + subtrees[i].length <= fileLength && !subtrees[i].octalCode.empty()
+            && subtrees[i].octalCode.size() == bytesRequiredForCodeLength(*(unsigned char*)subtrees[i].octalCode.data());
+    }
+    if (!extentsFit) {
+        qDebug("subtrees don't fit in %s, not loading it lazily\n", fileName);
+        unmapFile(fileData, fileLength);
+        return false;
+    }
+
+    qDebug("loading file %s, %lu of %lu bytes now...\n", fileName, topLevelsLength, fileLength);
+    ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+    readBitstreamToTree(fileData + topLevelsOffset, topLevelsLength, args);
+
+    pthread_mutex_lock(&_lazySubtreesLock);
+    for (int i = 0; i < subtrees.size(); i++) {
+        const unsigned char* octalCode = (const unsigned char*)subtrees[i].octalCode.data();
+        int level = numberOfThreeBitSectionsInCode(octalCode);
+        if (_lazySubtreeLevel < 0 && _lazySubtrees.empty()) {
+            _lazySubtreeLevel = level;
+        }
+        if (level != _lazySubtreeLevel || _lazySubtrees.count(subtrees[i].octalCode)) {
+            // we only look for lazy subtrees on one level
+            ReadBitstreamToTreeParams subtreeArgs(WANT_COLOR, NO_EXISTS_BITS);
+            readBitstreamToTree(fileData + subtrees[i].offset, subtrees[i].length, subtreeArgs);
+            continue;
+        }
+
+        // The levels above don't say if an uncolored subtree root exists, so make sure it does, without breaking up any
+        // colored leaves on the way down like createMissingNode() would.
+        VoxelNode* node = rootNode;
+        while (numberOfThreeBitSectionsInCode(node->getOctalCode()) < level) {
+            int childIndex = branchIndexWithDescendant(node->getOctalCode(), octalCode);
+            VoxelNode* childNode = node->getChildAtIndex(childIndex);
+            node = childNode ? childNode : node->addChildAtIndex(childIndex);
+        }
+
+        LazySubtree subtree;
+        subtree.data = fileData + subtrees[i].offset;
+        subtree.length = subtrees[i].length;
+        _lazySubtrees[subtrees[i].octalCode] = subtree;
+        _lazySubtreeBytes += subtree.length;
+    }
+
+    if (_lazySubtrees.empty()) {
+        unmapFile(fileData, fileLength);
+    } else {
+        _mappedFile = fileData;
+        _mappedFileLength = fileLength;
+    }
+    pthread_mutex_unlock(&_lazySubtreesLock);
+    return true;
+}
+
+// encodes call this for the leaves they'd send, which is cheap unless the leaf is on the lazy subtrees' level
+void VoxelTree::requestLazySubtree(const VoxelNode* node) const {
+    if (_lazySubtreeLevel < 0 || numberOfThreeBitSectionsInCode(node->getOctalCode()) != _lazySubtreeLevel) {
+        return;
+    }
+    std::string octalCode((const char*)node->getOctalCode(), bytesRequiredForCodeLength(_lazySubtreeLevel));
+    pthread_mutex_lock(&_lazySubtreesLock);
+    if (_lazySubtrees.count(octalCode)) {
+        _lazySubtreesRequested.insert(octalCode);
+    }
+    pthread_mutex_unlock(&_lazySubtreesLock);
+}
+
+void VoxelTree::decodeRequestedLazySubtrees() {
+    if (_lazySubtreeLevel < 0) {
+        return;
+    }
+    pthread_mutex_lock(&_lazySubtreesLock);
+    std::vector<std::string> requested(_lazySubtreesRequested.begin(), _lazySubtreesRequested.end());
+    _lazySubtreesRequested.clear();
+    pthread_mutex_unlock(&_lazySubtreesLock);
+
+    for (int i = 0; i < requested.size(); i++) {
+        decodeLazySubtrees((const unsigned char*)requested[i].data());
+    }
+}
+
+void VoxelTree::decodeLazySubtrees(const unsigned char* octalCode) {
+    if (_lazySubtreeLevel < 0) {
+        return;
+    }
+    lockForEdit(octalCode);
+    decodeLazySubtreesOverlapping(octalCode);
+    unlockForEdit();
+}
+
+void VoxelTree::decodeLazySubtreesOverlapping(const unsigned char* octalCode) {
+    if (_lazySubtreeLevel < 0) {
+        return;
+    }
+    pthread_mutex_lock(&_lazySubtreesLock);
+    std::vector<LazySubtreeMap::iterator> overlapping;
+    if (numberOfThreeBitSectionsInCode(octalCode) >= _lazySubtreeLevel) {
+        // at most the one subtree we're in
+        unsigned char* subtreeCode = ancestorOctalCode(octalCode, _lazySubtreeLevel);
+        LazySubtreeMap::iterator subtree = _lazySubtrees.find(
+            std::string((const char*)subtreeCode, bytesRequiredForCodeLength(_lazySubtreeLevel)));
+        delete[] subtreeCode;
+        if (subtree != _lazySubtrees.end()) {
+            overlapping.push_back(subtree);
+        }
+    } else {
+        for (LazySubtreeMap::iterator subtree = _lazySubtrees.begin(); subtree != _lazySubtrees.end(); ++subtree) {
+            if (isAncestorOf(octalCode, (const unsigned char*)subtree->first.data())) {
+                overlapping.push_back(subtree);
+            }
+        }
+    }
+
+    for (int i = 0; i < overlapping.size(); i++) {
+        const std::string& subtreeCode = overlapping[i]->first;
+
+        // decoding isn't an edit, so it doesn't make the tree dirty
+        bool wasDirty = _isDirty;
+        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+        readBitstreamToTree((unsigned char*)overlapping[i]->second.data, overlapping[i]->second.length, args);
+        _isDirty = wasDirty;
+
+        // but encodes of the ancestors cached earlier had the subtree's root as a leaf
+        VoxelNode* node = rootNode;
+        while (node && numberOfThreeBitSectionsInCode(node->getOctalCode()) < _lazySubtreeLevel) {
+            node->markWithChangedTime();
+            node = node->getChildAtIndex(branchIndexWithDescendant(node->getOctalCode(),
+                                                                   (const unsigned char*)subtreeCode.data()));
+        }
+
+        _lazySubtreeBytes -= overlapping[i]->second.length;
+        _lazySubtreesRequested.erase(subtreeCode);
+        _lazySubtrees.erase(overlapping[i]);
+    }
+
+    if (_lazySubtrees.empty() && _mappedFile) {
+        unmapFile(_mappedFile, _mappedFileLength);
+        _mappedFile = NULL;
+        _mappedFileLength = 0;
+    }
+    pthread_mutex_unlock(&_lazySubtreesLock);
+}
+
+bool VoxelTree::getLazySubtreeData(const VoxelNode* node, const unsigned char*& data, unsigned long& length) const {
+    if (_lazySubtreeLevel < 0 || numberOfThreeBitSectionsInCode(node->getOctalCode()) != _lazySubtreeLevel) {
+        return false;
+    }
+    bool found = false;
+    std::string octalCode((const char*)node->getOctalCode(), bytesRequiredForCodeLength(_lazySubtreeLevel));
+    pthread_mutex_lock(&_lazySubtreesLock);
+    LazySubtreeMap::const_iterator subtree = _lazySubtrees.find(octalCode);
+    if (subtree != _lazySubtrees.end()) {
+        data = subtree->second.data;
+        length = subtree->second.length;
+        found = true;
+    }
+    pthread_mutex_unlock(&_lazySubtreesLock);
+    return found;
+}
+
+int VoxelTree::getLazySubtreeCount() const {
+    pthread_mutex_lock(&_lazySubtreesLock);
+    int count = _lazySubtrees.size();
+    pthread_mutex_unlock(&_lazySubtreesLock);
+    return count;
+}
+
+uint64_t VoxelTree::getLazySubtreeBytes() const {
+    pthread_mutex_lock(&_lazySubtreesLock);
+    uint64_t bytes = _lazySubtreeBytes;
+    pthread_mutex_unlock(&_lazySubtreesLock);
+    return bytes;
+}
+
+// drops any subtrees that haven't been decoded, the caller must hold the write lock
+void VoxelTree::releaseLazySubtrees() {
+    pthread_mutex_lock(&_lazySubtreesLock);
+    _lazySubtrees.clear();
+    _lazySubtreesRequested.clear();
+    _lazySubtreeBytes = 0;
+    _lazySubtreeLevel = -1;
+    if (_mappedFile) {
+        unmapFile(_mappedFile, _mappedFileLength);
+        _mappedFile = NULL;
+        _mappedFileLength = 0;
+    }
+    pthread_mutex_unlock(&_lazySubtreesLock);
+}
+
 bool VoxelTree::readFromSquareARGB32Pixels(const char* filename) {
     emit importProgress(0);
     int minAlpha = INT_MAX;
@@ -1798,6 +2556,15 @@ void VoxelTree::writeToSVOFile(const char* fileName, VoxelNode* node) {
     if(file.is_open()) {
         qDebug("saving to file %s...\n", fileName);
 
+        if (_codingThreads != 1) {
+            encodeSubTreeInParallel(node ? node : rootNode, DONT_CHOP, writeEncodedStream, &file);
+            file.close();
+            return;
+        }
+
+        // anything still on disk has to be in the tree to be written out
+        decodeLazySubtrees(node ? node->getOctalCode() : rootNode->getOctalCode());
+
         VoxelNodeBag nodeBag;
         // If we were given a specific node, start from there, otherwise start from root
         if (node) {
@@ -1809,19 +2576,133 @@ void VoxelTree::writeToSVOFile(const char* fileName, VoxelNode* node) {
         static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
         int bytesWritten = 0;
 
-        while (!nodeBag.isEmpty()) {
-            VoxelNode* subTree = nodeBag.extract();
-
-            lockForRead(); // do tree locking down here so that we have shorter slices and less thread contention
+        // do tree locking down here so that we have shorter slices and less thread contention
+        VoxelNode* subTree;
+        while ((subTree = extractAndLockForEncoding(nodeBag))) {
             EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
             bytesWritten = encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, nodeBag, params);
-            unlock();
+            unlockForEncoding(subTree);
             file.write((const char*)&outputBuffer[0], bytesWritten);
         }
     }
     file.close();
 }
 
+/// the subtrees on the coding split level that are being encoded together, and what each was encoded into
+class ParallelEncodeBatch {
+public:
+    VoxelTree* tree;
+    int chopLevels;
+    std::vector<std::string> subtreeCodes;
+    std::vector<std::vector<unsigned char> > bitstreams;
+};
+
+/// a tree, and how to read into it, for encoded streams that are read straight into another tree
+class EncodedStreamReader {
+public:
+    VoxelTree* tree;
+    ReadBitstreamToTreeParams* args;
+};
+
+void VoxelTree::collectCodingSubtreeCodes(VoxelNode* node, int splitLevel, std::vector<std::string>& subtreeCodes) {
+    const unsigned char* octalCode = node->getOctalCode();
+    int level = numberOfThreeBitSectionsInCode(octalCode);
+    if (level == splitLevel) {
+        // leaves on this level are nothing more than a color, which the levels above them will have
+        if (!node->isLeaf()) {
+            subtreeCodes.push_back(std::string((const char*)octalCode, bytesRequiredForCodeLength(level)));
+        }
+        return;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* childNode = node->getChildAtIndex(i);
+        if (childNode) {
+            collectCodingSubtreeCodes(childNode, splitLevel, subtreeCodes);
+        }
+    }
+}
+
+void VoxelTree::encodeCodingSubtree(int subtreeIndex, void* extraData) {
+    ParallelEncodeBatch* batch = (ParallelEncodeBatch*)extraData;
+    VoxelNode* subtreeRoot = batch->tree->lockForEncoding((const unsigned char*)batch->subtreeCodes[subtreeIndex].data());
+    if (!subtreeRoot) {
+        return; // deleted since we looked
+    }
+
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    std::vector<unsigned char>& bitstream = batch->bitstreams[subtreeIndex];
+    VoxelNodeBag nodeBag;
+    nodeBag.insert(subtreeRoot);
+    while (!nodeBag.isEmpty()) {
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS, batch->chopLevels);
+        int bytesWritten = batch->tree->encodeTreeBitstream(nodeBag.extract(), &outputBuffer[0], sizeof(outputBuffer),
+                                                            nodeBag, params);
+        bitstream.insert(bitstream.end(), outputBuffer, outputBuffer + bytesWritten);
+    }
+    batch->tree->unlockForEncoding(subtreeRoot);
+}
+
+void VoxelTree::encodeSubTreeInParallel(VoxelNode* node, int chopLevels, EncodedStreamOperation operation,
+                                        void* extraData) {
+    // anything still on disk has to be in the tree to be encoded
+    decodeLazySubtrees(node->getOctalCode());
+
+    // the subtrees are whichever nodes are on the split level when we start, like a snapshot's chunks
+    int splitLevel = numberOfThreeBitSectionsInCode(node->getOctalCode()) + _codingSplitLevel;
+    std::vector<std::string> subtreeCodes;
+    lockForEncoding(node);
+    collectCodingSubtreeCodes(node, splitLevel, subtreeCodes);
+    unlockForEncoding(node);
+
+    // a few subtrees per thread at a time, so that we never hold the whole tree's bitstreams in memory
+    const int SUBTREES_PER_THREAD_PER_BATCH = 4;
+    int threadCount = (_codingThreads > 0) ? _codingThreads : getProcessorCount();
+    int subtreesPerBatch = threadCount * SUBTREES_PER_THREAD_PER_BATCH;
+    for (int firstSubtree = 0; firstSubtree < subtreeCodes.size(); firstSubtree += subtreesPerBatch) {
+        ParallelEncodeBatch batch;
+        batch.tree = this;
+        batch.chopLevels = chopLevels;
+        batch.subtreeCodes.assign(subtreeCodes.begin() + firstSubtree,
+                                  subtreeCodes.begin() + std::min((int)subtreeCodes.size(), firstSubtree + subtreesPerBatch));
+        batch.bitstreams.resize(batch.subtreeCodes.size());
+        runParallelJobs(encodeCodingSubtree, batch.subtreeCodes.size(), threadCount, &batch);
+
+        for (int i = 0; i < batch.bitstreams.size(); i++) {
+            if (!batch.bitstreams[i].empty()) {
+                operation(&batch.bitstreams[i][0], batch.bitstreams[i].size(), extraData);
+            }
+        }
+    }
+
+    // The levels above the subtrees come last, so that the subtrees' roots already exist when these are decoded, instead
+    // of being colored leaves that would have to be broken up to decode the subtrees under them.
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    std::vector<unsigned char> topLevels;
+    lockForEncoding(node);
+    VoxelNodeBag nodeBag;
+    nodeBag.insert(node);
+    while (!nodeBag.isEmpty()) {
+        VoxelNode* subTree = nodeBag.extract();
+        int maxEncodeLevel = splitLevel + 1 - numberOfThreeBitSectionsInCode(subTree->getOctalCode());
+        EncodeBitstreamParams params(maxEncodeLevel, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS, chopLevels);
+        int bytesWritten = encodeTreeBitstream(subTree, &outputBuffer[0], sizeof(outputBuffer), nodeBag, params);
+        topLevels.insert(topLevels.end(), outputBuffer, outputBuffer + bytesWritten);
+    }
+    unlockForEncoding(node);
+    if (!topLevels.empty()) {
+        operation(&topLevels[0], topLevels.size(), extraData);
+    }
+}
+
+void VoxelTree::readEncodedStream(unsigned char* bitstream, unsigned long int bufferSizeBytes, void* extraData) {
+    EncodedStreamReader* reader = (EncodedStreamReader*)extraData;
+    reader->tree->readBitstreamToTreeInParallel(bitstream, bufferSizeBytes, *reader->args);
+}
+
+void VoxelTree::writeEncodedStream(unsigned char* bitstream, unsigned long int bufferSizeBytes, void* extraData) {
+    ((std::ofstream*)extraData)->write((const char*)bitstream, bufferSizeBytes);
+}
+
 unsigned long VoxelTree::getVoxelCount() {
     unsigned long nodeCount = 0;
     recurseTreeWithOperation(countVoxelsOperation, &nodeCount);
@@ -1835,7 +2716,6 @@ bool VoxelTree::countVoxelsOperation(VoxelNode* node, void* extraData) {
 
 void VoxelTree::copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot) {
     VoxelNodeBag nodeBag;
-    nodeBag.insert(startNode);
     int chopLevels = 0;
     if (rebaseToRoot) {
         chopLevels = numberOfThreeBitSectionsInCode(startNode->getOctalCode());
@@ -1844,6 +2724,14 @@ void VoxelTree::copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinat
     static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
     int bytesWritten = 0;
 
+    if (_codingThreads != 1) {
+        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+        EncodedStreamReader reader = { destinationTree, &args };
+        encodeSubTreeInParallel(startNode, chopLevels, readEncodedStream, &reader);
+    } else {
+        nodeBag.insert(startNode);
+    }
+
     while (!nodeBag.isEmpty()) {
         VoxelNode* subTree = nodeBag.extract();
 
@@ -1866,6 +2754,14 @@ void VoxelTree::copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinat
 }
 
 void VoxelTree::copyFromTreeIntoSubTree(VoxelTree* sourceTree, VoxelNode* destinationNode) {
+    if (sourceTree->_codingThreads != 1) {
+        bool wantImportProgress = true;
+        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS, destinationNode, 0, wantImportProgress);
+        EncodedStreamReader reader = { this, &args };
+        sourceTree->encodeSubTreeInParallel(sourceTree->rootNode, DONT_CHOP, readEncodedStream, &reader);
+        return;
+    }
+
     VoxelNodeBag nodeBag;
     // If we were given a specific node, start from there, otherwise start from root
     nodeBag.insert(sourceTree->rootNode);
@@ -1887,63 +2783,119 @@ void VoxelTree::copyFromTreeIntoSubTree(VoxelTree* sourceTree, VoxelNode* destin
     }
 }
 
-void dumpSetContents(const char* name, std::set<unsigned char*> set) {
-    printf("set %s has %ld elements\n", name, set.size());
-    /*
-    for (std::set<unsigned char*>::iterator i = set.begin(); i != set.end(); ++i) {
-        printOctalCode(*i);
+bool VoxelTree::isEncodingOverlapping(const unsigned char* octalCode) const {
+    for (int i = 0; i < _codesBeingEncoded.size(); i++) {
+        if (isAncestorOf(octalCode, _codesBeingEncoded[i]) || isAncestorOf(_codesBeingEncoded[i], octalCode)) {
+            return true;
+        }
     }
-    */
+    return false;
 }
 
-void VoxelTree::startEncoding(VoxelNode* node) {
-    pthread_mutex_lock(&_encodeSetLock);
-    _codesBeingEncoded.insert(node->getOctalCode());
-    pthread_mutex_unlock(&_encodeSetLock);
+bool VoxelTree::isEditOverlapping(const unsigned char* octalCode) const {
+    return _codeBeingEdited && (isAncestorOf(octalCode, _codeBeingEdited) || isAncestorOf(_codeBeingEdited, octalCode));
 }
 
-void VoxelTree::doneEncoding(VoxelNode* node) {
-    pthread_mutex_lock(&_encodeSetLock);
-    _codesBeingEncoded.erase(node->getOctalCode());
-    pthread_mutex_unlock(&_encodeSetLock);
-    
-    // if we have any pending delete codes, then delete them now.
-    emptyDeleteQueue();
+void VoxelTree::lockForEdit(const unsigned char* octalCode) {
+    lock.lockForRead();
+    pthread_mutex_lock(&_editLock);
+
+    // once _codeBeingEdited is set, no new overlapping encodes will start, so we just wait for the current ones
+    pthread_mutex_lock(&_subtreeLocksLock);
+    _codeBeingEdited = octalCode;
+    while (isEncodingOverlapping(octalCode)) {
+        pthread_cond_wait(&_subtreeLocksChanged, &_subtreeLocksLock);
+    }
+    pthread_mutex_unlock(&_subtreeLocksLock);
 }
 
-void VoxelTree::startDeleting(unsigned char* code) {
-    pthread_mutex_lock(&_deleteSetLock);
-    _codesBeingDeleted.insert(code);
-    pthread_mutex_unlock(&_deleteSetLock);
+void VoxelTree::unlockForEdit() {
+    pthread_mutex_lock(&_subtreeLocksLock);
+    _codeBeingEdited = NULL;
+    pthread_cond_broadcast(&_subtreeLocksChanged);
+    pthread_mutex_unlock(&_subtreeLocksLock);
+
+    pthread_mutex_unlock(&_editLock);
+    lock.unlock();
 }
 
-void VoxelTree::doneDeleting(unsigned char* code) {
-    pthread_mutex_lock(&_deleteSetLock);
-    _codesBeingDeleted.erase(code);
-    pthread_mutex_unlock(&_deleteSetLock);
+void VoxelTree::lockForEncoding(VoxelNode* node) {
+    lock.lockForRead();
+    pthread_mutex_lock(&_subtreeLocksLock);
+    while (isEditOverlapping(node->getOctalCode())) {
+        pthread_cond_wait(&_subtreeLocksChanged, &_subtreeLocksLock);
+    }
+    _codesBeingEncoded.push_back(node->getOctalCode());
+    pthread_mutex_unlock(&_subtreeLocksLock);
 }
 
-bool VoxelTree::isEncoding(unsigned char* codeBuffer) {
-    pthread_mutex_lock(&_encodeSetLock);
-    bool isEncoding = (_codesBeingEncoded.find(codeBuffer) != _codesBeingEncoded.end());
-    pthread_mutex_unlock(&_encodeSetLock);
-    return isEncoding;
+// called by VoxelNodeBag::extractMatching() while it holds the bag's lock, which keeps the node from being deleted
+bool VoxelTree::startEncodingIfNotEdited(VoxelNode* node, void* extraData) {
+    VoxelTree* tree = (VoxelTree*)extraData;
+    bool started = false;
+    pthread_mutex_lock(&tree->_subtreeLocksLock);
+    if (!tree->isEditOverlapping(node->getOctalCode())) {
+        tree->_codesBeingEncoded.push_back(node->getOctalCode());
+        started = true;
+    }
+    pthread_mutex_unlock(&tree->_subtreeLocksLock);
+    return started;
 }
 
-void VoxelTree::queueForLaterDelete(unsigned char* codeBuffer) {
-    pthread_mutex_lock(&_deletePendingSetLock);
-    _codesPendingDelete.insert(codeBuffer);
-    pthread_mutex_unlock(&_deletePendingSetLock);
+VoxelNode* VoxelTree::extractAndLockForEncoding(VoxelNodeBag& bag) {
+    lock.lockForRead();
+    while (true) {
+        VoxelNode* node = bag.extractMatching(startEncodingIfNotEdited, this);
+        if (node) {
+            return node;
+        }
+        if (bag.isEmpty()) {
+            lock.unlock();
+            return NULL;
+        }
+        // everything in the bag overlaps the current edit. Note: we don't hold on to any of the nodes while we wait,
+        // since the edit may delete them (and remove them from the bag)
+        pthread_mutex_lock(&_subtreeLocksLock);
+        if (_codeBeingEdited) {
+            pthread_cond_wait(&_subtreeLocksChanged, &_subtreeLocksLock);
+        }
+        pthread_mutex_unlock(&_subtreeLocksLock);
+    }
 }
 
-void VoxelTree::emptyDeleteQueue() {
-    pthread_mutex_lock(&_deletePendingSetLock);
-    for (std::set<unsigned char*>::iterator i = _codesPendingDelete.begin(); i != _codesPendingDelete.end(); ++i) {
-        unsigned char* codeToDelete = *i;
-        _codesBeingDeleted.erase(codeToDelete);
-        deleteVoxelCodeFromTree(codeToDelete, COLLAPSE_EMPTY_TREE);
+VoxelNode* VoxelTree::lockForEncoding(const unsigned char* octalCode) {
+    lock.lockForRead();
+
+    // edits change the child arrays of every node on the way down to what they edit, so we can only walk down from
+    // the root while nobody is editing
+    pthread_mutex_lock(&_editLock);
+    VoxelNode* node = nodeForOctalCode(rootNode, octalCode, NULL);
+    if (*node->getOctalCode() == *octalCode) {
+        pthread_mutex_lock(&_subtreeLocksLock);
+        _codesBeingEncoded.push_back(node->getOctalCode());
+        pthread_mutex_unlock(&_subtreeLocksLock);
+    } else {
+        node = NULL;
+    }
+    pthread_mutex_unlock(&_editLock);
+
+    if (!node) {
+        lock.unlock();
+    }
+    return node;
+}
+
+void VoxelTree::unlockForEncoding(VoxelNode* node) {
+    pthread_mutex_lock(&_subtreeLocksLock);
+    for (int i = 0; i < _codesBeingEncoded.size(); i++) {
+        if (_codesBeingEncoded[i] == node->getOctalCode()) {
+            _codesBeingEncoded.erase(_codesBeingEncoded.begin() + i);
+            break;
+        }
     }
-    pthread_mutex_unlock(&_deletePendingSetLock);
+    pthread_cond_broadcast(&_subtreeLocksChanged);
+    pthread_mutex_unlock(&_subtreeLocksLock);
+    lock.unlock();
 }
 
 void VoxelTree::cancelImport() {
@@ -9,16 +9,22 @@
 #ifndef __hifi__VoxelTree__
 #define __hifi__VoxelTree__
 
+#include <map>
 #include <set>
+#include <string>
+#include <vector>
 #include <SimpleMovingAverage.h>
 
 #include "CoverageMap.h"
 #include "JurisdictionMap.h"
 #include "ViewFrustum.h"
+#include "VoxelCollisionQuery.h"
 #include "VoxelNode.h"
 #include "VoxelNodeBag.h"
 #include "VoxelSceneStats.h"
 #include "VoxelEditPacketSender.h"
+#include "VoxelEncodeCache.h"
+#include "VoxelOcclusionCache.h"
 
 #include <QObject>
 #include <QReadWriteLock>
@@ -45,6 +51,8 @@ const uint64_t IGNORE_LAST_SENT  = 0;
 #define IGNORE_VIEW_FRUSTUM      NULL
 #define IGNORE_COVERAGE_MAP      NULL
 #define IGNORE_JURISDICTION_MAP  NULL
+#define IGNORE_ENCODE_CACHE      NULL
+#define IGNORE_OCCLUSION_CACHE   NULL
 
 class EncodeBitstreamParams {
 public:
@@ -64,6 +72,10 @@ public:
     VoxelSceneStats* stats;
     CoverageMap* map;
     JurisdictionMap* jurisdictionMap;
+    VoxelEncodeCache* encodeCache;
+    VoxelOcclusionCache* occlusionCache; // used for occlusion culling instead of map when given
+    int subTreesDeferred; // number of subtrees put back in the bag because they didn't fit
+    bool encodingCacheFragment; // are we inside a subtree whose encoding will be stored in the encodeCache
     
     EncodeBitstreamParams(
         int maxEncodeLevel = INT_MAX, 
@@ -80,7 +92,9 @@ public:
         uint64_t lastViewFrustumSent = IGNORE_LAST_SENT,
         bool forceSendScene = true,
         VoxelSceneStats* stats = IGNORE_SCENE_STATS,
-        JurisdictionMap* jurisdictionMap = IGNORE_JURISDICTION_MAP) :
+        JurisdictionMap* jurisdictionMap = IGNORE_JURISDICTION_MAP,
+        VoxelEncodeCache* encodeCache = IGNORE_ENCODE_CACHE,
+        VoxelOcclusionCache* occlusionCache = IGNORE_OCCLUSION_CACHE) :
             maxEncodeLevel(maxEncodeLevel),
             maxLevelReached(0),
             viewFrustum(viewFrustum),
@@ -96,7 +110,11 @@ public:
             forceSendScene(forceSendScene),
             stats(stats),
             map(map),
-            jurisdictionMap(jurisdictionMap)
+            jurisdictionMap(jurisdictionMap),
+            encodeCache(encodeCache),
+            occlusionCache(occlusionCache),
+            subTreesDeferred(0),
+            encodingCacheFragment(false)
     {}
 };
 
@@ -122,6 +140,53 @@ public:
     {}
 };
 
+/// What decoding bitstreams did to the tree. Bitstreams decoded on different threads count into their own results, which
+/// are added to the tree's totals once the threads are done.
+class ReadBitstreamToTreeResults {
+public:
+    bool isDirty;
+    unsigned long int nodesChanged;
+    long voxelsCreated;
+    long voxelsColored;
+    bool wantMovingAverages; // the tree's moving averages are updated as each voxel is created or colored
+
+    ReadBitstreamToTreeResults(bool wantMovingAverages = true) :
+        isDirty(false),
+        nodesChanged(0),
+        voxelsCreated(0),
+        voxelsColored(0),
+        wantMovingAverages(wantMovingAverages)
+    {}
+};
+
+// Callback function, for encodeSubTreeInParallel(), gets each piece of the encoded stream in order
+typedef void (*EncodedStreamOperation)(unsigned char* bitstream, unsigned long int bufferSizeBytes, void* extraData);
+
+// By default a tree decodes and encodes on the calling thread. When it's told to use more threads, it splits its work
+// into the subtrees this many levels below where the work starts.
+const int DEFAULT_CODING_THREADS = 1;
+const int DEFAULT_CODING_SPLIT_LEVEL = 3;
+
+class ParallelReadBatch;
+
+/// Where one of the separately encoded subtrees of an SVO file is, see VoxelTree::readFromSVOFileLazily()
+class SVOSubtree {
+public:
+    std::string octalCode;
+    unsigned long offset;
+    unsigned long length;
+};
+
+/// One ray of a VoxelTree::findRayIntersections() batch, and what it hit
+class VoxelRayCast {
+public:
+    glm::vec3 origin;
+    glm::vec3 direction;
+    VoxelNode* node; // the colored leaf it hit, or NULL if it didn't hit one
+    float distance;
+    BoxFace face;
+};
+
 class VoxelTree : public QObject {
     Q_OBJECT
 public:
@@ -146,6 +211,12 @@ public:
     void processRemoveVoxelBitstream(unsigned char* bitstream, int bufferSizeBytes);
     void readBitstreamToTree(unsigned char* bitstream,  unsigned long int bufferSizeBytes, ReadBitstreamToTreeParams& args);
     void readCodeColorBufferToTree(unsigned char* codeColorBuffer, bool destructive = false);
+
+    /// Applies a batch of edits like readCodeColorBufferToTree() does, but in a single pass down the tree. The edits are
+    /// put in depth first order, so each node they pass through is visited, and reaveraged, once for the whole batch.
+    /// Edits of the same voxel are applied in the order given. If one edit is of an ancestor of another voxel in the
+    /// batch, their order matters, so then the batch is applied one edit at a time instead.
+    void readCodeColorBuffersToTree(const std::vector<unsigned char*>& codeColorBuffers, bool destructive = false);
     void deleteVoxelCodeFromTree(unsigned char* codeBuffer, bool collapseEmptyTrees = DONT_COLLAPSE);
     void printTreeForDebugging(VoxelNode* startNode);
     void reaverageVoxelColors(VoxelNode* startNode);
@@ -171,18 +242,67 @@ public:
     void setDirtyBit() { _isDirty = true; }
     unsigned long int getNodesChangedFromBitstream() const { return _nodesChangedFromBitstream; }
 
+    /// Finds the nearest colored leaf along a ray. Visits the nodes the ray passes through front to back, and stops at
+    /// the first colored leaf.
     bool findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
                              VoxelNode*& node, float& distance, BoxFace& face);
 
+    /// Casts many rays in one pass down the tree, like a grid of them across the screen. Rays that pass through the same
+    /// node are tested against its children together, so nearby rays share the walk down to where they part. Each cast
+    /// finds what findRayIntersection() would, and gets a NULL node if it hits nothing.
+    void findRayIntersections(std::vector<VoxelRayCast>& casts);
+
     bool findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration);
     bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration);
 
+    /// Finds the contacts of all of the query's shapes in one go, reusing the leaves it found last time when it can.
+    /// The caller must hold the tree lock for read, as for the other queries.
+    void findPenetrations(VoxelCollisionQuery& query);
+
     // Note: this assumes the fileFormat is the HIO individual voxels code files
     void loadVoxelsFile(const char* fileName, bool wantColorRandomizer);
 
     // these will read/write files that match the wireformat, excluding the 'V' leading
     void writeToSVOFile(const char* filename, VoxelNode* node = NULL);
     bool readFromSVOFile(const char* filename);
+
+    /// Sets how many threads readFromSVOFile(), writeToSVOFile() and the subtree copies decode and encode on, at most, and
+    /// the level below where they start that they split the tree into subtrees at, one subtree per thread at a time. A
+    /// threadCount of 1 does everything on the calling thread, 0 means one thread per core. Nodes are changed from those
+    /// threads, so leave a tree that has node update hooks watching it on 1.
+    void setCodingThreads(int threadCount, int splitLevel = DEFAULT_CODING_SPLIT_LEVEL);
+    int getCodingThreads() const { return _codingThreads; }
+    int getCodingSplitLevel() const { return _codingSplitLevel; }
+
+    /// Reads the same streams as readBitstreamToTree(), but the bitstreams that start on the split level or below are
+    /// decoded on the coding threads, each subtree on that level by one thread in stream order. The ones above it are
+    /// decoded on this thread once everything before them in the stream has been. So a stream with all the levels above
+    /// the subtrees at the end, like encodeSubTreeInParallel() makes, is decoded on all the threads at once.
+    void readBitstreamToTreeInParallel(unsigned char* bitstream, unsigned long int bufferSizeBytes,
+                                       ReadBitstreamToTreeParams& args);
+
+    /// Encodes node's subtree like writeToSVOFile() does, handing the stream to operation a piece at a time. The subtrees
+    /// on the split level are encoded on the coding threads, and the levels above them come last.
+    void encodeSubTreeInParallel(VoxelNode* node, int chopLevels, EncodedStreamOperation operation, void* extraData);
+
+    /// Maps an SVO file that was written as separately encoded subtrees, all on the same level, plus the levels above
+    /// them, which are in the file from topLevelsOffset for topLevelsLength bytes. Only those levels are decoded now. A
+    /// subtree is decoded the first time an edit reaches it, or once an encode has asked for it, see
+    /// decodeRequestedLazySubtrees(). Until then its root is a leaf. The caller must hold the write lock.
+    bool readFromSVOFileLazily(const char* filename, unsigned long topLevelsOffset, unsigned long topLevelsLength,
+                               const std::vector<SVOSubtree>& subtrees);
+
+    /// decodes the lazily loaded subtrees that encodes have run into since the last call, locking each for editing
+    void decodeRequestedLazySubtrees();
+
+    /// decodes the lazily loaded subtrees at or below octalCode, locking octalCode for editing
+    void decodeLazySubtrees(const unsigned char* octalCode);
+
+    /// If node is the root of a subtree that hasn't been decoded yet, gets the subtree's encoded data, which stays valid
+    /// as long as the caller has node locked for encoding.
+    bool getLazySubtreeData(const VoxelNode* node, const unsigned char*& data, unsigned long& length) const;
+    int getLazySubtreeCount() const;
+    uint64_t getLazySubtreeBytes() const;
     // reads voxels from square image with alpha as a Y-axis
     bool readFromSquareARGB32Pixels(const char *filename);
     bool readFromSchematicFile(const char* filename);
@@ -194,6 +314,28 @@ public:
     void tryLockForWrite() { lock.tryLockForWrite(); }
     void unlock() { lock.unlock(); }
 
+    // Subtree locking, for servers that edit and encode the tree from many threads. An edit of the voxel at some octal
+    // code only changes that voxel's subtree and its ancestors, and an encode of a subtree only reads that subtree. So
+    // edits and encodes only wait for each other when one's octal code is an ancestor of (or the same as) the other's.
+    // Edits are serialized with each other. Both hold the tree lock for read, so lockForWrite() excludes them all.
+
+    /// locks the subtree at octalCode and its ancestors for editing, waiting for any encodes that overlap it to finish
+    void lockForEdit(const unsigned char* octalCode);
+    void unlockForEdit();
+
+    /// locks node's subtree for encoding, waiting for any overlapping edit to finish. The caller must make sure node
+    /// can't be deleted while this waits, for example the rootNode. Use extractAndLockForEncoding() for bag nodes.
+    void lockForEncoding(VoxelNode* node);
+
+    /// pulls a node out of the bag and locks its subtree for encoding. Skips over nodes that overlap the current edit,
+    /// and waits for the edit if they all do. Returns NULL, without locking anything, if the bag is empty.
+    VoxelNode* extractAndLockForEncoding(VoxelNodeBag& bag);
+
+    /// looks up the node with exactly this octal code and locks its subtree for encoding. Returns NULL, without locking
+    /// anything, if there's no such node.
+    VoxelNode* lockForEncoding(const unsigned char* octalCode);
+    void unlockForEncoding(VoxelNode* node);
+
     unsigned long getVoxelCount();
 
     void copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot);
@@ -209,6 +351,8 @@ public:
 
     void nudgeSubTree(VoxelNode* nodeToNudge, const glm::vec3& nudgeAmount, VoxelEditPacketSender& voxelEditSender);
 
+    const VoxelNodeAllocator& getNodeAllocator() const { return _nodeAllocator; }
+
 signals:
     void importSize(float x, float y, float z);
     void importProgress(int progress);
@@ -220,54 +364,81 @@ public slots:
 private:
     void deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraData);
     void readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraData);
+    bool readCodeColorBuffersToTreeRecursion(VoxelNode* node, unsigned char** codeColorBuffers, int count, bool destructive);
+    bool setNodeColorFromCodeColorBuffer(VoxelNode* node, const unsigned char* codeColorBuffer, bool destructive);
 
     int encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag, 
                                      EncodeBitstreamParams& params, int& currentEncodeLevel) const;
+    int encodeTreeBitstreamRecursionCached(VoxelNode* node, unsigned char* outputBuffer, int availableBytes,
+                                           VoxelNodeBag& bag, EncodeBitstreamParams& params, int& currentEncodeLevel) const;
+    bool isOccluded(const VoxelNode* node, EncodeBitstreamParams& params, bool storeIt) const;
 
     static bool countVoxelsOperation(VoxelNode* node, void* extraData);
 
     VoxelNode* nodeForOctalCode(VoxelNode* ancestorNode, const unsigned char* needleCode, VoxelNode** parentOfFoundNode) const;
     VoxelNode* createMissingNode(VoxelNode* lastParentNode, unsigned char* deepestCodeToCreate);
-    int readNodeData(VoxelNode *destinationNode, unsigned char* nodeData, int bufferSizeBytes, ReadBitstreamToTreeParams& args);
+    int readNodeData(VoxelNode *destinationNode, unsigned char* nodeData, int bufferSizeBytes, ReadBitstreamToTreeParams& args,
+                     ReadBitstreamToTreeResults& results);
+    static int skipNodeData(const unsigned char* nodeData, int bytesLeftToRead, const ReadBitstreamToTreeParams& args);
+    int readRootRelativeBitstream(unsigned char* bitstream, int bytesLeftToRead, ReadBitstreamToTreeParams& args,
+                                  ReadBitstreamToTreeResults& results);
+    void addReadBitstreamResults(const ReadBitstreamToTreeResults& results);
+
+    void collectCodingSubtreeCodes(VoxelNode* node, int splitLevel, std::vector<std::string>& subtreeCodes);
+    static void readCodingSubtree(int subtreeIndex, void* extraData);
+    void readParallelReadBatch(ParallelReadBatch& batch);
+    static void encodeCodingSubtree(int subtreeIndex, void* extraData);
+    static void readEncodedStream(unsigned char* bitstream, unsigned long int bufferSizeBytes, void* extraData);
+    static void writeEncodedStream(unsigned char* bitstream, unsigned long int bufferSizeBytes, void* extraData);
+
+    void decodeLazySubtreesOverlapping(const unsigned char* octalCode); // caller must be editing octalCode
+    void requestLazySubtree(const VoxelNode* node) const;
+    void releaseLazySubtrees();
     
+    /// all of our nodes and their external child arrays are allocated from here
+    VoxelNodeAllocator _nodeAllocator;
+
     bool _isDirty;
     unsigned long int _nodesChangedFromBitstream;
     bool _shouldReaverage;
     bool _stopImport;
-
-    /// Octal Codes of any subtrees currently being encoded. While any of these codes is being encoded, ancestors and 
-    /// descendants of them can not be deleted.
-    std::set<const unsigned char*>  _codesBeingEncoded;
-    /// mutex lock to protect the encoding set
-    pthread_mutex_t _encodeSetLock;
-
-    /// Called to indicate that a VoxelNode is in the process of being encoded.
-    void startEncoding(VoxelNode* node);
-    /// Called to indicate that a VoxelNode is done being encoded.
-    void doneEncoding(VoxelNode* node);
-    /// Is the Octal Code currently being deleted?
-    bool isEncoding(unsigned char* codeBuffer);
-
-    /// Octal Codes of any subtrees currently being deleted. While any of these codes is being deleted, ancestors and 
-    /// descendants of them can not be encoded.
-    std::set<unsigned char*>  _codesBeingDeleted;
-    /// mutex lock to protect the deleting set
-    pthread_mutex_t _deleteSetLock;
-
-    /// Called to indicate that an octal code is in the process of being deleted.
-    void startDeleting(unsigned char* code);
-    /// Called to indicate that an octal code is done being deleted.
-    void doneDeleting(unsigned char* code);
-    /// Octal Codes that were attempted to be deleted but couldn't be because they were actively being encoded, and were
-    /// instead queued for later delete
-    std::set<unsigned char*>  _codesPendingDelete;
-    /// mutex lock to protect the deleting set
-    pthread_mutex_t _deletePendingSetLock;
-
-    /// Adds an Octal Code to the set of codes that needs to be deleted
-    void queueForLaterDelete(unsigned char* codeBuffer);
-    /// flushes out any Octal Codes that had to be queued
-    void emptyDeleteQueue();
+    int _codingThreads;
+    int _codingSplitLevel;
+
+    /// Octal Codes of any subtrees currently being encoded, one entry per encode. While any of these codes is being
+    /// encoded, ancestors and descendants of them can not be edited.
+    std::vector<const unsigned char*> _codesBeingEncoded;
+    /// Octal Code of the subtree currently being edited, or NULL. While it's being edited, ancestors and descendants of
+    /// it can not be encoded.
+    const unsigned char* _codeBeingEdited;
+    /// mutex lock to protect the encoding list and editing code, and a condition that's signaled when either changes
+    pthread_mutex_t _subtreeLocksLock;
+    pthread_cond_t _subtreeLocksChanged;
+    /// held for the duration of an edit, so that only one thread edits at a time
+    pthread_mutex_t _editLock;
+
+    bool isEncodingOverlapping(const unsigned char* octalCode) const; // caller must hold _subtreeLocksLock
+    bool isEditOverlapping(const unsigned char* octalCode) const; // caller must hold _subtreeLocksLock
+    static bool startEncodingIfNotEdited(VoxelNode* node, void* extraData);
+
+    /// a subtree of a mapped SVO file that hasn't been decoded yet
+    class LazySubtree {
+    public:
+        const unsigned char* data;
+        unsigned long length;
+    };
+    typedef std::map<std::string, LazySubtree> LazySubtreeMap;
+
+    /// Lazily loaded subtrees by their root's octal code, and the ones encodes have asked to be decoded. Those are
+    /// protected by _lazySubtreesLock, which is only held briefly, except while a subtree is being decoded.
+    LazySubtreeMap _lazySubtrees;
+    mutable std::set<std::string> _lazySubtreesRequested;
+    mutable pthread_mutex_t _lazySubtreesLock;
+    uint64_t _lazySubtreeBytes;
+    /// the level the lazy subtrees are on, or -1, only changed while the tree is locked for write
+    int _lazySubtreeLevel;
+    unsigned char* _mappedFile;
+    unsigned long _mappedFileLength;
 
     // helper functions for nudgeSubTree
     void recurseNodeForNudge(VoxelNode* node, RecurseVoxelTreeOperation operation, void* extraData);
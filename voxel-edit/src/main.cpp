@@ -6,10 +6,17 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
 //
 
+#include <pthread.h>
+
+#include <glm/gtx/quaternion.hpp>
+
 #include <VoxelTree.h>
+#include <LinearVoxelTree.h>
 #include <SharedUtil.h>
 #include <SceneUtils.h>
+#include <JurisdictionIndex.h>
 #include <JurisdictionMap.h>
+#include <OctalKey.h>
 #include <QString>
 #include <QStringList>
 
@@ -234,6 +241,1042 @@ void processFillSVOFile(const char* fillSVOFile) {
     printf("exiting now\n");
 }
 
+// Loads an SVO file into a fresh tree and reports how long it took and how much memory it used, then erases the tree
+// and reports how much memory was handed back. Run it against the same file on different builds to compare.
+void processBenchmarkLoadSVOFile(const char* benchmarkSVOFile) {
+    const float BYTES_PER_MEGABYTE = 1000000.0f;
+    printf("benchmarkLoadSVO: %s\n", benchmarkSVOFile);
+
+    uint64_t startResidentSize = getResidentSetSize();
+    VoxelTree benchmarkTree;
+
+    uint64_t start = usecTimestampNow();
+    if (!benchmarkTree.readFromSVOFile(benchmarkSVOFile)) {
+        printf("unable to open %s\n", benchmarkSVOFile);
+        return;
+    }
+    uint64_t loadTime = usecTimestampNow() - start;
+    uint64_t loadedResidentSize = getResidentSetSize();
+
+    unsigned long nodeCount = benchmarkTree.getVoxelCount();
+    printf("Loaded %lu nodes in %llu usecs (%f usecs/node)\n", nodeCount, loadTime, (float)loadTime / nodeCount);
+    printf("Resident set size: before load %8.2f MB, after load %8.2f MB\n",
+           startResidentSize / BYTES_PER_MEGABYTE, loadedResidentSize / BYTES_PER_MEGABYTE);
+    printf("Voxel Node Memory Usage:        %8.2f MB (%d slabs)\n",
+           VoxelNode::getVoxelMemoryUsage() / BYTES_PER_MEGABYTE, benchmarkTree.getNodeAllocator().getNodeSlabCount());
+    printf("Octcode Memory Usage:           %8.2f MB\n", VoxelNode::getOctcodeMemoryUsage() / BYTES_PER_MEGABYTE);
+    printf("External Children Memory Usage: %8.2f MB (%d slabs)\n",
+           VoxelNode::getExternalChildrenMemoryUsage() / BYTES_PER_MEGABYTE,
+           benchmarkTree.getNodeAllocator().getChildrenSlabCount());
+
+    start = usecTimestampNow();
+    benchmarkTree.eraseAllVoxels();
+    uint64_t eraseTime = usecTimestampNow() - start;
+    printf("Erased all voxels in %llu usecs, resident set size after erase %8.2f MB\n",
+           eraseTime, getResidentSetSize() / BYTES_PER_MEGABYTE);
+    printf("Voxel Node Memory Usage after erase: %8.2f MB\n", VoxelNode::getTotalMemoryUsage() / BYTES_PER_MEGABYTE);
+}
+
+// encodes the entire tree the way writeToSVOFile() does, returns the total bytes encoded
+template<typename Tree, typename NodeRef, typename Bag>
+static uint64_t encodeEntireTree(Tree& tree, NodeRef root, Bag& bag) {
+    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    uint64_t totalBytes = 0;
+    bag.insert(root);
+    while (!bag.isEmpty()) {
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        totalBytes += tree.encodeTreeBitstream(bag.extract(), &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, bag, params);
+    }
+    return totalBytes;
+}
+
+void processBenchmarkLinearSVOFile(const char* benchmarkSVOFile) {
+    const float BYTES_PER_MEGABYTE = 1000000.0f;
+    const int RAY_COUNT = 100000;
+    printf("benchmarkLinearSVO: %s\n", benchmarkSVOFile);
+
+    VoxelTree benchmarkTree;
+    if (!benchmarkTree.readFromSVOFile(benchmarkSVOFile)) {
+        printf("unable to open %s\n", benchmarkSVOFile);
+        return;
+    }
+
+    uint64_t start = usecTimestampNow();
+    LinearVoxelTree linearTree;
+    linearTree.buildFromTree(benchmarkTree.rootNode);
+    uint64_t buildTime = usecTimestampNow() - start;
+
+    unsigned long nodeCount = linearTree.getNodeCount();
+    printf("Built linear tree of %lu nodes in %llu usecs\n", nodeCount, buildTime);
+    printf("VoxelTree memory usage:       %8.2f MB (%5.1f bytes/node)\n",
+           VoxelNode::getTotalMemoryUsage() / BYTES_PER_MEGABYTE, (float)VoxelNode::getTotalMemoryUsage() / nodeCount);
+    printf("LinearVoxelTree memory usage: %8.2f MB (%5.1f bytes/node)\n",
+           linearTree.getMemoryUsage() / BYTES_PER_MEGABYTE, (float)linearTree.getMemoryUsage() / nodeCount);
+
+    start = usecTimestampNow();
+    VoxelNodeBag nodeBag;
+    uint64_t treeBytes = encodeEntireTree(benchmarkTree, benchmarkTree.rootNode, nodeBag);
+    uint64_t treeEncodeTime = usecTimestampNow() - start;
+
+    start = usecTimestampNow();
+    LinearVoxelNodeBag linearBag;
+    uint64_t linearBytes = encodeEntireTree(linearTree, linearTree.getRoot(), linearBag);
+    uint64_t linearEncodeTime = usecTimestampNow() - start;
+
+    printf("Encode entire tree: VoxelTree %llu bytes in %llu usecs, LinearVoxelTree %llu bytes in %llu usecs\n",
+           treeBytes, treeEncodeTime, linearBytes, linearEncodeTime);
+
+    // cast the same set of rays from outside the tree at both representations
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> directions;
+    srand(0);
+    for (int i = 0; i < RAY_COUNT; i++) {
+        origins.push_back(glm::vec3(randFloat(), randFloat(), -0.5f) * (float)TREE_SCALE);
+        directions.push_back(glm::normalize(glm::vec3(randFloatInRange(-0.5f, 0.5f), randFloatInRange(-0.5f, 0.5f), 1.0f)));
+    }
+
+    int treeHits = 0;
+    start = usecTimestampNow();
+    for (int i = 0; i < RAY_COUNT; i++) {
+        VoxelNode* node;
+        float distance;
+        BoxFace face;
+        treeHits += benchmarkTree.findRayIntersection(origins[i], directions[i], node, distance, face) ? 1 : 0;
+    }
+    uint64_t treeRayTime = usecTimestampNow() - start;
+
+    int linearHits = 0;
+    start = usecTimestampNow();
+    for (int i = 0; i < RAY_COUNT; i++) {
+        LinearVoxelNodeRef node;
+        float distance;
+        BoxFace face;
+        linearHits += linearTree.findRayIntersection(origins[i], directions[i], node, distance, face) ? 1 : 0;
+    }
+    uint64_t linearRayTime = usecTimestampNow() - start;
+
+    printf("%d rays: VoxelTree %d hits in %llu usecs, LinearVoxelTree %d hits in %llu usecs\n",
+           RAY_COUNT, treeHits, treeRayTime, linearHits, linearRayTime);
+}
+
+// the nearest colored leaf along a ray, found by testing every node whose box the ray touches, to check the casts against
+class ExhaustiveRayArgs {
+public:
+    glm::vec3 origin;
+    glm::vec3 direction;
+    VoxelNode* node;
+    float distance;
+};
+
+bool exhaustiveRayIntersectionOp(VoxelNode* node, void* extraData) {
+    ExhaustiveRayArgs* args = static_cast<ExhaustiveRayArgs*>(extraData);
+    float distance;
+    BoxFace face;
+    if (!node->getAABox().findRayIntersection(args->origin, args->direction, distance, face)) {
+        return false;
+    }
+    if (node->isLeaf() && node->isColored() && (!args->node || distance < args->distance)) {
+        args->node = node;
+        args->distance = distance;
+    }
+    return !node->isLeaf();
+}
+
+void processBenchmarkRayCasts(const char* benchmarkSVOFile) {
+    const int RANDOM_RAY_COUNT = 100000;
+    const int EXHAUSTIVE_RAY_COUNT = 1000;
+    const int GRID_SIZE = 512;
+    const float GRID_FIELD_OF_VIEW = 1.0f;
+    printf("benchmarkRayCasts: %s\n", benchmarkSVOFile);
+
+    VoxelTree benchmarkTree;
+    if (!benchmarkTree.readFromSVOFile(benchmarkSVOFile)) {
+        printf("unable to open %s\n", benchmarkSVOFile);
+        return;
+    }
+    printf("%lu voxels\n", benchmarkTree.getVoxelCount());
+
+    // rays from all around outside the tree, aimed at somewhere inside it
+    std::vector<VoxelRayCast> randomCasts(RANDOM_RAY_COUNT);
+    srand(0);
+    for (int i = 0; i < RANDOM_RAY_COUNT; i++) {
+        glm::vec3 target = glm::vec3(randFloat(), randFloat(), randFloat()) * (float)TREE_SCALE;
+        glm::vec3 away = glm::normalize(glm::vec3(randFloatInRange(-1.0f, 1.0f), randFloatInRange(-1.0f, 1.0f),
+                                                  randFloatInRange(-1.0f, 1.0f)));
+        randomCasts[i].origin = glm::vec3(0.5f, 0.5f, 0.5f) * (float)TREE_SCALE + away * (float)TREE_SCALE;
+        randomCasts[i].direction = glm::normalize(target - randomCasts[i].origin);
+    }
+
+    // a grid of rays across the screen of a camera looking at the middle of the tree from above one corner
+    std::vector<VoxelRayCast> gridCasts(GRID_SIZE * GRID_SIZE);
+    glm::vec3 eye = glm::vec3(-0.25f, 1.0f, -0.25f) * (float)TREE_SCALE;
+    glm::vec3 forward = glm::normalize(glm::vec3(0.5f, 0.25f, 0.5f) * (float)TREE_SCALE - eye);
+    glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+    glm::vec3 up = glm::cross(right, forward);
+    for (int y = 0; y < GRID_SIZE; y++) {
+        for (int x = 0; x < GRID_SIZE; x++) {
+            float screenX = ((x + 0.5f) / GRID_SIZE - 0.5f) * GRID_FIELD_OF_VIEW;
+            float screenY = ((y + 0.5f) / GRID_SIZE - 0.5f) * GRID_FIELD_OF_VIEW;
+            gridCasts[y * GRID_SIZE + x].origin = eye;
+            gridCasts[y * GRID_SIZE + x].direction = glm::normalize(forward + right * screenX + up * screenY);
+        }
+    }
+
+    const int CAST_SETS = 2;
+    const char* CAST_SET_NAMES[CAST_SETS] = { "random rays", "screen grid" };
+    std::vector<VoxelRayCast>* castSets[CAST_SETS] = { &randomCasts, &gridCasts };
+
+    for (int set = 0; set < CAST_SETS; set++) {
+        std::vector<VoxelRayCast>& casts = *castSets[set];
+
+        int hits = 0;
+        uint64_t start = usecTimestampNow();
+        for (int i = 0; i < casts.size(); i++) {
+            VoxelNode* node = NULL;
+            float distance;
+            BoxFace face;
+            hits += benchmarkTree.findRayIntersection(casts[i].origin, casts[i].direction, node, distance, face) ? 1 : 0;
+        }
+        uint64_t oneAtATime = usecTimestampNow() - start;
+
+        start = usecTimestampNow();
+        benchmarkTree.findRayIntersections(casts);
+        uint64_t batched = usecTimestampNow() - start;
+
+        // the batch has to find what casting the rays one at a time finds, and what testing every box finds
+        int mismatches = 0;
+        uint64_t exhaustive = 0;
+        for (int i = 0; i < casts.size(); i++) {
+            VoxelNode* node = NULL;
+            float distance;
+            BoxFace face;
+            bool hit = benchmarkTree.findRayIntersection(casts[i].origin, casts[i].direction, node, distance, face);
+            if (hit != (casts[i].node != NULL) || (hit && (node != casts[i].node || distance != casts[i].distance))) {
+                mismatches++;
+            }
+            if (i < EXHAUSTIVE_RAY_COUNT) {
+                ExhaustiveRayArgs args = { casts[i].origin / (float)TREE_SCALE, casts[i].direction, NULL, 0.0f };
+                start = usecTimestampNow();
+                benchmarkTree.recurseTreeWithOperation(exhaustiveRayIntersectionOp, &args);
+                exhaustive += usecTimestampNow() - start;
+                if (args.node != casts[i].node && (!args.node || !casts[i].node
+                        || fabsf(args.distance * TREE_SCALE - casts[i].distance) > EPSILON * TREE_SCALE)) {
+                    mismatches++;
+                }
+            }
+        }
+
+        int exhaustiveCount = std::min((int)casts.size(), EXHAUSTIVE_RAY_COUNT);
+        printf("%s: %lu rays, %d hits\n", CAST_SET_NAMES[set], casts.size(), hits);
+        printf("    one at a time: %10.0f rays/sec\n", casts.size() * 1000000.0 / std::max(oneAtATime, (uint64_t)1));
+        printf("          batched: %10.0f rays/sec\n", casts.size() * 1000000.0 / std::max(batched, (uint64_t)1));
+        printf("       exhaustive: %10.0f rays/sec (first %d rays)\n",
+               exhaustiveCount * 1000000.0 / std::max(exhaustive, (uint64_t)1), exhaustiveCount);
+        printf("    %d mismatches\n", mismatches);
+    }
+}
+
+// picks out every so many colored leaves, for bodies to start from
+class ColoredLeafSampleArgs {
+public:
+    int every;
+    int seen;
+    std::vector<glm::vec3> centers;
+};
+
+bool sampleColoredLeavesOp(VoxelNode* node, void* extraData) {
+    ColoredLeafSampleArgs* args = static_cast<ColoredLeafSampleArgs*>(extraData);
+    if (node->isLeaf() && node->isColored() && args->seen++ % args->every == 0) {
+        args->centers.push_back(node->getAABox().calcCenter() * (float)TREE_SCALE);
+    }
+    return true;
+}
+
+void processBenchmarkCollisions(const char* benchmarkSVOFile) {
+    const int BODY_COUNTS[] = { 1, 10, 100 };
+    const int NUMBER_OF_BODY_COUNTS = sizeof(BODY_COUNTS) / sizeof(BODY_COUNTS[0]);
+    const int FRAMES = 300;
+    const float FRAME_SECONDS = 1.0f / 60.0f;
+    const float WALKING_SPEED = 1.5f;
+    const float BODY_HEIGHT = 1.5f;
+    const float BODY_RADIUS = 0.3f;
+    printf("benchmarkCollisions: %s\n", benchmarkSVOFile);
+
+    VoxelTree benchmarkTree;
+    if (!benchmarkTree.readFromSVOFile(benchmarkSVOFile)) {
+        printf("unable to open %s\n", benchmarkSVOFile);
+        return;
+    }
+    ColoredLeafSampleArgs samples = { std::max((int)benchmarkTree.getVoxelCount() / 1000, 1), 0 };
+    benchmarkTree.recurseTreeWithOperation(sampleColoredLeavesOp, &samples);
+    if (samples.centers.empty()) {
+        printf("no colored voxels to collide with\n");
+        return;
+    }
+
+    for (int count = 0; count < NUMBER_OF_BODY_COUNTS; count++) {
+        int bodyCount = BODY_COUNTS[count];
+
+        // bodies start on voxels and walk off in straight lines, so they stay in detailed geometry
+        std::vector<glm::vec3> starts(bodyCount);
+        std::vector<glm::vec3> velocities(bodyCount);
+        srand(count);
+        for (int i = 0; i < bodyCount; i++) {
+            starts[i] = samples.centers[rand() % samples.centers.size()];
+            float heading = randFloatInRange(0.0f, PI_TIMES_TWO);
+            velocities[i] = glm::vec3(cosf(heading), 0.0f, sinf(heading)) * WALKING_SPEED;
+        }
+        std::vector<VoxelCollisionQuery> queries(bodyCount);
+
+        uint64_t oneShapeAtATime = 0;
+        uint64_t queried = 0;
+        int cacheUses = 0;
+        int contacts = 0;
+        int mismatches = 0;
+        for (int frame = 0; frame < FRAMES; frame++) {
+            for (int i = 0; i < bodyCount; i++) {
+                glm::vec3 position = starts[i] + velocities[i] * (frame * FRAME_SECONDS);
+                glm::vec3 start = position + glm::vec3(0.0f, BODY_RADIUS, 0.0f);
+                glm::vec3 end = position + glm::vec3(0.0f, BODY_HEIGHT - BODY_RADIUS, 0.0f);
+
+                glm::vec3 penetration;
+                uint64_t time = usecTimestampNow();
+                bool found = benchmarkTree.findCapsulePenetration(start, end, BODY_RADIUS, penetration);
+                oneShapeAtATime += usecTimestampNow() - time;
+
+                time = usecTimestampNow();
+                queries[i].clearShapes();
+                int body = queries[i].addCapsule(start, end, BODY_RADIUS);
+                benchmarkTree.findPenetrations(queries[i]);
+                queried += usecTimestampNow() - time;
+
+                cacheUses += queries[i].wasCacheUsed() ? 1 : 0;
+                contacts += queries[i].getContacts(body).size();
+                if (found != !queries[i].getContacts(body).empty()
+                        || glm::length(penetration - queries[i].getPenetration(body)) > EPSILON) {
+                    mismatches++;
+                }
+            }
+        }
+        printf("%d bodies: findCapsulePenetration() %6.1f usecs/frame, findPenetrations() %6.1f usecs/frame, "
+               "%.1f contacts/body/frame, cache used %.0f%% of the time, %d mismatches\n", bodyCount,
+               (float)oneShapeAtATime / FRAMES, (float)queried / FRAMES, (float)contacts / (bodyCount * FRAMES),
+               100.0f * cacheUses / (bodyCount * FRAMES), mismatches);
+    }
+}
+
+// adds nodes to the tree breadth first until it holds at least nodeCount nodes
+static void fillTreeWithNodes(VoxelTree& tree, int nodeCount, std::vector<VoxelNode*>& nodes) {
+    nodes.push_back(tree.rootNode);
+    for (int parent = 0; nodes.size() < nodeCount; parent++) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN && nodes.size() < nodeCount; i++) {
+            nodes.push_back(nodes[parent]->addChildAtIndex(i));
+        }
+    }
+}
+
+void processBenchmarkNodeBag() {
+    const int BAG_SIZES[] = { 10000, 100000, 1000000 };
+    const int NUMBER_OF_BAG_SIZES = sizeof(BAG_SIZES) / sizeof(BAG_SIZES[0]);
+    const int OTHER_BAGS = 32; // roughly one per connected client on a busy server
+
+    printf("benchmarkNodeBag\n");
+    for (int size = 0; size < NUMBER_OF_BAG_SIZES; size++) {
+        VoxelTree benchmarkTree;
+        std::vector<VoxelNode*> nodes;
+        fillTreeWithNodes(benchmarkTree, BAG_SIZES[size], nodes);
+        int nodeCount = nodes.size();
+
+        VoxelNodeBag bag;
+        uint64_t start = usecTimestampNow();
+        for (int i = 0; i < nodeCount; i++) {
+            bag.insert(nodes[i]);
+        }
+        uint64_t insertTime = usecTimestampNow() - start;
+
+        start = usecTimestampNow();
+        for (int i = 0; i < nodeCount; i++) {
+            bag.insert(nodes[i]);
+        }
+        uint64_t dedupeTime = usecTimestampNow() - start;
+
+        start = usecTimestampNow();
+        while (!bag.isEmpty()) {
+            bag.extract();
+        }
+        uint64_t extractTime = usecTimestampNow() - start;
+
+        // delete the tree with every other node in one bag, and a number of other bags that don't hold them
+        VoxelNodeBag otherBags[OTHER_BAGS];
+        for (int i = 0; i < nodeCount; i += 2) {
+            bag.insert(nodes[i]);
+        }
+        nodes.clear();
+        start = usecTimestampNow();
+        benchmarkTree.eraseAllVoxels();
+        uint64_t deleteTime = usecTimestampNow() - start;
+
+        printf("%8d nodes: insert %8.3f, dedupe %8.3f, extract %8.3f, delete with %d bags %8.3f usecs/node, %d left\n",
+               nodeCount, (float)insertTime / nodeCount, (float)dedupeTime / nodeCount, (float)extractTime / nodeCount,
+               OTHER_BAGS + 1, (float)deleteTime / nodeCount, bag.count());
+    }
+}
+
+// state shared by the editor and encoder threads of the tree locking benchmark
+class TreeLockingBenchmark {
+public:
+    VoxelTree* tree;
+    bool useSubtreeLocks;
+    volatile bool stop;
+
+    pthread_mutex_t statsLock;
+    uint64_t edits;
+    uint64_t totalEditUsecs;
+    uint64_t maxEditUsecs;
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+const float BENCHMARK_EDIT_VOXEL_SIZE = 1.0f / 256.0f;
+const int BENCHMARK_EDIT_INTERVAL_USECS = 1000; // each editor tries for a thousand edits per second
+
+static void* benchmarkEditorThread(void* extraData) {
+    TreeLockingBenchmark* benchmark = (TreeLockingBenchmark*)extraData;
+    unsigned int seed = (unsigned int)(uintptr_t)&seed;
+    uint64_t edits = 0;
+    uint64_t totalEditUsecs = 0;
+    uint64_t maxEditUsecs = 0;
+
+    while (!benchmark->stop) {
+        float x = (rand_r(&seed) % 256) * BENCHMARK_EDIT_VOXEL_SIZE;
+        float y = (rand_r(&seed) % 256) * BENCHMARK_EDIT_VOXEL_SIZE;
+        float z = (rand_r(&seed) % 256) * BENCHMARK_EDIT_VOXEL_SIZE;
+        unsigned char* voxelData = pointToVoxel(x, y, z, BENCHMARK_EDIT_VOXEL_SIZE, rand_r(&seed), rand_r(&seed), 255);
+
+        // edit latency includes waiting for the lock, since that's what stalls a busy server
+        uint64_t start = usecTimestampNow();
+        if (benchmark->useSubtreeLocks) {
+            benchmark->tree->lockForEdit(voxelData);
+            benchmark->tree->readCodeColorBufferToTree(voxelData);
+            benchmark->tree->unlockForEdit();
+        } else {
+            benchmark->tree->lockForWrite();
+            benchmark->tree->readCodeColorBufferToTree(voxelData);
+            benchmark->tree->unlock();
+        }
+        uint64_t editUsecs = usecTimestampNow() - start;
+        delete[] voxelData;
+
+        edits++;
+        totalEditUsecs += editUsecs;
+        maxEditUsecs = std::max(maxEditUsecs, editUsecs);
+        usleep(BENCHMARK_EDIT_INTERVAL_USECS);
+    }
+
+    pthread_mutex_lock(&benchmark->statsLock);
+    benchmark->edits += edits;
+    benchmark->totalEditUsecs += totalEditUsecs;
+    benchmark->maxEditUsecs = std::max(benchmark->maxEditUsecs, maxEditUsecs);
+    pthread_mutex_unlock(&benchmark->statsLock);
+    return NULL;
+}
+
+static void* benchmarkEncoderThread(void* extraData) {
+    TreeLockingBenchmark* benchmark = (TreeLockingBenchmark*)extraData;
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE];
+    VoxelNodeBag bag;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+
+    while (!benchmark->stop) {
+        if (bag.isEmpty()) {
+            bag.insert(benchmark->tree->rootNode); // start the next pass of the whole tree
+        }
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        VoxelNode* subTree;
+        if (benchmark->useSubtreeLocks) {
+            subTree = benchmark->tree->extractAndLockForEncoding(bag);
+            if (!subTree) {
+                continue;
+            }
+        } else {
+            benchmark->tree->lockForRead();
+            subTree = bag.extract();
+        }
+
+        bytes += benchmark->tree->encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, bag, params);
+        packets++;
+
+        if (benchmark->useSubtreeLocks) {
+            benchmark->tree->unlockForEncoding(subTree);
+        } else {
+            benchmark->tree->unlock();
+        }
+    }
+
+    pthread_mutex_lock(&benchmark->statsLock);
+    benchmark->packets += packets;
+    benchmark->bytes += bytes;
+    pthread_mutex_unlock(&benchmark->statsLock);
+    return NULL;
+}
+
+// runs editors and encoders against the same tree, first with the whole tree lock and then with subtree locks
+void processBenchmarkTreeLocking(int editorCount, int encoderCount) {
+    const int SCENE_VOXELS = 100000;
+    const int BENCHMARK_SECONDS = 5;
+
+    printf("benchmarkTreeLocking: %d editors, %d encoders\n", editorCount, encoderCount);
+    for (int mode = 0; mode < 2; mode++) {
+        VoxelTree benchmarkTree(true); // reaveraging, like the voxel server's tree
+        for (int i = 0; i < SCENE_VOXELS; i++) {
+            benchmarkTree.createVoxel(randIntInRange(0, 255) * BENCHMARK_EDIT_VOXEL_SIZE,
+                                      randIntInRange(0, 255) * BENCHMARK_EDIT_VOXEL_SIZE,
+                                      randIntInRange(0, 255) * BENCHMARK_EDIT_VOXEL_SIZE,
+                                      BENCHMARK_EDIT_VOXEL_SIZE, randIntInRange(0, 255), randIntInRange(0, 255), 255);
+        }
+
+        TreeLockingBenchmark benchmark;
+        benchmark.tree = &benchmarkTree;
+        benchmark.useSubtreeLocks = (mode == 1);
+        benchmark.stop = false;
+        pthread_mutex_init(&benchmark.statsLock, NULL);
+        benchmark.edits = 0;
+        benchmark.totalEditUsecs = 0;
+        benchmark.maxEditUsecs = 0;
+        benchmark.packets = 0;
+        benchmark.bytes = 0;
+
+        std::vector<pthread_t> threads(editorCount + encoderCount);
+        for (int i = 0; i < threads.size(); i++) {
+            pthread_create(&threads[i], NULL, (i < editorCount) ? benchmarkEditorThread : benchmarkEncoderThread,
+                           &benchmark);
+        }
+        usleep(BENCHMARK_SECONDS * 1000 * 1000);
+        benchmark.stop = true;
+        for (int i = 0; i < threads.size(); i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&benchmark.statsLock);
+
+        printf("%s: %llu edits/sec, edit latency avg %llu max %llu usecs, %llu packets/sec %8.2f MB/sec encoded\n",
+               benchmark.useSubtreeLocks ? "subtree locks" : "  tree lock  ",
+               benchmark.edits / BENCHMARK_SECONDS,
+               benchmark.edits ? benchmark.totalEditUsecs / benchmark.edits : 0, benchmark.maxEditUsecs,
+               benchmark.packets / BENCHMARK_SECONDS, benchmark.bytes / (BENCHMARK_SECONDS * 1000000.0f));
+    }
+}
+
+// applies the same edit packets to two trees, one edit at a time and in batches, the way the voxel server does
+void processBenchmarkEditBatching() {
+    const int PACKETS = 500;
+    const int EDITS_PER_PACKET = 100;
+    const int MAX_EDITS_PER_BATCH = 2000;
+    const float REGION_SIZE = 1.0f / 8.0f; // animation edits tend to be close together
+
+    std::vector<unsigned char*> edits;
+    for (int packet = 0; packet < PACKETS; packet++) {
+        float regionX = randIntInRange(0, 7) * REGION_SIZE;
+        float regionY = randIntInRange(0, 7) * REGION_SIZE;
+        float regionZ = randIntInRange(0, 7) * REGION_SIZE;
+        for (int i = 0; i < EDITS_PER_PACKET; i++) {
+            edits.push_back(pointToVoxel(regionX + randIntInRange(0, 31) * BENCHMARK_EDIT_VOXEL_SIZE,
+                                         regionY + randIntInRange(0, 31) * BENCHMARK_EDIT_VOXEL_SIZE,
+                                         regionZ + randIntInRange(0, 31) * BENCHMARK_EDIT_VOXEL_SIZE,
+                                         BENCHMARK_EDIT_VOXEL_SIZE, randIntInRange(0, 255), randIntInRange(0, 255), 255));
+        }
+    }
+
+    printf("benchmarkEditBatching: %d packets of %d edits\n", PACKETS, EDITS_PER_PACKET);
+
+    VoxelTree singleEditTree(true);
+    uint64_t start = usecTimestampNow();
+    for (int i = 0; i < edits.size(); i++) {
+        singleEditTree.lockForEdit(edits[i]);
+        singleEditTree.readCodeColorBufferToTree(edits[i]);
+        singleEditTree.unlockForEdit();
+    }
+    uint64_t singleEditUsecs = usecTimestampNow() - start;
+
+    VoxelTree batchedTree(true);
+    start = usecTimestampNow();
+    for (int first = 0; first < edits.size(); first += MAX_EDITS_PER_BATCH) {
+        std::vector<unsigned char*> batch(edits.begin() + first,
+                                          edits.begin() + std::min((int)edits.size(), first + MAX_EDITS_PER_BATCH));
+        int sharedSections = numberOfThreeBitSectionsInCode(batch[0]);
+        for (int i = 1; i < batch.size(); i++) {
+            sharedSections = std::min(sharedSections, numberOfSharedSections(batch[0], batch[i]));
+        }
+        unsigned char* batchCode = ancestorOctalCode(batch[0], sharedSections);
+        batchedTree.lockForEdit(batchCode);
+        batchedTree.readCodeColorBuffersToTree(batch);
+        batchedTree.unlockForEdit();
+        delete[] batchCode;
+    }
+    uint64_t batchedUsecs = usecTimestampNow() - start;
+
+    VoxelNodeBag singleEditBag;
+    VoxelNodeBag batchedBag;
+    bool treesMatch = singleEditTree.getVoxelCount() == batchedTree.getVoxelCount()
+        && encodeEntireTree(singleEditTree, singleEditTree.rootNode, singleEditBag)
+            == encodeEntireTree(batchedTree, batchedTree.rootNode, batchedBag);
+
+    printf("one at a time: %8llu usecs %8.3f usecs/edit\n", singleEditUsecs, (float)singleEditUsecs / edits.size());
+    printf("      batched: %8llu usecs %8.3f usecs/edit\n", batchedUsecs, (float)batchedUsecs / edits.size());
+    printf("trees %s\n", treesMatch ? "match" : "DO NOT MATCH");
+
+    for (int i = 0; i < edits.size(); i++) {
+        delete[] edits[i];
+    }
+}
+
+// Loads and saves an SVO file on the calling thread, and then on codingThreads threads, and checks that both loads built
+// the same tree. The saves are written next to the file, with .single and .parallel appended to its name.
+void processBenchmarkParallelCoding(const char* benchmarkSVOFile, int codingThreads) {
+    printf("benchmarkParallelCoding: %s codingThreads=%d\n", benchmarkSVOFile, codingThreads);
+
+    VoxelTree singleThreadTree;
+    uint64_t start = usecTimestampNow();
+    if (!singleThreadTree.readFromSVOFile(benchmarkSVOFile)) {
+        printf("unable to open %s\n", benchmarkSVOFile);
+        return;
+    }
+    uint64_t singleThreadLoad = usecTimestampNow() - start;
+
+    VoxelTree parallelTree;
+    parallelTree.setCodingThreads(codingThreads);
+    start = usecTimestampNow();
+    parallelTree.readFromSVOFile(benchmarkSVOFile);
+    uint64_t parallelLoad = usecTimestampNow() - start;
+
+    QString singleThreadSVOFile = QString(benchmarkSVOFile) + ".single";
+    start = usecTimestampNow();
+    singleThreadTree.writeToSVOFile(singleThreadSVOFile.toLocal8Bit().constData());
+    uint64_t singleThreadSave = usecTimestampNow() - start;
+
+    QString parallelSVOFile = QString(benchmarkSVOFile) + ".parallel";
+    start = usecTimestampNow();
+    parallelTree.writeToSVOFile(parallelSVOFile.toLocal8Bit().constData());
+    uint64_t parallelSave = usecTimestampNow() - start;
+
+    VoxelNodeBag singleThreadBag;
+    VoxelNodeBag parallelBag;
+    bool treesMatch = singleThreadTree.getVoxelCount() == parallelTree.getVoxelCount()
+        && encodeEntireTree(singleThreadTree, singleThreadTree.rootNode, singleThreadBag)
+            == encodeEntireTree(parallelTree, parallelTree.rootNode, parallelBag);
+
+    printf("one thread: load %10llu usecs, save %10llu usecs\n", singleThreadLoad, singleThreadSave);
+    printf("  parallel: load %10llu usecs, save %10llu usecs\n", parallelLoad, parallelSave);
+    printf("trees %s\n", treesMatch ? "match" : "DO NOT MATCH");
+}
+
+// a code for a random descendant of octalCode that's depth sections deep, the caller must delete[] it
+static unsigned char* randomDescendantCode(const unsigned char* octalCode, int depth) {
+    int bytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(octalCode));
+    unsigned char* code = new unsigned char[bytes];
+    memcpy(code, octalCode, bytes);
+    while (numberOfThreeBitSectionsInCode(code) < depth) {
+        unsigned char* childCode = childOctalCode(code, randIntInRange(0, NUMBER_OF_CHILDREN - 1));
+        delete[] code;
+        code = childCode;
+    }
+    return code;
+}
+
+static int countMismatches(const std::vector<int>& resultsA, const std::vector<int>& resultsB) {
+    int mismatches = 0;
+    for (int i = 0; i < resultsA.size(); i++) {
+        if (resultsA[i] != resultsB[i]) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+static void printOctalCodeTimes(const char* operation, uint64_t codeUsecs, uint64_t keyUsecs, int operations,
+                                int mismatches) {
+    printf("%20s: codes %7.1f, keys %7.1f nsecs each, %d mismatches\n", operation,
+           codeUsecs * 1000.0f / operations, keyUsecs * 1000.0f / operations, mismatches);
+}
+
+// Times the octal code functions on byte strings against the same operations on OctalKeys, on pairs of random codes
+// where the first is the second's ancestor about half the time, and checks that both give the same answers
+void processBenchmarkOctalCodes() {
+    const int PAIRS = 50000;
+    const int MAX_DEPTH = 24; // deeper than any tree we send, and still exact in a float
+    const int REPEATS = 20;
+    const int OPERATIONS = PAIRS * REPEATS;
+
+    unsigned char rootCode[1] = { 0 };
+    std::vector<unsigned char*> codes;
+    for (int i = 0; i < PAIRS; i++) {
+        int depth = randIntInRange(1, MAX_DEPTH);
+        unsigned char* code = randomDescendantCode(rootCode, depth);
+        codes.push_back(code);
+        codes.push_back(randomDescendantCode(randIntInRange(0, 1) ? code : rootCode, randIntInRange(depth, MAX_DEPTH)));
+    }
+    std::vector<OctalKey> keys(codes.size());
+
+    printf("benchmarkOctalCodes: %d pairs of codes up to %d sections deep\n", PAIRS, MAX_DEPTH);
+
+    uint64_t start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < codes.size(); i++) {
+            OctalKey::fromOctalCode(codes[i], keys[i]);
+        }
+    }
+    uint64_t fromCodeUsecs = usecTimestampNow() - start;
+
+    unsigned char keyCode[MAX_OCTAL_KEY_CODE_BYTES];
+    int roundTripMismatches = 0;
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < codes.size(); i++) {
+            int bytes = keys[i].toOctalCode(keyCode);
+            if (repeat == 0 && memcmp(keyCode, codes[i], bytes) != 0) {
+                roundTripMismatches++;
+            }
+        }
+    }
+    uint64_t toCodeUsecs = usecTimestampNow() - start;
+    printf("%20s: from codes %7.1f, to codes %7.1f nsecs each, %d mismatches\n", "conversion",
+           fromCodeUsecs * 1000.0f / (2 * OPERATIONS), toCodeUsecs * 1000.0f / (2 * OPERATIONS), roundTripMismatches);
+
+    std::vector<int> codeResults(PAIRS);
+    std::vector<int> keyResults(PAIRS);
+
+    // the allocating childOctalCode() and the one that writes into a buffer, against a key's child
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            unsigned char* childCode = childOctalCode(codes[2 * i], i % NUMBER_OF_CHILDREN);
+            codeResults[i] = childCode[bytesRequiredForCodeLength(*childCode) - 1];
+            delete[] childCode;
+        }
+    }
+    uint64_t allocatingChildUsecs = usecTimestampNow() - start;
+
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            int bytes = copyChildOctalCode(codes[2 * i], i % NUMBER_OF_CHILDREN, keyCode);
+            codeResults[i] = keyCode[bytes - 1];
+        }
+    }
+    uint64_t childUsecs = usecTimestampNow() - start;
+
+    int childMismatches = 0;
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            OctalKey childKey = keys[2 * i].child(i % NUMBER_OF_CHILDREN);
+            keyResults[i] = childKey.getLength();
+            if (repeat == 0) {
+                copyChildOctalCode(codes[2 * i], i % NUMBER_OF_CHILDREN, keyCode);
+                OctalKey childCodeKey;
+                OctalKey::fromOctalCode(keyCode, childCodeKey);
+                childMismatches += (childKey != childCodeKey);
+            }
+        }
+    }
+    uint64_t childKeyUsecs = usecTimestampNow() - start;
+    printf("%20s: allocating %7.1f, codes %7.1f, keys %7.1f nsecs each, %d mismatches\n", "child",
+           allocatingChildUsecs * 1000.0f / OPERATIONS, childUsecs * 1000.0f / OPERATIONS,
+           childKeyUsecs * 1000.0f / OPERATIONS, childMismatches);
+
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            codeResults[i] = isAncestorOf(codes[2 * i], codes[2 * i + 1]);
+        }
+    }
+    uint64_t codeUsecs = usecTimestampNow() - start;
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            keyResults[i] = keys[2 * i].isAncestorOf(keys[2 * i + 1]);
+        }
+    }
+    printOctalCodeTimes("isAncestorOf", codeUsecs, usecTimestampNow() - start, OPERATIONS,
+                        countMismatches(codeResults, keyResults));
+
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            codeResults[i] = numberOfSharedSections(codes[2 * i], codes[2 * i + 1]);
+        }
+    }
+    codeUsecs = usecTimestampNow() - start;
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            keyResults[i] = keys[2 * i].sharedSections(keys[2 * i + 1]);
+        }
+    }
+    printOctalCodeTimes("sharedSections", codeUsecs, usecTimestampNow() - start, OPERATIONS,
+                        countMismatches(codeResults, keyResults));
+
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            codeResults[i] = compareOctalCodes(codes[2 * i], codes[2 * i + 1]);
+        }
+    }
+    codeUsecs = usecTimestampNow() - start;
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            keyResults[i] = keys[2 * i].compare(keys[2 * i + 1]);
+        }
+    }
+    printOctalCodeTimes("compare", codeUsecs, usecTimestampNow() - start, OPERATIONS,
+                        countMismatches(codeResults, keyResults));
+
+    std::vector<VoxelPositionSize> codeDetails(PAIRS);
+    std::vector<VoxelPositionSize> keyDetails(PAIRS);
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            voxelDetailsForCode(codes[2 * i + 1], codeDetails[i]);
+        }
+    }
+    codeUsecs = usecTimestampNow() - start;
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            keys[2 * i + 1].getPositionSize(keyDetails[i]);
+        }
+    }
+    uint64_t keyUsecs = usecTimestampNow() - start;
+    int detailsMismatches = 0;
+    for (int i = 0; i < PAIRS; i++) {
+        // the corner added up a section at a time, the way voxelDetailsForCode() did before it used keys
+        const unsigned char* code = codes[2 * i + 1];
+        float corner[3] = { 0.0f, 0.0f, 0.0f };
+        float scale = 1.0f;
+        for (int section = 0; section < numberOfThreeBitSectionsInCode(code); section++) {
+            scale *= 0.5f;
+            int sectionValue = getOctalCodeSectionValue(code, section);
+            for (int axis = 0; axis < 3; axis++) {
+                corner[axis] += scale * oneAtBit(sectionValue, (BITS_IN_BYTE - BITS_IN_OCTAL) + axis);
+            }
+        }
+        if (corner[0] != keyDetails[i].x || corner[1] != keyDetails[i].y || corner[2] != keyDetails[i].z
+                || scale != keyDetails[i].s || memcmp(&codeDetails[i], &keyDetails[i], sizeof(VoxelPositionSize))) {
+            detailsMismatches++;
+        }
+    }
+    printOctalCodeTimes("voxelDetails", codeUsecs, keyUsecs, OPERATIONS, detailsMismatches);
+
+    // a server with a one section root, and the children of a few of its children given to other servers
+    const int END_NODES = 64;
+    unsigned char* jurisdictionRoot = randomDescendantCode(rootCode, 1);
+    std::vector<unsigned char*> endNodes;
+    for (int i = 0; i < END_NODES; i++) {
+        endNodes.push_back(randomDescendantCode(jurisdictionRoot, 3));
+    }
+    JurisdictionMap jurisdiction(jurisdictionRoot, endNodes);
+
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            codeResults[i] = jurisdiction.isMyJurisdiction(codes[2 * i + 1], CHECK_NODE_ONLY);
+        }
+    }
+    codeUsecs = usecTimestampNow() - start;
+    start = usecTimestampNow();
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int i = 0; i < PAIRS; i++) {
+            keyResults[i] = jurisdiction.isMyJurisdiction(keys[2 * i + 1], CHECK_NODE_ONLY);
+        }
+    }
+    printOctalCodeTimes("isMyJurisdiction", codeUsecs, usecTimestampNow() - start, OPERATIONS,
+                        countMismatches(codeResults, keyResults));
+
+    for (int i = 0; i < codes.size(); i++) {
+        delete[] codes[i];
+    }
+}
+
+// Routes random edits to the servers of a finely split domain, asking each server's map and with a JurisdictionIndex,
+// and encodes an SVO file as the server with the most end nodes would. One server has the whole domain except for a
+// few hundred small pieces, each of which has its own server.
+void processBenchmarkJurisdictions(const char* benchmarkSVOFile) {
+    const int SPLIT_SECTIONS = 4;
+    const int SPLIT_SERVERS = 256;
+    const int EDITS = 100000;
+    const int MAX_EDIT_SECTIONS = 12;
+
+    const int SPLIT_PIECES = 1 << (BITS_IN_OCTAL * SPLIT_SECTIONS);
+    const int PIECES_PER_SERVER = SPLIT_PIECES / SPLIT_SERVERS;
+
+    // one piece out of each run of pieces, so they're spread across the domain
+    unsigned char rootCode[1] = { 0 };
+    std::vector<unsigned char*> splitCodes;
+    for (int i = 0; i < SPLIT_SERVERS; i++) {
+        int piece = i * PIECES_PER_SERVER + randIntInRange(0, PIECES_PER_SERVER - 1);
+        unsigned char* code = randomDescendantCode(rootCode, 0);
+        for (int section = SPLIT_SECTIONS - 1; section >= 0; section--) {
+            unsigned char* childCode = childOctalCode(code, (piece >> (BITS_IN_OCTAL * section)) & 7);
+            delete[] code;
+            code = childCode;
+        }
+        splitCodes.push_back(code);
+    }
+
+    // the maps own the codes they're given
+    NodeToJurisdictionMap jurisdictions;
+    std::vector<unsigned char*> noEndNodes;
+    std::vector<unsigned char*> worldEndNodes;
+    for (int i = 0; i < splitCodes.size(); i++) {
+        worldEndNodes.push_back(randomDescendantCode(splitCodes[i], SPLIT_SECTIONS));
+        jurisdictions[QUuid::createUuid()] = JurisdictionMap(splitCodes[i], noEndNodes);
+    }
+    JurisdictionMap& worldMap = jurisdictions[QUuid::createUuid()];
+    worldMap = JurisdictionMap(randomDescendantCode(rootCode, 0), worldEndNodes);
+
+    std::vector<unsigned char*> edits;
+    for (int i = 0; i < EDITS; i++) {
+        edits.push_back(randomDescendantCode(rootCode, randIntInRange(1, MAX_EDIT_SECTIONS)));
+    }
+
+    printf("benchmarkJurisdictions: %d servers, one with %d end nodes, %d edits\n", (int)jurisdictions.size(),
+           SPLIT_SERVERS, EDITS);
+
+    std::vector<std::vector<QUuid> > mapServers(EDITS);
+    uint64_t start = usecTimestampNow();
+    for (int i = 0; i < EDITS; i++) {
+        for (NodeToJurisdictionMap::iterator server = jurisdictions.begin(); server != jurisdictions.end(); server++) {
+            if (server->second.isMyJurisdiction(edits[i], CHECK_NODE_ONLY) == JurisdictionMap::WITHIN) {
+                mapServers[i].push_back(server->first);
+            }
+        }
+    }
+    uint64_t mapUsecs = usecTimestampNow() - start;
+
+    JurisdictionIndex index;
+    index.setJurisdictions(&jurisdictions);
+    std::vector<std::vector<QUuid> > indexServers(EDITS);
+    start = usecTimestampNow();
+    for (int i = 0; i < EDITS; i++) {
+        index.findServersWithin(edits[i], indexServers[i]);
+    }
+    uint64_t indexUsecs = usecTimestampNow() - start;
+
+    int mismatches = 0;
+    int routedEdits = 0;
+    for (int i = 0; i < EDITS; i++) {
+        std::sort(mapServers[i].begin(), mapServers[i].end());
+        std::sort(indexServers[i].begin(), indexServers[i].end());
+        mismatches += (mapServers[i] != indexServers[i]);
+        routedEdits += !indexServers[i].empty();
+        delete[] edits[i];
+    }
+    printf("routing edits: each map %8.3f, index %8.3f usecs/edit, %d of %d edits routed, %d mismatches\n",
+           (float)mapUsecs / EDITS, (float)indexUsecs / EDITS, routedEdits, EDITS, mismatches);
+
+    VoxelTree tree;
+    if (!tree.readFromSVOFile(benchmarkSVOFile)) {
+        printf("unable to open %s\n", benchmarkSVOFile);
+        return;
+    }
+    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    uint64_t totalBytes = 0;
+    VoxelNodeBag bag;
+    bag.insert(tree.rootNode);
+    start = usecTimestampNow();
+    while (!bag.isEmpty()) {
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, WANT_EXISTS_BITS, 0, false,
+                                     IGNORE_VIEW_FRUSTUM, NO_OCCLUSION_CULLING, IGNORE_COVERAGE_MAP, NO_BOUNDARY_ADJUST,
+                                     DEFAULT_VOXEL_SIZE_SCALE, IGNORE_LAST_SENT, true, IGNORE_SCENE_STATS, &worldMap);
+        totalBytes += tree.encodeTreeBitstream(bag.extract(), &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, bag, params);
+    }
+    printf("encoding %s within the server with %d end nodes: %llu bytes in %llu usecs\n", benchmarkSVOFile,
+           SPLIT_SERVERS, totalBytes, usecTimestampNow() - start);
+}
+
+// Encodes the scenes a client orbiting the tree is sent, without occlusion culling, with a coverage map started over
+// for each scene as the voxel server used to, with an occlusion cache started over for each scene, and with one
+// occlusion cache kept from scene to scene.
+void processBenchmarkOcclusion(const char* benchmarkSVOFile) {
+    const int SCENES = 30;
+    const float DEGREES_PER_SCENE = 2.0f;
+    const float METERS_PER_SCENE = 1.0f;
+    const float START_DISTANCE = 0.75f * TREE_SCALE;
+    const float FIELD_OF_VIEW = 60.0f;
+    const float ASPECT_RATIO = 16.0f / 9.0f;
+
+    VoxelTree tree;
+    if (!tree.readFromSVOFile(benchmarkSVOFile)) {
+        printf("unable to open %s\n", benchmarkSVOFile);
+        return;
+    }
+    printf("benchmarkOcclusion: %s, %lu voxels, %d scenes %.1f degrees and %.1f meters apart\n", benchmarkSVOFile,
+           tree.getVoxelCount(), SCENES, DEGREES_PER_SCENE, METERS_PER_SCENE);
+
+    const int MODES = 4;
+    const char* MODE_NAMES[MODES] = { "no occlusion culling", "coverage map per scene", "occlusion cache per scene",
+                                      "occlusion cache kept" };
+    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    glm::vec3 center = glm::vec3(0.5f, 0.5f, 0.5f) * (float)TREE_SCALE;
+
+    for (int mode = 0; mode < MODES; mode++) {
+        CoverageMap coverageMap;
+        VoxelOcclusionCache occlusionCache;
+        VoxelSceneStats stats;
+        VoxelNodeBag bag;
+        uint64_t totalBytes = 0;
+        uint64_t totalUsecs = 0;
+        int viewChanges = 0;
+        ViewFrustum viewFrustum;
+
+        for (int scene = 0; scene < SCENES; scene++) {
+            // walking towards the middle of the tree while looking around, the voxel server only takes the new view
+            // once it's no longer very similar to the one it has
+            float yaw = scene * DEGREES_PER_SCENE;
+            ViewFrustum clientViewFrustum;
+            clientViewFrustum.setPosition(center + glm::vec3(0.0f, 0.0f, START_DISTANCE - scene * METERS_PER_SCENE));
+            clientViewFrustum.setOrientation(glm::angleAxis(yaw, glm::vec3(0.0f, 1.0f, 0.0f)));
+            clientViewFrustum.setFieldOfView(FIELD_OF_VIEW);
+            clientViewFrustum.setAspectRatio(ASPECT_RATIO);
+            clientViewFrustum.setFarClip(2.0f * TREE_SCALE);
+            if (scene == 0 || !clientViewFrustum.isVerySimilar(viewFrustum)) {
+                viewFrustum = clientViewFrustum;
+                viewFrustum.calculate();
+                viewChanges++;
+            }
+
+            stats.sceneStarted(true, true, tree.rootNode, IGNORE_JURISDICTION_MAP);
+            uint64_t start = usecTimestampNow();
+            coverageMap.erase();
+            if (mode != 3) {
+                occlusionCache.erase();
+            }
+            occlusionCache.sceneStarted(tree.rootNode, viewFrustum);
+            stats.occludersReused(occlusionCache.getOccludersReused(), occlusionCache.getOccludersDropped(),
+                                  occlusionCache.getRebuildTime());
+
+            bag.insert(tree.rootNode);
+            while (!bag.isEmpty()) {
+                EncodeBitstreamParams params(INT_MAX, &viewFrustum, WANT_COLOR, WANT_EXISTS_BITS, DONT_CHOP, false,
+                                             IGNORE_VIEW_FRUSTUM, mode > 0, &coverageMap, NO_BOUNDARY_ADJUST,
+                                             DEFAULT_VOXEL_SIZE_SCALE, IGNORE_LAST_SENT, true, &stats,
+                                             IGNORE_JURISDICTION_MAP, IGNORE_ENCODE_CACHE,
+                                             mode >= 2 ? &occlusionCache : IGNORE_OCCLUSION_CACHE);
+                int bytes = tree.encodeTreeBitstream(bag.extract(), &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, bag,
+                                                     params);
+                stats.packetSent(bytes);
+                totalBytes += bytes;
+            }
+            totalUsecs += usecTimestampNow() - start;
+            stats.sceneCompleted();
+        }
+        printf("%s: %llu bytes, %llu usecs per scene, %d view changes\n", MODE_NAMES[mode], totalBytes / SCENES,
+               totalUsecs / SCENES, viewChanges);
+        printf("    last scene skipped occluded: %s\n", stats.getItemValue(VoxelSceneStats::ITEM_SKIPPED_OCCLUDED));
+        printf("    last scene occlusion: %s\n", stats.getItemValue(VoxelSceneStats::ITEM_OCCLUSION));
+    }
+}
 
 int main(int argc, const char * argv[])
 {
@@ -296,6 +1339,94 @@ int main(int argc, const char * argv[])
         return 0;
     }
     
+    // Measures load time and memory usage of reading an SVO file
+    const char* BENCHMARK_LOAD_SVO = "--benchmarkLoadSVO";
+    const char* benchmarkSVOFile = getCmdOption(argc, argv, BENCHMARK_LOAD_SVO);
+    if (benchmarkSVOFile) {
+        processBenchmarkLoadSVOFile(benchmarkSVOFile);
+        return 0;
+    }
+
+    const char* BENCHMARK_NODE_BAG = "--benchmarkNodeBag";
+    if (cmdOptionExists(argc, argv, BENCHMARK_NODE_BAG)) {
+        processBenchmarkNodeBag();
+        return 0;
+    }
+
+    // Stress test of editing and encoding the same tree from many threads, takes the number of editors and encoders
+    const char* BENCHMARK_TREE_LOCKING = "--benchmarkTreeLocking";
+    if (cmdOptionExists(argc, argv, BENCHMARK_TREE_LOCKING)) {
+        const char* BENCHMARK_EDITORS = "--editors";
+        const char* BENCHMARK_ENCODERS = "--encoders";
+        const char* editors = getCmdOption(argc, argv, BENCHMARK_EDITORS);
+        const char* encoders = getCmdOption(argc, argv, BENCHMARK_ENCODERS);
+        processBenchmarkTreeLocking(editors ? atoi(editors) : 2, encoders ? atoi(encoders) : 8);
+        return 0;
+    }
+
+    // Compares applying edits one at a time with applying them in batches
+    const char* BENCHMARK_EDIT_BATCHING = "--benchmarkEditBatching";
+    if (cmdOptionExists(argc, argv, BENCHMARK_EDIT_BATCHING)) {
+        processBenchmarkEditBatching();
+        return 0;
+    }
+
+    // Compares loading and saving an SVO file on one thread with doing it on --codingThreads threads (default one per core)
+    const char* BENCHMARK_PARALLEL_CODING = "--benchmarkParallelCoding";
+    const char* benchmarkParallelCodingFile = getCmdOption(argc, argv, BENCHMARK_PARALLEL_CODING);
+    if (benchmarkParallelCodingFile) {
+        const char* CODING_THREADS = "--codingThreads";
+        const char* codingThreads = getCmdOption(argc, argv, CODING_THREADS);
+        processBenchmarkParallelCoding(benchmarkParallelCodingFile, codingThreads ? atoi(codingThreads) : 0);
+        return 0;
+    }
+
+    const char* BENCHMARK_LINEAR_SVO = "--benchmarkLinearSVO";
+    const char* benchmarkLinearSVOFile = getCmdOption(argc, argv, BENCHMARK_LINEAR_SVO);
+    if (benchmarkLinearSVOFile) {
+        processBenchmarkLinearSVOFile(benchmarkLinearSVOFile);
+        return 0;
+    }
+
+    // Measures how many rays a second can be cast at an SVO file, one at a time and in batches
+    const char* BENCHMARK_RAY_CASTS = "--benchmarkRayCasts";
+    const char* benchmarkRayCastsFile = getCmdOption(argc, argv, BENCHMARK_RAY_CASTS);
+    if (benchmarkRayCastsFile) {
+        processBenchmarkRayCasts(benchmarkRayCastsFile);
+        return 0;
+    }
+
+    // Compares finding avatar sized capsules' voxel penetrations one at a time with collision queries, as they walk
+    const char* BENCHMARK_COLLISIONS = "--benchmarkCollisions";
+    const char* benchmarkCollisionsFile = getCmdOption(argc, argv, BENCHMARK_COLLISIONS);
+    if (benchmarkCollisionsFile) {
+        processBenchmarkCollisions(benchmarkCollisionsFile);
+        return 0;
+    }
+
+    // Times the octal code functions against the same operations on OctalKeys, and checks that they agree
+    const char* BENCHMARK_OCTAL_CODES = "--benchmarkOctalCodes";
+    if (cmdOptionExists(argc, argv, BENCHMARK_OCTAL_CODES)) {
+        processBenchmarkOctalCodes();
+        return 0;
+    }
+
+    // Times routing edits to the servers of a finely split domain, and encoding an SVO file for one of them
+    const char* BENCHMARK_JURISDICTIONS = "--benchmarkJurisdictions";
+    const char* benchmarkJurisdictionsFile = getCmdOption(argc, argv, BENCHMARK_JURISDICTIONS);
+    if (benchmarkJurisdictionsFile) {
+        processBenchmarkJurisdictions(benchmarkJurisdictionsFile);
+        return 0;
+    }
+
+    // Times sending the scenes of a moving client with and without keeping occluders from scene to scene
+    const char* BENCHMARK_OCCLUSION = "--benchmarkOcclusion";
+    const char* benchmarkOcclusionFile = getCmdOption(argc, argv, BENCHMARK_OCCLUSION);
+    if (benchmarkOcclusionFile) {
+        processBenchmarkOcclusion(benchmarkOcclusionFile);
+        return 0;
+    }
+
     const char* DONT_CREATE_FILE = "--dontCreateSceneFile";
     bool dontCreateFile = cmdOptionExists(argc, argv, DONT_CREATE_FILE);
 